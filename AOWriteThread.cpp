@@ -16,7 +16,7 @@ namespace DAQ {
 const unsigned AOWriteThread::QueueSz(5);
 
 AOWriteThread::AOWriteThread(QObject *parent, const QString & aoChanString, const Params & params, AOWriteThread *oldToDelete)
-: QThread(parent), SampleBufQ("AOWriteThread", QueueSz), aoChanString(aoChanString), params(params), old2Delete(oldToDelete)
+: QThread(parent), SampleBufQ("AOWriteThread", QueueSz), aoChanString(aoChanString), params(params), old2Delete(oldToDelete), tel("ao")
 {
     dequeueWarnThresh = 10;
 	pleaseStop = false;
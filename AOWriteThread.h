@@ -11,6 +11,7 @@
 #define AOWriteThread_H
 #include "DAQ.h"
 #include "SampleBufQ.h"
+#include "Telemetry.h"
 #include <QObject>
 #include <QThread>
 //#ifdef HAVE_NIDAQmx
@@ -40,6 +41,7 @@ private:
 	QString aoChanString;
 	const Params & params;
 	AOWriteThread *old2Delete;
+	Telemetry::Stage tel; ///< DAQmxWriteBinaryI16 call latency, scans written, queue backlog
 };
 	
 }
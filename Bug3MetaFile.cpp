@@ -0,0 +1,239 @@
+#include "Bug3MetaFile.h"
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QTime>
+#include <string.h>
+
+namespace Bug3Meta
+{
+    /* Header, all little-endian:
+         0  8 bytes   magic: "SGLBUG3M"
+         8  u16       version (Version)
+        10  u16       header size in bytes (HeaderBytes)
+        12  u32       record size in bytes (RecordBytes for version 1)
+        16  u16       FramesPerBlock
+        18  u16       SpikeGL scans per block
+        20  u32       number of channels in the data file (so sample count = scan count * this)
+        24  40 bytes  reserved, 0
+       Then one record per block, each Record field in declaration order with no padding:
+         0 blockNum u64, 8 scans u64, 16 millisecondOffset i64, 24 systemClockMS u32, 28 dataFileScanCount u64,
+        36 boardFrameCounter i32[40], 196 boardFrameTimer i32[40], 356 chipFrameCounter i32[40],
+       516 chipID u16[40], 596 frameMarkerCorrelation u16[40], 676 missingFrameCount i32, 680 falseFrameCount i32,
+       684 BER f64, 692 WER f64, 700 avgVunreg f64, 708 comm_absTimeNS u64, 716 creation_absTimeNS u64
+       Matlab/ParseBug3FileFromSpikeGL.m knows these offsets too. */
+    static const char magic[8] = { 'S', 'G', 'L', 'B', 'U', 'G', '3', 'M' };
+
+    template <typename T> static inline T getLE(const char *p) { T t; memcpy(&t, p, sizeof(T)); return t; }
+    template <typename T> static inline void putLE(char *p, T t) { memcpy(p, &t, sizeof(T)); }
+
+    namespace {
+        template <typename Op> void eachField(Record & r, Op & op)
+        {
+            op(r.blockNum); op(r.scans); op(r.millisecondOffset); op(r.systemClockMS); op(r.dataFileScanCount);
+            op(r.boardFrameCounter); op(r.boardFrameTimer); op(r.chipFrameCounter); op(r.chipID); op(r.frameMarkerCorrelation);
+            op(r.missingFrameCount); op(r.falseFrameCount); op(r.BER); op(r.WER); op(r.avgVunreg);
+            op(r.comm_absTimeNS); op(r.creation_absTimeNS);
+        }
+
+        struct GetOp { const char *p; explicit GetOp(const char *p) : p(p) {} template <typename T> void operator()(T & f) { memcpy(&f, p, sizeof(f)); p += sizeof(f); } };
+        struct PutOp { char *p; explicit PutOp(char *p) : p(p) {} template <typename T> void operator()(T & f) { memcpy(p, &f, sizeof(f)); p += sizeof(f); } };
+    }
+
+    void encodeHeader(char *p, unsigned nChans, unsigned scansPerBlock)
+    {
+        memset(p, 0, HeaderBytes);
+        memcpy(p, magic, sizeof(magic));
+        putLE<quint16>(p+8, Version);
+        putLE<quint16>(p+10, HeaderBytes);
+        putLE<quint32>(p+12, RecordBytes);
+        putLE<quint16>(p+16, FramesPerBlock);
+        putLE<quint16>(p+18, quint16(scansPerBlock));
+        putLE<quint32>(p+20, nChans);
+    }
+
+    void encodeRecord(const Record & r, char *out)
+    {
+        PutOp op(out);
+        eachField(const_cast<Record &>(r), op);
+    }
+
+    // --- Writer ---
+
+    Writer::Writer() : QThread(0), pleaseStop(false), nDropped(0) {}
+
+    Writer::~Writer() { close(); }
+
+    bool Writer::open(const QString & fname, unsigned nChans, unsigned scansPerBlock, QString *err)
+    {
+        close();
+        f.setFileName(fname);
+        if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+            if (err) *err = QString("could not open %1 for writing: %2").arg(fname).arg(f.errorString());
+            return false;
+        }
+        char hdr[HeaderBytes];
+        encodeHeader(hdr, nChans, scansPerBlock);
+        if (f.write(hdr, HeaderBytes) != HeaderBytes) {
+            if (err) *err = QString("could not write the header to %1: %2").arg(fname).arg(f.errorString());
+            f.close();
+            return false;
+        }
+        pending.clear();
+        pending.reserve(RecordBytes * 64);
+        nDropped = 0;
+        writeError = QString();
+        pleaseStop = false;
+        start(QThread::LowPriority);
+        return true;
+    }
+
+    void Writer::append(const Record & r)
+    {
+        QMutexLocker l(&mut);
+        if (!f.isOpen()) return;
+        if (pending.size() + RecordBytes > MaxPendingBytes) { ++nDropped; return; }
+        const size_t off = pending.size();
+        pending.resize(off + RecordBytes);
+        encodeRecord(r, &pending[off]);
+    }
+
+    void Writer::flushPending(std::vector<char> & buf)
+    {
+        {
+            QMutexLocker l(&mut);
+            buf.swap(pending);
+        }
+        if (buf.empty()) return;
+        if (f.write(&buf[0], qint64(buf.size())) != qint64(buf.size()) || !f.flush()) {
+            if (writeError.isEmpty()) writeError = f.errorString();
+        }
+        buf.clear();
+    }
+
+    void Writer::run()
+    {
+        std::vector<char> buf;
+        buf.reserve(RecordBytes * 64);
+        mut.lock();
+        while (!pleaseStop) {
+            cond.wait(&mut, FlushIntervalMS);
+            mut.unlock();
+            flushPending(buf);
+            mut.lock();
+        }
+        mut.unlock();
+        flushPending(buf);
+    }
+
+    bool Writer::close(QString *err)
+    {
+        if (!f.isOpen()) return true;
+        {
+            QMutexLocker l(&mut);
+            pleaseStop = true;
+            cond.wakeAll();
+        }
+        wait();
+        bool ok = writeError.isEmpty() && !nDropped;
+        if (!ok && err) {
+            *err = writeError.isEmpty() ? QString() : QString("write error on %1: %2").arg(f.fileName()).arg(writeError);
+            if (nDropped) *err += QString("%1%2 records dropped because the disk could not keep up").arg(err->isEmpty() ? "" : "; ").arg(nDropped);
+        }
+        QMutexLocker l(&mut);
+        f.close();
+        pending.clear();
+        return ok;
+    }
+
+    // --- Reader ---
+
+    bool Reader::open(const QString & fname, QString *err)
+    {
+        data.clear(); nRecs = 0;
+        memset(&fi, 0, sizeof(fi));
+        QFile f(fname);
+        if (!f.open(QIODevice::ReadOnly)) {
+            if (err) *err = QString("could not open %1: %2").arg(fname).arg(f.errorString());
+            return false;
+        }
+        data = f.readAll();
+        const char *p = data.constData();
+        if (data.size() < HeaderBytes || memcmp(p, magic, sizeof(magic))) {
+            if (err) *err = QString("%1 is not a Bug3 block metadata file").arg(fname);
+            return false;
+        }
+        fi.version = getLE<quint16>(p+8);
+        const unsigned hdrBytes = getLE<quint16>(p+10);
+        fi.recordBytes = getLE<quint32>(p+12);
+        fi.framesPerBlock = getLE<quint16>(p+16);
+        fi.scansPerBlock = getLE<quint16>(p+18);
+        fi.nChans = getLE<quint32>(p+20);
+        // newer versions may only append fields to the header and to each record
+        if (fi.version < unsigned(Version) || hdrBytes < unsigned(HeaderBytes) || fi.recordBytes < unsigned(RecordBytes)
+            || fi.framesPerBlock != unsigned(FramesPerBlock) || unsigned(data.size()) < hdrBytes) {
+            if (err) *err = QString("%1: unsupported version %2 (record size %3, %4 frames per block)").arg(fname).arg(fi.version).arg(fi.recordBytes).arg(fi.framesPerBlock);
+            return false;
+        }
+        // a partial record at the end (SpikeGL crashed mid-write) is ignored
+        nRecs = (unsigned(data.size()) - hdrBytes) / fi.recordBytes;
+        data.remove(0, int(hdrBytes));
+        return true;
+    }
+
+    void Reader::get(unsigned i, Record & out) const
+    {
+        GetOp op(data.constData() + size_t(i) * fi.recordBytes);
+        eachField(out, op);
+    }
+
+    template <typename T> static void writeList(QTextStream & ts, const char *name, const T *v)
+    {
+        ts << name << " = ";
+        for (int i = 0; i < FramesPerBlock; ++i) {
+            if (i) ts << ",";
+            ts << v[i];
+        }
+        ts << "\n";
+    }
+
+    void Reader::writeText(QTextStream & ts, unsigned i) const
+    {
+        Record m;
+        get(i, m);
+        ts << "[ block " << m.blockNum << " ]\n";
+        ts << "scans = " << m.scans << "\n";
+        ts << "millisecondOffset = " << m.millisecondOffset << "\n";
+        ts << "systemClock = " << QTime(0, 0).addMSecs(int(m.systemClockMS)).toString("hh:mm:ss.zzz") << "\n";
+        ts << "framesThisBlock = " << fi.framesPerBlock << "\n";
+        ts << "spikeGL_DataFile_ScanCount = " << m.dataFileScanCount << "\n";
+        ts << "spikeGL_DataFile_SampleCount = " << (m.dataFileScanCount * quint64(fi.nChans)) << "\n";
+        ts << "spikeGL_ScansInBlock = " << fi.scansPerBlock << "\n";
+        writeList(ts, "boardFrameCounter", m.boardFrameCounter);
+        writeList(ts, "boardFrameTimer", m.boardFrameTimer);
+        writeList(ts, "chipFrameCounter", m.chipFrameCounter);
+        writeList(ts, "chipID", m.chipID);
+        writeList(ts, "frameMarkerCorrelation", m.frameMarkerCorrelation);
+        ts << "missingFrameCount = " << m.missingFrameCount << "\n";
+        ts << "falseFrameCount = " << m.falseFrameCount << "\n";
+        ts << "BER = " << m.BER << "\n";
+        ts << "WER = " << m.WER << "\n";
+        ts << "avgVunreg = " << m.avgVunreg << "\n";
+    }
+
+    bool Reader::convertToText(const QString & textFile, QString *err) const
+    {
+        QFile f(textFile);
+        if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text)) {
+            if (err) *err = QString("could not open %1 for writing: %2").arg(textFile).arg(f.errorString());
+            return false;
+        }
+        QTextStream ts(&f);
+        for (unsigned i = 0; i < nRecs; ++i) writeText(ts, i);
+        ts.flush();
+        if (ts.status() != QTextStream::Ok) {
+            if (err) *err = QString("write error on %1: %2").arg(textFile).arg(f.errorString());
+            return false;
+        }
+        return true;
+    }
+}
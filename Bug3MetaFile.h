@@ -0,0 +1,117 @@
+#ifndef Bug3MetaFile_H
+#define Bug3MetaFile_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <vector>
+
+class QTextStream;
+
+/// The per-block Bug3 metadata SpikeGL saves alongside a data file.
+///
+/// It is a binary file (.bug3b) of one fixed-size Record per block, after a small versioned header, so it can be
+/// appended to cheaply during acquisition and loaded quickly afterwards (see Matlab/ParseBug3FileFromSpikeGL.m).
+/// Reader::writeText() turns it into the older .bug3 text format.  Qt core only, so it can be used from standalone
+/// tools.
+namespace Bug3Meta
+{
+    enum {
+        Version = 1,
+        HeaderBytes = 64,
+        RecordBytes = 724, ///< on disk -- fields are packed, see Bug3MetaFile.cpp
+        FramesPerBlock = 40
+    };
+
+    struct Record {
+        quint64 blockNum;
+        quint64 scans; ///< scans SpikeGL produced for the block
+        qint64 millisecondOffset; ///< since the Bug3 window was opened
+        quint32 systemClockMS; ///< local time of day the block was saved, in ms since midnight
+        quint64 dataFileScanCount; ///< data file scan count after the block's scans were written
+        qint32 boardFrameCounter[FramesPerBlock];
+        qint32 boardFrameTimer[FramesPerBlock];
+        qint32 chipFrameCounter[FramesPerBlock];
+        quint16 chipID[FramesPerBlock];
+        quint16 frameMarkerCorrelation[FramesPerBlock];
+        qint32 missingFrameCount, falseFrameCount;
+        double BER, WER, avgVunreg;
+        quint64 comm_absTimeNS, creation_absTimeNS;
+    };
+
+    /// what the header says about the file
+    struct FileInfo {
+        unsigned version, recordBytes, framesPerBlock, scansPerBlock, nChans;
+    };
+
+    /// Appends Records to a .bug3b file from a background thread, so the caller only pays for a memcpy.  Records
+    /// are written out in batches every FlushIntervalMS, and everything pending is written by close().
+    class Writer : protected QThread
+    {
+    public:
+        enum { FlushIntervalMS = 250, MaxPendingBytes = 16*1024*1024 };
+
+        Writer();
+        ~Writer(); ///< calls close()
+
+        /// Creates (truncates) fname, writes the header and starts the writer thread.  Closes any previous file first.
+        bool open(const QString & fname, unsigned nChans, unsigned scansPerBlock, QString *err = 0);
+        bool isOpen() const { return f.isOpen(); }
+        QString fileName() const { return f.fileName(); }
+
+        /// Queues r to be written.  If the disk can't keep up and MaxPendingBytes are already queued, r is dropped.
+        void append(const Record & r);
+
+        /// Writes everything still pending and closes the file.  Returns false if any write failed or any
+        /// records were dropped since open(), in which case *err says what happened.
+        bool close(QString *err = 0);
+
+    protected:
+        void run(); ///< reimplemented from QThread
+
+    private:
+        void flushPending(std::vector<char> & buf);
+
+        QFile f;
+        QMutex mut;
+        QWaitCondition cond;
+        std::vector<char> pending;
+        volatile bool pleaseStop;
+        quint64 nDropped;
+        QString writeError;
+    };
+
+    /// Reads a .bug3b file.  The whole file is loaded by open().
+    class Reader
+    {
+    public:
+        Reader() : nRecs(0) { fi.version = fi.recordBytes = fi.framesPerBlock = fi.scansPerBlock = fi.nChans = 0; }
+
+        bool open(const QString & fname, QString *err = 0);
+
+        const FileInfo & info() const { return fi; }
+        unsigned count() const { return nRecs; }
+        /// i must be < count()
+        void get(unsigned i, Record & out) const;
+
+        /// Writes record i to ts the way SpikeGL used to write each block to the .bug3 text file.
+        void writeText(QTextStream & ts, unsigned i) const;
+        /// Writes the whole file to textFile, in the .bug3 text format.
+        bool convertToText(const QString & textFile, QString *err = 0) const;
+
+    private:
+        QByteArray data;
+        FileInfo fi;
+        unsigned nRecs;
+    };
+
+    /// Fills the record-independent part of a .bug3b header.
+    void encodeHeader(char *hdr, unsigned nChans, unsigned scansPerBlock);
+    /// Encodes r into RecordBytes at out.
+    void encodeRecord(const Record & r, char *out);
+}
+
+#endif
@@ -0,0 +1,328 @@
+#include "Bug3Protocol.h"
+#include <string.h>
+
+namespace Bug3
+{
+    static const int ADCOffset = 1023; ///< 0V for the neural, EMG and aux channels
+
+    void Block::clear()
+    {
+        ::memset(this, 0, sizeof(*this));
+        // channels that never get filled in read as 0V, not as the most negative value
+        for (int c = 0; c < TotalNeuralChans; ++c) for (int i = 0; i < NeuralSamplesPerBlock; ++i) neural[c][i] = ADCOffset;
+        for (int c = 0; c < TotalEMGChans; ++c) for (int i = 0; i < FramesPerBlock; ++i) emg[c][i] = ADCOffset;
+        for (int c = 0; c < TotalAuxChans; ++c) for (int i = 0; i < FramesPerBlock; ++i) aux[c][i] = ADCOffset;
+    }
+
+    bool Block::operator==(const Block & o) const
+    {
+        return !memcmp(neural, o.neural, sizeof(neural)) && !memcmp(emg, o.emg, sizeof(emg)) && !memcmp(aux, o.aux, sizeof(aux))
+            && !memcmp(ttl, o.ttl, sizeof(ttl)) && !memcmp(chipID, o.chipID, sizeof(chipID))
+            && !memcmp(chipFrameCounter, o.chipFrameCounter, sizeof(chipFrameCounter))
+            && !memcmp(frameMarkerCorrelation, o.frameMarkerCorrelation, sizeof(frameMarkerCorrelation))
+            && !memcmp(boardFrameCounter, o.boardFrameCounter, sizeof(boardFrameCounter))
+            && !memcmp(boardFrameTimer, o.boardFrameTimer, sizeof(boardFrameTimer))
+            && creation_absTimeNS == o.creation_absTimeNS && comm_absTimeNS == o.comm_absTimeNS
+            && !memcmp(&BER, &o.BER, sizeof(BER)) && !memcmp(&WER, &o.WER, sizeof(WER))
+            && missingFrameCount == o.missingFrameCount && falseFrameCount == o.falseFrameCount;
+    }
+
+    /* Binary header, all little-endian:
+         0  4 bytes   magic: '\0' 'B' '3' 'B'
+         4  u16       version (BinVersion)
+         6  u16       header size in bytes (BinHeaderBytes)
+         8  u32       payload size in bytes (BinPayloadBytes for version 1)
+        12  u16 x 6   TotalNeuralChans, NeuralSamplesPerBlock, TotalEMGChans, TotalAuxChans, TotalTTLChans, FramesPerBlock
+        24  8 bytes   reserved, 0
+       The payload is the Block's fields, in declaration order, with no padding.
+       Like the rest of SpikeGL, this assumes a little-endian host, so each field is a straight memcpy. */
+    static const char binMagic[4] = { '\0', 'B', '3', 'B' };
+
+    template <typename T> static inline T getLE(const char *p) { T t; memcpy(&t, p, sizeof(T)); return t; }
+    template <typename T> static inline void putLE(char *p, T t) { memcpy(p, &t, sizeof(T)); }
+
+    namespace {
+        /// walks a payload buffer field by field, in one direction or the other
+        struct PayloadCursor {
+            char *p;
+            explicit PayloadCursor(char *p) : p(p) {}
+            template <typename T> void get(T & field) { memcpy(&field, p, sizeof(field)); p += sizeof(field); }
+            template <typename T> void put(const T & field) { memcpy(p, &field, sizeof(field)); p += sizeof(field); }
+        };
+
+        template <typename Op> void eachField(Block & b, Op & op)
+        {
+            op(b.neural); op(b.emg); op(b.aux); op(b.ttl); op(b.chipID); op(b.chipFrameCounter); op(b.frameMarkerCorrelation);
+            op(b.boardFrameCounter); op(b.boardFrameTimer); op(b.creation_absTimeNS); op(b.comm_absTimeNS);
+            op(b.BER); op(b.WER); op(b.missingFrameCount); op(b.falseFrameCount);
+        }
+
+        struct GetOp { PayloadCursor c; explicit GetOp(const char *p) : c(const_cast<char *>(p)) {} template <typename T> void operator()(T & f) { c.get(f); } };
+        struct PutOp { PayloadCursor c; explicit PutOp(char *p) : c(p) {} template <typename T> void operator()(T & f) { c.put(f); } };
+    }
+
+    DecodeResult decodeBinary(const char *buf, unsigned len, Block & out, unsigned *frameBytes, QString *err)
+    {
+        unsigned dummy;
+        if (!frameBytes) frameBytes = &dummy;
+        if (len < unsigned(BinHeaderBytes)) { *frameBytes = BinHeaderBytes; return DecodeNeedMore; }
+        if (memcmp(buf, binMagic, sizeof(binMagic))) {
+            if (err) *err = "bad magic";
+            *frameBytes = 1;
+            return DecodeBad;
+        }
+        const unsigned hdrBytes = getLE<quint16>(buf+6), payloadBytes = getLE<quint32>(buf+8);
+        if (hdrBytes < unsigned(BinHeaderBytes) || hdrBytes + payloadBytes > unsigned(BinMaxFrameBytes)) {
+            if (err) *err = QString("implausible header/payload size %1/%2").arg(hdrBytes).arg(payloadBytes);
+            *frameBytes = 1;
+            return DecodeBad;
+        }
+        if (len < hdrBytes + payloadBytes) { *frameBytes = hdrBytes + payloadBytes; return DecodeNeedMore; }
+        *frameBytes = hdrBytes + payloadBytes;
+        const quint16 version = getLE<quint16>(buf+4);
+        const bool dimsOk = getLE<quint16>(buf+12) == TotalNeuralChans && getLE<quint16>(buf+14) == NeuralSamplesPerBlock
+                            && getLE<quint16>(buf+16) == TotalEMGChans && getLE<quint16>(buf+18) == TotalAuxChans
+                            && getLE<quint16>(buf+20) == TotalTTLChans && getLE<quint16>(buf+22) == FramesPerBlock;
+        if (version != BinVersion || !dimsOk || payloadBytes != unsigned(BinPayloadBytes)) {
+            if (err) *err = QString("unsupported block (version %1, payload %2 bytes)").arg(version).arg(payloadBytes);
+            return DecodeBad;
+        }
+        GetOp op(buf+hdrBytes);
+        eachField(out, op);
+        return DecodeOk;
+    }
+
+    void encodeBinary(const Block & b, QByteArray & out)
+    {
+        const int off = out.size();
+        out.resize(off + BinHeaderBytes + BinPayloadBytes);
+        char *p = out.data() + off;
+        memset(p, 0, BinHeaderBytes);
+        memcpy(p, binMagic, sizeof(binMagic));
+        putLE<quint16>(p+4, BinVersion);
+        putLE<quint16>(p+6, BinHeaderBytes);
+        putLE<quint32>(p+8, BinPayloadBytes);
+        putLE<quint16>(p+12, TotalNeuralChans); putLE<quint16>(p+14, NeuralSamplesPerBlock);
+        putLE<quint16>(p+16, TotalEMGChans); putLE<quint16>(p+18, TotalAuxChans);
+        putLE<quint16>(p+20, TotalTTLChans); putLE<quint16>(p+22, FramesPerBlock);
+        PutOp op(p+BinHeaderBytes);
+        eachField(const_cast<Block &>(b), op);
+    }
+
+    // --- text ---
+
+    template <typename T> static void appendList(QByteArray & out, const char *name, const T *v, int n)
+    {
+        out.append(name).append('{');
+        for (int i = 0; i < n; ++i) {
+            if (i) out.append(',');
+            out.append(QByteArray::number(v[i]));
+        }
+        out.append("}\r\n");
+    }
+
+    static void appendList(QByteArray & out, const char *name, const quint8 *v, int n)
+    {
+        out.append(name).append('{');
+        for (int i = 0; i < n; ++i) {
+            if (i) out.append(',');
+            out.append(v[i] ? '1' : '0');
+        }
+        out.append("}\r\n");
+    }
+
+    void encodeText(const Block & b, QByteArray & out)
+    {
+        out.append("---> Console data out called at time: 0ms plotQueue.Count=1 numPagesLeftInRAM=0\r\n");
+        for (int c = 0; c < TotalNeuralChans; ++c) appendList(out, QString("NEU_%1").arg(c).toLatin1().constData(), b.neural[c], NeuralSamplesPerBlock);
+        for (int c = 0; c < TotalEMGChans; ++c) appendList(out, QString("EMG_%1").arg(c).toLatin1().constData(), b.emg[c], FramesPerBlock);
+        for (int c = 0; c < TotalAuxChans; ++c) appendList(out, QString("AUX_%1").arg(c).toLatin1().constData(), b.aux[c], FramesPerBlock);
+        for (int c = 0; c < TotalTTLChans; ++c) appendList(out, QString("TTL_%1").arg(c).toLatin1().constData(), b.ttl[c], FramesPerBlock);
+        appendList(out, "CHIPID", b.chipID, FramesPerBlock);
+        appendList(out, "CHIP_FC", b.chipFrameCounter, FramesPerBlock);
+        appendList(out, "FRAME_MARKER_COR", b.frameMarkerCorrelation, FramesPerBlock);
+        appendList(out, "BOARD_FC", b.boardFrameCounter, FramesPerBlock);
+        appendList(out, "BOARD_FRAME_TIMER", b.boardFrameTimer, FramesPerBlock);
+        out.append("CREATION_ABSTIMENS{").append(QByteArray::number(b.creation_absTimeNS)).append("}\r\n");
+        out.append("COMM_ABSTIMENS{").append(QByteArray::number(b.comm_absTimeNS)).append("}\r\n");
+        out.append("BER{").append(QByteArray::number(b.BER, 'g', 17)).append("}\r\n");
+        out.append("WER{").append(QByteArray::number(b.WER, 'g', 17)).append("}\r\n");
+        out.append("MISSING_FC{").append(QByteArray::number(b.missingFrameCount)).append("}\r\n");
+        out.append("FALSE_FC{").append(QByteArray::number(b.falseFrameCount)).append("}\r\n");
+    }
+
+    namespace {
+        inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+        template <unsigned N> inline bool startsWith(const char *p, const char *end, const char (&lit)[N])
+        { return unsigned(end-p) >= N-1 && !memcmp(p, lit, N-1); }
+
+        template <unsigned N> inline bool keyIs(const char *k, unsigned klen, const char (&lit)[N])
+        { return klen == N-1 && !memcmp(k, lit, N-1); }
+
+        /// Scans an optionally-signed decimal integer starting at p, with optional surrounding blanks.  Returns
+        /// where it stopped; ok is false if there were no digits or it overflowed 64 bits.
+        inline const char *scanInt(const char *p, const char *end, qint64 & v, bool & ok)
+        {
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            bool neg = false;
+            if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+            quint64 u = 0;
+            const char * const digits = p;
+            while (p < end && unsigned(*p - '0') < 10u) {
+                if (u > (~0ULL - 9ULL)/10ULL) { ok = false; return p; }
+                u = u*10ULL + quint64(*p++ - '0');
+            }
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            ok = p > digits && u <= quint64(neg ? 0x8000000000000000ULL : 0x7fffffffffffffffULL);
+            v = neg ? qint64(0ULL - u) : qint64(u);
+            return p;
+        }
+
+        inline const char *scanUInt64(const char *p, const char *end, quint64 & v, bool & ok)
+        {
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            const char * const digits = p;
+            v = 0; ok = true;
+            while (p < end && unsigned(*p - '0') < 10u) {
+                if (v > (~0ULL - quint64(*p - '0'))/10ULL) ok = false;
+                v = v*10ULL + quint64(*p++ - '0');
+            }
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            ok = ok && p > digits;
+            return p;
+        }
+
+        inline bool inRange(qint64 v, quint16 *) { return v >= 0 && v <= 65535; }
+        inline bool inRange(qint64 v, qint32 *) { return v >= -2147483647LL-1LL && v <= 2147483647LL; }
+    }
+
+    void TextParser::noteProblem(const char *what, const char *key, unsigned klen)
+    {
+        if (!nProblems++) problem = QString("%1 in `%2'").arg(what).arg(QString::fromLatin1(key, int(klen)));
+    }
+
+    template <typename T> void TextParser::parseList(const char *key, unsigned klen, const char *p, const char *vend, T *out, unsigned n)
+    {
+        for (unsigned i = 0; i < n; ++i) {
+            if (p >= vend) {
+                noteProblem("ran out of samples", key, klen);
+                for ( ; i < n; ++i) out[i] = 0;
+                return;
+            }
+            qint64 v = 0;
+            bool ok = false;
+            p = scanInt(p, vend, v, ok);
+            if (!ok || !inRange(v, out) || (p < vend && *p != ',')) {
+                noteProblem("parse error on a sample", key, klen);
+                v = 0;
+                while (p < vend && *p != ',') ++p;
+            }
+            out[i] = T(v);
+            if (p < vend) ++p; // skip the ','
+        }
+    }
+
+    int TextParser::parseChanIndex(const char *key, unsigned klen, int maxChans)
+    {
+        // key is XXX_n
+        qint64 chan = 0;
+        bool ok = false;
+        if (klen > 4) {
+            const char *end = scanInt(key+4, key+klen, chan, ok);
+            ok = ok && end == key+klen && chan >= 0 && chan < maxChans;
+        }
+        if (!ok) { noteProblem("bad channel index", key, klen); chan = 0; }
+        return int(chan);
+    }
+
+    TextParser::LineType TextParser::processLine(const char *line, unsigned len, Block & out, QString *msg)
+    {
+        const char *p = line, *end = line + len;
+        while (p < end && isSpace(*p)) ++p;
+        while (end > p && isSpace(end[-1])) --end;
+
+        if (startsWith(p, end, "---> Console")) {
+            ++nlines;
+            state = 1;
+            nProblems = 0; problem = QString();
+            out.clear();
+            return Ignored;
+        } else if (state) {
+            ++nlines;
+            // we are in parsing mode.. looking for NAME{values}
+            const char *brace = reinterpret_cast<const char *>(memchr(p, '{', size_t(end-p)));
+            if (!brace || brace == p || end[-1] != '}' || brace+1 >= end-1) return Ignored;
+            parseField(p, unsigned(brace-p), brace+1, end-1, out);
+            if (++state > TextFieldsPerBlock) {
+                state = 0;
+                return BlockDone;
+            }
+            return Field;
+        }
+        LineType t = Ignored;
+        unsigned skip = 0;
+        if (startsWith(p, end, "USRMSG:")) t = UserMsg, skip = 7;
+        else if (startsWith(p, end, "WARNMSG:")) t = WarnMsg, skip = 8;
+        else if (startsWith(p, end, "LOGMSG:")) t = LogMsg, skip = 7;
+        if (t != Ignored && msg) *msg = QString::fromLatin1(p+skip, int(end-p-skip)).trimmed();
+        return t;
+    }
+
+    void TextParser::parseField(const char *k, unsigned kl, const char *v, const char *vend, Block & b)
+    {
+        switch (k[0]) {
+        case 'N':
+            if (startsWith(k, k+kl, "NEU_")) { parseList(k, kl, v, vend, b.neural[parseChanIndex(k, kl, TotalNeuralChans)], NeuralSamplesPerBlock); return; }
+            break;
+        case 'E':
+            if (startsWith(k, k+kl, "EMG_")) { parseList(k, kl, v, vend, b.emg[parseChanIndex(k, kl, TotalEMGChans)], FramesPerBlock); return; }
+            break;
+        case 'A':
+            if (startsWith(k, k+kl, "AUX_")) { parseList(k, kl, v, vend, b.aux[parseChanIndex(k, kl, TotalAuxChans)], FramesPerBlock); return; }
+            break;
+        case 'T':
+            if (startsWith(k, k+kl, "TTL_")) {
+                quint16 tmp[FramesPerBlock];
+                quint8 *ttl = b.ttl[parseChanIndex(k, kl, TotalTTLChans)];
+                parseList(k, kl, v, vend, tmp, FramesPerBlock);
+                for (int i = 0; i < FramesPerBlock; ++i) ttl[i] = tmp[i] ? 1 : 0;
+                return;
+            }
+            break;
+        case 'C':
+            if (keyIs(k, kl, "CHIPID")) { parseList(k, kl, v, vend, b.chipID, FramesPerBlock); return; }
+            if (keyIs(k, kl, "CHIP_FC")) { parseList(k, kl, v, vend, b.chipFrameCounter, FramesPerBlock); return; }
+            break;
+        case 'F':
+            if (keyIs(k, kl, "FRAME_MARKER_COR")) { parseList(k, kl, v, vend, b.frameMarkerCorrelation, FramesPerBlock); return; }
+            break;
+        case 'B':
+            if (keyIs(k, kl, "BOARD_FC")) { parseList(k, kl, v, vend, b.boardFrameCounter, FramesPerBlock); return; }
+            if (keyIs(k, kl, "BOARD_FRAME_TIMER")) { parseList(k, kl, v, vend, b.boardFrameTimer, FramesPerBlock); return; }
+            break;
+        }
+
+        // the scalars
+        bool ok = true;
+        qint64 i = 0;
+        const char *stop = vend;
+        if (keyIs(k, kl, "BER") || keyIs(k, kl, "WER")) {
+            // only 2 of these per block, so it's not worth hand-rolling a correctly-rounded double parser.
+            // fromRawData() doesn't copy, and QByteArray::toDouble() always uses the C locale.
+            const double d = QByteArray::fromRawData(v, int(vend-v)).toDouble(&ok);
+            (k[0] == 'B' ? b.BER : b.WER) = d;
+        } else if (keyIs(k, kl, "MISSING_FC")) {
+            stop = scanInt(v, vend, i, ok);
+            b.missingFrameCount = ok && inRange(i, &b.missingFrameCount) ? qint32(i) : 0;
+        } else if (keyIs(k, kl, "FALSE_FC")) {
+            stop = scanInt(v, vend, i, ok);
+            b.falseFrameCount = ok && inRange(i, &b.falseFrameCount) ? qint32(i) : 0;
+        } else if (keyIs(k, kl, "COMM_ABSTIMENS")) {
+            stop = scanUInt64(v, vend, b.comm_absTimeNS, ok);
+        } else if (keyIs(k, kl, "CREATION_ABSTIMENS")) {
+            stop = scanUInt64(v, vend, b.creation_absTimeNS, ok);
+        }
+        if (!ok || stop != vend) noteProblem("parse error", k, kl);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef Bug3Protocol_H
+#define Bug3Protocol_H
+
+#include <QString>
+#include <QByteArray>
+
+/// The two formats bug3_spikegl.exe can use to send a block of Bug3 data down its stdout pipe to SpikeGL:
+///
+/// - Text (the original protocol, and the fallback): a "---> Console data out..." marker line followed by
+///   38 lines of the form NAME{v1,v2,...}, one per channel / per block metadata field.
+/// - Binary (if the exe was started with BUG3_BINARY_BLOCKS set): a BinHeaderBytes header starting with a
+///   NUL byte, so it can't be mistaken for a text line, followed by the raw samples and metadata, little-endian,
+///   in the order of the Block fields below.
+///
+/// Both decode to the same Block, which holds the samples exactly as the Bug3 receiver produced them (11-bit ADC
+/// values with 0V at 1023).  Turning that into SpikeGL scans is BugTask's job.  Qt core only, so it can be used
+/// from standalone tools.
+namespace Bug3
+{
+    enum {
+        FramesPerBlock = 40,
+        NeuralSamplesPerFrame = 16,
+        NeuralSamplesPerBlock = FramesPerBlock*NeuralSamplesPerFrame,
+        TotalNeuralChans = 10,
+        TotalEMGChans = 4,
+        TotalAuxChans = 2,
+        TotalTTLChans = 11,
+        TextFieldsPerBlock = 38 ///< number of NAME{...} lines in a text block
+    };
+
+    struct Block {
+        quint16 neural[TotalNeuralChans][NeuralSamplesPerBlock];
+        quint16 emg[TotalEMGChans][FramesPerBlock];
+        quint16 aux[TotalAuxChans][FramesPerBlock];
+        quint8 ttl[TotalTTLChans][FramesPerBlock]; ///< 0 or 1
+        quint16 chipID[FramesPerBlock];
+        qint32 chipFrameCounter[FramesPerBlock];
+        quint16 frameMarkerCorrelation[FramesPerBlock];
+        qint32 boardFrameCounter[FramesPerBlock];
+        qint32 boardFrameTimer[FramesPerBlock];
+        quint64 creation_absTimeNS, comm_absTimeNS;
+        double BER, WER;
+        qint32 missingFrameCount, falseFrameCount;
+
+        void clear();
+        bool operator==(const Block & o) const;
+        bool operator!=(const Block & o) const { return !(*this == o); }
+    };
+
+    // --- binary ---
+
+    enum {
+        BinHeaderBytes = 32,
+        BinVersion = 1,
+        BinPayloadBytes = TotalNeuralChans*NeuralSamplesPerBlock*2 + (TotalEMGChans+TotalAuxChans)*FramesPerBlock*2
+                          + TotalTTLChans*FramesPerBlock + FramesPerBlock*(2+4+2+4+4) + 8+8+8+8+4+4,
+        BinMaxFrameBytes = 1024*1024 ///< sanity limit on a header's payload size, so garbage can't make us wait forever
+    };
+
+    enum DecodeResult { DecodeBad = -1, DecodeNeedMore = 0, DecodeOk = 1 };
+
+    /// True if buf (len bytes, len >= 1) could be the start of a binary block -- ie it starts with a NUL byte.
+    inline bool looksBinary(const char *buf, unsigned len) { return len && !buf[0]; }
+
+    /// Decodes the binary block at the start of buf.  On DecodeOk, *frameBytes is the number of bytes the block used.
+    /// On DecodeNeedMore, it is the number of bytes needed to make progress.  On DecodeBad, it is the number of
+    /// bytes to skip before trying again, and *err says what was wrong.
+    DecodeResult decodeBinary(const char *buf, unsigned len, Block & out, unsigned *frameBytes, QString *err = 0);
+    /// Appends b, as a binary block, to out.  (bug3_spikegl.exe has its own C# version of this.)
+    void encodeBinary(const Block & b, QByteArray & out);
+
+    // --- text ---
+
+    /// Appends b to out, in the same text format bug3_spikegl.exe produces.
+    void encodeText(const Block & b, QByteArray & out);
+
+    /// Parses the text protocol one line at a time, straight from the bytes as they came off the pipe and into a
+    /// Block: no QStrings, no lists, no per-sample allocations.
+    class TextParser
+    {
+    public:
+        enum LineType {
+            Ignored = 0, ///< not part of a block, and not a message
+            Field, ///< a NAME{...} line of the block in progress
+            BlockDone, ///< the block is complete
+            UserMsg, WarnMsg, LogMsg ///< USRMSG:, WARNMSG: or LOGMSG: lines from the exe.  The text is in *msg
+        };
+
+        TextParser() { reset(); }
+        void reset() { state = 0; nlines = 0; nProblems = 0; }
+
+        /// line is len bytes, and may include its trailing newline.  The block in progress is filled in directly in out
+        /// as its lines arrive, so pass the same Block for every line; it is complete when BlockDone is returned.
+        LineType processLine(const char *line, unsigned len, Block & out, QString *msg = 0);
+
+        bool inBlock() const { return state > 0; }
+        quint64 numLines() const { return nlines; } ///< lines that were part of a block, so far
+
+        /// Parse problems (missing samples, unparseable numbers, bad channel indices) seen in the last block.
+        /// These don't stop the block from being produced -- missing or bad values are treated as 0.
+        unsigned problems() const { return nProblems; }
+        const QString & firstProblem() const { return problem; }
+
+    private:
+        void parseField(const char *key, unsigned klen, const char *v, const char *vend, Block & out);
+        void noteProblem(const char *what, const char *key, unsigned klen);
+        template <typename T> void parseList(const char *key, unsigned klen, const char *v, const char *vend, T *out, unsigned n);
+        int parseChanIndex(const char *key, unsigned klen, int maxChans);
+
+        int state;
+        quint64 nlines;
+        unsigned nProblems;
+        QString problem;
+    };
+}
+
+#endif
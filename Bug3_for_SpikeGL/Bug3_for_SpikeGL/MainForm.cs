@@ -164,6 +164,7 @@ namespace Bug3
         {
             public bool guiHidden = false;
             public bool consoleData = false;
+            public bool binaryData = false; // if true, console data blocks are sent in SpikeGL's binary block format instead of as text
             public bool autoStart = false;
             public DataRate rate = DataRate.High;
             public int clockEdgePolarity = 0; // rising=0, falling=1
@@ -186,6 +187,11 @@ namespace Bug3
                 Params.consoleData = true;
                 Params.autoStart = true;
             }
+            if (null != (s = Environment.GetEnvironmentVariable("BUG3_BINARY_BLOCKS"))) // if set, send data blocks in binary
+            {
+                Console.WriteLine("Binary data blocks enabled");
+                Params.binaryData = true;
+            }
             if (null != (s = Environment.GetEnvironmentVariable("BUG3_DATA_RATE"))) // low, medium, high
             {
                 s = s.ToLower();
@@ -1028,6 +1034,11 @@ namespace Bug3
             foreach (USBData data in plotQueue)
             {
                 lastBlockSentTS = System.DateTime.Now.Ticks;
+                if (Params.binaryData)
+                {
+                    doConsoleBinaryOutput(data);
+                    continue;
+                }
                 Console.WriteLine("---> Console data out called at time: " + (long)((System.DateTime.Now.Ticks - t0) / 1e4) + "ms plotQueue.Count=" + plotQueue.Count + " numPagesLeftInRAM=" + numPagesLeftInRAM);
 
                 UInt16[,] array = null;
@@ -1143,6 +1154,64 @@ namespace Bug3
             }
         }
 
+        private static Stream rawStdout = null;
+        private MemoryStream binBlock = new MemoryStream(32 + 14400);
+
+        // Same data as the text output above, as one binary block: a 32-byte header followed by the raw samples and
+        // metadata, little-endian.  The format is documented in Bug3Protocol.h in the SpikeGL sources -- keep them in sync!
+        private void doConsoleBinaryOutput(USBData data)
+        {
+            if (rawStdout == null) rawStdout = Console.OpenStandardOutput();
+            binBlock.SetLength(0);
+            BinaryWriter w = new BinaryWriter(binBlock);
+
+            w.Write((byte)0); w.Write((byte)'B'); w.Write((byte)'3'); w.Write((byte)'B'); // magic: the leading NUL is what tells SpikeGL this isn't a text line
+            w.Write((UInt16)1);  // version
+            w.Write((UInt16)32); // header size
+            w.Write((UInt32)0);  // payload size, filled in below
+            w.Write((UInt16)Constant.TotalNeuralChannels);
+            w.Write((UInt16)(Constant.NeuralSamplesPerFrame * Constant.FramesPerBlock));
+            w.Write((UInt16)Constant.TotalEMGChannels);
+            w.Write((UInt16)Constant.TotalAuxChannels);
+            w.Write((UInt16)Constant.TotalTTLChannels);
+            w.Write((UInt16)Constant.FramesPerBlock);
+            w.Write((UInt64)0);  // reserved
+
+            for (int i = 0; i < Constant.TotalNeuralChannels; ++i)
+                for (int j = 0; j < Constant.NeuralSamplesPerFrame * Constant.FramesPerBlock; ++j)
+                    w.Write(data.neuralData16[i, j]);
+            for (int i = 0; i < Constant.TotalEMGChannels; ++i)
+                for (int j = 0; j < Constant.FramesPerBlock; ++j)
+                    w.Write(data.EMGData16[i, j]);
+            for (int i = 0; i < Constant.TotalAuxChannels; ++i)
+                for (int j = 0; j < Constant.FramesPerBlock; ++j)
+                    w.Write(data.auxData16[i, j]);
+            bool[,] ttls = null;
+            data.CopyTTLDataToArray(ref ttls);
+            for (int i = 0; i < Constant.TotalTTLChannels; ++i)
+                for (int j = 0; j < Constant.FramesPerBlock; ++j)
+                    w.Write((byte)(ttls[i, j] ? 1 : 0));
+            for (int i = 0; i < Constant.FramesPerBlock; ++i) w.Write(data.chipID[i]);
+            for (int i = 0; i < Constant.FramesPerBlock; ++i) w.Write(data.chipFrameCounter[i]);
+            for (int i = 0; i < Constant.FramesPerBlock; ++i) w.Write(data.frameMarkerCorrelation[i]);
+            for (int i = 0; i < Constant.FramesPerBlock; ++i) w.Write(data.boardFrameCounter[i]);
+            for (int i = 0; i < Constant.FramesPerBlock; ++i) w.Write(data.boardFrameTimer[i]);
+            w.Write((UInt64)data.timeStampNanos);
+            w.Write((UInt64)GetAbsTimeNS());
+            w.Write(data.BER);
+            w.Write(data.WER);
+            w.Write(data.missingFrameCount);
+            w.Write(data.falseFrameCount);
+            w.Flush();
+            binBlock.Position = 8;
+            w.Write((UInt32)(binBlock.Length - 32));
+            w.Flush();
+
+            Console.Out.Flush(); // anything written as text so far must go out first
+            rawStdout.Write(binBlock.GetBuffer(), 0, (int)binBlock.Length);
+            rawStdout.Flush();
+        }
+
         // tmrDraw is a timer that 'ticks' once every 5 milliseconds.  Upon a 'tick', we check to see
         // if there is enough new data from the USB port to update our waveform plots.
         private void tmrDraw_Tick(object sender, EventArgs e)
@@ -92,6 +92,7 @@ Bug_Popout::Bug_Popout(DAQ::BugTask *task, QWidget *parent)
 Bug_Popout::~Bug_Popout()
 {
     if (plotThread) delete plotThread, plotThread = 0;
+	closeBug3File();
 	mainApp()->sortGraphsByElectrodeAct->setEnabled(true);
 	delete ui; ui = 0;
 
@@ -101,62 +102,59 @@ Bug_Popout::~Bug_Popout()
 
 void Bug_Popout::writeMetaToBug3File(const DataFile &df, const DAQ::BugTask::BlockMetaData &m/*, int fudge*/)
 {
+	QMutexLocker l(&bug3Mut);
+	if (!df.isOpenForWrite()) return; // closed under us: don't re-create (and truncate) its sidecar
 	QString fname (df.metaFileName());
 	static const QString metaExt(".meta");
-	if (fname.toLower().endsWith(metaExt)) fname = fname.left(fname.size()-metaExt.size()) + ".bug3";
-	QFile f(fname);
-	if (!df.scanCount()) {
-		f.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text);
+	if (fname.toLower().endsWith(metaExt)) fname = fname.left(fname.size()-metaExt.size());
+	fname += ".bug3b";
+	if (!df.scanCount() || !bug3File.isOpen() || bug3File.fileName() != fname) {
+		if (fname == bug3FileFailed) return;
+		closeBug3FileLocked();
+		QString err;
+		if (!bug3File.open(fname, df.numChans(), DAQ::BugTask::SpikeGLScansPerBlock, &err)) {
+			Error() << "Bug3 block metadata file: " << err;
+			bug3FileFailed = fname;
+			return;
+		}
+		bug3FileFailed = QString();
 		Debug() << "Bug3 'extra data' file created: " << fname;
-	} else {
-		f.open(QIODevice::WriteOnly|QIODevice::Append|QIODevice::Text);
-		f.seek(f.size()); // got to end?
-	}
-	QTextStream ts(&f);
-	ts << "[ block " << m.blockNum << " ]\n";
-	ts << "scans = " << m.scansSz << "\n";
-	ts << "millisecondOffset = " << this->timeSinceStart->elapsed() << "\n";
-	ts << "systemClock = " << QTime::currentTime().toString("hh:mm:ss.zzz") << "\n";
-	ts << "framesThisBlock = " << DAQ::BugTask::FramesPerBlock << "\n";
-    ts << "spikeGL_DataFile_ScanCount = " << (df.scanCount()/*+u64(fudge/task->numChans())*/) << "\n";
-    ts << "spikeGL_DataFile_SampleCount = " << (df.sampleCount()/*+u64(fudge)*/) << "\n";
-	ts << "spikeGL_ScansInBlock = " << DAQ::BugTask::SpikeGLScansPerBlock << "\n";
-	ts << "boardFrameCounter = ";
-	for (int i = 0; i < DAQ::BugTask::FramesPerBlock; ++i) {
-		if (i) ts << ",";
-		ts << m.boardFrameCounter[i];
-	}
-	ts << "\n";
-	ts << "boardFrameTimer = ";
-	for (int i = 0; i < DAQ::BugTask::FramesPerBlock; ++i) {
-		if (i) ts << ",";
-		ts << m.boardFrameTimer[i];
-	}
-	ts << "\n";
-	ts << "chipFrameCounter = ";
-	for (int i = 0; i < DAQ::BugTask::FramesPerBlock; ++i) {
-		if (i) ts << ",";
-		ts << m.chipFrameCounter[i];
 	}
-	ts << "\n";
-	ts << "chipID = ";
+	Bug3Meta::Record r;
+	r.blockNum = m.blockNum;
+	r.scans = m.scansSz;
+	r.millisecondOffset = this->timeSinceStart->elapsed();
+	r.systemClockMS = quint32(QTime(0,0).msecsTo(QTime::currentTime()));
+	r.dataFileScanCount = df.scanCount()/*+u64(fudge/task->numChans())*/;
 	for (int i = 0; i < DAQ::BugTask::FramesPerBlock; ++i) {
-		if (i) ts << ",";
-		ts << m.chipID[i];
+		r.boardFrameCounter[i] = m.boardFrameCounter[i];
+		r.boardFrameTimer[i] = m.boardFrameTimer[i];
+		r.chipFrameCounter[i] = m.chipFrameCounter[i];
+		r.chipID[i] = m.chipID[i];
+		r.frameMarkerCorrelation[i] = m.frameMarkerCorrelation[i];
 	}
-	ts << "\n";
-	ts << "frameMarkerCorrelation = ";
-	for (int i = 0; i < DAQ::BugTask::FramesPerBlock; ++i) {
-		if (i) ts << ",";
-		ts << m.frameMarkerCorrelation[i];
-	}
-	ts << "\n";
-	ts << "missingFrameCount = " << m.missingFrameCount << "\n";
-	ts << "falseFrameCount = " << m.falseFrameCount << "\n";
-	ts << "BER = " << m.BER << "\n";
-	ts << "WER = " << m.WER << "\n";
-	ts << "avgVunreg = " << m.avgVunreg << "\n";
-	ts.flush();
+	r.missingFrameCount = m.missingFrameCount;
+	r.falseFrameCount = m.falseFrameCount;
+	r.BER = m.BER;
+	r.WER = m.WER;
+	r.avgVunreg = m.avgVunreg;
+	r.comm_absTimeNS = m.comm_absTimeNS;
+	r.creation_absTimeNS = m.creation_absTimeNS;
+	bug3File.append(r);
+}
+
+void Bug_Popout::closeBug3File()
+{
+	QMutexLocker l(&bug3Mut);
+	closeBug3FileLocked();
+}
+
+void Bug_Popout::closeBug3FileLocked()
+{
+	if (!bug3File.isOpen()) return;
+	const QString fname (bug3File.fileName());
+	QString err;
+	if (!bug3File.close(&err)) Warning() << "Bug3 'extra data' file " << fname << ": " << err;
 }
 
 void Bug_Popout::plotMeta(const DAQ::BugTask::BlockMetaData & meta)
@@ -15,6 +15,7 @@
 #include "DAQ.h"
 #include "ui_Bug_Popout.h"
 #include "DataFile.h"
+#include "Bug3MetaFile.h"
 
 class Bug_Graph;
 class Bug_MetaPlotThread;
@@ -27,7 +28,12 @@ public:
 	~Bug_Popout();
 
     void plotMeta(const DAQ::BugTask::BlockMetaData & meta);
+    /// Queues the block's metadata to be appended to the data file's .bug3b sidecar (see Bug3MetaFile.h), which is
+    /// (re)created if dataFile is new.  Call this after writing the block's scans to dataFile.
     void writeMetaToBug3File(const DataFile & dataFile, const DAQ::BugTask::BlockMetaData & meta/*, int fudge_sampct = 0*/);
+    /// Writes out everything queued by writeMetaToBug3File() and closes the sidecar file.  Call when the data file is
+    /// closed.  Threadsafe.
+    void closeBug3File();
 
 private slots:
 	void filterSettingsChanged();
@@ -38,6 +44,7 @@ private slots:
 private:
 	void setupGraphs();
     void setupAOPassThru();
+    void closeBug3FileLocked(); ///< closeBug3File() with bug3Mut held
 	
 	QTime* timeSinceStart;
 
@@ -55,6 +62,10 @@ private:
     DAQ::BugTask::BlockMetaData lastMeta;
 
     Bug_MetaPlotThread *plotThread;
+
+    QMutex bug3Mut; ///< guards bug3File and bug3FileFailed: the saver writes to it while the GUI thread may close it
+    Bug3Meta::Writer bug3File;
+    QString bug3FileFailed; ///< so we complain only once if it can't be created
 };
 
 
@@ -21,6 +21,7 @@
 #include <QWaitCondition>
 #include "ConfigureDialogController.h"
 #include "Par2Window.h"
+#include "Telemetry.h"
 
 
 CommandServer::CommandServer(MainApp *parent)
@@ -67,6 +68,8 @@ class CommandConnection : public QThread
     QWaitCondition cond;
     volatile bool gotResponse, lastResponse;
     QVariant evtResponse;
+
+    Telemetry::Stage tel; ///< commands handled, failed commands, response bytes, time to handle each command
     
     bool processLine(const QString & line);
     void sendOK();
@@ -123,7 +126,7 @@ CommandConnection::CommandConnection(qintptr sockFd, int timeout)
 #else
 CommandConnection::CommandConnection(int sockFd, int timeout)
 #endif
-    : QThread(mainApp()), stop(false), sock(0), sockFd(sockFd), timeout(timeout)
+    : QThread(mainApp()), stop(false), sock(0), sockFd(sockFd), timeout(timeout), tel("cmd")
 {    
 }
 
@@ -161,6 +164,7 @@ void CommandConnection::run() {
     sock->moveToThread(this);
     QString connName = sock->peerAddress().toString() + ":" + QString::number(sock->peerPort());
     Log() << "New command connection from " << connName ;
+    tel.setName("cmd " + connName);
     SockUtil::Context ctx(QString("Command connection from ") + connName);
 #if QT_VERSION >= 0x040600
     sock->setSocketOption(QAbstractSocket::LowDelayOption, 1); // turn off Nagle algorithm
@@ -177,7 +181,15 @@ void CommandConnection::run() {
         }
         Debug() << "Got line: " << line;
         if (line.length()) {
-            if ( processLine(line) ) {
+            const u64 t0 = Telemetry::now();
+            const bool ok = processLine(line);
+            {
+                Telemetry::Update u(tel);
+                u.work(Telemetry::now() - t0);
+                if (!ok) u.add(Telemetry::Errors);
+                else if (!resp.isNull()) u.add(Telemetry::Bytes, u64(resp.length()));
+            }
+            if ( ok ) {
                 sendOK();
                 errCt = 0;
             } else {
@@ -461,6 +473,21 @@ bool CommandConnection::processLine(const QString & line)
     } else if (cmd == "GETCHANNELSUBSET") {
 		QEvent *e = new CustomEvt(E_GetChannelSubset, this);
         postEventToAppAndWaitForReply(e);
+    } else if (cmd == "GETSPIKES") {
+        // response: first line is the 'since' to use next time, then one "scan chan amplitude" line per spike
+        u64 since = toks.size() ? toks.front().toULongLong() : 0ULL, next = since;
+        std::vector<SpikeDetector::Spike> spikes;
+        if (!mainApp()->getRecentSpikes(since, spikes, &next)) {
+            Warning() << (errMsg = "Online spike detection is not running");
+            ret = false;
+        } else {
+            resp = QString::number(next) + "\n";
+            for (size_t i = 0; i < spikes.size(); ++i)
+                resp += QString("%1 %2 %3\n").arg(spikes[i].scan).arg(spikes[i].chan).arg(spikes[i].amp);
+        }
+    } else if (cmd == "GETSTATS") {
+        // read straight out of the stages from this thread -- no need to bother the main thread
+        resp = Telemetry::formatColumns(Telemetry::Stage::snapshotAll());
     }
     else if (cmd == "BYE" || cmd == "QUIT" || cmd == "EXIT" || cmd == "CLOSE") {
         Debug() << "Client requested shutdown, closing connection..";
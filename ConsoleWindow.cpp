@@ -46,10 +46,18 @@ ConsoleWindow::ConsoleWindow(QWidget *p, Qt::WindowFlags f)
 	m->addAction(app->tempFileSizeAct);
 	m->addAction(app->sortGraphsByElectrodeAct);
     m->addAction(app->bufferSizesDialogAct);
+    m->addAction(app->filterBankAct);
+    m->addAction(app->filterBankOnSaveAct);
+    m->addAction(app->refStageAct);
+    m->addAction(app->refStageOnSaveAct);
+    m->addAction(app->spikeDetAct);
+    m->addAction(app->spikeThreshAct);
 
 	m = mb->addMenu("&Tools");
     m->addAction(app->verifySha1Act);
     m->addAction(app->par2Act);
+    m->addAction(app->statsAct);
+    m->addAction(app->traceAct);
 	
 	m = mb->addMenu("&Window");
 	windMenu = m;
@@ -22,6 +22,7 @@
 #include <QMutexLocker>
 #include <QProcess>
 #include <QProcessEnvironment>
+#include <QFileInfo>
 #include <math.h>
 #include "SampleBufQ.h"
 #include "MainApp.h"
@@ -315,6 +316,7 @@ namespace DAQ
           clockSource(0), error(0), callStr(0)
     {
         errBuff[0] = 0;
+        setupIntanDemux(demux, params);
         setDO(false); // assert DO is low when stopped...
     }
 	
@@ -360,49 +362,90 @@ namespace DAQ
 }// end namespace DAQ
 
 #include <stdlib.h>
+#include "SyntheticDAQ.h"
 
 namespace DAQ 
 {
     void NITask::daqThr()
     {
-        static QString fname(":/fakedaq/fakedaqdata.bin");
-        char *e;
-        if ((e=getenv("FAKEDAQ"))) {
-            fname = e;
-        } else {
-            Warning() << "FAKEDAQ env var not found, using " << fname << " as filename instead";
+        const char *e = getenv("FAKEDAQ");
+        const char *spec = getenv("FAKEDAQ_SYNTH");
+        const bool fromFile = e && *e;
+        SyntheticDAQParams sp;
+        if (!fromFile) {
+            // no data file given: synthesize the data, as configured by the FAKEDAQ_SYNTH env var
+            std::string err;
+            if (!sp.parse(spec ? spec : "", &err)) {
+                QString msg = QString("Bad FAKEDAQ_SYNTH setting: ") + err.c_str();
+                Error() << msg;
+                emit taskError(msg);
+                return;
+            }
+            sp.nChans = params.nVAIChans;
+            sp.srate = params.srate;
+            sp.pdChan = params.usePD ? params.idxOfPdChan : -1;
         }
-        QFile f(fname);
-        if (!f.open(QIODevice::ReadOnly)) {
-            QString err = QString("Could not open %1!").arg(fname);
+        QFile f(fromFile ? QString(e) : QString());
+        if (fromFile && !f.open(QIODevice::ReadOnly)) {
+            QString err = QString("Could not open %1!").arg(f.fileName());
             Error() << err;
             emit taskError(err);
             return;
         }
+        SyntheticDAQ synth(sp);
+        if (fromFile)
+            Log() << "FakeDAQ: playing back " << f.fileName();
+        else
+            Log() << "FakeDAQ: synthetic data (FAKEDAQ_SYNTH=\"" << QString(spec) << "\")" << (sp.maxSpeed ? ", as fast as possible" : "");
+
+        // one page per period, against absolute deadlines so oversleeping doesn't slow the average rate
+        DeadlinePacer pacer;
+        pacer.start(sp.maxSpeed ? 0. : writer.scansPerPage()/params.srate);
         std::vector<int16> data;
-        const double onePd = writer.scansPerPage()/params.srate;
         while (!pleaseStop) {
-			double ts = getTime();
-            data.resize(unsigned(params.nVAIChans*writer.scansPerPage()));
-            qint64 nread = f.read((char *)&data[0], data.size()*sizeof(int16));
-            if (nread != qint64(data.size()*sizeof(int16))) {
-                f.seek(0);
-            } else if (nread > 0) {
-                nread /= sizeof(int16);
-                data.resize(nread);
+            const double late = pacer.wait();
+            if (late > 1.0) {
+                Warning() << "FakeDAQ NITask::daqThr() is " << late << " s behind, can't keep up at " << params.srate << " Hz!  Skipping ahead.";
+                pacer.resync();
+            }
+            u64 nread = 0;
+            const u64 tr0 = Telemetry::now();
+            if (fromFile) {
+                data.resize(unsigned(params.nVAIChans*writer.scansPerPage()));
+                qint64 nbytes = f.read((char *)&data[0], data.size()*sizeof(int16));
+                if (nbytes != qint64(data.size()*sizeof(int16))) {
+                    f.seek(0);
+                    continue;
+                }
+                nread = u64(nbytes/sizeof(int16));
+                { Telemetry::Update u(acqTel); u.work(Telemetry::now() - tr0); u.add(Telemetry::Scans, nread/params.nVAIChans); u.add(Telemetry::Bytes, u64(nbytes)); }
+                acqTel.span("read", tr0, Telemetry::now(), 0, writer.scansWritten());
                 if (!totalRead) emit(gotFirstScan());
-
                 doFinalDemuxAndEnqueue(data);
-      
-                totalReadMut.lock();
-                totalRead += nread;
-                totalReadMut.unlock();
+            } else {
+                // generated straight into the page, already in final channel order
+                unsigned nFree = 0;
+                int16 *dst = writer.directWritePtr(&nFree);
+                if (!dst || !nFree) {
+                    Error() << "FakeDAQ NITask::daqThr writer.directWritePtr() returned NULL! FIXME!";
+                    break;
+                }
+                synth.generate(dst, nFree);
+                nread = u64(nFree)*u64(params.nVAIChans);
+                { Telemetry::Update u(acqTel); u.work(Telemetry::now() - tr0); u.add(Telemetry::Scans, nFree); u.add(Telemetry::Bytes, nread*sizeof(int16)); }
+                acqTel.span("read", tr0, Telemetry::now(), 0, writer.scansWritten());
+                if (!totalRead) emit(gotFirstScan());
+                const u64 tw0 = Telemetry::now(), scansBefore = writer.scansWritten();
+                const bool ok = writer.commitDirectWrite(nFree);
+                ringWritten(tw0, scansBefore, ok);
+                if (!ok) {
+                    Error() << "FakeDAQ NITask::daqThr writer.commitDirectWrite() returned false! FIXME!";
+                    break;
+                }
             }
-            int sleeptime = int(onePd*1e6) - int((getTime()-ts)*1e6);
-			if (sleeptime > 0) 
-				usleep(sleeptime);
-			else
-				Warning() << "FakeDAQ NITask::daqThr(). sleeptime (" << sleeptime << ") is less than 0!";
+            totalReadMut.lock();
+            totalRead += nread;
+            totalReadMut.unlock();
         }
     }
 
@@ -520,7 +563,19 @@ namespace DAQ
                     }*/
 
                     double t0 = getTime();
-                    if ( DAQmxErrChkNoJump(DAQmxWriteBinaryI16(taskHandle, nScansToWrite, 1, aoTimeout, DAQmx_Val_GroupByScanNumber, &samps[sampIdx], &nScansWritten, NULL)) )
+                    const u64 tw0 = Telemetry::now();
+                    const bool failed = DAQmxErrChkNoJump(DAQmxWriteBinaryI16(taskHandle, nScansToWrite, 1, aoTimeout, DAQmx_Val_GroupByScanNumber, &samps[sampIdx], &nScansWritten, NULL));
+                    {
+                        Telemetry::Update u(tel);
+                        u.work(Telemetry::now() - tw0);
+                        u.backlog(dataQueueSize());
+                        if (failed) u.add(Telemetry::Errors);
+                        else if (nScansWritten > 0) {
+                            u.add(Telemetry::Scans, u64(nScansWritten));
+                            u.add(Telemetry::Bytes, u64(nScansWritten)*u64(aoChansSize)*sizeof(int16));
+                        }
+                    }
+                    if (failed)
                     {
                         break2 = true;
                         if (++daqerrct < 3) {
@@ -676,7 +731,19 @@ namespace DAQ
     int NITask::doAIRead(TaskHandle th, u64 samplesPerChan, std::vector<int16> & data, unsigned long oldS, int32 pointsToRead, int32 & pointsRead)
     {
         const DAQ::Params & p(params);
-        if (DAQmxErrChkNoJump (DAQmxReadBinaryI16(th,samplesPerChan,timeout,DAQmx_Val_GroupByScanNumber,&data[oldS],pointsToRead,&pointsRead,NULL))) {
+        const u64 tr0 = Telemetry::now();
+        const bool failed = DAQmxErrChkNoJump (DAQmxReadBinaryI16(th,samplesPerChan,timeout,DAQmx_Val_GroupByScanNumber,&data[oldS],pointsToRead,&pointsRead,NULL));
+        {
+            Telemetry::Update u(acqTel);
+            u.work(Telemetry::now() - tr0);
+            if (failed) u.add(Telemetry::Errors);
+            else if (samplesPerChan) {
+                u.add(Telemetry::Scans, u64(pointsRead));
+                u.add(Telemetry::Bytes, u64(pointsRead) * (u64(pointsToRead)/samplesPerChan) * sizeof(int16));
+            }
+        }
+        acqTel.span("read", tr0, Telemetry::now(), 0, writer.scansWritten());
+        if (failed) {
             Debug() << "Got error number on AI read: " << error;
             if (p.autoRetryOnAIOverrun && acceptableRetryErrors.contains(error)) {
                 if (nReadRetries > 2) {
@@ -796,6 +863,10 @@ namespace DAQ
         }
 
         recomputeAOAITab(aoAITab, aoChan, p);
+
+        ScanPermutation dualDevFused;
+        if (p.dualDevMode && unsigned(NCHANS1+NCHANS2) == writer.scanSizeSamps())
+            setupFusedDualDev(dualDevFused, demux, NCHANS1, NCHANS2, nExtraChans1, nExtraChans2);
         
         const int task_read_freq_hz = computeTaskReadFreq(p.srate);
         
@@ -1031,10 +1102,17 @@ namespace DAQ
                 }
             }
             
+            bool wroteFused = false;
             if (p.dualDevMode) {
-                std::vector<int16> out;
-                mergeDualDevData(out, data, data2, NCHANS1, NCHANS2, nExtraChans1, nExtraChans2);
-                data.swap(out);
+                if (!aoWriteThr && !dualDevFused.isNull()) {
+                    // merge + demux + copy into the ring page, all in one pass.  AO passthru needs the merged scans, so it keeps using the path below
+                    writeFusedDualDevData(data, data2, dualDevFused);
+                    wroteFused = true;
+                } else {
+                    std::vector<int16> out;
+                    mergeDualDevData(out, data, data2, NCHANS1, NCHANS2, nExtraChans1, nExtraChans2);
+                    data.swap(out);
+                }
             }
 
             totalReadMut.lock();
@@ -1042,7 +1120,8 @@ namespace DAQ
             totalReadMut.unlock();
 
             // note that from this point forward, the 'data' buffer is the only valid buffer
-            // and it contains the MERGED data from both devices if in dual dev mode.
+            // and it contains the MERGED data from both devices if in dual dev mode (unless wroteFused, in which
+            // case the scans already went straight into the ring buffer).
             
             // now, do optional AO output .. done in another thread to save on latency...
             if (aoWriteThr) {  
@@ -1092,7 +1171,8 @@ namespace DAQ
                 aoSampCount += sz;
             }
             
-            doFinalDemuxAndEnqueue(data);
+            if (wroteFused) data.clear();
+            else doFinalDemuxAndEnqueue(data);
             lastEnq = lastReadTime;
 
             // fast settle...
@@ -1141,6 +1221,59 @@ namespace DAQ
         
     }
     
+    /* static */
+    void NITask::setupFusedDualDev(ScanPermutation & fused, const ScanPermutation & demux, int NCHANS1, int NCHANS2, int nExtraChans1, int nExtraChans2)
+    {
+        fused.clear();
+        if (NCHANS1 <= 0 || NCHANS2 < 0) return;
+        // where each sample of a merged scan comes from -- same order as mergeDualDevData().  Indices >= NCHANS1 are into data2's scan
+        const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2;
+        std::vector<int> merged;
+        merged.reserve(NCHANS1+NCHANS2);
+        for (int i = 0; i < nMx; ++i) merged.push_back(i);
+        for (int i = 0; i < nMx2; ++i) merged.push_back(NCHANS1+i);
+        for (int i = nMx > 0 ? nMx : 0; i < NCHANS1; ++i) merged.push_back(i);
+        for (int i = nMx2 > 0 ? nMx2 : 0; i < NCHANS2; ++i) merged.push_back(NCHANS1+i);
+        if (!demux.isNull() && demux.scanSize() != merged.size()) {
+            Error() << "INTERNAL ERROR: demux scan size " << demux.scanSize() << " != merged dual dev scan size " << merged.size() << ", not using the fused write path.";
+            return;
+        }
+        std::vector<int> g(merged.size());
+        for (unsigned i = 0; i < g.size(); ++i)
+            g[i] = merged[demux.isNull() ? i : demux.table()[i]];
+        fused.setGather2(g, unsigned(NCHANS1));
+    }
+
+    void NITask::writeFusedDualDevData(const std::vector<int16> & data, const std::vector<int16> & data2, const ScanPermutation & fused)
+    {
+        const unsigned ss1 = fused.scanSize1(), ss2 = fused.scanSize2();
+        unsigned nScans = ss1 ? unsigned(data.size()/ss1) : 0;
+        if (ss2 && data2.size()/ss2 != nScans) {
+            Error() << "INTERNAL ERROR IN FUNCTION `writeFusedDualDevData()'!  The two device buffers data and data2 have differing numbers of scans! FIXME!  Aieeeee!!\n";
+            if (data2.size()/ss2 < nScans) nScans = unsigned(data2.size()/ss2);
+        }
+        const int16 *in1 = nScans ? &data[0] : 0, *in2 = (nScans && ss2) ? &data2[0] : 0;
+        while (nScans) {
+            unsigned nFree = 0;
+            int16 *dst = writer.directWritePtr(&nFree);
+            if (!dst || !nFree) {
+                Error() << "NITask::writeFusedDualDevData writer.directWritePtr() returned NULL! FIXME!";
+                return;
+            }
+            const unsigned n = nScans < nFree ? nScans : nFree;
+            fused.apply2(in1, in2, dst, n);
+            const u64 tw0 = Telemetry::now(), scansBefore = writer.scansWritten();
+            const bool ok = writer.commitDirectWrite(n);
+            ringWritten(tw0, scansBefore, ok);
+            if (!ok) {
+                Error() << "NITask::writeFusedDualDevData writer.commitDirectWrite() returned false! FIXME!";
+                return;
+            }
+            in1 += size_t(n)*ss1; if (in2) in2 += size_t(n)*ss2;
+            nScans -= n;
+        }
+    }
+
     /*static*/
     inline void NITask::mergeDualDevData(std::vector<int16> & out,
                                 const std::vector<int16> & data, const std::vector<int16> & data2, 
@@ -1249,32 +1382,31 @@ namespace DAQ
 #endif // ! FAKEDAQ
 
 
-    static inline void ApplyNewIntanDemuxToScan(int16 *begin, const unsigned nchans_per_intan, const unsigned num_intans) {
-        int narr = nchans_per_intan*num_intans;
-        int16 tmparr[NUM_MUX_CHANS_MAX]; // hopefully 512 channels is freakin' enough..
-        if (narr > NUM_MUX_CHANS_MAX) {
-            Error() << "INTERNAL ERROR: Scan size too large for compiled-in limits (too many INTANs?!).  Please fix the sourcecode at DAQ::ApplyJFRCIntanXXDemuxToScan!";
+    /* static */
+    void NITask::setupIntanDemux(ScanPermutation & demux, const Params & p)
+    {
+        demux.clear();
+        if (p.doPreJuly2011IntanDemux || p.mode == DAQ::AIRegular || p.mode >= DAQ::N_Modes) return;
+        /* Scans come off the card as Intan0_CH0, Intan1_CH0, ... IntanN_CH0, Intan0_CH1, ... followed by the extra chans.
+           That is, a (chans per intan) x (num intans) matrix which we transpose to get each Intan's chans together.
+           In dual dev mode, the 2nd device's Intans were merged in as extra columns. */
+        const unsigned nchans_per_intan = DAQ::ModeNumChansPerIntan[p.mode],
+                       num_intans = DAQ::ModeNumIntans[p.mode]*(p.dualDevMode && !p.secondDevIsAuxOnly ? 2 : 1);
+        if (nchans_per_intan*num_intans > NUM_MUX_CHANS_MAX || nchans_per_intan*num_intans > p.nVAIChans) {
+            Error() << "INTERNAL ERROR: Scan size too large for compiled-in limits (too many INTANs?!).  Please fix the sourcecode at DAQ::NITask::setupIntanDemux!";
             return;
         }
-        int i,j,k;
-        for (k = 0; k < int(num_intans); ++k) {
-            const int jlimit = (k+1)*int(nchans_per_intan);
-            for (i = k, j = k*int(nchans_per_intan); j < jlimit; i+=num_intans,++j) {
-                tmparr[j] = begin[i];
-            }
-        }
-        memcpy(begin, tmparr, narr*sizeof(int16));
+        demux.setTranspose(p.nVAIChans, nchans_per_intan, num_intans);
     }
 
     void NITask::doFinalDemuxAndEnqueue(std::vector<int16> & data)
     {
         const DAQ::Params & p (params);
-        if (!p.doPreJuly2011IntanDemux && p.mode != DAQ::AIRegular) {
-            for (int i = 0; i < (int)data.size(); i += p.nVAIChans) {
-                ApplyNewIntanDemuxToScan(&data[i], DAQ::ModeNumChansPerIntan[p.mode], DAQ::ModeNumIntans[p.mode]*(p.dualDevMode && !p.secondDevIsAuxOnly ? 2 : 1));
-            }
-        }
-        if (!writer.write(&data[0],unsigned(data.size())/p.nVAIChans)) {
+        // the demux is done by the writer, on the way into the page, so the data is only touched once
+        const u64 tw0 = Telemetry::now(), scansBefore = writer.scansWritten();
+        const bool ok = writer.write(&data[0],unsigned(data.size())/p.nVAIChans, 0, demux.isNull() ? 0 : &demux);
+        ringWritten(tw0, scansBefore, ok);
+        if (!ok) {
             Error() << "NITask::daqThr writer.write() returned false! FIXME!";
         }
         data.clear();
@@ -1338,12 +1470,34 @@ namespace DAQ
     }
 
     Task::Task(QObject *parent, const QString & nam, const PagedScanReader & prb)
-        : QThread(parent), totalRead(0ULL), writer(prb.scanSizeSamps(),prb.metaDataSizeBytes(),prb.rawData(),prb.totalSize(),prb.pageSize())
+        : QThread(parent), totalRead(0ULL), writer(prb.scanSizeSamps(),prb.metaDataSizeBytes(),prb.rawData(),prb.totalSize(),prb.pageSize()),
+          acqTel("acq"), ringTel("ring"), ringForcedSeen(0)
 	{
         setObjectName(nam);
+        // a MustNotDrop reader (the saver) that falls behind may stall us this long; the driver buffers meanwhile
+        writer.setMaxBlockMs(SAMPLES_SHM_MAX_WRITER_BLOCK_MS);
 	}
 	
     Task::~Task() {   }
+
+    void Task::ringWritten(u64 t0, u64 scansBefore, bool ok)
+    {
+        const u64 scans = writer.scansWritten(), spp = writer.scansPerPage() ? writer.scansPerPage() : 1;
+        const u64 t1 = Telemetry::now();
+        {
+            Telemetry::Update u(ringTel);
+            u.work(t1 - t0);
+            u.add(Telemetry::Scans, scans - scansBefore);
+            u.add(Telemetry::Bytes, (scans - scansBefore) * u64(writer.scanSizeBytes()));
+            u.add(Telemetry::Pages, scans/spp - scansBefore/spp);
+            if (!ok) u.add(Telemetry::Errors);
+            if (writer.forcedOverruns() != ringForcedSeen) {
+                u.add(Telemetry::Skips, writer.forcedOverruns() - ringForcedSeen);
+                ringForcedSeen = writer.forcedOverruns();
+            }
+        }
+        ringTel.span("write", t0, t1, writer.latest(), scansBefore);
+    }
 	
 	u64 Task::lastReadScan() const
     {
@@ -1465,11 +1619,10 @@ namespace DAQ
         emit(justStarted());
 
 		int tout_ct = 0;
-		QByteArray data;
+		InputBuf inbuf(4*1024*1024);
 		
         int notRunningCt = 0;
 		
-		data.reserve(4*1024*1024);
         while (!pleaseStop /*&& p.state() != QProcess::NotRunning*/) {
 			if (p.state() == QProcess::Running) { 
 				qint64 n_avail = p.bytesAvailable();
@@ -1491,18 +1644,21 @@ namespace DAQ
 					return;
 				}
                 tout_ct = 0;
-				QByteArray buf = p.readAll();
-				if (!buf.size()) {
+				// read everything that's available (at least 64KB at a time) straight into inbuf
+				n_avail = p.bytesAvailable();
+				char *wp = inbuf.writePtr(unsigned(qMin(qMax(n_avail, qint64(65536)), qint64(64*1024*1024))));
+				const qint64 nread = p.read(wp, qint64(inbuf.writeSpace()));
+				if (nread <= 0) {
 					Warning() << shortName << " slave process: read 0 bytes!";
                     readStdErr(p);
                     processCmds(p);
 					continue;
 				}
-				data.append(buf);
-				unsigned consumed = gotInput(data, buf.size(), p);
-				data.remove(0,consumed);
-				if (excessiveDebug && data.size()) {
-					Debug() << shortName << " slave process: partial data left over " << data.size() << " bytes";
+				inbuf.wrote(unsigned(nread));
+				unsigned consumed = gotInput(inbuf.readPtr(), inbuf.readAvail(), unsigned(nread), p);
+				inbuf.consume(consumed);
+				if (excessiveDebug && inbuf.readAvail()) {
+					Debug() << shortName << " slave process: partial data left over " << inbuf.readAvail() << " bytes";
 				}
 				
                 readStdErr(p);
@@ -1579,7 +1735,7 @@ namespace DAQ
     BugTask::BugTask(DAQ::Params & p, QObject *parent, const PagedScanReader & psr)
         : SubprocessTask(p, parent, "Bug3", "bug3_spikegl.exe", psr), req_shm_pg_sz(requiredShmPageSize(p.nVAIChans)), aoWriteThread(0), aoSampCount(0), aireader(0)
 	{
-		state = 0; nblocks = 0; nlines = 0;
+		nblocks = 0; protoSeen = 0; lineScanned = 0;
 		debugTTLStart = 0;
         if (writer.pageSize() != req_shm_pg_sz)
             Error() << "INTERNAL ERROR: BugTask needs a shm with page size == requiredShmPageSize()!  FIXME!!";
@@ -1628,6 +1784,7 @@ namespace DAQ
 	void BugTask::setupEnv(QProcessEnvironment & env) const
 	{
 		env.insert("BUG3_SPIKEGL_MODE", "yes");
+		env.insert("BUG3_BINARY_BLOCKS", "yes"); // older exes ignore this and keep sending text, which we still accept
 		switch (params.bug.rate) {
 			case 0:
 				env.insert("BUG3_DATA_RATE", "LOW");
@@ -1661,342 +1818,126 @@ namespace DAQ
 		return frameSize * FramesPerBlock;
 	}
 	
-	unsigned BugTask::gotInput(const QByteArray & data, unsigned lastReadNBytes, QProcess & p) 
+	unsigned BugTask::gotInput(const char *data, unsigned size, unsigned lastReadNBytes, QProcess & p) 
 	{
-		(void) p;
+		(void) p; (void) lastReadNBytes;
+		// The stream is a mix of text lines and (if the exe supports it) binary blocks, which start with a NUL byte
+		// and so can never be confused with a line.  Consume whole lines/blocks from the front until we hit an incomplete one.
+		// Lines are parsed in place, straight out of data.
+		const char * const buf = data;
 		unsigned consumed = 0;
-		for (int i = (data.size()-lastReadNBytes), l = 0; i < data.size(); ++i) {
-			if (data[i] == '\n') {
-				QString line = data.mid(l, i-l+1);
-				l = consumed = i+1;
-				processLine(line, block, nblocks, state, nlines); 
-				if (state > nstates) {
-					processBlock(block, nblocks++);
-					block.clear();
-					state = 0;
+		// a partial line left over from last time was already searched for '\n', so don't search it again
+		unsigned skip = lineScanned;
+		lineScanned = 0;
+		while (consumed < size) {
+			const char *pos = buf + consumed;
+			const unsigned avail = size - consumed;
+			if (Bug3::looksBinary(pos, avail) && !textParser.inBlock()) {
+				unsigned frameBytes = 0;
+				QString err;
+				const Bug3::DecodeResult r = Bug3::decodeBinary(pos, avail, rawBlock, &frameBytes, &err);
+				if (r == Bug3::DecodeNeedMore) break;
+				consumed += frameBytes;
+				if (r == Bug3::DecodeBad) {
+					Warning() << "Bug3: skipping " << frameBytes << " bytes of bad binary data: " << err;
+					continue;
 				}
+				if (protoSeen != 2) { Debug() << "Bug3: receiving binary blocks from the slave process"; protoSeen = 2; }
+				processBlock(rawBlock, nblocks++);
+			} else {
+				if (skip > avail) skip = avail;
+				const char *nl = reinterpret_cast<const char *>(memchr(pos + skip, '\n', avail - skip));
+				if (!nl) { lineScanned = avail; break; }
+				skip = 0;
+				const unsigned lineLen = unsigned(nl - pos) + 1;
+				processLine(pos, lineLen);
+				consumed += lineLen;
 			}
 		}
 		return consumed;
 	}
 			
-	void BugTask::processLine(const QString & lineUntrimmed, QMap<QString, QString> & block, const quint64 & nblocks, int & state, quint64 & nlines)
+	void BugTask::processLine(const char *line, unsigned len)
 	{
-		QString line = lineUntrimmed.trimmed();
-#if 0
-		if (excessiveDebug) {
-			QString linecpy = line;
-			if (line.length() > 75) linecpy = line.left(65) + "..." + line.right(10);
-			if (linecpy.length() > 3) { Debug() << "Bug3: " << linecpy; }
+		QString msg;
+		switch (textParser.processLine(line, len, rawBlock, &msg)) {
+			case Bug3::TextParser::BlockDone:
+				if (textParser.problems()) {
+					Warning() << "Bug3: Internal problem -- " << textParser.problems() << " parse error(s) in block " << nblocks << ", first: " << textParser.firstProblem();
+					acqTel.add(Telemetry::Errors, textParser.problems());
+				}
+				if (protoSeen != 1) { Debug() << "Bug3: receiving text blocks from the slave process"; protoSeen = 1; }
+				processBlock(rawBlock, nblocks++);
+				break;
+			case Bug3::TextParser::UserMsg: emit(taskWarning(msg)); break;
+			case Bug3::TextParser::WarnMsg: Warning() << "Bug3: " << msg; break;
+			case Bug3::TextParser::LogMsg: Log() << "Bug3: " << msg; break;
+			default: break;
 		}
-#endif
-		if (line.startsWith("---> Console")) { 
-			++nlines;
-			state=1; 
-			if (excessiveDebug) Debug() << "Bug3: New block, current nblocks=" << nblocks; 
-		} else if (state) {
-			++nlines;
-            static QRegExp blkSepRE("[}{]"); ///< made static here to compile the RE only once.. performance optimization
-			// we are in parsing mode..
-            QStringList nv = line.split(blkSepRE, QString::SkipEmptyParts);
-			if (nv.count() == 2) {
-				//Debug() << "Bug3: Got name=" << nv.first() << " v=" << nv.last().left(5) << "..." << nv.last().right(5);
-				block[nv.first()] = nv.last();
-				++state;
-            }
-            else if (excessiveDebug)  Debug() << "Bug3: line: '" << line << "' had nv.count()=" << nv.count();
-		} else if (!state && line.startsWith("USRMSG:")) {
-            emit(taskWarning(line.mid(7).trimmed()));
-        } else if (!state && line.startsWith("WARNMSG:")) {
-            Warning() << "Bug3: " << line.mid(8).trimmed();
-        } else if (!state && line.startsWith("LOGMSG:")) {
-            Log() << "Bug3: " << line.mid(7).trimmed();
-        }
 	}
 	
-	void BugTask::processBlock(const QMap<QString, QString> & blk, quint64 blockNum)
+	void BugTask::processBlock(const Bug3::Block & blk, quint64 blockNum)
 	{
+		const u64 tBlk0 = Telemetry::now();
 		BlockMetaData meta;
 		meta.blockNum = blockNum;
 		const int nchans (numChans());
-		std::vector<int16> samps;
-        samps.resize(nchans * NeuralSamplesPerFrame * FramesPerBlock, 0); // todo: fix to come from params?
-		
-		// todo implement..
-		for (QMap<QString,QString>::const_iterator it = blk.begin(); it != blk.end(); ++it) {
-			const QString & k = it.key(), & v(it.value());
-#if 0
-            if (excessiveDebug) Debug() << "Bug3: " << "Got key: '" << k << "'";
-#endif
-			if (k.startsWith("NEU_")) {
-				QStringList knv = k.split("_");
-				int neur_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					neur_chan = knv.last().toInt(&ok);
-					if (neur_chan < 0 || neur_chan >= TotalNeuralChans) { neur_chan = 0; ok = false; }
-				} 
-				if (!ok) 
-					Warning() << "Bug3: Internal problem -- parse error on NEU_ key.";
-
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " neural samples for NEU chan " << neur_chan << "..";
-				bool warned = false;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					for (int neurix = 0; neurix < NeuralSamplesPerFrame; ++neurix) {
-						QString num = nums.empty() ? "0" : nums.front();
-						if (nums.empty()) { 
-							if (!warned) Warning() << "Bug3: Internal problem -- ran out of neural samples in frame `" << v << "'";
-							warned = true;
-						} else nums.pop_front();
-						ok = false;
-						int samp = num.toUShort(&ok);
-						if (!ok) Error() << "Bug3: Internal error -- parse error while reading neuronal sample `" << num << "'";
-						// todo.. fix this.  wtf? can't think straight now...
-						samp = samp-ADCOffset; // incoming data is such that 0v = (int16)1023, this is because incoming samples are 11-bit. normalize so that 0v = 0
-						samp = samp * int16(32); // promote to 16-bit
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + neurix*nchans + neur_chan ] = samp;
-					}
-				}
-			} else if (k.startsWith("EMG_")) {
-				QStringList knv = k.split("_");
-				int emg_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					emg_chan = knv.last().toInt(&ok);
-					if (emg_chan < 0 || emg_chan >= TotalEMGChans) { emg_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on EMG_ key.";
-
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " EMG samples..";
-				bool warned = false;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of EMG samples in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int samp = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-					samp = samp-ADCOffset; // normalize since incoming data is weird 11 bit
-					samp = samp * int16(32); // promote to 16-bit
-					for (int emgix = 0; emgix < NeuralSamplesPerFrame; ++emgix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!						
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + emgix*nchans + (TotalNeuralChans+emg_chan) ] = samp;
-					}
-
-				}
-			} else if (k.startsWith("AUX_")) {
-				QStringList knv = k.split("_");
-				int aux_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					aux_chan = knv.last().toInt(&ok);
-					if (aux_chan < 0 || aux_chan >= TotalAuxChans) { aux_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on AUX_ key.";
-				bool warned = false;
-				QStringList nums = v.split(",");
-                //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " AUX samples..";
-				double avgVunreg = 0.0;
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of AUX samples in frame `" << v << "'";
-						warned = true;
-                    }
-					else nums.pop_front();
-					bool ok = false;
-					int samp = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-					samp = samp-ADCOffset; // normalize since incoming data is 11-bit
-					if (aux_chan == 1)  avgVunreg += ADCStep * double(samp);
-					samp = samp * int16(32); // promote to 16-bit					
-					for (int auxix = 0; auxix < NeuralSamplesPerFrame; ++auxix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!	
-						samps[ frame*(NeuralSamplesPerFrame*nchans) + auxix*nchans + (TotalNeuralChans+TotalEMGChans+aux_chan) ] = samp;
-					}
-				}
-				if (aux_chan == 1) {
-					avgVunreg = avgVunreg / (double)FramesPerBlock;
-					if (avgVunreg < 0.0) avgVunreg = 0.0;
-					if (avgVunreg > 6.0) avgVunreg = 6.0;
-					meta.avgVunreg = avgVunreg;
-				}
-			} else if (k.startsWith("TTL_")) {
-				// don't grab all ttl chans here, since we only really support a subset of them
-				QStringList knv = k.split("_");
-				int ttl_chan = 0;
-				bool ok = false;
-				if (knv.count() == 2) {
-					ttl_chan = knv.last().toInt(&ok);
-					if (ttl_chan < 0 || ttl_chan >= TotalTTLChans) { ttl_chan = 0; ok = false; }
-				} 
-				if (!ok) Warning() << "Bug3: Internal problem -- parse error on TTL_ key.";
-				if (params.bug.whichTTLs & (0x1<<ttl_chan)) {
-                    int ttl_chan_translated = ttl_chan;
-                    for (int i = 0; i < TotalTTLChans && i < ttl_chan; ++i)
-                        // make the TTL line number -> our_channelid
-                        // (because TTL10 from bug3 may not always be our TTL10 if say the ttl chans we have on are like 0,1,3,5,10,
-                        // then TTL 10 is really 4 for us!
-                        if (!(params.bug.whichTTLs & (0x1<<i)))
-                            --ttl_chan_translated;
-					bool warned = false;
-					QStringList nums = v.split(",");
-                    //if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " TTL samples..";
-					for (int frame = 0; frame < FramesPerBlock; ++frame) {
-						QString num = nums.empty() ? "0" : nums.front();
-						if (nums.empty()) { 
-							if (!warned) Warning() << "Bug3: Internal problem -- ran out of TTL samples in frame `" << v << "'";
-							warned = true;
-						}
-						else nums.pop_front();
-						bool ok = false;
-						int samp = num.toUShort(&ok);
-						if (!ok) Error() << "Bug3: Internal error -- parse error while reading emg sample `" << num << "'";
-#if 0 // BUG3_TTL_TESTING
-						// TODO HACK BUG FIXME TESTING XXX
-						///*
-						if (ttl_chan_translated == 0) {
-							qint64 scan = qint64(blockNum)*qint64(SpikeGLScansPerBlock) + qint64(frame*NeuralSamplesPerFrame);
-							const qint64 sr = params.srate;
-							static const qint64 ttlWSamps = 640*2;
-							static const qint64 everyNSecs = 2;
-							
-							if (scan>sr*everyNSecs) {
-								if (scan>(debugTTLStart+sr*everyNSecs)) 
-									debugTTLStart = scan;
-							
-								if (scan<debugTTLStart+ttlWSamps)
-									samp = 1;
-								else samp = 0;
-							}
-						}
-						//*/
-#endif
-						if (samp) samp = 32767; // normalize high to maxV
-						for (int ix = 0; ix < NeuralSamplesPerFrame; ++ix) { // need to produce 16 samples for each 1 emg sample read in order to match neuronal rate!						
-                            samps[ frame*(NeuralSamplesPerFrame*nchans) + ix*nchans + (TotalNeuralChans+TotalEMGChans+TotalAuxChans+ttl_chan_translated) ] = samp;
-						}						
-					}				
-				}
-			} else if (k.startsWith("CHIPID")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " chipIDs..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of chipID data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					quint16 chipid = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading chipID `" << num << "'";
-					meta.chipID[frame] = chipid;
-				}
-			} else if (k.startsWith("CHIP_FC")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " chip_fcs..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of chip_fc data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int chipfc = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading chip_fc `" << num << "'";
-					meta.chipFrameCounter[frame] = chipfc;
-				}
-			} else if (k.startsWith("FRAME_MARKER_COR")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " FMCorr..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of framemarker_corr data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					quint16 fmc  = num.toUShort(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading fmcorr `" << num << "'";
-					meta.frameMarkerCorrelation[frame] = fmc;
-				}
-			} else if (k.startsWith("BOARD_FC")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " board_fc..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of board_fc data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int bfc  = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading board_fc `" << num << "'";
-					meta.boardFrameCounter[frame] = bfc;
-				}
-			} else if (k.startsWith("BOARD_FRAME_TIMER")) {
-				QStringList nums = v.split(",");
-				bool warned = false;
-				//if (excessiveDebug) Debug() << "Bug3: got " << nums.count() << " board_frame_timer..";
-				for (int frame = 0; frame < FramesPerBlock; ++frame) {
-					QString num = nums.empty() ? "0" : nums.front();
-					if (nums.empty()) { 
-						if (!warned) Warning() << "Bug3: Internal problem -- ran out of board_ftimer data in frame `" << v << "'";
-						warned = true;
-					}
-					else nums.pop_front();
-					bool ok = false;
-					int bft  = num.toInt(&ok);
-					if (!ok) Error() << "Bug3: Internal error -- parse error while reading board_ftimer `" << num << "'";
-					meta.boardFrameTimer[frame] = bft;
-				}
-			} else if (k.startsWith("BER")) {
-				bool ok = false;
-				double n = v.toDouble(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing BER `" << v << "'";
-				meta.BER = n;
-			} else if (k.startsWith("WER")) {
-				bool ok = false;
-				double n = v.toDouble(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing WER `" << v << "'";
-				meta.WER = n;				
-			} else if (k.startsWith("MISSING_FC")) {
-				bool ok = false;
-				int n = v.toInt(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing MISSING_FC `" << v << "'";
-				// TESTING HACK XXX TODO FIXME!
-//				if (Util::random() < .3 && totalRead < 10000000ULL) n = int(Util::random(0.,16.)) % 6;
-                meta.missingFrameCount = n;
-            } else if (k.startsWith("COMM_ABSTIMENS")) {
-                bool ok = false;
-                u64 abs = v.toULongLong(&ok);
-                if (!ok) Warning() << "Bug3: Internal problem -- error parsing COMM_ABSTIMENS `" << v << "'";
-                meta.comm_absTimeNS = abs;
-            } else if (k.startsWith("CREATION_ABSTIMENS")) {
-                bool ok = false;
-                u64 abs = v.toULongLong(&ok);
-                if (!ok) Warning() << "Bug3: Internal problem -- error parsing CREATION_ABSTIMENS `" << v << "'";
-                meta.creation_absTimeNS = abs;
-            } else if (k.startsWith("FALSE_FC")) {
-				bool ok = false;
-				int n = v.toInt(&ok);
-				if (!ok) Warning() << "Bug3: Internal problem -- error parsing FALSE_FC `" << v << "'";
-				// TESTING HACK XXX TODO FIXME!
-//				if (Util::random() < .3 && totalRead < 10000000ULL) n = int(Util::random(0.,16.)) % 6;
-				meta.falseFrameCount = n;								
+		std::vector<int16> & samps (blockSamps);
+		samps.assign(nchans * NeuralSamplesPerFrame * FramesPerBlock, 0); // todo: fix to come from params?
+
+		// incoming data is such that 0v = (int16)1023, this is because incoming samples are 11-bit. normalize so that 0v = 0, and promote to 16-bit
+		for (int neur_chan = 0; neur_chan < TotalNeuralChans; ++neur_chan) {
+			const quint16 *in = blk.neural[neur_chan];
+			for (int frame = 0; frame < FramesPerBlock; ++frame)
+				for (int neurix = 0; neurix < NeuralSamplesPerFrame; ++neurix)
+					samps[ frame*(NeuralSamplesPerFrame*nchans) + neurix*nchans + neur_chan ] = int16((int(*in++) - ADCOffset) * 32);
+		}
+		// EMG and AUX are sampled once per frame: need to produce 16 samples for each 1 read in order to match neuronal rate!
+		for (int emg_chan = 0; emg_chan < TotalEMGChans; ++emg_chan)
+			for (int frame = 0; frame < FramesPerBlock; ++frame) {
+				const int16 samp = int16((int(blk.emg[emg_chan][frame]) - ADCOffset) * 32);
+				for (int emgix = 0; emgix < NeuralSamplesPerFrame; ++emgix)
+					samps[ frame*(NeuralSamplesPerFrame*nchans) + emgix*nchans + (TotalNeuralChans+emg_chan) ] = samp;
+			}
+		for (int aux_chan = 0; aux_chan < TotalAuxChans; ++aux_chan) {
+			double avgVunreg = 0.0;
+			for (int frame = 0; frame < FramesPerBlock; ++frame) {
+				const int samp = int(blk.aux[aux_chan][frame]) - ADCOffset;
+				if (aux_chan == 1)  avgVunreg += ADCStep * double(samp);
+				for (int auxix = 0; auxix < NeuralSamplesPerFrame; ++auxix)
+					samps[ frame*(NeuralSamplesPerFrame*nchans) + auxix*nchans + (TotalNeuralChans+TotalEMGChans+aux_chan) ] = int16(samp * 32);
 			}
+			if (aux_chan == 1) {
+				avgVunreg = avgVunreg / (double)FramesPerBlock;
+				if (avgVunreg < 0.0) avgVunreg = 0.0;
+				if (avgVunreg > 6.0) avgVunreg = 6.0;
+				meta.avgVunreg = avgVunreg;
+			}
+		}
+		// don't grab all ttl chans here, since we only really support a subset of them
+		for (int ttl_chan = 0, ttl_chan_translated = 0; ttl_chan < TotalTTLChans; ++ttl_chan) {
+			if (!(params.bug.whichTTLs & (0x1<<ttl_chan))) continue;
+			// TTL line number -> our_channelid.  (because TTL10 from bug3 may not always be our TTL10 if say the ttl chans we have on are like 0,1,3,5,10,
+			// then TTL 10 is really 4 for us!)
+			for (int frame = 0; frame < FramesPerBlock; ++frame) {
+				const int16 samp = blk.ttl[ttl_chan][frame] ? 32767 : 0; // normalize high to maxV
+				for (int ix = 0; ix < NeuralSamplesPerFrame; ++ix)
+					samps[ frame*(NeuralSamplesPerFrame*nchans) + ix*nchans + (TotalNeuralChans+TotalEMGChans+TotalAuxChans+ttl_chan_translated) ] = samp;
+			}
+			++ttl_chan_translated;
 		}
+		memcpy(meta.chipID, blk.chipID, sizeof(meta.chipID));
+		memcpy(meta.chipFrameCounter, blk.chipFrameCounter, sizeof(meta.chipFrameCounter));
+		memcpy(meta.frameMarkerCorrelation, blk.frameMarkerCorrelation, sizeof(meta.frameMarkerCorrelation));
+		memcpy(meta.boardFrameCounter, blk.boardFrameCounter, sizeof(meta.boardFrameCounter));
+		memcpy(meta.boardFrameTimer, blk.boardFrameTimer, sizeof(meta.boardFrameTimer));
+		meta.BER = blk.BER;
+		meta.WER = blk.WER;
+		meta.missingFrameCount = blk.missingFrameCount;
+		meta.falseFrameCount = blk.falseFrameCount;
+		meta.comm_absTimeNS = blk.comm_absTimeNS;
+		meta.creation_absTimeNS = blk.creation_absTimeNS;
+
 		totalReadMut.lock();
 		quint64 oldTotalRead = totalRead;
 		totalRead += (quint64)samps.size(); 
@@ -2007,7 +1948,17 @@ namespace DAQ
         handleAOPassthru(samps);
 
 		//Debug() << "Enq: " << samps.size() << " samps, firstSamp: " << oldTotalRead;
-        if (!writer.write(&samps[0],unsigned(samps.size())/nchans,&meta)) {
+        {
+            Telemetry::Update u(acqTel);
+            u.work(Telemetry::now() - tBlk0);
+            u.add(Telemetry::Scans, samps.size()/nchans);
+            u.add(Telemetry::Bytes, samps.size()*sizeof(int16));
+        }
+        acqTel.span("block", tBlk0, Telemetry::now(), 0, writer.scansWritten());
+        const u64 tw0 = Telemetry::now(), scansBefore = writer.scansWritten();
+        const bool ok = writer.write(&samps[0],unsigned(samps.size())/nchans,&meta);
+        ringWritten(tw0, scansBefore, ok);
+        if (!ok) {
             Error() << "Bug3: INTERNAL PROBLEM, writer.write() returned false!";
         }
 		if (!oldTotalRead) emit(gotFirstScan());
@@ -2226,6 +2177,13 @@ namespace DAQ
     FGTask::FGTask(Params & ap, QObject *parent, const PagedScanReader &psr, bool isDummy)
         : SubprocessTask(ap, parent, "Framegrabber", "FG_SpikeGL.exe", psr), lastScanTS(0), lastScanTSMut(QMutex::Recursive)
 	{
+        const QString synthExe(synthExePath());
+        if ((synth = !synthExe.isEmpty())) {
+            QFileInfo fi(synthExe);
+            exeName = fi.fileName();
+            exeDir = fi.absolutePath() + "/";
+            if (!isDummy) Log() << "Framegrabber: using synthetic frames from " << exePath();
+        }
         killAllInstancesOfProcessWithImageName(exeName);                
 
         dialogW = 0; dialog = 0;
@@ -2269,9 +2227,33 @@ namespace DAQ
         if (dialogW) delete dialogW; dialogW = 0;
     }
 
+    /* static */ QString FGTask::synthExePath()
+    {
+        return QProcessEnvironment::systemEnvironment().value("SPIKEGL_FG_SYNTH").trimmed();
+    }
+
+    /* static */ QString FGTask::samplesShmNativeKey()
+    {
+#ifdef Q_OS_WINDOWS
+        return SAMPLES_SHM_NAME;
+#else
+        QString tp(QDir::tempPath());
+        if (!tp.endsWith("/")) tp.append("/");
+        return tp + SAMPLES_SHM_NAME;
+#endif
+    }
+
+    void FGTask::setupEnv(QProcessEnvironment & e) const
+    {
+        // FG_Synth paces its frames to the acquisition's sampling rate unless told otherwise
+        if (synth && !e.contains("FG_SYNTH_RATE") && params.srate)
+            e.insert("FG_SYNTH_RATE", QString::number(params.srate));
+    }
+
 	QStringList FGTask::filesList() const 
 	{
 		QStringList files;
+        if (synth) return files; // nothing to unpack, it's run from where it is
         files.push_back(QString(":/FG/FrameGrabber/FG_SpikeGL/x64/Release/") + exeName);
 		files.push_back(":/FG/FrameGrabber/J_2000+_Electrode_8tap_8bit.ccf");
         files.push_back(":/FG/FrameGrabber/B_a2040_FreeRun_8Tap_Default.ccf");
@@ -2310,27 +2292,22 @@ namespace DAQ
         pushCmd(x);
     }
 
-	unsigned FGTask::gotInput(const QByteArray & data, unsigned lastReadNBytes, QProcess & p) 
+	unsigned FGTask::gotInput(const char *data, unsigned size, unsigned lastReadNBytes, QProcess & p) 
 	{
         (void) p;
 		(void) lastReadNBytes;
 		unsigned consumed = 0;
 		
-		std::vector<const XtCmd *> cmds;
-		cmds.reserve(16384);
+		// handle each command as it's parsed, in place in data
 		const XtCmd *xt = 0;
         int cons = 0;
-		unsigned char *pdata = (unsigned char *)data.data();
-		while ((xt = XtCmd::parseBuf(pdata+consumed, data.size()-consumed, cons))) {
+		const unsigned char *pdata = (const unsigned char *)data;
+		while ((xt = XtCmd::parseBuf(pdata+consumed, int(size-consumed), cons))) {
 			consumed += cons;
-			cmds.push_back(xt);
-		}
-		for (std::vector<const XtCmd *>::iterator it = cmds.begin(); it != cmds.end(); ++it) {
-			xt = *it;
             if (xt->cmd == XtCmd_Img) {
                 Error() << "XtCmd_Img mechanism via stdout/stdin is no longer supported -- subprocess should be using shm mechanism!";
                 p.kill();
-                return 0;
+                return consumed;
             } else if (xt->cmd == XtCmd_ConsoleMessage) {
 				XtCmdConsoleMsg *xm = (XtCmdConsoleMsg *)xt; 
                 QString msg(xm->msg);
@@ -2672,11 +2649,12 @@ channel #32 & #64  64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8
 
         // grab frames.. does stuff with Sapera API in the slave process
         XtCmdGrabFrames x;
+        const std::string shmKey(samplesShmNativeKey().toStdString());
 
         if (params.fg.isCalinsConfig)
-            x.init(SAMPLES_SHM_NAME, writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "B_a2040_FreeRun_8Tap_Default.ccf", 2048, 2048/4, NumChansCalinsTest, 0/*getDefaultMapping(1)*/);
+            x.init(shmKey, writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "B_a2040_FreeRun_8Tap_Default.ccf", 2048, 2048/4, NumChansCalinsTest, 0/*getDefaultMapping(1)*/);
         else
-            x.init(SAMPLES_SHM_NAME, writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "J_2000+_Electrode_8tap_8bit.ccf", 144, 32, NumChans, 0/*getDefaultMapping(0)*/);
+            x.init(shmKey, writer.totalSize(), writer.pageSize(), writer.metaDataSizeBytes(), "J_2000+_Electrode_8tap_8bit.ccf", 144, 32, NumChans, 0/*getDefaultMapping(0)*/);
         pushCmd(x);
     }
 
@@ -2740,7 +2718,7 @@ channel #32 & #64  64‐bit           8‐bit 8‐bit 8‐bit 8‐bit 8‐bit 8
             probedHardware.clear();
             do {
                 ba += p.readAll();
-                unsigned consumed = task.gotInput(ba, 0, p);
+                unsigned consumed = task.gotInput(ba.constData(), unsigned(ba.size()), 0, p);
                 ba.remove(0,consumed);
                 if (!probedHardware.empty()) timeout = 500;
             } while (p.state() == QProcess::Running && p.waitForReadyRead(timeout));
@@ -10,6 +10,7 @@
 #include <QMutexLocker>
 #include <vector>
 #include <deque>
+#include <string.h>
 #include <QMap>
 #include <QStringList>
 #include <QVector>
@@ -27,6 +28,8 @@
 #include <list>
 #include "ui_FG_Controls.h"
 #include "PagedRingBuffer.h"
+#include "Telemetry.h"
+#include "Bug3Protocol.h"
 
 struct XtCmd;
 
@@ -149,6 +152,8 @@ namespace DAQ
 		bool autoRetryOnAIOverrun; ///< if true, auto-restart the acquisition every time there is a buffer overrun error from the NI DAQ drivers. Note that if we get more than 2 failures in a 1s period, the acquisition is aborted anyway.
         int overrideGraphsPerTab; ///< if nonzero, the number of graphs per tab to display, 0 implies use mode-specific limits
         int graphUpdateRate, spatialVisUpdateRate; ///< if nonzero, update the graphs this many times per second.  if <=0, will use DEF_TASK_READ_FREQ_HZ from SpikeGL.h
+        QString filterBankSpec; ///< if not empty, the FilterBank::Spec string of the filter bank applied to the data before it was saved to disk
+        QString refStageSpec; ///< if not empty, the ReferenceStage::Spec string of the re-referencing applied to the data (after the filter bank) before it was saved to disk
 
 		struct Bug {
 			bool enabled; // if true, acquisition is in bug mode
@@ -262,9 +267,16 @@ namespace DAQ
         void taskWarning(const QString &);
 		
 	protected:
+        /// telemetry bookkeeping for one writer.write() or commitDirectWrite() begun at t0 (a Telemetry::now()), when
+        /// writer.scansWritten() was scansBefore
+        void ringWritten(u64 t0, u64 scansBefore, bool ok);
+
         u64 totalRead;
         mutable QMutex totalReadMut;
         PagedScanWriter writer;
+        Telemetry::Stage acqTel; ///< the reads from the hardware (or subprocess): call latency, scans, bytes
+        Telemetry::Stage ringTel; ///< the writes into the sample ring: call latency, scans, pages, pages overwritten unread
+        unsigned long ringForcedSeen; ///< writer.forcedOverruns() as of the last ringWritten()
 	};
 	
 	
@@ -316,6 +328,12 @@ namespace DAQ
 
         // used on all platforms
         void doFinalDemuxAndEnqueue(std::vector<int16> & data);
+        static void setupIntanDemux(ScanPermutation & demux, const Params & p); ///< builds the (new-style) Intan demux permutation table for p.mode
+        ScanPermutation demux; ///< empty (null) for AIRegular and the pre-July-2011 layout
+        /// dual dev mode: mergeDualDevData() followed by the demux, as a single two-source gather.  See writeFusedDualDevData()
+        static void setupFusedDualDev(ScanPermutation & fused, const ScanPermutation & demux, int NCHANS1, int NCHANS2, int nExtraChans, int nExtraChans2);
+        /// merges, demuxes and writes the scans straight into the ring pages in one pass.  Equivalent to mergeDualDevData() + doFinalDemuxAndEnqueue().
+        void writeFusedDualDevData(const std::vector<int16> & data, const std::vector<int16> & data2, const ScanPermutation & fused);
 
         AOWriteThread *aoWriteThr;
         QVector<QPair<int,int> > aoAITab;
@@ -373,8 +391,9 @@ namespace DAQ
 	protected:
 		void daqThr(); ///< implemented from Task
 		
-         ///< return number of bytes consumed from data.  Data buffer will then have those bytes removed from beginning
-        virtual unsigned gotInput(const QByteArray & allData, unsigned lastReadNBytes, QProcess & p) { (void)allData; (void)lastReadNBytes; (void)p; return 0; }
+         ///< data is the size bytes of unconsumed input, the last lastReadNBytes of which just arrived.  Parse it in place
+         ///< and return the number of bytes consumed from the front; the rest is passed in again, with more data after it, next time
+        virtual unsigned gotInput(const char *data, unsigned size, unsigned lastReadNBytes, QProcess & p) { (void)data; (void)size; (void)lastReadNBytes; (void)p; return 0; }
         ///< used to setup the exedir with the appropriate files in resources.  reimplement to return a list of resource paths to put into the exedir..
         virtual QStringList filesList() const { return QStringList(); }
          ///< called before the exe is about to be run. set up any needed environment parameters
@@ -410,6 +429,30 @@ namespace DAQ
 		QList<QByteArray> cmdQ; QMutex cmdQMut;
 		void processCmds(QProcess & p);
         void readStdErr(QProcess & p);
+
+        /// daqThr()'s input buffer.  The slave's output is read straight into the space after the write cursor and parsed
+        /// in place from the read cursor.  Once everything is consumed both cursors go back to the start, so the leftover
+        /// partial line/command is only moved to the front when there isn't room after it for the next read.
+        class InputBuf {
+        public:
+            explicit InputBuf(unsigned capacity) : buf(capacity), rd(0), wr(0) {}
+            const char *readPtr() const { return &buf[0] + rd; }
+            unsigned readAvail() const { return wr - rd; }
+            void consume(unsigned n) { rd += n; if (rd >= wr) rd = wr = 0; }
+            /// makes at least n bytes of space available after the write cursor, and returns that space
+            char *writePtr(unsigned n) {
+                if (unsigned(buf.size()) - wr < n) {
+                    if (rd) { ::memmove(&buf[0], &buf[0] + rd, wr - rd); wr -= rd; rd = 0; }
+                    if (unsigned(buf.size()) - wr < n) buf.resize(qMax(size_t(wr + n), buf.size()*2));
+                }
+                return &buf[0] + wr;
+            }
+            unsigned writeSpace() const { return unsigned(buf.size()) - wr; }
+            void wrote(unsigned n) { wr += n; }
+        private:
+            std::vector<char> buf;
+            unsigned rd, wr;
+        };
 	};
 	
     class MultiChanAIReader; ///< fwd decl -- see declaration at end of this namespace
@@ -485,7 +528,7 @@ namespace DAQ
         static bool isMissingFCChan(const Params &p, unsigned num);
 		
 	protected:
-		unsigned gotInput(const QByteArray & data, unsigned lastReadNBytes, QProcess & p); ///< return number of bytes consumed from data.  Data buffer will then have those bytes removed from beginning
+		unsigned gotInput(const char *data, unsigned size, unsigned lastReadNBytes, QProcess & p); ///< return number of bytes consumed from the front of data
 		QStringList filesList() const; ///< used to setup the exedir with the appropriate files in resources.  reimplement to return a list of resource paths to put into the exedir..
 		void setupEnv(QProcessEnvironment &) const; ///< called before the exe is about to be run. set up any needed environment parameters
 		void sendExitCommand(QProcess &p) const;
@@ -494,11 +537,13 @@ namespace DAQ
 	private:
         unsigned req_shm_pg_sz;
 
-		int state;
-        static const int nstates = 38;
-		quint64 nblocks, nlines;
+		quint64 nblocks;
 		qint64 debugTTLStart;
-		QMap<QString, QString> block;
+        Bug3::TextParser textParser; ///< for the text protocol, used if the exe doesn't speak the binary one
+        Bug3::Block rawBlock; ///< the block being decoded, reused
+        int protoSeen; ///< 0 = no blocks yet, 1 = text, 2 = binary -- just so we can log which one is in use
+        unsigned lineScanned; ///< how much of the partial line at the front of the buffer was already searched for a newline
+        std::vector<int16> blockSamps; ///< persistent scan buffer for processBlock()
 
         AOWriteThread *aoWriteThread;
         u64 aoSampCount;
@@ -509,8 +554,8 @@ namespace DAQ
         MultiChanAIReader *aireader;
         std::vector<int16> ais; ///< persistent ai buffer
 		
-		void processLine(const QString & lineUntrimmed, QMap<QString, QString> & block, const quint64 & nblocks, int & state, quint64 & nlines);
-		void processBlock(const QMap<QString, QString> &, quint64 blockNum);		
+		void processLine(const char *line, unsigned len);
+		void processBlock(const Bug3::Block &, quint64 blockNum);
         void handleAOPassthru(const std::vector<int16> & samps);
         void handleAI(std::vector<int16> & samps);
         void handleBadDataGraph(std::vector<int16> & samps, const BlockMetaData & meta);
@@ -548,16 +593,27 @@ namespace DAQ
         void pushCmd(const XtCmd * c);
         void pushCmd(const XtCmd & c) { pushCmd(&c); }
 
+        /// If the SPIKEGL_FG_SYNTH environment variable is set, it's the path to FG_Synth (see FrameGrabber/FG_Synth),
+        /// which is then run instead of FG_SpikeGL.exe to produce synthetic frames.  That works on any platform.
+        static QString synthExePath();
+        bool usingSynth() const { return synth; }
+
+        /// The native key of the SAMPLES_SHM_NAME shm the frames are written to.  Outside of Windows Qt uses a native key
+        /// as the path of a key file, so there it is an absolute path (the slave process runs in another directory).
+        static QString samplesShmNativeKey();
+
         QDialog *dialogW;
 
         void updateTimesampLabel(unsigned long long ts);
 
     protected:
 #ifndef Q_OS_WINDOWS
-		bool platformSupported() const { return false; }
+		bool platformSupported() const { return synth; }
 #endif
+        QString interpreter() const { return synth ? QString() : SubprocessTask::interpreter(); }
+        void setupEnv(QProcessEnvironment & e) const;
         int readTimeoutMaxSecs() const { return 9999; }
-		unsigned gotInput(const QByteArray & data, unsigned lastReadNBytes, QProcess & p);
+		unsigned gotInput(const char *data, unsigned size, unsigned lastReadNBytes, QProcess & p);
 		QStringList filesList() const;
         void sendExitCommand(QProcess & p) const;
         bool outputCmdsAreBinary() const { return true; }
@@ -585,7 +641,7 @@ namespace DAQ
 	private:
 
         static double last_hw_probe_ts;
-        bool sentFGCmd, didImgSizeWarn;
+        bool sentFGCmd, didImgSizeWarn, synth;
         Ui::FG_Controls *dialog;
         bool need2EmitFirstScan;
         volatile unsigned long long lastScanTS; QMutex lastScanTSMut;
@@ -11,6 +11,7 @@
 #include <QMessageBox>
 #include <QTextStream>
 #include <QMutexLocker>
+#include <QDir>
 
 class DFWriteThread : public QThread, public SampleBufQ
 {
@@ -26,6 +27,23 @@ protected:
 	bool write(const std::vector<int16> & scans);
 };
 
+/// Finishes a data file closed from the saver thread while its spill still held more than a chunk: appends the rest
+/// of the spill to the data file, removes the spill file and writes the meta file.
+class DFSpillFinisher : public QThread
+{
+public:
+    DFSpillFinisher(const QString & dataFileName, const QString & spillFileName, qint64 spillHead, qint64 spillTail,
+                    const QString & metaFileName, const Params & params)
+        : QThread(0), dataFileName(dataFileName), spillFileName(spillFileName), metaFileName(metaFileName),
+          head(spillHead), tail(spillTail), params(params) {}
+protected:
+    void run(); ///< from QThread
+private:
+    const QString dataFileName, spillFileName, metaFileName;
+    const qint64 head, tail;
+    const Params params;
+};
+
 
 static QString metaFileForFileName(const QString &fname)
 {
@@ -57,16 +75,21 @@ static QString metaFileForFileName(const QString &fname)
  }
  
 DataFile::DataFile()
-    : mut(QMutex::Recursive), mode(Undefined), scanCt(0), nChans(0), sRate(0), writeRateAvg_for_ui(0), writeRateAvg(0.), nWritesAvg(0), nWritesAvgMax(1), dfwt(0)
+    : mut(QMutex::Recursive), mode(Undefined), scanCt(0), nChans(0), sRate(0), writeRateAvg_for_ui(0), writeRateAvg(0.), nWritesAvg(0), nWritesAvgMax(1), dfwt(0),
+      spillHead(0), spillTail(0), spillPeakBytes(0), spilling(false), spillEvents(0), spilledScans(0), tel(0)
 {
 }
 
 DataFile::~DataFile() {
 	if (dfwt) delete dfwt, dfwt = 0;
+    closeSpill();
+    reapSpillFinishers(true);
+    delete tel, tel = 0;
 }
 
 bool DataFile::closeAndFinalize() 
 {
+    drainSpillForClose(); // GUI thread only
     QMutexLocker ml(&mut);
 
     if (!isOpen()) return false;
@@ -79,10 +102,17 @@ bool DataFile::closeAndFinalize()
 	} else if (mode == Output) {
 		if (dfwt) delete dfwt, dfwt = 0;
 		// Output mode...
+        spilling = false;
+        // off the GUI thread drainSpillForClose() didn't run: if more than a chunk is left, leave it to a DFSpillFinisher
+        const bool background = spillPendingScans()*u64(nChans)*sizeof(int16) > u64(DATAFILE_SPILL_CHUNK_BYTES);
+        // whatever was spilled while drainSpillForClose() had the lock released
+        if (!background && spillPendingScans() && !drainSpill())
+            Error() << fileName() << ": " << spillPendingScans() << " spilled scans could not be written to the data file and are lost";
+        if (!background) closeSpill();
 		sha.Final();
         params["sha1"] = /*sha.ReportHash().c_str()*/ "0";
 		params["fileTimeSecs"] = fileTimeSecs();
-		params["fileSizeBytes"] = dataFile.size();
+		params["fileSizeBytes"] = dataFile.size() + (background ? spillTail - spillHead : 0);
 		params["createdBy"] = QString("%1").arg(VERSION_STR);
         if (badData.count()) {
             QString bdString;
@@ -95,6 +125,11 @@ bool DataFile::closeAndFinalize()
             ts.flush();
             params["badData"] = bdString;
         }
+        if (spillEvents) {
+            params["spillEvents"] = spillEvents;
+            params["spilledScans"] = spilledScans;
+            params["spillPeakBytes"] = spillPeakBytes;
+        }
         Debug() << fileName() << " closing after saving " << scanCount() << " scans @ "  << (writeSpeedBytesSec()/1024.0/1024.0) << " MB/s avg";
 		dataFile.close();
 		QString mf = metaFile.fileName();
@@ -102,6 +137,19 @@ bool DataFile::closeAndFinalize()
         writeRateAvg_for_ui = writeRateAvg = 0.;
 		nWritesAvg = nWritesAvgMax = 0;
 		mode = Undefined;
+        delete tel, tel = 0;
+        if (background) {
+            reapSpillFinishers();
+            Log() << dataFile.fileName() << ": writing the last " << spillPendingScans() << " spilled scans and the meta file in the background";
+            DFSpillFinisher *f = new DFSpillFinisher(dataFile.fileName(), spillFile.fileName(), spillHead, spillTail, mf, params);
+            // the finisher reads the spill file from here on: let go of it without removing it
+            spillFile.close();
+            spillHead = spillTail = 0;
+            spillBuf.clear();
+            spillFinishers.push_back(f);
+            f->start();
+            return true;
+        }
 		return params.toFile(mf,true /* append since we may have written comments to metafile!*/);
 	} 
 	return false; // not normally reached...
@@ -128,6 +176,7 @@ bool DataFile::writeScans(const int16 *scans, unsigned nScans)
     }
 
     scanCt += nScans;
+    if (spilling || spillTail > spillHead) return spillWrite(scans, nScans); // behind what's already spilled
     // synchronous write..
     return doFileWrite(scans, nScans);
 }
@@ -177,6 +226,7 @@ bool DataFile::writeScans(const std::vector<int16> & scans, bool asynch, unsigne
 		dfwt = 0;
 	}
 	// else .. synch..
+    if (spilling || spillTail > spillHead) return spillWrite(&scans[0], unsigned(scans.size()/nChans));
 	return doFileWrite(scans);
 }
 
@@ -196,9 +246,18 @@ bool DataFile::doFileWrite(const int16 *scans, unsigned nScans)
     const int n2Write = nScans*numChans()*sizeof(int16);
 	
 	double tWrite = getTime();
+	const u64 tw0 = Telemetry::now();
 	
     int nWrit = dataFile.write((const char *)scans, n2Write);
 
+	if (tel) {
+		Telemetry::Update u(*tel);
+		u.work(Telemetry::now() - tw0);
+		if (nWrit > 0) u.add(Telemetry::Bytes, u64(nWrit));
+		if (nWrit != n2Write) u.add(Telemetry::Errors);
+		else u.add(Telemetry::Scans, nScans);
+	}
+
 	if (nWrit != n2Write) {
 		Error() << "DataFile::doFileWrite: Error returned from write call: " << nWrit;
 		return false;
@@ -268,6 +327,8 @@ bool DataFile::openForReWrite(const DataFile & other, const QString & filename,
     writeRateAvg = 0.;
     nWritesAvg = 0;
     nWritesAvgMax = /*unsigned(sRate/10.)*/10;
+    delete tel; // a stage of its own per output file, so read-only DataFiles don't show up in the stats
+    tel = new Telemetry::Stage("datafile " + QFileInfo(outputFile).fileName());
     if (!nWritesAvgMax) nWritesAvgMax = 1;
 	// compute save channel subset fudge
 	const QVector<unsigned> ocid = other.channelIDs();
@@ -297,17 +358,166 @@ bool DataFile::openForReWrite(const DataFile & other, const QString & filename,
 	return true;
 }
 
-/// threadsafe
-bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_override) 
+bool DataFile::beginSpill()
 {
     QMutexLocker ml(&mut);
+    if (!isOpen() || mode != Output) return false;
+    if (spilling) return true;
+    if (!spillFile.isOpen()) {
+        spillFile.setFileName(QDir::tempPath() + "/" + QFileInfo(dataFile.fileName()).fileName() + ".spill");
+        if (!spillFile.open(QIODevice::ReadWrite|QIODevice::Truncate|QIODevice::Unbuffered)) {
+            Error() << "DataFile: could not open spill file " << spillFile.fileName() << ": " << spillFile.errorString();
+            return false;
+        }
+        spillHead = spillTail = 0;
+    }
+    spilling = true;
+    ++spillEvents;
+    Debug() << fileName() << " spilling to " << spillFile.fileName() << " (spill event #" << spillEvents << ", " << spillPendingScans() << " scans already pending)";
+    return true;
+}
+
+bool DataFile::spillWrite(const int16 *scans, unsigned nScans)
+{
+    const qint64 n2Write = qint64(nScans)*nChans*sizeof(int16);
+    if (spillTail - spillHead + n2Write > qint64(DATAFILE_SPILL_MAX_BYTES)) {
+        // spill is full -- nothing for it but to wait on the data file
+        Warning() << "DataFile: spill file " << spillFile.fileName() << " is full (" << (spillTail - spillHead)/(1024*1024) << " MB), draining it into the data file now.";
+        spilling = false;
+        if (!drainSpill()) return false;
+        return doFileWrite(scans, nScans);
+    }
+    if (!spillFile.seek(spillTail) || spillFile.write((const char *)scans, n2Write) != n2Write) {
+        Error() << "DataFile: write to spill file " << spillFile.fileName() << " failed: " << spillFile.errorString();
+        spilling = false;
+        if (!drainSpill()) return false;
+        return doFileWrite(scans, nScans);
+    }
+    spillTail += n2Write;
+    spilledScans += nScans;
+    if (spillTail - spillHead > spillPeakBytes) spillPeakBytes = spillTail - spillHead;
+    return true;
+}
 
+bool DataFile::drainSpill(u64 maxScans)
+{
+    QMutexLocker ml(&mut);
+    const qint64 scanBytes = qint64(nChans)*sizeof(int16);
+    if (!scanBytes || spillTail <= spillHead) return true;
+    qint64 left = spillTail - spillHead;
+    if (maxScans && qint64(maxScans)*scanBytes < left) left = qint64(maxScans)*scanBytes;
+    const qint64 chunkMax = qMax(scanBytes, qint64(DATAFILE_SPILL_CHUNK_BYTES) / scanBytes * scanBytes);
+    while (left > 0) {
+        const qint64 chunk = qMin(left, chunkMax);
+        spillBuf.resize(size_t(chunk/sizeof(int16)));
+        if (!spillFile.seek(spillHead) || spillFile.read((char *)&spillBuf[0], chunk) != chunk) {
+            Error() << "DataFile: read from spill file " << spillFile.fileName() << " failed: " << spillFile.errorString();
+            return false;
+        }
+        if (!doFileWrite(&spillBuf[0], unsigned(chunk/scanBytes))) return false;
+        spillHead += chunk;
+        left -= chunk;
+    }
+    if (spillHead == spillTail) {
+        // empty: start over at the front of the file so it doesn't just keep growing
+        spillFile.resize(0);
+        spillHead = spillTail = 0;
+        if (!spilling) Debug() << fileName() << " caught up with its spill file";
+    }
+    return true;
+}
+
+/// Moves what's in the spill into the data file ahead of closing it, a chunk at a time, with mut released in
+/// between chunks: whatever else wants the file (the saver, the status bar) only ever waits for one chunk.  Puts up a
+/// "please be patient" box and keeps the windows painting meanwhile, as ~DFWriteThread() does.  Does nothing off the
+/// GUI thread: there closeAndFinalize() leaves the spill to a DFSpillFinisher rather than stall the saver.
+void DataFile::drainSpillForClose()
+{
+    if (!qApp || QThread::currentThread() != qApp->thread()) return;
+    u64 n;
+    {
+        QMutexLocker ml(&mut);
+        if (!isOpen() || mode != Output) return;
+        spilling = false;
+        n = spillPendingScans();
+    }
+    if (!n) return;
+    Debug() << fileName() << " draining " << n << " spilled scans before closing";
+    const u64 step = qMax(u64(1), u64(DATAFILE_SPILL_CHUNK_BYTES) / (u64(nChans)*sizeof(int16)));
+    QMessageBox *mb = 0;
+    for (u64 done = 0; done < n; done += step) {
+        if (!drainSpill(qMin(step, n - done))) break;
+        if (done + step < n) {
+            if (!mb) {
+                mb = new QMessageBox(0);
+                mb->setWindowModality(Qt::ApplicationModal);
+                mb->setStandardButtons(QMessageBox::NoButton);
+                mb->setText(QString("Writing %1 MB of spilled data to %2, please be patient... ").arg(double(n)*nChans*sizeof(int16)/(1024.*1024.), 0, 'f', 1).arg(fileName()));
+                mb->show();
+            }
+            qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
+        }
+    }
+    delete mb;
+}
+
+/// Deletes the DFSpillFinishers that are done, or waits for all of them if wait is true
+void DataFile::reapSpillFinishers(bool wait)
+{
+    for (QList<DFSpillFinisher *>::iterator it = spillFinishers.begin(); it != spillFinishers.end(); ) {
+        if (wait) (*it)->wait();
+        if ((*it)->isFinished()) delete *it, it = spillFinishers.erase(it);
+        else ++it;
+    }
+}
+
+void DFSpillFinisher::run()
+{
+    QFile out(dataFileName), in(spillFileName);
+    qint64 pos = head;
+    if (!out.open(QIODevice::WriteOnly|QIODevice::Append) || !in.open(QIODevice::ReadOnly) || !in.seek(head)) {
+        Error() << "DataFile: could not finish writing " << dataFileName << " from its spill file " << spillFileName << ": " << out.errorString() << " / " << in.errorString();
+    } else {
+        std::vector<char> buf(size_t(qMin(tail - head, qint64(DATAFILE_SPILL_CHUNK_BYTES))));
+        while (pos < tail) {
+            const qint64 chunk = qMin(tail - pos, qint64(buf.size()));
+            if (in.read(&buf[0], chunk) != chunk || out.write(&buf[0], chunk) != chunk) {
+                Error() << "DataFile: writing the spill into " << dataFileName << " failed, " << (tail - pos) << " bytes lost: " << out.errorString() << " / " << in.errorString();
+                break;
+            }
+            pos += chunk;
+        }
+    }
+    out.close();
+    in.close();
+    in.remove();
+    if (!params.toFile(metaFileName, true))
+        Error() << "DataFile: could not write meta file " << metaFileName;
+    Debug() << dataFileName << " finished in the background, " << (pos - head) << " bytes from the spill";
+}
+
+void DataFile::closeSpill()
+{
+    if (spillFile.isOpen()) {
+        spillFile.close();
+        spillFile.remove();
+    }
+    spillHead = spillTail = 0;
+    spilling = false;
+    spillBuf.clear();
+}
+
+/// threadsafe
+bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_override) 
+{
 	const int nOnChans = dp.demuxedBitMap.count(true);
     if (!dp.aiChannels.size() || !nOnChans) {
         Error() << "DataFile::openForWrite Error cannot open a datafile with scansize of 0!";
         return false;
     }
-    if (isOpen()) closeAndFinalize();
+    if (isOpen()) closeAndFinalize(); // before we lock: it drains any spill with the lock released in between chunks
+
+    QMutexLocker ml(&mut);
 
     QString outputFile = filename_override.length() ? filename_override : dp.outputFile;
 
@@ -328,12 +538,19 @@ bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_ove
     sha.Reset();
     params = Params();
     badData.clear();
+    // closeAndFinalize() drained the spill into the last file.  anything still in it now didn't belong to a file
+    if (spillPendingScans())
+        Error() << "DataFile: discarding " << spillPendingScans() << " spilled scans left over from a previous file";
+    closeSpill();
+    spillEvents = 0; spilledScans = 0; spillPeakBytes = 0;
     scanCt = 0;
     nChans = nOnChans;
     sRate = dp.srate;
     writeRateAvg = 0.;
     nWritesAvg = 0;
     nWritesAvgMax = /*unsigned(sRate/10.)*/10;
+    delete tel; // a stage of its own per output file, so read-only DataFiles don't show up in the stats
+    tel = new Telemetry::Stage("datafile " + QFileInfo(outputFile).fileName());
     if (!nWritesAvgMax) nWritesAvgMax = 1;
     params["outputFile"] = outputFile;
 	params["createdOn"] = QDateTime::currentDateTime().toString("yyyy-MM-dd HH:mm:ss.zzz");
@@ -394,6 +611,10 @@ bool DataFile::openForWrite(const DAQ::Params & dp, const QString & filename_ove
         params["bug_dataRate"] = dp.bug.rate;
     }
     params["acqStartEndMode"] = DAQ::AcqStartEndModeToString(dp.acqStartEndMode);
+    if (dp.filterBankSpec.length())
+        params["filterBank"] = dp.filterBankSpec;
+    if (dp.refStageSpec.length())
+        params["referenceStage"] = dp.refStageSpec;
     if (dp.demuxedBitMap.count(false)) {
         params["saveChannelSubset"] = dp.subsetString;
     } else 
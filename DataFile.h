@@ -11,10 +11,12 @@
 #include "Params.h"
 
 #include "sha1.h"
+#include "Telemetry.h"
 #include "DAQ.h"
 #include "ChanMap.h"
 
 class DFWriteThread;
+class DFSpillFinisher;
 
 class DataFile
 {
@@ -78,6 +80,22 @@ public:
     /// are in `scans'.
     bool writeScans(const int16 *scans, unsigned scanCt);
 
+    /** Emergency spillover for when the data file can't keep up.  While spilling, scans passed to writeScans() are
+        appended to a spill file in the temp directory instead of the data file, and stay queued there until
+        drainSpill() moves them, in order, into the data file.  Writes keep going to the spill for as long as it holds
+        anything, so the data file never gets scans out of order or any gaps.  scanCount() counts spilled scans too.
+        On the GUI thread, closeAndFinalize() drains whatever is left (a chunk at a time, without holding the file
+        locked throughout).  On any other thread, ie the saver, more than a chunk of it is handed to a background
+        thread that appends it to the data file and then writes the meta file, so the caller can move on to the next
+        file right away.  Either way the spill events are recorded in the meta file. */
+    bool beginSpill();
+    /// stop spilling new scans -- they still queue behind what's in the spill until drainSpill() has emptied it
+    void endSpill() { QMutexLocker ml(&mut); spilling = false; }
+    bool isSpilling() const { return spilling; }
+    u64 spillPendingScans() const { return nChans ? u64(spillTail - spillHead) / (u64(nChans)*sizeof(int16)) : 0; }
+    /// writes up to maxScans of the oldest spilled scans to the data file, or all of them if maxScans is 0
+    bool drainSpill(u64 maxScans = 0);
+
 	/// Returns true iff we did an asynch write and we have writes that still haven't finished.  False otherwise.
 	bool hasPendingWrites() const;
 	
@@ -135,6 +153,10 @@ public:
 protected:
 	bool doFileWrite(const std::vector<int16> & scans);
     bool doFileWrite(const int16 *scans, unsigned nScans);
+    bool spillWrite(const int16 *scans, unsigned nScans);
+    void drainSpillForClose();
+    void closeSpill();
+    void reapSpillFinishers(bool wait = false);
 
     mutable QMutex mut;
 
@@ -165,5 +187,13 @@ private:
     double writeRateAvg; ///< in bytes/sec
     unsigned nWritesAvg, nWritesAvgMax; ///< the number of writes in the average, tops off at sRate/10
 	DFWriteThread *dfwt;
+    QFile spillFile; ///< FIFO of scans waiting for the data file: read at spillHead, appended at spillTail
+    qint64 spillHead, spillTail, spillPeakBytes;
+    volatile bool spilling;
+    unsigned spillEvents;
+    u64 spilledScans;
+    std::vector<int16> spillBuf;
+    QList<DFSpillFinisher *> spillFinishers; ///< closed files whose spill is still being appended in the background
+    Telemetry::Stage *tel; ///< write call latency, bytes and errors of the file currently open for output.  NULL while none is
 };
 #endif
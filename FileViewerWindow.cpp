@@ -40,6 +40,7 @@
 #include <QCheckBox>
 #include <QPushButton>
 #include "HPFilter.h"
+#include "FilterBank.h"
 #include "ClickableLabel.h"
 #include <QKeyEvent>
 #include "ui_FVW_OptionsDialog.h"
@@ -69,7 +70,7 @@ private:
 };
 
 FileViewerWindow::FileViewerWindow()
-: QMainWindow(0), pscale(1), mouseOverT(-1.), mouseOverV(0), mouseOverGNum(-1), mouseButtonIsDown(false), dontKillSelection(false), hpfilter(0), arrowKeyFactor(.1), pgKeyFactor(.5), n_graphs_pg(8), curr_graph_page(0), showReadme(true)
+: QMainWindow(0), pscale(1), mouseOverT(-1.), mouseOverV(0), mouseOverGNum(-1), mouseButtonIsDown(false), dontKillSelection(false), hpfilter(0), fbank(0), fbankAct(0), arrowKeyFactor(.1), pgKeyFactor(.5), n_graphs_pg(8), curr_graph_page(0), showReadme(true)
 {	
     readmeDlg = 0; readme=0;
 
@@ -234,6 +235,10 @@ FileViewerWindow::FileViewerWindow()
 		QAction *a = viewModeActions[i] = m->addAction(viewModeNames[i], this, SLOT(viewModeMenuSlot()));
 		a->setCheckable(true);
 	}
+	m->addSeparator();
+	fbankAct = m->addAction("Apply Filter Bank", this, SLOT(fbankMenuSlot()));
+	fbankAct->setCheckable(true);
+	fbankAct->setToolTip("Apply the filter bank set in the console window's Options->Filter Bank... menu to the electrode channels (display and export)");
     channelsMenu = mb->addMenu("&Channels");
 	channelsMenu->addAction("Show All", this, SLOT(showAllGraphs()));
     channelsMenu->addSeparator();
@@ -272,6 +277,7 @@ FileViewerWindow::~FileViewerWindow()
 {	
 	/// scrollArea and graphParent automatically deleted here because they are children of us.
 	delete hpfilter;
+	delete fbank;
     // these aren't children, so delete them
     delete readmeDlg, readmeDlg = 0;
     delete readme, readme = 0;
@@ -311,6 +317,9 @@ bool FileViewerWindow::viewFile(const QString & fname, QString *errMsg /* = 0 */
 
 	if (hpfilter) delete hpfilter;
 	hpfilter = new HPFilter(dataFile.numChans(), 300);
+	if (fbank) delete fbank, fbank = 0;
+	if (fbankAct->isChecked())
+		fbank = new FilterBank(dataFile.numChans(), dataFile.samplingRateHz(), FilterBank::Spec::fromString(mainApp()->filterBankSpec()));
     const int nChans = dataFile.numChans();
     graphHideUnhideActions.clear(); graphHideUnhideActions.resize(nChans);
     graphParams.clear(); graphParams.resize(nChans);
@@ -421,6 +430,7 @@ void FileViewerWindow::loadSettings()
 	if (fabs(arrowKeyFactor) < 0.0001) arrowKeyFactor = .1;
 	pgKeyFactor = settings.value("pgKeyFactor", .5).toDouble();
 	if (fabs(pgKeyFactor) < 0.0001) pgKeyFactor = .5;
+	fbankAct->setChecked(settings.value("applyFilterBank", false).toBool());
 	colorScheme = (ColorScheme)cs;
 	xScaleSB->blockSignals(true);
 	yScaleSB->blockSignals(true);
@@ -459,6 +469,7 @@ void FileViewerWindow::saveSettings()
 	settings.setValue("sortGraphsByElectrode", electrodeSort);
     settings.setValue("graphsPerPage", graphsPerPage());
     settings.setValue("neverShowReadme", !showReadme);
+    settings.setValue("applyFilterBank", fbankAct->isChecked());
 }
 
 void FileViewerWindow::layoutGraphs()
@@ -590,7 +601,8 @@ void FileViewerWindow::updateData()
     int nChansOn = channelSubset.count(true);
     const int nGraphs = graphs.size();
 	QVector<int> chanIdsOn(nChansOn);
-	std::vector<bool> chansToFilter(nChansOn, false), chansToDCSubtract(nChansOn, false);
+	std::vector<unsigned char> chansToFilter(nChansOn, 0), chansToFbank(nChansOn, 0);
+	std::vector<bool> chansToDCSubtract(nChansOn, false);
 	int maxW = 1;
 	bool hasDCSubtract = false;
 	for (int i = 0, j = 0; i < nChans; ++i) {
@@ -600,7 +612,9 @@ void FileViewerWindow::updateData()
                 // channel is on, and on-screen.  Read it.
                 if (maxW < graphs[gnum]->width()) maxW = graphs[gnum]->width();
                 if (graphParams[i].filter300Hz)
-                    chansToFilter[j] = true;
+                    chansToFilter[j] = 1;
+                if (!isAuxChan(i))
+                    chansToFbank[j] = 1;
                 if (graphParams[i].dcFilter)
                     chansToDCSubtract[j] = true, hasDCSubtract = true;
                 chanIdsOn[j++] = i;
@@ -613,6 +627,7 @@ void FileViewerWindow::updateData()
 	}
     chanIdsOn.resize(nChansOn);
     chansToFilter.resize(nChansOn);
+    chansToFbank.resize(nChansOn);
     chansToDCSubtract.resize(nChansOn);
     HPFilter & filter(*hpfilter);
     if ((int)filter.scanSize() != nChansOn) filter.setScanSize(nChansOn);
@@ -653,8 +668,15 @@ void FileViewerWindow::updateData()
         const float avgfactor = 1.0f/float(nread);
         QVector<QVector<Vec2f> > & vecs (scratchVecs);
         if (vecs.size() < nChansOn) vecs.resize(nChansOn);
+        if (nread > 0 && nChansOn > 0) {
+            filter.apply(&data[0], unsigned(nread), dt, &chansToFilter[0]);
+            if (fbank) {
+                if ((int)fbank->scanSize() != nChansOn) fbank->setScanSize(nChansOn);
+                fbank->setSamplingRate(srate / double(downsample));
+                fbank->apply(&data[0], unsigned(nread), &chansToFbank[0]);
+            }
+        }
 		for (int i = 0; i < nread; ++i) {
-			filter.apply(&data[i * nChansOn], dt, chansToFilter);
 			for (int j = 0; j < nChansOn; ++j) {                
                 const int chanId = chanIdsOn[j];
                 const int g = i2g(chanId);
@@ -1187,6 +1209,27 @@ void FileViewerWindow::viewModeMenuSlot()
 	}
 }
 
+void FileViewerWindow::fbankMenuSlot()
+{
+	if (fbank) delete fbank, fbank = 0;
+	if (fbankAct->isChecked()) {
+		const FilterBank::Spec spec = FilterBank::Spec::fromString(mainApp()->filterBankSpec());
+		if (spec.isNull()) 
+			Warning() << "Filter bank is empty -- set it from the console window's Options->Filter Bank... menu.";
+		fbank = new FilterBank(dataFile.numChans(), dataFile.samplingRateHz(), spec);
+	}
+	saveSettings();
+	QTimer::singleShot(10, this, SLOT(updateData()));
+}
+
+bool FileViewerWindow::isAuxChan(int idx) const
+{
+	if (dataFile.daqMode() == DAQ::AIRegular || idx < 0 || idx >= (int)dataFile.channelIDs().size()) return false;
+	const int m = dataFile.daqMode();
+	const int first_non_mux_id = dataFile.isDualDevMode() && !dataFile.secondDevIsAuxOnly() ? (DAQ::ModeNumIntans[m]*2 * DAQ::ModeNumChansPerIntan[m]) : (DAQ::ModeNumIntans[m] * DAQ::ModeNumChansPerIntan[m]);
+	return int(dataFile.channelIDs()[idx]) >= first_non_mux_id;
+}
+
 void FileViewerWindow::resizeEvent(QResizeEvent *r)
 {
 	QMainWindow::resizeEvent(r);
@@ -1313,6 +1356,14 @@ void FileViewerWindow::doExport(const ExportParams & p)
 	progress.setWindowModality(Qt::WindowModal);
 	progress.setMinimumDuration(0);
 	
+	// optionally run the filter bank over the exported electrode chans
+	const FilterBank::Spec fbSpec = FilterBank::Spec::fromString(mainApp()->filterBankSpec());
+	const bool doFb = fbankAct->isChecked() && !fbSpec.isNull();
+	FilterBank exportFb(doFb ? p.chanSubset.count(true) : 0, dataFile.samplingRateHz(), fbSpec);
+	std::vector<unsigned char> exportFbChans;
+	if (doFb) 
+		for (int i = 0; i < (int)p.chanSubset.size(); ++i) 
+			if (p.chanSubset.testBit(i)) exportFbChans.push_back(isAuxChan(i) ? 0 : 1);
 
 	if (p.format == ExportParams::Bin) {
 	
@@ -1326,6 +1377,7 @@ void FileViewerWindow::doExport(const ExportParams & p)
 		
 		// override the auxGain parameter from the input file with out custom gain setting
 		out.setParam("auxGain", defaultGain);
+		if (doFb) out.setParam("filterBank", fbSpec.toString());
 		
 		int prevVal = -1;
 		std::vector<int16> scan;
@@ -1334,6 +1386,7 @@ void FileViewerWindow::doExport(const ExportParams & p)
 		for (qint64 i = 0; i < nscans; ++i) {
 			
 			dataFile.readScans(scan, p.from+i, 1, p.chanSubset);
+			if (doFb && scan.size()) exportFb.apply(&scan[0], 1, &exportFbChans[0]);
 			out.writeScans(scan);
 			int val = int((i*100LL)/nscans);
 			if (val > prevVal) progress.setValue(prevVal = val);		
@@ -1369,6 +1422,7 @@ void FileViewerWindow::doExport(const ExportParams & p)
 		for (qint64 i = 0; i < nscans; ++i) {
 			
 			dataFile.readScans(scan, p.from+i, 1, p.chanSubset);
+			if (doFb && scan.size()) exportFb.apply(&scan[0], 1, &exportFbChans[0]);
             if (p.csvSubFormat == ExportParams::Real) {
                 const double smin = double(SHRT_MIN), usmax = double(USHRT_MAX);
                 for (int j = 0; j < scansz; ++j) {
@@ -31,6 +31,7 @@ struct ExportParams;
 class QFrame;
 class QCheckBox;
 class HPFilter;
+class FilterBank;
 class QEvent;
 class TaggableLabel;
 class QComboBox;
@@ -75,6 +76,7 @@ private slots:
 	void hideUnhideGraphSlot();
 	void hideCloseTimeout();
 	void viewModeMenuSlot();
+	void fbankMenuSlot();
 	void resizeIt();
 	void updateData();
 	void mouseClickSlot(double,double);
@@ -121,6 +123,7 @@ private:
     void updateSelection(bool do_opengl_update);
 
 	QString generateGraphNameString(unsigned graphNum, bool verbose = true) const;
+	bool isAuxChan(int idx) const; ///< true if channel index idx (not graph number!) is an AUX or PD chan, as opposed to an electrode
 	
 	enum ViewMode { Tiled = 0, Stacked, StackedLarge, StackedHuge, N_ViewMode } viewMode;
 	static const QString viewModeNames[];
@@ -198,6 +201,8 @@ private:
 	
 	
 	HPFilter *hpfilter;
+	FilterBank *fbank; ///< non-NULL iff the 'Apply Filter Bank' menu option is checked
+	QAction *fbankAct;
 	double arrowKeyFactor, pgKeyFactor;
 
     QComboBox *pageCB;
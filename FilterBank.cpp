@@ -0,0 +1,230 @@
+#include "FilterBank.h"
+#include <math.h>
+#include <string.h>
+#include <QStringList>
+#ifndef M_PI
+# define M_PI           3.14159265358979323846
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define FILTERBANK_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+namespace {
+    enum SectionType { LowPass = 0, HighPass, Notch };
+    /// Q's of the two 2nd order sections making up a 4th order Butterworth
+    const double Butterworth4Q[2] = { 0.54119610, 1.30656296 };
+}
+
+QString FilterBank::Spec::toString() const
+{
+    QStringList l;
+    if (bpLoHz > 0. || bpHiHz > 0.)
+        l.push_back(QString("bp=%1-%2").arg(bpLoHz > 0. ? bpLoHz : 0.).arg(bpHiHz > 0. ? bpHiHz : 0.));
+    if (notchHz > 0.) {
+        l.push_back(QString("notch=%1x%2").arg(notchHz).arg(notchHarmonics ? notchHarmonics : 1));
+        l.push_back(QString("q=%1").arg(notchQ));
+    }
+    if (car) l.push_back("car");
+    return l.join(";");
+}
+
+/* static */ FilterBank::Spec FilterBank::Spec::fromString(const QString & str, bool *ok_out)
+{
+    Spec s;
+    bool allok = true;
+    QStringList toks = str.split(";", QString::SkipEmptyParts);
+    for (QStringList::iterator it = toks.begin(); it != toks.end(); ++it) {
+        const QString t = (*it).trimmed().toLower();
+        const QString key = t.section('=', 0, 0).trimmed(), val = t.section('=', 1).trimmed();
+        bool ok = true, ok2 = true;
+        if (key == "car") {
+            s.car = true;
+        } else if (key == "bp") {
+            s.bpLoHz = val.section('-', 0, 0).toDouble(&ok);
+            s.bpHiHz = val.section('-', 1, 1).toDouble(&ok2);
+        } else if (key == "hp") {
+            s.bpLoHz = val.toDouble(&ok);
+        } else if (key == "lp") {
+            s.bpHiHz = val.toDouble(&ok);
+        } else if (key == "notch") {
+            s.notchHz = val.section('x', 0, 0).toDouble(&ok);
+            if (val.contains('x')) s.notchHarmonics = val.section('x', 1, 1).toUInt(&ok2);
+        } else if (key == "q") {
+            s.notchQ = val.toDouble(&ok);
+        } else if (t.length())
+            ok = false;
+        if (!ok || !ok2) allok = false;
+    }
+    if (s.notchQ <= 0.) s.notchQ = 30., allok = false;
+    if (!s.notchHarmonics) s.notchHarmonics = 1;
+    if (ok_out) *ok_out = allok;
+    return s;
+}
+
+FilterBank::FilterBank(unsigned ss, double sr, const Spec & s)
+    : sp(s), srate(sr), nChans(0), nPadded(0)
+{
+    setScanSize(ss);
+}
+
+void FilterBank::setSpec(const Spec & s)
+{
+    sp = s;
+    design();
+}
+
+void FilterBank::setSamplingRate(double sr)
+{
+    if (sr == srate) return;
+    srate = sr;
+    design();
+}
+
+void FilterBank::setScanSize(unsigned ss)
+{
+    nChans = ss;
+    nPadded = (ss + 3U) & ~3U;
+    work.clear();
+    work.resize(nPadded, 0.f);
+    carWeights.clear();
+    carWeights.resize(nPadded, 0.f);
+    design();
+}
+
+void FilterBank::reset()
+{
+    if (z.size()) memset(&z[0], 0, z.size()*sizeof(float));
+}
+
+void FilterBank::addSection(int type, double f0, double Q)
+{
+    if (srate <= 0. || f0 <= 0. || f0 >= srate/2.) return; // can't realize this section at this sampling rate
+    const double w0 = 2.0 * M_PI * f0 / srate, cw = cos(w0), alpha = sin(w0) / (2.0*Q);
+    double b0, b1, b2;
+    const double a0 = 1.0 + alpha, a1 = -2.0*cw, a2 = 1.0 - alpha;
+    switch (type) {
+    case LowPass:  b0 = (1.0-cw)/2.0; b1 = 1.0-cw;     b2 = b0; break;
+    case HighPass: b0 = (1.0+cw)/2.0; b1 = -(1.0+cw);  b2 = b0; break;
+    default:       b0 = 1.0;          b1 = -2.0*cw;    b2 = 1.0; break; // Notch
+    }
+    Biquad bq;
+    bq.b0 = float(b0/a0); bq.b1 = float(b1/a0); bq.b2 = float(b2/a0);
+    bq.a1 = float(a1/a0); bq.a2 = float(a2/a0);
+    sections.push_back(bq);
+}
+
+void FilterBank::design()
+{
+    sections.clear();
+    if (sp.bpLoHz > 0.)
+        for (int i = 0; i < 2; ++i) addSection(HighPass, sp.bpLoHz, Butterworth4Q[i]);
+    if (sp.bpHiHz > 0.)
+        for (int i = 0; i < 2; ++i) addSection(LowPass, sp.bpHiHz, Butterworth4Q[i]);
+    if (sp.notchHz > 0.)
+        for (unsigned h = 1; h <= sp.notchHarmonics; ++h) addSection(Notch, sp.notchHz*h, sp.notchQ);
+    z.clear();
+    z.resize(sections.size()*2*nPadded, 0.f);
+}
+
+void FilterBank::apply(short *scans, unsigned nScans, const unsigned char *chans)
+{
+    if (!nChans || !nScans || (sections.empty() && !sp.car)) return;
+
+    const int nc = int(nChans), np = int(nPadded), nsec = int(sections.size());
+    float * const w = &work[0];
+    float * const cw = &carWeights[0];
+    float nCar = 0.f;
+    for (int c = 0; c < nc; ++c) nCar += (cw[c] = (!chans || chans[c]) ? 1.f : 0.f);
+    const float carScale = nCar > 0.f ? 1.f/nCar : 0.f;
+    const bool doCar = sp.car && nCar > 0.f;
+#ifdef FILTERBANK_USE_SSE2
+    const __m128 vMin = _mm_set1_ps(-32768.f), vMax = _mm_set1_ps(32767.f), vHalf = _mm_set1_ps(.5f), vSign = _mm_set1_ps(-0.f);
+#endif
+
+    for (unsigned s = 0; s < nScans; ++s) {
+        short * const scan = scans + size_t(s)*size_t(nc);
+        int c = 0;
+
+        // widen to float.  The padding at the end of work[] stays 0.
+#ifdef FILTERBANK_USE_SSE2
+        for ( ; c+4 <= nc; c += 4) {
+            const __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(scan+c));
+            _mm_storeu_ps(w+c, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)));
+        }
+#endif
+        for ( ; c < nc; ++c) w[c] = float(scan[c]);
+
+        // biquad cascade, DF-II transposed, across all channels at once
+        for (int k = 0; k < nsec; ++k) {
+            const Biquad & bq(sections[k]);
+            float * const z1 = &z[(k*2)*np], * const z2 = &z[(k*2+1)*np];
+            c = 0;
+#ifdef FILTERBANK_USE_SSE2
+            const __m128 b0 = _mm_set1_ps(bq.b0), b1 = _mm_set1_ps(bq.b1), b2 = _mm_set1_ps(bq.b2),
+                         a1 = _mm_set1_ps(bq.a1), a2 = _mm_set1_ps(bq.a2);
+            for ( ; c < np; c += 4) {
+                const __m128 x = _mm_loadu_ps(w+c);
+                const __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), _mm_loadu_ps(z1+c));
+                _mm_storeu_ps(z1+c, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), _mm_loadu_ps(z2+c)));
+                _mm_storeu_ps(z2+c, _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y)));
+                _mm_storeu_ps(w+c, y);
+            }
+#endif
+            for ( ; c < np; ++c) {
+                const float x = w[c], y = bq.b0*x + z1[c];
+                z1[c] = bq.b1*x - bq.a1*y + z2[c];
+                z2[c] = bq.b2*x - bq.a2*y;
+                w[c] = y;
+            }
+        }
+
+        if (doCar) {
+            float sum = 0.f;
+            c = 0;
+#ifdef FILTERBANK_USE_SSE2
+            __m128 vsum = _mm_setzero_ps();
+            for ( ; c < np; c += 4)
+                vsum = _mm_add_ps(vsum, _mm_mul_ps(_mm_loadu_ps(w+c), _mm_loadu_ps(cw+c)));
+            float tmp[4];
+            _mm_storeu_ps(tmp, vsum);
+            sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#endif
+            for ( ; c < np; ++c) sum += w[c]*cw[c];
+            const float avg = sum * carScale;
+            c = 0;
+#ifdef FILTERBANK_USE_SSE2
+            const __m128 vavg = _mm_set1_ps(avg);
+            for ( ; c < np; c += 4)
+                _mm_storeu_ps(w+c, _mm_sub_ps(_mm_loadu_ps(w+c), _mm_mul_ps(vavg, _mm_loadu_ps(cw+c))));
+#endif
+            for ( ; c < np; ++c) w[c] -= avg*cw[c];
+        }
+
+        // narrow back to int16 with saturation, leaving un-selected chans alone.  Both paths round half away from
+        // zero, so a channel comes out the same whichever path it lands in
+        c = 0;
+#ifdef FILTERBANK_USE_SSE2
+        for ( ; c+4 <= nc; c += 4) {
+            const __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(w+c), vMin), vMax);
+            const __m128i v = _mm_cvttps_epi32(_mm_add_ps(f, _mm_or_ps(_mm_and_ps(f, vSign), vHalf)));
+            __m128i res = _mm_packs_epi32(v, v);
+            if (chans) {
+                // keep = 0xffff for the chans we are *not* supposed to touch
+                const __m128i keep32 = _mm_castps_si128(_mm_cmpeq_ps(_mm_loadu_ps(cw+c), _mm_setzero_ps())),
+                              keep = _mm_packs_epi32(keep32, keep32),
+                              orig = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(scan+c));
+                res = _mm_or_si128(_mm_andnot_si128(keep, res), _mm_and_si128(keep, orig));
+            }
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(scan+c), res);
+        }
+#endif
+        for ( ; c < nc; ++c) {
+            if (chans && !chans[c]) continue;
+            float v = w[c];
+            if (v > 32767.f) v = 32767.f;
+            else if (v < -32768.f) v = -32768.f;
+            scan[c] = short(v >= 0.f ? v + .5f : v - .5f);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef FilterBank_H
+#define FilterBank_H
+
+#include <vector>
+#include <QString>
+
+/// A bank of cascaded IIR (biquad) filter sections, with an optional
+/// common-average-reference (CAR) stage at the end.  Like HPFilter, feed it
+/// blocks of interleaved scans and it filters them in-place, keeping
+/// per-channel state across calls.  The biquads run across channels
+/// (SSE2 where available), with state kept in float SoA arrays.
+class FilterBank
+{
+public:
+    /// Describes which stages to run.  A Spec round-trips through a string of
+    /// the form "bp=300-6000;notch=60x3;q=30;car" so that it can be stored
+    /// in the settings and in .meta files.
+    struct Spec {
+        double bpLoHz, bpHiHz; ///< band-pass edges, each 4th order Butterworth. 0 for either one disables that edge (ie low-pass only or high-pass only)
+        double notchHz; ///< mains frequency to notch out (50 or 60 typically), 0 = no notch
+        unsigned notchHarmonics; ///< number of notches, including the fundamental.  Eg 3 @ 60Hz -> 60, 120, 180 Hz
+        double notchQ; ///< quality factor of each notch
+        bool car; ///< if true, after the biquads subtract the common average of all the filtered channels from each scan
+
+        Spec() : bpLoHz(0.), bpHiHz(0.), notchHz(0.), notchHarmonics(1), notchQ(30.), car(false) {}
+
+        bool isNull() const { return bpLoHz <= 0. && bpHiHz <= 0. && notchHz <= 0. && !car; }
+        QString toString() const;
+        /// Parses the string format described above.  Unknown or malformed tokens set *ok to false, but the rest of the string is still parsed.
+        static Spec fromString(const QString & s, bool *ok = 0);
+    };
+
+    FilterBank(unsigned scanSize = 0, double srateHz = 0., const Spec & spec = Spec());
+
+    void setSpec(const Spec &);
+    const Spec & spec() const { return sp; }
+
+    void setSamplingRate(double srateHz);
+    double samplingRate() const { return srate; }
+
+    void setScanSize(unsigned);
+    unsigned scanSize() const { return nChans; }
+
+    /// The number of biquad sections actually in use.  Sections at or above Nyquist are dropped.
+    unsigned numSections() const { return unsigned(sections.size()); }
+
+    /// Zero the per-channel filter state, eg when jumping to a discontiguous position in a file.
+    void reset();
+
+    /// Filters nScans contiguous scans (each scanSize() samples) in-place.
+    /// If which_chans is not NULL, it should point to scanSize() bytes, where
+    /// which_chans[i] != 0 -> filter channel i (and include it in the CAR).
+    /// Unfiltered channels are passed through untouched.
+    void apply(short *scans, unsigned nScans, const unsigned char *which_chans = 0);
+
+private:
+    struct Biquad { float b0, b1, b2, a1, a2; };
+
+    void design();
+    void addSection(int type, double f0, double Q);
+
+    Spec sp;
+    double srate;
+    unsigned nChans, nPadded; ///< nPadded is nChans rounded up to a multiple of 4
+    std::vector<Biquad> sections;
+    std::vector<float> z; ///< section-major DF-II transposed state: z[(sec*2 + k)*nPadded + chan]
+    std::vector<float> work; ///< one scan's worth of samples, as float
+    std::vector<float> carWeights; ///< 1.0 for chans that participate in CAR, 0.0 otherwise
+};
+
+#endif
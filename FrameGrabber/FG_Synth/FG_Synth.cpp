@@ -0,0 +1,507 @@
+/*
+ * FG_Synth: a stand-in for FG_SpikeGL.exe that needs no frame grabber, no Sapera and no Windows.  It speaks the same
+ * XtCmd protocol on stdin/stdout and, on XtCmd_GrabFrames, attaches to SpikeGL's sample shm and writes synthetic
+ * frames into it through a PagedScanWriter, the same way FG_SpikeGL.exe writes the frames Sapera gives it
+ * (writePartial() line by line for the FPGA format, write() otherwise).  This lets the consumer side of the
+ * framegrabber acquisition mode be run, profiled and load tested anywhere, at and beyond real frame grabber rates.
+ *
+ * SpikeGL runs it in place of FG_SpikeGL.exe when the SPIKEGL_FG_SYNTH environment variable is set to its path.
+ *
+ * Usage: FG_Synth [-fps n] [-rate n] [-w bytes] [-h lines] [-pitch bytes] [-jitter us]
+ *
+ * Every option can also be given as an environment variable (in brackets), since SpikeGL starts it without arguments.
+ *   -fps n       frames per second, 0 for as fast as possible.  Default: -rate divided by the scans per frame. [FG_SYNTH_FPS]
+ *   -rate n      scans per second, used when there is no -fps.  Default: 26739, or the acquisition's sampling rate
+ *                when SpikeGL starts it. [FG_SYNTH_RATE]
+ *   -w, -h       size of the grabbed frames, in bytes per line and lines.  Default: what XtCmd_GrabFrames asks for.
+ *                As with a real grabber, bigger frames are cropped and smaller ones are an error. [FG_SYNTH_W, FG_SYNTH_H]
+ *   -pitch n     bytes from the start of one line to the next.  Default: w+8 (the FPGA format: an 8 byte timestamp,
+ *                then the line's samples) if a frame holds exactly one scan, otherwise w.  Like FG_SpikeGL.exe, only
+ *                those two layouts are supported. [FG_SYNTH_PITCH]
+ *   -jitter us   each frame arrives up to this many microseconds late, at random. [FG_SYNTH_JITTER_US]
+ *
+ * Frames are paced against absolute deadlines, so a late wakeup is made up for by writing the frames that are due
+ * back to back.  If it falls more than a second behind it says so and carries on as fast as it can.
+ *
+ * It exits on XtCmd_Exit, or when stdin is closed.  Exit status is 0, or 2 on bad usage.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <vector>
+#include <deque>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QSharedMemory>
+#include <QElapsedTimer>
+#include <QString>
+#include "XtCmd.h"
+#include "PagedRingBuffer.h"
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace {
+
+const double TwoPi = 6.283185307179586;
+
+struct Options {
+    double fps, rate; ///< fps < 0 means derive it from rate
+    int w, h, pitch; ///< <= 0 means the default
+    unsigned jitterUS;
+    Options() : fps(-1.), rate(26739.0), w(0), h(0), pitch(0), jitterUS(0) {}
+};
+
+// --- output to SpikeGL ---
+
+void send(const XtCmd & xt)
+{
+    xt.write(stdout);
+    fflush(stdout);
+}
+
+void vsendMsg(int type, const char *fmt, va_list ap)
+{
+    char buf[1024];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    buf[sizeof(buf)-1] = 0;
+    XtCmdConsoleMsg *m = XtCmdConsoleMsg::allocInit(buf, type);
+    if (m) send(*m);
+    free(m);
+}
+
+void sendMsg(int type, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsendMsg(type, fmt, ap);
+    va_end(ap);
+}
+
+int PSWErrFunc(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsendMsg(XtCmdConsoleMsg::Error, fmt, ap);
+    va_end(ap);
+    return 0;
+}
+
+int PSWDbgFunc(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vsendMsg(XtCmdConsoleMsg::Debug, fmt, ap);
+    va_end(ap);
+    return 0;
+}
+
+// --- input from SpikeGL ---
+
+/// Reads XtCmds from stdin on its own thread, so the frame loop never blocks on the pipe.
+class Input : public QThread
+{
+public:
+    Input() : eof(false) {}
+
+    /// Takes the next command into out, waiting up to ms for one.  Returns false if there was none.
+    bool pop(std::vector<unsigned char> & out, unsigned long ms)
+    {
+        QMutexLocker l(&mut);
+        if (q.empty() && !eof && ms) cond.wait(&mut, ms);
+        if (q.empty()) return false;
+        out.swap(q.front());
+        q.pop_front();
+        return true;
+    }
+    /// true once stdin is closed and every command before that has been popped
+    bool done() { QMutexLocker l(&mut); return eof && q.empty(); }
+
+    static void sleepUS(unsigned long us) { QThread::usleep(us); } // protected in Qt4
+
+protected:
+    void run()
+    {
+#ifdef Q_OS_WIN
+        _setmode(_fileno(stdin), O_BINARY);
+#endif
+        std::vector<unsigned char> buf;
+        for (;;) {
+            XtCmd *xt = XtCmd::read(buf, stdin);
+            if (!xt) {
+                if (feof(stdin) || ferror(stdin)) break;
+                continue; // garbage, skip it
+            }
+            const size_t n = offsetof(XtCmd, data) + size_t(xt->len);
+            QMutexLocker l(&mut);
+            q.push_back(std::vector<unsigned char>(buf.begin(), buf.begin() + n));
+            cond.wakeOne();
+        }
+        QMutexLocker l(&mut);
+        eof = true;
+        cond.wakeOne();
+    }
+
+private:
+    QMutex mut;
+    QWaitCondition cond;
+    std::deque<std::vector<unsigned char> > q;
+    bool eof;
+};
+
+// --- the frame producer ---
+
+class Synth
+{
+public:
+    explicit Synth(const Options & o)
+        : opt(o), writer(0), nChansPerScan(0), w(0), h(0), pitch(0), nScansInFrame(0), fpgaFormat(false),
+          frameBytes(0), nBank(0), grabbing(false), fps(0.), periodNs(0.), t0Ns(0), jitterNs(0), nFrames(0),
+          metaIdx(0), metaMaxIdx(0), lastFPSNs(0), lastFPSFrames(0), lastClkNs(0), warnedBehind(false) {}
+
+    /// returns false when it's time to exit
+    bool handle(const XtCmd *xt);
+    bool isGrabbing() const { return grabbing; }
+    /// Writes the frames that are due (for at most a few ms), or sleeps until the next one is.
+    void run();
+    void stop();
+
+private:
+    bool startGrab(const XtCmdGrabFrames *x);
+    void makeFrames();
+    bool writeFrame();
+    void sendStatus(qint64 now);
+    qint64 nextDueNs() const { return fps > 0. ? t0Ns + qint64(double(nFrames) * periodNs) + jitterNs : 0; }
+    void pickJitter() { jitterNs = opt.jitterUS ? qint64(rand() % (opt.jitterUS + 1)) * 1000 : 0; }
+
+    Options opt;
+    QSharedMemory shm;
+    PagedScanWriter *writer;
+    std::vector<int> chanMapping;
+    unsigned nChansPerScan, w, h, pitch, nScansInFrame;
+    bool fpgaFormat;
+
+    std::vector<char> frames; ///< a bank of precomputed frames, pitch*h bytes each, written in rotation
+    unsigned frameBytes, nBank;
+
+    bool grabbing;
+    double fps, periodNs;
+    QElapsedTimer clock;
+    qint64 t0Ns, jitterNs;
+    quint64 nFrames;
+
+    std::vector<quint64> meta; ///< same as FG_SpikeGL.exe: a ring of the last frames' timestamps, shmMetaSize bytes
+    unsigned metaIdx, metaMaxIdx;
+
+    qint64 lastFPSNs; quint64 lastFPSFrames; qint64 lastClkNs;
+    bool warnedBehind;
+};
+
+bool Synth::handle(const XtCmd *xt)
+{
+    switch (xt->cmd) {
+    case XtCmd_Exit:
+        sendMsg(XtCmdConsoleMsg::Debug, "Got exit command.. exiting gracefully...");
+        return false;
+    case XtCmd_Test:
+        sendMsg(XtCmdConsoleMsg::Debug, "Got 'TEST' command, replying with this debug message!");
+        break;
+    case XtCmd_GrabFrames:
+        sendMsg(XtCmdConsoleMsg::Debug, "Got 'GrabFrames' command");
+        if (!startGrab((const XtCmdGrabFrames *)xt))
+            sendMsg(XtCmdConsoleMsg::Warning, "Failed to start acquisition.");
+        break;
+    case XtCmd_FPGAProto: {
+        const XtCmdFPGAProto *x = (const XtCmdFPGAProto *)xt;
+        if (x->len >= 16) sendMsg(XtCmdConsoleMsg::Debug, "Got 'FPGAProto' command %d,%d,%d (no FPGA, ignored)", x->cmd_code, x->value1, x->value2);
+        break;
+    }
+    case XtCmd_OpenPort:
+        sendMsg(XtCmdConsoleMsg::Normal, "FG_Synth: frames are synthetic, no COM port needed");
+        break;
+    case XtCmd_ServerResource: {
+        const XtCmdServerResource *x = (const XtCmdServerResource *)xt;
+        sendMsg(XtCmdConsoleMsg::Debug, "Got 'ServerResource' command");
+        if (x->serverIndex < 0 || x->resourceIndex < 0) {
+            XtCmdServerResource r;
+            r.init("FG_Synth", "Synthetic frames", 1, 0, 0, true);
+            send(r);
+        } else
+            sendMsg(XtCmdConsoleMsg::Debug, "Setting serverIndex=%d resourceIndex=%d", x->serverIndex, x->resourceIndex);
+        break;
+    }
+    default:
+        break;
+    }
+    return true;
+}
+
+bool Synth::startGrab(const XtCmdGrabFrames *x)
+{
+    stop();
+    nChansPerScan = x->numChansPerScan > 0 ? unsigned(x->numChansPerScan) : 1;
+    if (x->numChansPerScan <= 0) sendMsg(XtCmdConsoleMsg::Warning, "FIXME: nChansPerScan was not specified in XtCmd_GrabFrames!");
+    if (x->shmPageSize <= 0 || x->shmSize <= 0 || !x->shmName[0]) {
+        sendMsg(XtCmdConsoleMsg::Error, "FIXME: shmPageSize,shmName,and shmSize need to be specified in XtCmd_GrabFrames!");
+        return false;
+    }
+    if (x->shmPageSize > x->shmSize) {
+        sendMsg(XtCmdConsoleMsg::Error, "FIXME: shmPageSize cannot be > shmSize in XtCmd_GrabFrames!");
+        return false;
+    }
+    const unsigned wantW = x->frameW > 0 ? unsigned(x->frameW) : 144, wantH = x->frameH > 0 ? unsigned(x->frameH) : 32;
+
+    // the frames the "hardware" delivers, cropped to what was asked for like FG_SpikeGL.exe does
+    const unsigned grabW = opt.w > 0 ? unsigned(opt.w) : wantW, grabH = opt.h > 0 ? unsigned(opt.h) : wantH;
+    if (grabW < wantW || grabH < wantH) {
+        sendMsg(XtCmdConsoleMsg::Error, "acqCallback got a frame of size %ux%u, but expected a frame of size %ux%u", grabW, grabH, wantW, wantH);
+        return false;
+    }
+    w = wantW; h = wantH;
+    const unsigned scanBytes = nChansPerScan * unsigned(sizeof(short));
+    nScansInFrame = (w*h) / scanBytes;
+    if (!nScansInFrame) {
+        sendMsg(XtCmdConsoleMsg::Error, "Frame must contain at least 1 full scan! FIXME!");
+        return false;
+    }
+    pitch = opt.pitch > 0 ? unsigned(opt.pitch) : (nScansInFrame == 1 ? grabW + 8 : grabW);
+    if (pitch < grabW) {
+        sendMsg(XtCmdConsoleMsg::Error, "FG_Synth: pitch (%u) cannot be less than the frame width (%u)", pitch, grabW);
+        return false;
+    }
+    fpgaFormat = pitch != w;
+    if (fpgaFormat && pitch - w != 8) {
+        sendMsg(XtCmdConsoleMsg::Error, "Unsupported frame format! We are expecting a frame where pitch is 8 bytes larger than width!");
+        return false;
+    }
+    if (fpgaFormat && nScansInFrame != 1) {
+        sendMsg(XtCmdConsoleMsg::Error, "Unsupported frame format! We are expecting a frame where there is exactly one complete scan per frame!");
+        return false;
+    }
+
+#if QT_VERSION >= 0x040800
+    shm.setNativeKey(QString::fromUtf8(x->shmName));
+#else
+    shm.setKey(QString::fromUtf8(x->shmName));
+#endif
+    if (!shm.attach(QSharedMemory::ReadWrite)) {
+        sendMsg(XtCmdConsoleMsg::Error, "Could not open shared memory \"%s\" (%s).", x->shmName, shm.errorString().toUtf8().constData());
+        return false;
+    }
+    if (shm.size() < x->shmSize) {
+        sendMsg(XtCmdConsoleMsg::Error, "Shared memory \"%s\" is %d bytes, expected %d.", x->shmName, shm.size(), x->shmSize);
+        shm.detach();
+        return false;
+    }
+    chanMapping.clear();
+    if (x->use_map) {
+        const unsigned maxsize = sizeof(x->mapping) / sizeof(*x->mapping);
+        chanMapping.assign(x->mapping, x->mapping + (nChansPerScan < maxsize ? nChansPerScan : maxsize));
+    }
+    writer = new PagedScanWriter(nChansPerScan, unsigned(x->shmMetaSize), shm.data(), (unsigned long)x->shmSize, (unsigned long)x->shmPageSize, chanMapping);
+    writer->ErrFunc = &PSWErrFunc; writer->DbgFunc = &PSWDbgFunc;
+    if (!writer->scansPerPage()) {
+        sendMsg(XtCmdConsoleMsg::Error, "INTERNAL ERROR.. shm page, cannot fit at least 1 scan! FIXME!");
+        stop();
+        return false;
+    }
+    metaMaxIdx = unsigned(x->shmMetaSize) / unsigned(sizeof(quint64));
+    meta.assign(metaMaxIdx ? metaMaxIdx : 1, 0);
+    metaIdx = 0;
+    sendMsg(XtCmdConsoleMsg::Debug, "Connected to shared memory \"%s\" size: %d  pagesize: %d metadatasize: %d", x->shmName, x->shmSize, x->shmPageSize, x->shmMetaSize);
+
+    makeFrames();
+
+    fps = opt.fps >= 0. ? opt.fps : opt.rate / double(nScansInFrame);
+    periodNs = fps > 0. ? 1e9 / fps : 0.;
+    nFrames = 0; lastFPSFrames = 0;
+    warnedBehind = false;
+    clock.start();
+    t0Ns = lastFPSNs = lastClkNs = 0;
+    pickJitter();
+    grabbing = true;
+    sendMsg(XtCmdConsoleMsg::Normal, "FG_Synth: grabbing %ux%u frames (pitch %u, %u scan%s of %u channels each) at %s%s",
+            w, h, pitch, nScansInFrame, nScansInFrame == 1 ? "" : "s", nChansPerScan,
+            fps > 0. ? QString("%1 fps").arg(fps).toUtf8().constData() : "full speed",
+            opt.jitterUS ? QString(", up to %1 us jitter").arg(opt.jitterUS).toUtf8().constData() : "");
+    return true;
+}
+
+/// A few hundred ms worth of frames (up to 32MB of them) holding a slow sine per channel, each channel phase shifted,
+/// plus a little noise.  Cycling through a precomputed bank keeps the per-frame cost down to what the real thing pays.
+void Synth::makeFrames()
+{
+    frameBytes = pitch * h;
+    nBank = (32u*1024u*1024u) / frameBytes;
+    if (nBank > 256) nBank = 256;
+    if (nBank < 2) nBank = 2;
+    frames.assign(size_t(frameBytes) * nBank, 0);
+
+    const unsigned lineData = w, off = fpgaFormat ? 8 : 0;
+    const double period = double(nBank) * double(nScansInFrame); // so the bank loops seamlessly
+    std::vector<short> scan(nChansPerScan);
+    for (unsigned f = 0; f < nBank; ++f) {
+        char *frame = &frames[size_t(f) * frameBytes];
+        for (unsigned s = 0; s < nScansInFrame; ++s) {
+            const double t = double(f) * double(nScansInFrame) + double(s);
+            for (unsigned c = 0; c < nChansPerScan; ++c)
+                scan[c] = short(8000.0 * sin(TwoPi * (t / period + double(c) / double(nChansPerScan))) + double(rand() % 201 - 100));
+            // scan s's bytes are bytes [s*scanBytes, (s+1)*scanBytes) of the frame's line data, line after line
+            const char *src = reinterpret_cast<const char *>(&scan[0]);
+            unsigned pos = s * nChansPerScan * unsigned(sizeof(short)), left = nChansPerScan * unsigned(sizeof(short));
+            while (left) {
+                const unsigned line = pos / lineData, col = pos % lineData, n = (lineData - col) < left ? (lineData - col) : left;
+                memcpy(frame + line*pitch + off + col, src, n);
+                src += n; pos += n; left -= n;
+            }
+        }
+    }
+}
+
+bool Synth::writeFrame()
+{
+    char *frame = &frames[size_t(nFrames % nBank) * frameBytes];
+    if (fpgaFormat) {
+        // the FPGA puts a timestamp at the start of every line; FG_SpikeGL.exe keeps the last line's as the metadata
+        const quint64 ts = nFrames;
+        memcpy(frame + (h-1)*pitch, &ts, sizeof(ts));
+        meta[metaIdx] = ts;
+        if (++metaIdx >= metaMaxIdx) metaIdx = 0;
+        writer->writePartialBegin();
+        for (unsigned line = 0; line < h; ++line) {
+            if (!writer->writePartial(frame + 8 + line*pitch, w, metaMaxIdx ? &meta[0] : 0)) {
+                sendMsg(XtCmdConsoleMsg::Error, "PagedScanWriter::writePartial() returned false!");
+                writer->writePartialEnd();
+                return false;
+            }
+        }
+        if (!writer->writePartialEnd()) {
+            sendMsg(XtCmdConsoleMsg::Error, "PagedScanWriter::writePartialEnd() returned false!");
+            return false;
+        }
+    } else {
+        if (metaMaxIdx) meta[metaMaxIdx - 1] = nFrames; // what FG_SpikeGL.exe does for this format too
+        if (!writer->write(reinterpret_cast<const short *>(frame), nScansInFrame, metaMaxIdx ? &meta[0] : 0)) {
+            sendMsg(XtCmdConsoleMsg::Error, "PagedScanWriter::write returned false!");
+            return false;
+        }
+    }
+    ++nFrames;
+    pickJitter();
+    return true;
+}
+
+void Synth::run()
+{
+    qint64 now = clock.nsecsElapsed(), due = nextDueNs();
+    if (due > now) {
+        const qint64 us = (due - now) / 1000;
+        Input::sleepUS((unsigned long)(us > 10000 ? 10000 : (us ? us : 1)));
+        sendStatus(clock.nsecsElapsed());
+        return;
+    }
+    if (fps > 0. && now - due > 1000000000LL) {
+        if (!warnedBehind)
+            sendMsg(XtCmdConsoleMsg::Warning, "FG_Synth: more than 1 s behind schedule, %g fps is too fast for this machine -- continuing as fast as possible", fps);
+        warnedBehind = true;
+        t0Ns += now - due; // don't try to make it all up
+    }
+    // write the frames that are due, coming back to look at commands and send status every few ms
+    const qint64 until = now + 5000000LL;
+    do {
+        if (!writeFrame()) { stop(); return; }
+        now = clock.nsecsElapsed();
+    } while (nextDueNs() <= now && now < until);
+    sendStatus(now);
+}
+
+void Synth::sendStatus(qint64 now)
+{
+    if (now - lastFPSNs >= 1000000000LL) {
+        XtCmdFPS f;
+        f.init(double(nFrames - lastFPSFrames) * 1e9 / double(now - lastFPSNs));
+        send(f);
+        lastFPSNs = now; lastFPSFrames = nFrames;
+    }
+    if (now - lastClkNs >= 250000000LL) {
+        XtCmdClkSignals c;
+        c.init(true, true, true, true, true);
+        send(c);
+        lastClkNs = now;
+    }
+}
+
+void Synth::stop()
+{
+    if (grabbing) {
+        const double secs = double(clock.nsecsElapsed()) / 1e9;
+        const double mb = double(nFrames) * double(nScansInFrame) * double(nChansPerScan) * 2.0 / (1024.0*1024.0);
+        sendMsg(XtCmdConsoleMsg::Normal, "FG_Synth: wrote %llu frames in %.1f s (%.1f fps, %.1f MB/s)",
+                (unsigned long long)nFrames, secs, secs > 0. ? double(nFrames)/secs : 0., secs > 0. ? mb/secs : 0.);
+    }
+    grabbing = false;
+    delete writer; writer = 0;
+    if (shm.isAttached()) shm.detach();
+}
+
+bool optVal(const char *name, const char *envName, int argc, char **argv, double & out)
+{
+    for (int i = 1; i + 1 < argc; ++i)
+        if (!strcmp(argv[i], name)) { out = atof(argv[i+1]); return true; }
+    const char *e = getenv(envName);
+    if (e && *e) { out = atof(e); return true; }
+    return false;
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage: FG_Synth [-fps n] [-rate n] [-w bytes] [-h lines] [-pitch bytes] [-jitter us]\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    static const char * const opts[] = { "-fps", "-rate", "-w", "-h", "-pitch", "-jitter" };
+    for (int i = 1; i < argc; i += 2) {
+        bool ok = false;
+        for (unsigned j = 0; j < sizeof(opts)/sizeof(*opts); ++j) ok = ok || !strcmp(argv[i], opts[j]);
+        if (!ok || i + 1 >= argc) usage();
+    }
+    Options o;
+    double v;
+    if (optVal("-fps", "FG_SYNTH_FPS", argc, argv, v)) o.fps = v < 0. ? 0. : v;
+    if (optVal("-rate", "FG_SYNTH_RATE", argc, argv, v) && v > 0.) o.rate = v;
+    if (optVal("-w", "FG_SYNTH_W", argc, argv, v)) o.w = int(v);
+    if (optVal("-h", "FG_SYNTH_H", argc, argv, v)) o.h = int(v);
+    if (optVal("-pitch", "FG_SYNTH_PITCH", argc, argv, v)) o.pitch = int(v);
+    if (optVal("-jitter", "FG_SYNTH_JITTER_US", argc, argv, v) && v > 0.) o.jitterUS = unsigned(v);
+
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdout), O_BINARY);
+#endif
+    sendMsg(XtCmdConsoleMsg::Normal, "FG_Synth slave process started.");
+
+    // never deleted: it's blocked reading stdin when we exit
+    Input *in = new Input;
+    in->start();
+    Synth synth(o);
+    std::vector<unsigned char> cmd;
+    for (;;) {
+        bool quit = false;
+        for (unsigned long waitMS = synth.isGrabbing() ? 0 : 250; !quit && in->pop(cmd, waitMS); waitMS = 0)
+            quit = !synth.handle(reinterpret_cast<const XtCmd *>(&cmd[0]));
+        if (quit || in->done()) break;
+        if (synth.isGrabbing()) synth.run();
+    }
+    synth.stop();
+    fflush(stdout);
+    exit(0);
+}
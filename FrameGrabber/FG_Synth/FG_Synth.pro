@@ -0,0 +1,17 @@
+######################################################################
+# FG_Synth: synthetic frame grabber process, a portable stand-in for
+# FG_SpikeGL.exe.  Set SPIKEGL_FG_SYNTH to the built binary's path and
+# SpikeGL will run it instead.  Headless, Qt core only.
+# Build with qmake && make
+######################################################################
+
+TEMPLATE = app
+TARGET = FG_Synth
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ../.. ../FG_SpikeGL/FG_SpikeGL
+INCLUDEPATH += . ../.. ../FG_SpikeGL/FG_SpikeGL
+
+HEADERS += ../FG_SpikeGL/FG_SpikeGL/XtCmd.h ../../PagedRingBuffer.h ../../Thread_Compat.h ../../stdafx.h
+SOURCES += FG_Synth.cpp ../../PagedRingBuffer.cpp
@@ -18,6 +18,39 @@
 #include <QMouseEvent>
 #include "Util.h"
 #include <QVarLengthArray.h>
+#ifdef GLSPATIALVIS_USE_SHADERS
+#include <QGLShaderProgram>
+#include <QGLBuffer>
+#endif
+#ifndef GL_TEXTURE_1D
+#define GL_TEXTURE_1D 0x0DE0
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+namespace {
+	const int CMapLen = 256; ///< texels per colormap, the texture holds 2 of them back to back
+
+#ifdef GLSPATIALVIS_USE_SHADERS
+	// Uses the fixed-function matrix stack and gl_Vertex so the rest of the
+	// widget's legacy GL drawing (grid, selection, overlay) is unaffected.
+	const char *vertShaderSrc =
+		"attribute float intensity;\n" // normalized unsigned byte, 0..1
+		"attribute float palette;\n"   // 0 or 1
+		"varying float cmapCoord;\n"
+		"void main() {\n"
+		"    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+		"    cmapCoord = (palette * 256.0 + intensity * 255.0 + 0.5) / 512.0;\n"
+		"}\n";
+	const char *fragShaderSrc =
+		"uniform sampler1D cmap;\n"
+		"varying float cmapCoord;\n"
+		"void main() {\n"
+		"    gl_FragColor = texture1D(cmap, cmapCoord);\n"
+		"}\n";
+#endif
+}
 
 void GLSpatialVis::reset()
 {
@@ -41,6 +74,13 @@ void GLSpatialVis::reset()
 	colorsBuf.clear();
 	vbuf.clear();
 	cbuf.clear();
+	intensity_mode = false;
+	intensBuf.clear();
+	paletteBuf.clear();
+	ibuf.clear();
+	cmap_colors[0] = QColor(0x87, 0xce, 0xfa, 0x7f);
+	cmap_colors[1] = QColor(0xfa, 0x87, 0x37, 0x7f);
+	geom_dirty = intens_dirty = cmap_dirty = true;
     auto_update = false;
     setNumHGridLines(4);
     setNumVGridLines(4);
@@ -56,7 +96,11 @@ void GLSpatialVis::reset()
 }
 
 GLSpatialVis::GLSpatialVis(QWidget *parent)
-    : QGLWidget(parent, Util::sharedGLWidget()), tex(0)
+    : QGLWidget(parent, Util::sharedGLWidget()), cmapTex(0),
+#ifdef GLSPATIALVIS_USE_SHADERS
+	  prog(0), geomVBO(0), intensVBO(0), intensityAttr(-1), paletteAttr(-1),
+#endif
+	  shaders_ok(false), tex(0)
 {
     reset();
 
@@ -65,10 +109,56 @@ GLSpatialVis::GLSpatialVis(QWidget *parent)
 
 GLSpatialVis::~GLSpatialVis() 
 {
+	makeCurrent();
 	if (tex) glDeleteTextures(1, &tex), tex = 0;
+	destroyGLObjects();
     Util::sharedGLWidgetDtorCB(this);
 }
 
+void GLSpatialVis::destroyGLObjects()
+{
+	if (cmapTex) glDeleteTextures(1, &cmapTex), cmapTex = 0;
+#ifdef GLSPATIALVIS_USE_SHADERS
+	delete prog, prog = 0;
+	delete geomVBO, geomVBO = 0;
+	delete intensVBO, intensVBO = 0;
+#endif
+	shaders_ok = false;
+	geom_dirty = intens_dirty = cmap_dirty = true;
+}
+
+void GLSpatialVis::initShaders()
+{
+	destroyGLObjects();
+#ifdef GLSPATIALVIS_USE_SHADERS
+	if (!QGLShaderProgram::hasOpenGLShaderPrograms(context())) {
+		Warning() << "GLSpatialVis: no GLSL support, falling back to per-vertex colors";
+		return;
+	}
+	prog = new QGLShaderProgram(context(), this);
+	if (!prog->addShaderFromSourceCode(QGLShader::Vertex, vertShaderSrc)
+		|| !prog->addShaderFromSourceCode(QGLShader::Fragment, fragShaderSrc)
+		|| !prog->link()) {
+		Warning() << "GLSpatialVis: shader setup failed, falling back to per-vertex colors: " << prog->log();
+		delete prog, prog = 0;
+		return;
+	}
+	intensityAttr = prog->attributeLocation("intensity");
+	paletteAttr = prog->attributeLocation("palette");
+	geomVBO = new QGLBuffer(QGLBuffer::VertexBuffer);
+	intensVBO = new QGLBuffer(QGLBuffer::VertexBuffer);
+	geomVBO->setUsagePattern(QGLBuffer::StaticDraw);
+	intensVBO->setUsagePattern(QGLBuffer::StreamDraw);
+	if (!geomVBO->create() || !intensVBO->create()) {
+		Warning() << "GLSpatialVis: could not create vertex buffers, falling back to per-vertex colors";
+		destroyGLObjects();
+		return;
+	}
+	glGenTextures(1, &cmapTex);
+	shaders_ok = true;
+#endif
+}
+
 void GLSpatialVis::initializeGL()
 {
     glDisable(GL_DEPTH_TEST);
@@ -77,6 +167,7 @@ void GLSpatialVis::initializeGL()
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 //    glEnable(GL_LINE_SMOOTH);
     glEnable(GL_POINT_SMOOTH);
+	initShaders();
 }
 
 
@@ -112,7 +203,7 @@ void GLSpatialVis::paintGL()
 		glScalef(xform.v3,xform.v4,1.f);
 
 		drawGrid();
-		if (pointsBuf.size() && colorsBuf.size()) 
+		if (pointsBuf.size() && (colorsBuf.size() || (intensity_mode && intensBuf.size())))
 			drawPoints();
 		drawSelection();
 	
@@ -233,8 +324,103 @@ void GLSpatialVis::drawPoints() const
 	}
 }
 
+void GLSpatialVis::uploadDirtyBuffers()
+{
+#ifdef GLSPATIALVIS_USE_SHADERS
+	if (cmap_dirty) {
+		unsigned char texels[2*CMapLen*4];
+		for (int p = 0; p < 2; ++p) {
+			const QColor & c (cmap_colors[p]);
+			for (int i = 0; i < CMapLen; ++i) {
+				unsigned char * const t = texels + (p*CMapLen + i)*4;
+				t[0] = (unsigned char)((c.red()*i + 127) / 255);
+				t[1] = (unsigned char)((c.green()*i + 127) / 255);
+				t[2] = (unsigned char)((c.blue()*i + 127) / 255);
+				t[3] = (unsigned char)c.alpha();
+			}
+		}
+		glBindTexture(GL_TEXTURE_1D, cmapTex);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA, 2*CMapLen, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+		glBindTexture(GL_TEXTURE_1D, 0);
+		cmap_dirty = false;
+	}
+	const int nverts = vbuf.size();
+	if (geom_dirty) {
+		// positions first, then one palette float per vertex.  Only rebuilt on resize/layout/palette changes.
+		QVector<float> pal(nverts, 0.f);
+		for (int i = 0; i < paletteBuf.size() && i*4+3 < nverts; ++i)
+			pal[i*4] = pal[i*4+1] = pal[i*4+2] = pal[i*4+3] = paletteBuf[i] ? 1.f : 0.f;
+		geomVBO->bind();
+		geomVBO->allocate(nverts * int(sizeof(Vec2f) + sizeof(float)));
+		if (nverts) {
+			geomVBO->write(0, vbuf.constData(), nverts * int(sizeof(Vec2f)));
+			geomVBO->write(nverts * int(sizeof(Vec2f)), pal.constData(), nverts * int(sizeof(float)));
+		}
+		geomVBO->release();
+		geom_dirty = false;
+		intens_dirty = true; // size may have changed
+	}
+	if (intens_dirty) {
+		// the only per-frame upload: 1 byte per vertex
+		const int n = intensBuf.size() < nverts/4 ? intensBuf.size() : nverts/4;
+		ibuf.resize(nverts);
+		quint8 * const dst = ibuf.data();
+		const quint8 * const src = intensBuf.constData();
+		for (int i = 0; i < n; ++i)
+			dst[i*4] = dst[i*4+1] = dst[i*4+2] = dst[i*4+3] = src[i];
+		for (int i = n*4; i < nverts; ++i) dst[i] = 0;
+		intensVBO->bind();
+		if (intensVBO->size() != nverts) intensVBO->allocate(dst, nverts);
+		else if (nverts) intensVBO->write(0, dst, nverts);
+		intensVBO->release();
+		intens_dirty = false;
+	}
+#endif
+}
+
+void GLSpatialVis::drawSquaresShaded()
+{
+#ifdef GLSPATIALVIS_USE_SHADERS
+	uploadDirtyBuffers();
+	const int nverts = vbuf.size();
+	if (!nverts) return;
+
+	GLint saved_polygonmode[2];
+	glGetIntegerv(GL_POLYGON_MODE, saved_polygonmode);
+	glPolygonMode(GL_FRONT, GL_FILL);
+
+	prog->bind();
+	glBindTexture(GL_TEXTURE_1D, cmapTex);
+	prog->setUniformValue("cmap", 0);
+
+	geomVBO->bind();
+	glVertexPointer(2, GL_FLOAT, 0, 0);
+	prog->enableAttributeArray(paletteAttr);
+	prog->setAttributeBuffer(paletteAttr, GL_FLOAT, nverts * int(sizeof(Vec2f)), 1);
+	intensVBO->bind();
+	prog->enableAttributeArray(intensityAttr);
+	prog->setAttributeBuffer(intensityAttr, GL_UNSIGNED_BYTE, 0, 1); // QGLShaderProgram normalizes to 0..1
+
+	glDrawArrays(GL_QUADS, 0, nverts);
+
+	prog->disableAttributeArray(intensityAttr);
+	prog->disableAttributeArray(paletteAttr);
+	intensVBO->release(); // unbinds GL_ARRAY_BUFFER so the client-side arrays used elsewhere work again
+	glBindTexture(GL_TEXTURE_1D, 0);
+	prog->release();
+	glPolygonMode(GL_FRONT, saved_polygonmode[0]);
+#endif
+}
+
 void GLSpatialVis::drawSquares() const
 {
+	if (intensity_mode && shaders_ok) {
+		const_cast<GLSpatialVis *>(this)->drawSquaresShaded();
+		return;
+	}
 	// in this mode, each point is the center of a square of glyphSize() width
 	if (vbuf.size() != cbuf.size()) {
 		Error() << "GLSparialVis::drawSquares INTERNAL error -- color buffer != points buffer size!";
@@ -419,6 +605,7 @@ void GLSpatialVis::setGlyphType(GLSpatialVis::GlyphType g)
 		updateVertexBuf();
 		updateColorBuf();
 	}
+	if (intensity_mode) updateIntensityColors();
 	if (auto_update) updateGL();
 	else need_update = true;
 }
@@ -494,6 +681,7 @@ void GLSpatialVis::updateVertexBuf()
 		vbuf[vi+2].x = p.x+xoff, vbuf[vi+2].y = p.y+yoff; // top right
 		vbuf[vi+3].x = p.x-xoff, vbuf[vi+3].y = p.y+yoff; // top left		
 	}	
+	geom_dirty = true;
 }
 
 void GLSpatialVis::setColors(const QVector<Vec4f> & colors)
@@ -501,12 +689,64 @@ void GLSpatialVis::setColors(const QVector<Vec4f> & colors)
 	if (pointsBuf.size() != colors.size()) {
 		Error() << "INTERNAL ERROR: GLSpatialVis '" << objectName() << "' -- color buffer length != vector buffer length! Argh!";		
 	}
+	intensity_mode = false;
 	colorsBuf = colors;
 	if (glyphType() == Square) updateColorBuf();	
 	if (auto_update) updateGL();
 	else need_update = true;
 }
 
+void GLSpatialVis::setIntensities(const QVector<quint8> & intensities)
+{
+	if (pointsBuf.size() != intensities.size()) {
+		Error() << "INTERNAL ERROR: GLSpatialVis '" << objectName() << "' -- intensity buffer length != vector buffer length! Argh!";
+	}
+	intensity_mode = true;
+	intensBuf = intensities; // constant time, implicitly shared
+	intens_dirty = true;
+	if (!shaders_ok || glyphType() != Square) updateIntensityColors();
+	if (auto_update) updateGL();
+	else need_update = true;
+}
+
+void GLSpatialVis::setPalettes(const QVector<quint8> & palettes)
+{
+	paletteBuf = palettes;
+	geom_dirty = true;
+	if (intensity_mode && (!shaders_ok || glyphType() != Square)) updateIntensityColors();
+	if (auto_update) updateGL();
+	else need_update = true;
+}
+
+void GLSpatialVis::setColormaps(const QColor & c0, const QColor & c1)
+{
+	if (c0 == cmap_colors[0] && c1 == cmap_colors[1]) return;
+	cmap_colors[0] = c0;
+	cmap_colors[1] = c1;
+	cmap_dirty = true;
+	if (intensity_mode && (!shaders_ok || glyphType() != Square)) updateIntensityColors();
+	if (auto_update) updateGL();
+	else need_update = true;
+}
+
+void GLSpatialVis::updateIntensityColors()
+{
+	const int n = intensBuf.size();
+	colorsBuf.resize(n);
+	Vec4f lut[2][CMapLen];
+	for (int p = 0; p < 2; ++p) {
+		const QColor & c (cmap_colors[p]);
+		const float r = c.redF(), g = c.greenF(), b = c.blueF(), a = c.alphaF();
+		for (int i = 0; i < CMapLen; ++i) {
+			const float f = float(i) / float(CMapLen-1);
+			lut[p][i] = Vec4f(r*f, g*f, b*f, a);
+		}
+	}
+	for (int i = 0; i < n; ++i)
+		colorsBuf[i] = lut[i < paletteBuf.size() && paletteBuf[i] ? 1 : 0][intensBuf[i]];
+	if (glyphType() == Square) updateColorBuf();
+}
+
 void GLSpatialVis::mouseMoveEvent(QMouseEvent *evt)
 {
 	emit(cursorOverWindowCoords(evt->x(), evt->y()));
@@ -9,6 +9,12 @@
 
 #include "Vec.h"
 
+#if QT_VERSION >= 0x040700
+#  define GLSPATIALVIS_USE_SHADERS 1
+class QGLShaderProgram;
+class QGLBuffer;
+#endif
+
 class GLSpatialVis : public QGLWidget
 {
     Q_OBJECT
@@ -23,7 +29,16 @@ public:
     void reset();
 
 	void setPoints(const QVector<Vec2> & points);
-	void setColors(const QVector<Vec4f> & colors);
+	void setColors(const QVector<Vec4f> & colors); ///< legacy per-glyph RGBA path, rebuilds the whole color buffer
+
+	/// Preferred path: one intensity (0-255) per glyph, in the same order as setPoints().
+	/// Only this array is streamed to the GPU each frame -- the glyph geometry lives in
+	/// a static vertex buffer and the color comes from a colormap texture lookup.
+	void setIntensities(const QVector<quint8> & intensities);
+	/// Selects, per glyph, which of the 2 colormaps to use (0 or 1).  Changes rarely.
+	void setPalettes(const QVector<quint8> & palettes);
+	/// Builds the 2 colormaps as linear ramps from black to c0 and c1 respectively (alpha is kept constant).
+	void setColormaps(const QColor & c0, const QColor & c1);
 	
 	Vec2f glyphSize() const { return glyph_size; }
 	void setGlyphSize(Vec2f gs);
@@ -99,6 +114,11 @@ private:
 	
 	void updateColorBuf();
 	void updateVertexBuf();
+	void updateIntensityColors(); ///< CPU fallback for the intensity path: expands intensities via the colormaps into colorsBuf
+	void initShaders();
+	void drawSquaresShaded();
+	void uploadDirtyBuffers();
+	void destroyGLObjects();
 
 	int w_pix, h_pix;
     QColor bg_Color, grid_Color;
@@ -112,6 +132,19 @@ private:
 	QVector<Vec4f> colorsBuf;
 	QVector<Vec2f> vbuf;///< scratch buff for vertices in squares mode, mostly
 	QVector<Vec4f> cbuf; 
+
+	bool intensity_mode; ///< true if the last colors came from setIntensities(), false if from setColors()
+	QVector<quint8> intensBuf, paletteBuf;
+	QVector<quint8> ibuf; ///< intensBuf expanded to 1 byte per vertex -- this is what gets uploaded each frame
+	QColor cmap_colors[2];
+	bool geom_dirty, intens_dirty, cmap_dirty;
+	GLuint cmapTex; ///< 2x256 texel GL_TEXTURE_1D
+#ifdef GLSPATIALVIS_USE_SHADERS
+	QGLShaderProgram *prog;
+	QGLBuffer *geomVBO, *intensVBO;
+	int intensityAttr, paletteAttr;
+#endif
+	bool shaders_ok;
     std::vector<Vec2> gridVs, gridHs;
     bool auto_update, need_update;
 	double selx1[N_Sel],selx2[N_Sel],sely1[N_Sel],sely2[N_Sel];
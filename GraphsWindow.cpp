@@ -34,6 +34,8 @@
 #include <string.h>
 #include "MainApp.h"
 #include "HPFilter.h"
+#include "FilterBank.h"
+#include "ReferenceStage.h"
 #include "QLed.h"
 #include "ConfigureDialogController.h"
 #include "play.xpm"
@@ -79,7 +81,7 @@ static void initIcons()
 }
 
 GraphsWindow::GraphsWindow(DAQ::Params & p, QWidget *parent, bool isSaving, bool useTabs, int graphUpdateRateHz)
-    : QMainWindow(parent), threadsafe_is_visible(false), params(p), useTabs(useTabs), nPtsAllGs(0), downsampleRatio(1.), tNow(0.), tLast(0.), tAvg(0.), tNum(0.), filter(0), modeCaresAboutSGL(false), modeCaresAboutPD(false), suppressRecursive(false), graphsMut(QMutex::Recursive)
+    : QMainWindow(parent), threadsafe_is_visible(false), params(p), useTabs(useTabs), nPtsAllGs(0), downsampleRatio(1.), tNow(0.), tLast(0.), tAvg(0.), tNum(0.), filter(0), fbank(0), refStage(0), modeCaresAboutSGL(false), modeCaresAboutPD(false), suppressRecursive(false), graphsMut(QMutex::Recursive)
 {
     sharedCtor(p, isSaving, graphUpdateRateHz);
 }
@@ -237,7 +239,9 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
     QSettings settings("janelia.hhmi.org", APPNAME);
 	settings.beginGroup("GraphsWindow");
 	const bool setting_ds = settings.value("downsample",false).toBool(),
-               setting_filt = settings.value("filter",true).toBool();
+               setting_filt = settings.value("filter",true).toBool(),
+               setting_fbank = settings.value("filterBank",false).toBool(),
+               setting_ref = settings.value("refStage",false).toBool();
     const double setting_dshz = settings.value("downsample_hz",double(DOWNSAMPLE_TARGET_HZ)).toDouble();
 
     QCheckBox *dsc = downsampleChk = new QCheckBox(QString("Downsample"), graphCtls);
@@ -262,6 +266,16 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
     filter = 0;
     Connect(highPassChk, SIGNAL(clicked(bool)), this, SLOT(hpfChk(bool)));
 
+    fbankChkBox = new QCheckBox("Filter Bank", graphCtls);
+    graphCtls->addWidget(fbankChkBox);
+    fbankChkBox->setChecked(setting_fbank);
+    Connect(fbankChkBox, SIGNAL(clicked(bool)), this, SLOT(fbankChk(bool)));
+
+    refChkBox = new QCheckBox("Re-reference", graphCtls);
+    graphCtls->addWidget(refChkBox);
+    refChkBox->setChecked(setting_ref);
+    Connect(refChkBox, SIGNAL(clicked(bool)), this, SLOT(refChk(bool)));
+
     graphCtls->addSeparator();
 	
 	/*
@@ -506,6 +520,8 @@ void GraphsWindow::sharedCtor(DAQ::Params & p, bool isSaving, int graphUpdateRat
 	/// apply saved settings by calling the callback after everything is constructed
     setDownsampling(setting_ds);
 	hpfChk(setting_filt);
+    fbankChk(setting_fbank);
+    refChk(setting_ref);
 	
 	// setup sorting/naming
 	const int gs = graphs.size(), cs = p.chanMap.size();
@@ -541,6 +557,8 @@ GraphsWindow::~GraphsWindow()
     const int gfs = graphFrames.size();
     for (int i = 0; i < gfs; ++i) mainApp()->putGLGraphWithFrame(graphFrames[i]);
     if (filter) delete filter, filter = 0;
+    if (fbank) delete fbank, fbank = 0;
+    if (refStage) delete refStage, refStage = 0;
 	setUpdatesEnabled(true);
 }
 
@@ -629,13 +647,36 @@ void GraphsWindow::putScans(const int16 * data, unsigned DSIZE, u64 firstSamp)
         int idx = 0;
         const int maximizedIdx = (maximized ? parseGraphNum(maximized) : -1);
 
-        bool needFilter = filter;
-        if (needFilter) scanTmp.resize(NGRAPHS);
+        bool needFilter = (filter || fbank || refStage) && NGRAPHS;
+        int filtRow = 0;
+        if (needFilter) {
+            // gather all the (downsampled) scans we are about to graph into one contiguous block,
+            // and highpass them in 1 call to the block filter, rather than 1 call per scan
+            const int maxRows = (int(DSIZE)-startpt)/(DOWNSAMPLE_RATIO*NGRAPHS) + 2;
+            int nRows = 0;
+            scanTmp.resize(maxRows*NGRAPHS);
+            for (int i = startpt; i < (int)DSIZE && nRows < maxRows; ++nRows) {
+                const int n = MIN(NGRAPHS, int(DSIZE)-i);
+                int16 * const row = &scanTmp[nRows*NGRAPHS];
+                memcpy(row, &data[i], n*sizeof(int16));
+                if (n < NGRAPHS) memset(row+n, 0, (NGRAPHS-n)*sizeof(int16));
+                // same stepping as the graphing loop below
+                i = int((i-1) + DOWNSAMPLE_RATIO*NGRAPHS);
+                if ((i+1)%NGRAPHS) i -= (i+1)%NGRAPHS;
+                ++i;
+            }
+            if (nRows) {
+                if (filter) filter->apply(&scanTmp[0], unsigned(nRows), deltaT);
+                if (fbank) {
+                    fbank->setSamplingRate(1.0/deltaT);
+                    fbank->apply(&scanTmp[0], unsigned(nRows), &fbankChans[0]);
+                }
+                if (refStage) refStage->apply(&scanTmp[0], unsigned(nRows));
+            } else needFilter = false;
+        }
         for (int i = startpt; i < (int)DSIZE; ++i) {
             if (needFilter) {
-                memcpy(&scanTmp[0], &data[i], NGRAPHS*sizeof(int16));
-                filter->apply(&scanTmp[0], deltaT);
-                DPTR = (&scanTmp[0])-i;//fudge DPTR.. dangerous but below code always accesses it as DPTR[i], so it's ok
+                DPTR = (&scanTmp[(filtRow++)*NGRAPHS])-i;//fudge DPTR.. dangerous but below code always accesses it as DPTR[i], so it's ok
                 needFilter = false;
             }
             if ( graphs[idx] && !pgraphs[idx] && (maximizedIdx < 0 || maximizedIdx == idx)) {
@@ -660,7 +701,7 @@ void GraphsWindow::putScans(const int16 * data, unsigned DSIZE, u64 firstSamp)
                 i = int((i-NGRAPHS) + DOWNSAMPLE_RATIO*NGRAPHS);
                 if ((i+1)%NGRAPHS) i -= (i+1)%NGRAPHS;
                 DPTR = &data[0];
-                needFilter = filter;
+                needFilter = (filter || fbank || refStage) && NGRAPHS;
             }
         }
         for (int i = 0; i < NGRAPHS; ++i) {
@@ -1097,6 +1138,41 @@ void GraphsWindow::hpfChk(bool b)
 	settings.setValue("filter",b);
 }
 
+void GraphsWindow::fbankChk(bool b)
+{
+    QMutexLocker l(&graphsMut);
+
+    if (fbank) delete fbank, fbank = 0;
+    const FilterBank::Spec spec = FilterBank::Spec::fromString(mainApp()->filterBankSpec());
+    fbankChkBox->setToolTip(QString("Apply the filter bank '%1' to the graphs. Set it from the console window's Options->Filter Bank... menu.").arg(spec.toString()));
+    if (b && !spec.isNull()) {
+        // NB: sampling rate is set in putScans() as it depends on the downsample ratio
+        fbank = new FilterBank(graphs.size(), 0., spec);
+        fbankChans.resize(graphs.size());
+        for (int i = 0; i < (int)fbankChans.size(); ++i) fbankChans[i] = params.isAuxChan(i) ? 0 : 1;
+    }
+    QSettings settings("janelia.hhmi.org", APPNAME);
+	settings.beginGroup("GraphsWindow");
+	settings.setValue("filterBank",b);
+}
+
+void GraphsWindow::refChk(bool b)
+{
+    QMutexLocker l(&graphsMut);
+
+    if (refStage) delete refStage, refStage = 0;
+    const ReferenceStage::Spec spec = ReferenceStage::Spec::fromString(mainApp()->refStageSpec());
+    refChkBox->setToolTip(QString("Re-reference the graphs using '%1'. Set it from the console window's Options->Reference Stage... menu.").arg(spec.toString()));
+    if (b) {
+        std::vector<unsigned char> chans(graphs.size());
+        for (int i = 0; i < (int)chans.size(); ++i) chans[i] = params.isAuxChan(i) ? 0 : 1;
+        refStage = new ReferenceStage(graphs.size(), spec, chans.size() ? &chans[0] : 0);
+    }
+    QSettings settings("janelia.hhmi.org", APPNAME);
+	settings.beginGroup("GraphsWindow");
+	settings.setValue("refStage",b);
+}
+
 double GraphsWindow::GraphStats::rms() const {  return sqrt(rms2()); }
 
 double GraphsWindow::GraphStats::stdDev() const
@@ -22,6 +22,8 @@ class QFrame;
 class QDoubleSpinBox;
 class QCheckBox;
 class HPFilter;
+class FilterBank;
+class ReferenceStage;
 class QLed;
 class QPushButton;
 class QTabWidget;
@@ -118,6 +120,8 @@ protected:
 private slots:
     void updateGraphs();
     void hpfChk(bool checked);
+    void fbankChk(bool checked);
+    void refChk(bool checked);
     void pauseGraph();
     void toggleMaximize();
     void selectGraph(int num);
@@ -182,7 +186,7 @@ private:
     QPushButton *chanBut;
 	QLabel *chanLbl;
     QDoubleSpinBox *graphYScale, *graphSecs;
-    QCheckBox *highPassChk, *toggleSaveChk, *downsampleChk;
+    QCheckBox *highPassChk, *fbankChkBox, *refChkBox, *toggleSaveChk, *downsampleChk;
     QLineEdit *saveFileLE;
     QPushButton *graphColorBut;
     QVector<Vec2fWrapBuffer> points;
@@ -212,6 +216,9 @@ private:
     QAction *pauseAct, *maxAct, *applyAllAct;
     GLGraph *maximized; ///< if not null, a graph is maximized 
     HPFilter *filter;
+    FilterBank *fbank; ///< optional, user-configured filter bank, applied after the HPFilter
+    std::vector<unsigned char> fbankChans; ///< which graphs fbank filters -- all but the aux chans
+    ReferenceStage *refStage; ///< optional, user-configured CAR/median re-referencing, applied after fbank
     Vec2 lastMousePos;
     int lastMouseOverGraph;
     int selectedGraph;
@@ -3,6 +3,11 @@
 #ifndef M_PI
 # define M_PI           3.14159265358979323846
 #endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define HPFILTER_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
+
 HPFilter::HPFilter(unsigned ssize, double coff)
 {
     setScanSize(ssize);
@@ -11,8 +16,10 @@ HPFilter::HPFilter(unsigned ssize, double coff)
 
 void HPFilter::setScanSize(unsigned ss)
 {
+    nChans = ss;
     state.clear();
-    state.resize(ss, 0.);
+    state.resize(ss, 0.f);
+    chanMask.clear();
     lastDt = 0.;    
     virgin = true;
 }
@@ -27,29 +34,70 @@ void HPFilter::setCutoffFreqHz(double f)
 
 void HPFilter::apply(short *scan, double dt)
 {
-	std::vector<bool> v;
-	v.resize(scanSize(), true);
-	apply(scan, dt, v);
+    apply(scan, 1, dt, 0);
 }
 
 void HPFilter::apply(short *scan, double dt, const std::vector<bool> & chans)
 {
 	if (chans.size() < scanSize()) return;
+    chanMask.resize(nChans);
+    for (unsigned i = 0; i < nChans; ++i) chanMask[i] = chans[i] ? 1 : 0;
+    apply(scan, 1, dt, nChans ? &chanMask[0] : 0);
+}
+
+void HPFilter::apply(short *scans, unsigned nScans, double dt, const unsigned char *chans)
+{
     if (dt <= 0.) return; // error!
+    if (!nChans || !nScans) return;
     if (lastDt != dt || virgin) {
         lastDt = dt;
         recomputeCoeffs();
     }
 
-    const int ss = scanSize();
-    for (int i = 0; i < ss; ++i) {
-		const double in = static_cast<double>(scan[i])/32768.;
-		state[i] = B * in + A * state[i];            
-		double out =  in - state[i];            
-		if (out > 1.0) out = 1.0;
-		else if (out < -1.0) out = -1.0;
-		if (chans[i])
-            scan[i] = static_cast<short>(out*32767.);
+    const int ss = int(nChans);
+    const float a = float(A), b = float(B);
+    float * const st = &state[0];
+#ifdef HPFILTER_USE_SSE2
+    const __m128 va = _mm_set1_ps(a), vb = _mm_set1_ps(b),
+                 vInScale = _mm_set1_ps(1.f/32768.f), vOutScale = _mm_set1_ps(32767.f),
+                 vOne = _mm_set1_ps(1.f), vNegOne = _mm_set1_ps(-1.f);
+    const __m128i vZero = _mm_setzero_si128();
+#endif
+
+    for (unsigned s = 0; s < nScans; ++s) {
+        short * const scan = scans + size_t(s)*size_t(ss);
+        int i = 0;
+#ifdef HPFILTER_USE_SSE2
+        // 8 channels per iteration: widen to 2x4 floats, filter, clamp, and saturate-pack back to int16
+        for ( ; i+8 <= ss; i += 8) {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scan+i));
+            const __m128 in0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), vInScale),
+                         in1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), vInScale);
+            const __m128 s0 = _mm_add_ps(_mm_mul_ps(vb, in0), _mm_mul_ps(va, _mm_loadu_ps(st+i))),
+                         s1 = _mm_add_ps(_mm_mul_ps(vb, in1), _mm_mul_ps(va, _mm_loadu_ps(st+i+4)));
+            _mm_storeu_ps(st+i, s0);
+            _mm_storeu_ps(st+i+4, s1);
+            const __m128 out0 = _mm_min_ps(_mm_max_ps(_mm_sub_ps(in0, s0), vNegOne), vOne),
+                         out1 = _mm_min_ps(_mm_max_ps(_mm_sub_ps(in1, s1), vNegOne), vOne);
+            __m128i res = _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(out0, vOutScale)),
+                                          _mm_cvttps_epi32(_mm_mul_ps(out1, vOutScale)));
+            if (chans) {
+                // keep = 0xffff for channels we are *not* supposed to filter
+                const __m128i keep = _mm_cmpeq_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(chans+i)), vZero), vZero);
+                res = _mm_or_si128(_mm_andnot_si128(keep, res), _mm_and_si128(keep, x));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(scan+i), res);
+        }
+#endif
+        for ( ; i < ss; ++i) {
+            const float in = static_cast<float>(scan[i])/32768.f;
+            st[i] = b * in + a * st[i];
+            float out =  in - st[i];
+            if (out > 1.f) out = 1.f;
+            else if (out < -1.f) out = -1.f;
+            if (!chans || chans[i])
+                scan[i] = static_cast<short>(out*32767.f);
+        }
     }
     virgin = false;
 }
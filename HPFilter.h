@@ -3,8 +3,8 @@
 
 #include <vector>
 
-/// A high-pass filter.  Feed it a scan at a time and have it 
-/// high-pass filter based on the cutoff freq.
+/// A high-pass filter.  Feed it a scan (or a block of scans) at a time and 
+/// have it high-pass filter based on the cutoff freq.
 /// This is basically a biquad filter.
 class HPFilter
 {
@@ -14,7 +14,7 @@ public:
     double cutoffFreqHz() const { return cutoffHz; }
     
     void setScanSize(unsigned);
-    unsigned scanSize() const { return unsigned(state.size()); }
+    unsigned scanSize() const { return nChans; }
 
     /// Convolves the scan in-place using the filter
     void apply(short *scan, double dt);
@@ -25,11 +25,20 @@ public:
 	/// (NB: filter state is always updated for each chan even if filtering isn't applied)
 	void apply(short *scan, double dt, const std::vector<bool> & which_chans);
 
+    /// Block version of the above: convolves nScans contiguous scans (each scanSize() 
+    /// samples long) in-place.  If which_chans is not NULL, it should point to 
+    /// scanSize() bytes, where which_chans[i] != 0 -> filter channel i.
+    /// Per-channel state is kept in float and the inner loop runs across channels
+    /// using SSE2 (where available), so prefer this to calling apply() per scan.
+    void apply(short *scans, unsigned nScans, double dt, const unsigned char *which_chans = 0);
+
 private:
     void recomputeCoeffs();
 
     double cutoffHz, lastDt, A, B;
-    std::vector<double> state;
+    unsigned nChans;
+    std::vector<float> state; ///< one entry per channel
+    std::vector<unsigned char> chanMask; ///< scratch space for the std::vector<bool> version of apply()
     bool virgin;
     
 };
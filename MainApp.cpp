@@ -49,6 +49,10 @@
 #include "Bug_Popout.h"
 #include "FG_ConfigDialog.h"
 #include "ui_SampleBuf_Dialog.h"
+#include "FilterBank.h"
+#include "ReferenceStage.h"
+#include "RingGeometry.h"
+#include <QInputDialog>
 
 Q_DECLARE_METATYPE(unsigned);
 
@@ -92,12 +96,24 @@ MainApp::MainApp(int & argc, char ** argv)
 {
     got_sgl_ended = got_sgl_save = got_sgl_started = false;
     reader = 0;
+    preTrigScans = 0;
     gthread1 = gthread2 = 0;
     dthread = 0;
-    samplesBuffer = 0;
+    saveFilter = 0;
+    saveFilterStale = false;
+    saveRef = 0;
+    spikeDet = 0;
+    savedScanEnd = 0;
+    samplesBuffer = 0; samplesBufferBytes = 0;
     need2FreeSamplesBuffer = false;
     scanCt = 0;
     scanSkipCt = 0;
+    saverTel.setName("saver");
+    ringPageFixedNs = ringPagePerSampNs = 0.;
+    ringPageMs = SAMPLES_SHM_DESIRED_PAGETIME_MS;
+    statsWindow = 0;
+    statsText = 0;
+    statsTimer = 0;
 
 	QLocale::setDefault(QLocale::c());
 	setApplicationName("SpikeGL");
@@ -187,6 +203,7 @@ MainApp::MainApp(int & argc, char ** argv)
 MainApp::~MainApp()
 {
     stopTask();
+    Telemetry::Trace::stop();
     Log() << "Application shutting down..";
     Status() << "Application shutting down.";
     if (commandServer) delete commandServer, commandServer = 0;
@@ -252,6 +269,46 @@ void MainApp::toggleEnableDSFacility()
 	saveSettings();
 }
 
+void MainApp::toggleFilterBankOnSave()
+{
+    fbankOnSave = !fbankOnSave;
+    if (isAcquiring())
+        Warning() << "'Apply Filter Bank When Saving' will take effect on the next acquisition.";
+    saveSettings();
+}
+
+void MainApp::toggleRefStageOnSave()
+{
+    if (!refOnSave && QMessageBox::question(consoleWindow, "Apply Reference Stage When Saving",
+                                            "With this on, the re-referenced signal is saved to disk *instead of* the raw data, and the raw data cannot be recovered from the file.\n\n"
+                                            "The reference stage used is recorded in each file's .meta file (referenceStage).\n\nSave re-referenced data?",
+                                            QMessageBox::Yes|QMessageBox::No, QMessageBox::No) != QMessageBox::Yes) {
+        refStageOnSaveAct->setChecked(false);
+        return;
+    }
+    refOnSave = !refOnSave;
+    if (isAcquiring())
+        Warning() << "'Apply Reference Stage When Saving' will take effect on the next acquisition.";
+    saveSettings();
+}
+
+void MainApp::toggleSpikeDetection()
+{
+    spikeDetEnabled = !spikeDetEnabled;
+    if (isAcquiring())
+        Warning() << "'Online Spike Detection' will take effect on the next acquisition.";
+    saveSettings();
+}
+
+bool MainApp::getRecentSpikes(u64 since, std::vector<SpikeDetector::Spike> & out, u64 *next_since)
+{
+    QMutexLocker l(&mut);
+    if (!spikeDet) return false;
+    const u64 n = spikeDet->recentSpikes(since, out);
+    if (next_since) *next_since = n;
+    return true;
+}
+
 bool MainApp::isShiftPressed()
 {
     return (keyboardModifiers() & Qt::ShiftModifier);
@@ -420,8 +477,16 @@ void MainApp::loadSettings()
 
 	dsFacilityEnabled = settings.value("dsFacilityEnabled", false).toBool();
     tmpDataFile.setTempFileSize(settings.value("dsTemporaryFileSize", 1048576000).toLongLong());
+    fbankOnSave = settings.value("filterBankOnSave", false).toBool();
+    refOnSave = settings.value("refStageOnSave", false).toBool();
+    spikeDetEnabled = settings.value("spikeDetection", false).toBool();
+    spikeThreshMAD = settings.value("spikeThreshMAD", 5.0).toDouble();
+    ringPageFixedNs = settings.value("ringPageFixedNs", 0.).toDouble();
+    ringPagePerSampNs = settings.value("ringPagePerSampNs", 0.).toDouble();
 
     mut.lock();
+    fbankSpec = settings.value("filterBankSpec", "bp=300-6000;notch=60x3;q=30").toString();
+    refSpec = settings.value("refStageSpec", "ref=median").toString();
 #ifdef Q_OS_WIN
     outDir = settings.value("outDir", "c:/users/code").toString();
 #else
@@ -454,6 +519,7 @@ void MainApp::loadSettings()
         p.regularMB = settings.value("BufSize_RegularAcq_MB", unsigned(DEF_SAMPLES_SHM_SIZE_REG)/(1024U*1024U)).toUInt();
         p.fgShmMB = settings.value("BufSize_FGAcq_MB", unsigned(DEF_SAMPLES_SHM_SIZE_FG)/(1024U*1024U)).toUInt();
 #endif
+        p.largePages = settings.value("BufSize_LargePages", true).toBool();
     }
 }
 
@@ -468,11 +534,19 @@ void MainApp::saveSettings()
 
 	settings.setValue("dsFacilityEnabled", dsFacilityEnabled);
     settings.setValue("dsTemporaryFileSize", tmpDataFile.getTempFileSize());
+    settings.setValue("filterBankOnSave", fbankOnSave);
+    settings.setValue("refStageOnSave", refOnSave);
+    settings.setValue("spikeDetection", spikeDetEnabled);
+    settings.setValue("spikeThreshMAD", spikeThreshMAD);
+    settings.setValue("ringPageFixedNs", ringPageFixedNs);
+    settings.setValue("ringPagePerSampNs", ringPagePerSampNs);
 
 	settings.setValue("sortGraphsByElectrodeId", m_sortGraphsByElectrodeId);
 
     mut.lock();
     settings.setValue("outDir", outDir);
+    settings.setValue("filterBankSpec", fbankSpec);
+    settings.setValue("refStageSpec", refSpec);
     mut.unlock();
 	settings.setValue("lastFileOpenFile", lastOpenFile);
 	
@@ -498,6 +572,7 @@ void MainApp::saveSettings()
         settings.setValue("BufSize_RegularAcq_MB", p.regularMB);
         settings.setValue("BufSize_FGAcq_MB", p.fgShmMB);
 #endif
+        settings.setValue("BufSize_LargePages", p.largePages);
     }
 }
 
@@ -717,6 +792,14 @@ void MainApp::initActions()
     Connect( par2Act = new QAction("PAR2 Redundancy Tool", this),
              SIGNAL(triggered()), this, SLOT(showPar2Win()) );
 
+    Connect( statsAct = new QAction("Pipeline Stats...", this),
+             SIGNAL(triggered()), this, SLOT(showStatsWindow()) );
+
+    Connect( traceAct = new QAction("Record Pipeline Trace", this),
+             SIGNAL(triggered()), this, SLOT(toggleTrace()) );
+    traceAct->setCheckable(true);
+    traceAct->setChecked(false);
+
     Connect( stimGLIntOptionsAct = new QAction("StimGL Integration Options", this),
              SIGNAL(triggered()), this, SLOT(execStimGLIntegrationDialog()) );
 	
@@ -739,6 +822,30 @@ void MainApp::initActions()
 
     Connect( bufferSizesDialogAct = new QAction("Specify Realtime Buffer Sizes...", this),
              SIGNAL(triggered()), this, SLOT(execBufferSizesDialog()) );
+
+    Connect( filterBankAct = new QAction("Filter Bank...", this),
+             SIGNAL(triggered()), this, SLOT(execFilterBankDialog()) );
+
+    Connect( filterBankOnSaveAct = new QAction("Apply Filter Bank When Saving", this),
+             SIGNAL(triggered()), this, SLOT(toggleFilterBankOnSave()) );
+    filterBankOnSaveAct->setCheckable(true);
+    filterBankOnSaveAct->setChecked(fbankOnSave);
+
+    Connect( refStageAct = new QAction("Reference Stage...", this),
+             SIGNAL(triggered()), this, SLOT(execRefStageDialog()) );
+
+    Connect( refStageOnSaveAct = new QAction("Apply Reference Stage When Saving", this),
+             SIGNAL(triggered()), this, SLOT(toggleRefStageOnSave()) );
+    refStageOnSaveAct->setCheckable(true);
+    refStageOnSaveAct->setChecked(refOnSave);
+
+    Connect( spikeDetAct = new QAction("Online Spike Detection", this),
+             SIGNAL(triggered()), this, SLOT(toggleSpikeDetection()) );
+    spikeDetAct->setCheckable(true);
+    spikeDetAct->setChecked(spikeDetEnabled);
+
+    Connect( spikeThreshAct = new QAction("Spike Detection Threshold...", this),
+             SIGNAL(triggered()), this, SLOT(execSpikeThresholdDialog()) );
 	
 	Connect( fileOpenAct = new QAction("Open... &O", this), SIGNAL(triggered()), this, SLOT(fileOpen())); 
 	
@@ -749,13 +856,60 @@ void MainApp::initActions()
 	sortGraphsByElectrodeAct->setChecked(m_sortGraphsByElectrodeId);
 }
 
-static inline unsigned long computeSamplesShmPageSize(double samplingRateHz, unsigned scanSizeSamps, bool lowLatency, unsigned metaBytesPerScan = 0, unsigned *metaBytesPerPage = 0) {
-    unsigned long oneScanBytes = scanSizeSamps * sizeof(int16);
-    unsigned long nScansPerPage = (unsigned long)qRound(samplingRateHz * double((double)SAMPLES_SHM_DESIRED_PAGETIME_MS/1000.0));
-    if (lowLatency) nScansPerPage /= 2;
-    if (!nScansPerPage) nScansPerPage = 1;
-    if (metaBytesPerPage) *metaBytesPerPage = nScansPerPage * metaBytesPerScan;
-    return nScansPerPage*oneScanBytes + metaBytesPerScan*nScansPerPage;
+/// Picks this acquisition's sample ring page size.  Pages are as long as the latency target allows
+/// (SAMPLES_SHM_DESIRED_PAGETIME_MS, halved for low latency), and no bigger than SAMPLES_SHM_MAX_PAGE_BYTES so that high
+/// channel count runs still get fine grained triggers and graphs.  Unless the ring consumers' cost measured last time
+/// says pages that small would overrun them: then pages grow just enough to keep the slowest consumer under
+/// SAMPLES_SHM_MAX_CONSUMER_LOAD, since a fixed per-page cost is amortized over more scans the bigger the page.
+/// Whatever the cost, pages stay small enough for ringBytes to hold SAMPLES_SHM_MIN_PAGES of them, and twice the
+/// pre-trigger window's pages with room to spare.  The computation is RingGeometry's, shared with the benchmarks.
+unsigned long MainApp::ringPageSize(const DAQ::Params & p, unsigned long ringBytes, unsigned metaBytesPerScan, unsigned *metaBytesPerPage)
+{
+    RingGeometry g;
+    g.srate = p.srate;
+    g.nChans = p.nVAIChans;
+    g.oneScanBytes = p.nVAIChans * sizeof(int16) + metaBytesPerScan;
+    g.lowLatency = p.lowLatency;
+    g.ringBytes = ringBytes;
+    g.preTrigScans = preTrigScans;
+    g.fixedNs = ringPageFixedNs;
+    g.perSampNs = ringPagePerSampNs;
+    g.compute();
+    if (g.perSampLoad >= SAMPLES_SHM_MAX_CONSUMER_LOAD)
+        Warning() << "Sample ring consumers were measured at " << g.perSampLoad*100. << "% of real time at " << p.nVAIChans << " channels, " << p.srate << " Hz, before any per-page cost -- expect overruns.";
+    else if (double(g.wantScans) > g.timeScans + .5)
+        Debug() << "Sample ring pages grown from " << qRound(g.timeScans) << " to " << g.wantScans << " scans to amortize the consumers' " << ringPageFixedNs/1e3 << " us per-page cost.";
+    if (g.scansPerPage != g.wantScans)
+        Log() << "Sample ring pages clamped from " << g.wantScans << " to " << g.scansPerPage << " scans, to fit at least " << SAMPLES_SHM_MIN_PAGES << " pages" << (preTrigScans ? " and the pre-trigger window" : "") << " in the " << ringBytes/(1024*1024) << " MB sample buffer.";
+    ringPageMs = g.pageMs();
+    if (metaBytesPerPage) *metaBytesPerPage = g.scansPerPage * metaBytesPerScan;
+    return g.pageBytes();
+}
+
+/// Updates ringPageFixedNs/ringPagePerSampNs from the consumer stages' telemetry for the acquisition that's ending.
+/// Call before the GraphingThreads go away.  A stage's cheapest page bounds its fixed per-page cost from above,
+/// and whatever is left of its median is put down to the samples.  The median, not the mean, so that the saver's
+/// occasional long stalls on the disk (and the graphs' on the GUI) don't pass for a cost that bigger pages could
+/// amortize.  The worst stage's numbers are kept.
+void MainApp::measureRingCost(unsigned nChans, unsigned scansPerPage)
+{
+    if (!nChans || !scansPerPage) return;
+    double fixedNs = 0., perSampNs = 0.;
+    bool any = false;
+    QList<Telemetry::Snapshot> snaps = Telemetry::Stage::snapshotAll();
+    for (QList<Telemetry::Snapshot>::const_iterator it = snaps.begin(); it != snaps.end(); ++it) {
+        if (it->name != "saver" && !it->name.startsWith("graph ")) continue;
+        if (it->work.n < 100) continue; // too short a run to say anything
+        const double a = double(it->work.min), med = double(it->work.percentile(50.)),
+                     b = (med > a ? med - a : 0.) / (double(nChans) * scansPerPage);
+        if (a > fixedNs) fixedNs = a;
+        if (b > perSampNs) perSampNs = b;
+        any = true;
+    }
+    if (!any) return;
+    ringPageFixedNs = fixedNs;
+    ringPagePerSampNs = perSampNs;
+    Debug() << "Sample ring consumer cost: " << fixedNs/1e3 << " us per page + " << perSampNs << " ns per sample.";
 }
 
 
@@ -772,6 +926,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     fgWindow = 0;
     scanCt = 0;
     scanSkipCt = 0;
+    saverTel.reset();
     lastScanSz = 0;
 	stopRecordAtSamp = -1;
     tNow = getTime();
@@ -787,6 +942,12 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         return false;
     }
     DAQ::Params & params(doBugAcqInstead ? bugConfig->acceptedParams : (doFGAcqInstead ? fgConfig->acceptedParams : configCtl->acceptedParams));    
+    params.filterBankSpec = "";
+    if (fbankOnSave) {
+        FilterBank::Spec fbs = FilterBank::Spec::fromString(filterBankSpec());
+        if (!fbs.isNull()) params.filterBankSpec = fbs.toString(); // so that it ends up in the .meta file
+    }
+    params.refStageSpec = refOnSave ? ReferenceStage::Spec::fromString(refStageSpec()).toString() : QString("");
     lastNPDSamples.clear();
     lastNPDSamples.reserve(params.pdThreshW);
     if (!params.stimGlTrigResave) {
@@ -795,6 +956,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
             errMsg = QString("Could not open data file `%1'!").arg(params.outputFile);
             return false;
         }
+        spikeSidecarOpen();
 		QString fnameBinLog = params.outputFile.replace(".bin", "").append("_all.bin");
 		if (!dataFileLog.openForWrite(params, fnameBinLog)) {
 			errTitle = "Error Opening File!";
@@ -804,7 +966,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         if (!queuedParams.isEmpty()) stimGL_SaveParams("", queuedParams);
     }
 
-    if (samplesBuffer && need2FreeSamplesBuffer)  free(samplesBuffer);
+    if (samplesBuffer && need2FreeSamplesBuffer)  freeSampleBuffer(samplesBuffer, samplesBufferBytes);
     samplesBuffer = 0; need2FreeSamplesBuffer = false;
 
     int shmSizeMB = doFGAcqInstead ? bufSizesParams.fgShmMB : bufSizesParams.regularMB;
@@ -814,7 +976,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     if (doFGAcqInstead) {
         if (!shm.isAttached()) {
 #if QT_VERSION >= 0x040800
-            shm.setNativeKey(SAMPLES_SHM_NAME);
+            shm.setNativeKey(DAQ::FGTask::samplesShmNativeKey());
 #else
             shm.setKey(SAMPLES_SHM_NAME);
 #endif
@@ -850,16 +1012,24 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         }
         samplesBuffer = shm.data();
         need2FreeSamplesBuffer = false;
-    } else { // not framegrabber acq, so don't use  a SHM, instead just malloc the required memory
+        // FG_SpikeGL maps this segment too, through QSharedMemory, so it stays on regular pages -- but fault it all in
+        // now and pin it, rather than take page faults (or get paged out) during the first minutes of acquisition
+        QString how;
+        prefaultAndLock(samplesBuffer, quint64(shmSizeBytes), &how);
+        samplesBufferBytes = quint64(shmSizeBytes);
+        Debug() << "'" << SAMPLES_SHM_NAME << "' shm segment " << how;
+    } else { // not framegrabber acq, so don't use  a SHM, instead just allocate the required memory
         need2FreeSamplesBuffer = false;
-        samplesBuffer = malloc(shmSizeBytes);
+        QString how;
+        samplesBuffer = allocSampleBuffer(quint64(shmSizeBytes), bufSizesParams.largePages, &how);
+        samplesBufferBytes = quint64(shmSizeBytes);
         if (!samplesBuffer) {
             errTitle = "Not Enough Memory";
             errMsg = QString("Failed to allocate a sample buffer of size ") + QString::number(shmSizeMB) + " MB.\n\nSpikeGL requires a large sample buffer to avoid potential overruns.  Free up some memory or upgrade your system! ";
             return false;
         }
         need2FreeSamplesBuffer = true;
-        Log() << "Successfully created '" << SAMPLES_SHM_NAME <<"' sample buffer size " << QString::number(shmSizeMB) << "MB";
+        Log() << "Successfully created '" << SAMPLES_SHM_NAME <<"' sample buffer size " << QString::number(shmSizeMB) << "MB: " << how;
     }
 
 	// re-set the data temp file, delete it, etc
@@ -876,37 +1046,18 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     acqStartingDialog->open();
     // end acq starting dialog block
     
-	// Initialize ephys acquisition circular buffer
-    preBuf.clear();
-    preBuf.reserve(0);
+	// Size the pre-trigger window.  The scans themselves are not copied anywhere -- on trigger they are written
+	// straight out of the pages still sitting in the sample ring, see writePreTriggerScans()
+    preTrigScans = 0;
     if (params.usePD && (params.acqStartEndMode == DAQ::PDStart || params.acqStartEndMode == DAQ::PDStartEnd
 						 || params.acqStartEndMode == DAQ::AITriggered || params.acqStartEndMode == DAQ::Bug3TTLTriggered)) {
         const double sil = params.silenceBeforePD > 0. ? params.silenceBeforePD : DEFAULT_PD_SILENCE;
         if (params.stimGlTrigResave) pdWaitingForStimGL = true;
-        int szSamps = params.nVAIChans*params.srate*sil;
-        if (szSamps <= 0) szSamps = params.nVAIChans;
-        if (szSamps % params.nVAIChans) 
-            szSamps += params.nVAIChans - szSamps%params.nVAIChans;
-        preBuf.reserve(szSamps*sizeof(int16));
-		char *mem = new char[preBuf.capacity()];
-		memset(mem, 0, preBuf.capacity());
-		preBuf.putData(mem, preBuf.capacity());
-		delete [] mem;
-    }
-
-	// Initialize ephys acquisition block metadata circular buffer
-	preBufMeta.clear();
-	preBufMeta.reserve(0);
-	if (params.usePD && (params.acqStartEndMode == DAQ::PDStart || params.acqStartEndMode == DAQ::PDStartEnd
-		|| params.acqStartEndMode == DAQ::AITriggered || params.acqStartEndMode == DAQ::Bug3TTLTriggered)) {
-		const double sil = params.silenceBeforePD > 0. ? params.silenceBeforePD : DEFAULT_PD_SILENCE;
-		int szMeta = qCeil(params.srate * sil / DAQ::BugTask::SpikeGLScansPerBlock);
-		preBufMeta.reserve(szMeta * sizeof(DAQ::BugTask::BlockMetaData));
-		char *mem = new char[preBufMeta.capacity()];
-		memset(mem, 0, preBufMeta.capacity());
-		preBufMeta.putData(mem, preBufMeta.capacity());
-		delete[] mem;
-	}
+        preTrigScans = unsigned(qCeil(params.srate*sil));
+        if (!preTrigScans) preTrigScans = 1;
+    }
+    save_filtered.clear();
+    save_filtered_pnum.clear();
 
     if (doFGAcqInstead) {
         if (params.fg.disableChanMap) {
@@ -1020,7 +1171,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
         graphsWindow->setTrigOverrideEnabled(false);
 
     if (reader) delete reader, reader = 0;
-    reader = new PagedScanReader(params.nVAIChans, 0, samplesBuffer, shmSizeBytes, computeSamplesShmPageSize(params.srate,params.nVAIChans,params.lowLatency));
+    reader = new PagedScanReader(params.nVAIChans, 0, samplesBuffer, shmSizeBytes, ringPageSize(params, shmSizeBytes));
     reader->bzero();
 
 	DAQ::NITask *nitask = 0;
@@ -1031,16 +1182,42 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     } else if (doBugAcqInstead) {
         delete reader;  // need to force the page size to something smaller.. for bug's metadata requirements
         reader = new PagedScanReader(params.nVAIChans, sizeof(DAQ::BugTask::BlockMetaData), samplesBuffer, shmSizeBytes, DAQ::BugTask::requiredShmPageSize(params.nVAIChans));
+        ringPageMs = params.srate > 0. ? reader->scansPerPage() * 1000. / params.srate : double(SAMPLES_SHM_DESIRED_PAGETIME_MS);
         task = bugtask = new DAQ::BugTask(params, this, *reader);
     } else if (doFGAcqInstead) {
         delete reader; // need to force the page size to something that supports metadata
         unsigned metaSzPerPage = 0, metaBytesPerScan = sizeof(unsigned long long); // just take the latest 64-bit timestamp value per scan.. even though FPGA gives us a value per row
-        unsigned pgSize = computeSamplesShmPageSize(params.srate, params.nVAIChans, params.lowLatency, metaBytesPerScan, &metaSzPerPage);
+        unsigned pgSize = ringPageSize(params, shmSizeBytes, metaBytesPerScan, &metaSzPerPage);
         reader = new PagedScanReader(params.nVAIChans, metaSzPerPage, samplesBuffer, shmSizeBytes, pgSize);
         task = fgtask = new DAQ::FGTask(params, this, *reader);
         fgWindow = fgtask->dialogW;
     }
-    Debug() << "SamplesSHM Page Size: " << reader->pageSize() << " bytes (" << reader->scansPerPage() << " scans per page), " << reader->nPages() << " total pages";
+    // graphs may drop, the saver may never drop: the writer blocks briefly for it rather than overwrite unsaved pages
+    if (!reader->registerReader(PagedScanReader::MustNotDrop))
+        Warning() << "Could not register the data saver with the sample ring (out of reader slots); it will be treated like any other reader.";
+    Debug() << "SamplesSHM Page Size: " << reader->pageSize() << " bytes (" << reader->scansPerPage() << " scans per page, " << ringPageMs << " ms), " << reader->nPages() << " total pages";
+    if (preTrigScans && reader->scansPerPage()) {
+        const unsigned preTrigPages = (preTrigScans + reader->scansPerPage() - 1) / reader->scansPerPage();
+        // the pre-trigger pages have to survive in the ring while the saver lags behind the writer: hold the writer
+        // back from them, but leave it at least half the ring
+        if (preTrigPages*2 >= reader->nPages())
+            Warning() << "Pre-trigger window of " << preTrigScans << " scans (" << preTrigPages << " pages) is large relative to the " << reader->nPages() << "-page sample buffer; pre-trigger data may be lost if saving falls behind.  Consider increasing the sample buffer size.";
+        reader->setRetainPages(qMin(preTrigPages, reader->nPages()/2));
+    }
+
+    if (saveFilter) delete saveFilter, saveFilter = 0;
+    if (saveRef) delete saveRef, saveRef = 0;
+    saveFilterStale = false;
+    saveFilterChans.resize(params.nVAIChans);
+    for (unsigned i = 0; i < params.nVAIChans; ++i) saveFilterChans[i] = params.isAuxChan(i) ? 0 : 1;
+    if (params.refStageSpec.length()) {
+        saveRef = new ReferenceStage(params.nVAIChans, ReferenceStage::Spec::fromString(params.refStageSpec), &saveFilterChans[0]);
+        Warning() << "Reference stage '" << params.refStageSpec << "' (" << saveRef->numGroups() << " channel groups) will be applied to saved data -- the raw data will not be saved.";
+    }
+    if (params.filterBankSpec.length()) {
+        saveFilter = new FilterBank(params.nVAIChans, params.srate, FilterBank::Spec::fromString(params.filterBankSpec));
+        Log() << "Filter bank '" << params.filterBankSpec << "' (" << saveFilter->numSections() << " biquad sections) will be applied to saved data.";
+    }
 
     if (gthread1) delete gthread1, gthread1 = 0;
     if (gthread2) delete gthread2, gthread2 = 0;
@@ -1048,6 +1225,17 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     gthread1 = new GraphingThread(graphsWindow, *reader, params);
     gthread2 = new GraphingThread(spatialWindow, *reader, params);
 
+    mut.lock();
+    if (spikeDet) delete spikeDet, spikeDet = 0;
+    if (spikeDetEnabled) {
+        SpikeDetector::Config sdc;
+        sdc.threshMAD = spikeThreshMAD;
+        // the sidecar lives next to the data file, eg foo.bin -> foo.spikes, and only while one is open.
+        // spikeSidecarOpen()/closeSidecars() follow the data file as it gets opened and closed
+        spikeDet = new SpikeDetector(*reader, params, spikeSidecarFileName(), sdc);
+    }
+    mut.unlock();
+
 	doBugAcqInstead = false;
 	doFGAcqInstead = false;
     Connect(task, SIGNAL(bufferOverrun()), this, SLOT(gotBufferOverrun()));
@@ -1086,6 +1274,7 @@ bool MainApp::startAcq(QString & errTitle, QString & errMsg)
     Connect(task, SIGNAL(gotFirstScan()), this, SLOT(gotFirstScan()));
     if (gthread1) gthread1->start(QThread::LowPriority);
     if (gthread2) gthread2->start(QThread::LowestPriority);
+    if (spikeDet) spikeDet->startDetecting(QThread::LowPriority);
     dthread = new DataSavingThread(this);
     dthread->start(QThread::HighPriority);
     task->start();
@@ -1201,11 +1390,12 @@ void MainApp::stopTask()
 	
     if (!task) return;
     if (task->isRunning()) task->stop();
+    if (reader) measureRingCost(reader->scanSizeSamps(), reader->scansPerPage());
     if (gthread1) delete gthread1, gthread1 = 0;
     if (gthread2) delete gthread2, gthread2 = 0;
     if (dthread) {
         QMessageBox *mb = 0;
-        if ((reader->latest() - reader->latestPageRead()) * SAMPLES_SHM_DESIRED_PAGETIME_MS > 500) {
+        if ((reader->latest() - reader->latestPageRead()) * ringPageMs > 500.) {
             // if we are more than 500ms behind in data saving, indicate there will be a delay
             // in ending the acquisition to the user via a messagebox..
             mb=new QMessageBox ( QMessageBox::Information, "Saving Data...", "Saving pending data, please wait...", QMessageBox::Ok, consoleWindow, Qt::WindowFlags(Qt::Dialog| Qt::MSWindowsFixedSizeDialogHint));
@@ -1217,6 +1407,23 @@ void MainApp::stopTask()
         delete dthread, dthread = 0; // delete data saving thread.  this may block for a little bit as the data saving thread reads old data, depending on the stop condition.
         if (mb) delete mb;
     }
+    if (spikeDet) {
+        // after the saver, so the sidecar ends where the data file does.  The workers finish what is left in the ring
+        closeSidecars();
+        mut.lock();
+        SpikeDetector *sd = spikeDet;
+        spikeDet = 0;
+        mut.unlock();
+        Log() << "Spike detection: " << sd->spikeCount() << " spikes detected" << (sd->sidecarFileName().length() ? QString(", saved to ") + sd->sidecarFileName() : QString("")) << ".";
+        delete sd; // stops the threads, flushes and closes the sidecar
+    }
+    if (reader) {
+        if (reader->forcedDrops())
+            Warning() << "The sample ring writer had to overwrite " << reader->forcedDrops() << " pages the data saver had not saved yet, after waiting up to " << SAMPLES_SHM_MAX_WRITER_BLOCK_MS << " ms for it each time.  Saving too slow for the acquisition?";
+        reader->unregisterReader(); // the ring memory goes away before the reader does, in the next startAcq()
+    }
+    if (saveFilter) delete saveFilter, saveFilter = 0;
+    if (saveRef) delete saveRef, saveRef = 0;
     if (bugWindow) {
 		windowMenuRemove(bugWindow);
 		delete bugWindow, bugWindow = 0;
@@ -1253,10 +1460,11 @@ void MainApp::stopTask()
     unsigned long bufSize = reader ? reader->totalSize() : 0;
     if (reader) delete reader, reader = 0;
     if (need2FreeSamplesBuffer && samplesBuffer) {
-        free(samplesBuffer);
+        freeSampleBuffer(samplesBuffer, samplesBufferBytes);
         Log() << "Freed `" << SAMPLES_SHM_NAME << "' sample buffer of size " << (bufSize/(1024*1024)) << "MB";
     }
     if (shm.isAttached()) {
+        unlockBuffer(shm.data(), samplesBufferBytes);
         shm.detach();
         Log() << "Deleted `" << SAMPLES_SHM_NAME << "' shm of size " << (bufSize/(1024*1024)) << "MB";
     }
@@ -1296,28 +1504,81 @@ void MainApp::gotTaskWarning(const QString & e)
 }
 
 
-/* static */
-void MainApp::prependPrebufToScans(const WrapBuffer & preBuf, std::vector<int16> & scans, int & num, int skip)
+void MainApp::writeScansToDataFile(const DAQ::Params & p, const int16 *scans, unsigned nScans)
 {
-	if (scans.capacity() < (preBuf.size() / sizeof(int16))) scans.reserve(preBuf.size() / sizeof(int16));
-	void *ptr = 0;
-	unsigned lenBytes = 0, lenElems = 0;
-	preBuf.dataPtr1(ptr, lenBytes);
-	lenElems = lenBytes / sizeof(int16);
-	num = 0;
-	if (ptr && skip < (int)lenElems) {
-		scans.insert(scans.begin(), reinterpret_cast<int16 *>(ptr) + skip, reinterpret_cast<int16 *>(ptr) + skip + (lenElems - skip));
-		num += lenElems - skip;
-	}
-	skip -= lenElems;
-	if (skip < 0) skip = 0;
-	preBuf.dataPtr2(ptr, lenBytes);
-	lenElems = lenBytes / sizeof(int16);
-	if (ptr && skip < (int)lenElems) {
-		scans.insert(scans.begin() + num, reinterpret_cast<int16 *>(ptr) + skip, reinterpret_cast<int16 *>(ptr) + skip + (lenElems - skip));
-		num += lenElems - skip;
-	}
-	skip -= lenElems;
+    if (!nScans) return;
+    if (dataFile.numChans() == p.nVAIChans) {
+        dataFile.writeScans(scans, nScans);
+        return;
+    }
+    // need to subset the chans here.  a bit costly performance-wise.. we can optimize this further if need be by doing it on multiple cores at once using QConcurrent or somesuch mechanism
+    save_subset.resize(0);
+    save_subset.reserve(size_t(nScans)*dataFile.numChans());
+    for (unsigned s = 0; s < nScans; ++s, scans += p.nVAIChans)
+        for (unsigned c = 0; c < p.nVAIChans; ++c)
+            if (p.demuxedBitMap.testBit(c)) save_subset.push_back(scans[c]);
+    dataFile.writeScans(save_subset);
+}
+
+u64 MainApp::writePreTriggerScans(const DAQ::Params & p, i32 triggerOffset)
+{
+    const unsigned spp = reader->scansPerPage(), nsamps = spp*reader->scanSizeSamps();
+    const unsigned trigScan = unsigned(triggerOffset) / p.nVAIChans;
+    if (!spp || trigScan >= preTrigScans) return 0; // the whole window lies within the current page, which the caller writes
+    const unsigned need = preTrigScans - trigScan, npages = (need + spp - 1) / spp;
+    const unsigned pnum = reader->latestPageRead();
+    const unsigned nslots = unsigned(save_filtered_pnum.size());
+    const bool filtered = saveFilter || saveRef;
+    const bool wantMeta = bugWindow && reader->metaDataSizeBytes() >= unsigned(sizeof(DAQ::BugTask::BlockMetaData));
+    u64 written = 0, missing = 0;
+    unsigned nMeta = 0;
+    pretrig_page.resize(nsamps);
+    pretrig_meta.resize(wantMeta ? reader->metaDataSizeBytes() : 0);
+
+    for (unsigned back = npages; back >= 1; --back) {
+        const unsigned first = back == npages ? npages*spp - need : 0; // the oldest page may be only partly inside the window
+        const unsigned n = spp - first;
+        // pages within the saver's retainPages() are held back from the writer, so they're written straight out of the
+        // ring.  Older ones are copied out first, in case the writer gets to the page while we're writing it
+        const bool held = reader->isRetained(back);
+        const int16 *ringPage = 0;
+        if (held) {
+            void *meta = 0;
+            ringPage = reader->pastPage(back, wantMeta ? &meta : 0);
+            if (ringPage && wantMeta && meta) memcpy(&pretrig_meta[0], meta, pretrig_meta.size());
+        } else if (reader->copyPastPage(back, &pretrig_page[0], wantMeta ? &pretrig_meta[0] : 0))
+            ringPage = &pretrig_page[0];
+        const int16 *page = ringPage;
+        if (page && filtered) {
+            // the ring only has the raw scans -- the filtered version of the page is in its save_filtered slot, if still there
+            const unsigned slot = (pnum - back) % (nslots ? nslots : 1);
+            page = nslots && save_filtered_pnum[slot] == pnum - back ? &save_filtered[size_t(slot)*nsamps] : 0;
+        }
+        if (!page) {
+            // before the start of the acquisition or lost to an overflow: pad with silence like we always have
+            if (pnum > back) dataFile.pushBadData(dataFile.scanCount(), n);
+            prebuf_scans.assign(size_t(n)*p.nVAIChans, 0);
+            writeScansToDataFile(p, &prebuf_scans[0], n);
+            missing += n;
+            continue;
+        }
+        writeScansToDataFile(p, page + size_t(first)*p.nVAIChans, n);
+        written += n;
+        if (held && page == ringPage && reader->pastPage(back) != ringPage) {
+            // the writer gave up waiting for us and overwrote it while we were saving it
+            Warning() << "Pre-trigger page " << (pnum - back) << " was overwritten while being saved; marking it as bad data.";
+            dataFile.pushBadData(dataFile.scanCount() - n, n);
+        }
+        if (wantMeta) {
+            DAQ::BugTask::BlockMetaData m;
+            memcpy(&m, &pretrig_meta[0], sizeof(m));
+            m.scansSz = nsamps;
+            bugWindow->writeMetaToBug3File(dataFile, m); // after the page's scans, so scan counts line up
+            ++nMeta;
+        }
+    }
+    Debug() << "Pre-trigger: wrote " << written << " scans from " << npages << " buffered pages" << (missing ? QString(" (%1 scans zero-padded)").arg(missing) : QString()) << (nMeta ? QString(", %1 Bug3 blocks").arg(nMeta) : QString());
+    return written + missing;
 }
 
 void MainApp::putRestarts(const DAQ::Params & p, u64 firstSamp, u64 restartNumScans) const
@@ -1366,10 +1627,13 @@ bool MainApp::sortGraphsByElectrodeId() const { return m_sortGraphsByElectrodeId
 
 
 MainApp::GraphingThread::GraphingThread(GenericGrapher *g, const PagedScanReader & psr, const DAQ::Params &p)
-    : QThread(dynamic_cast<QObject *>(g)), g(g), reader(psr), p(p), pleaseStop(false)
+    : QThread(dynamic_cast<QObject *>(g)), g(g), reader(psr), p(p), pleaseStop(false), tel(QString("graph ") + g->grapherName())
 {
     sampCount = 0ULL;
     reader.resetToBeginning();
+    // best effort: if the graphs fall more than about a second behind, skip ahead rather than draw stale data
+    const unsigned pagesPerSec = reader.scansPerPage() ? unsigned(p.srate / reader.scansPerPage()) : 0;
+    reader.registerReader(PagedScanReader::BestEffort, pagesPerSec > 2 ? pagesPerSec : 2);
 }
 
 MainApp::GraphingThread::~GraphingThread() {
@@ -1405,8 +1669,22 @@ void MainApp::GraphingThread::run()
                     sampCount += u64(droppedPageScans.size());
                 }
             }
+            const u64 t0 = Telemetry::now(), tCommit = reader.lastPageCommitTimeNS();
             if (g->threadsafeIsVisible()) g->putScans(scans, nChansPerScan*nScansPerPage, sampCount);
             sampCount += u64(nChansPerScan*nScansPerPage);
+
+            const u64 t1 = Telemetry::now();
+            {
+                Telemetry::Update u(tel);
+                u.work(t1 - t0);
+                if (tCommit && t0 > tCommit) u.residency(t0 - tCommit);
+                u.add(Telemetry::Pages);
+                u.add(Telemetry::Scans, u64(nScansPerPage));
+                if (skips > 0) u.add(Telemetry::Skips, u64(skips));
+                u.backlog(qint64(reader.latest()) - qint64(reader.latestPageRead()));
+            }
+            if (tCommit) tel.span("wait", tCommit, t0, reader.latestPageRead(), reader.lastPageFirstScan());
+            tel.span("page", t0, t1, reader.latestPageRead(), reader.lastPageFirstScan());
         }
     }
 
@@ -1463,10 +1741,43 @@ bool MainApp::taskReadFunc()
         scans = reader->next(&skips,&metaPtr,&scans_ret);
         gotSomething = !!scans;
 
-        if (!gotSomething) { break; }
+        if (!gotSomething) {
+            // nothing new in the ring: a good time to move spilled scans along
+            if (dataFile.isOpen() && !dataFile.isSpilling() && dataFile.spillPendingScans())
+                dataFile.drainSpill(u64(reader->scansPerPage())*SAMPLES_SHM_SPILL_DRAIN_PAGES);
+            break;
+        }
+        const u64 tPage0 = Telemetry::now(), tCommit = reader->lastPageCommitTimeNS();
+        const u64 pageNum = reader->latestPageRead(), pageScan0 = reader->lastPageFirstScan();
         if (scans_ret != reader->scansPerPage()) {
             Error() << "MainApp::taskReadFunc INTERNAL ERROR: scans_ret != scansPerPage -- FIXME!";
         }
+        // 'saveScans' is what gets written to disk (and pre-buffered).  Trigger detection always looks at the raw 'scans'.
+        const int16 *saveScans = scans;
+        // only worth filtering if the page may end up on disk: now, or later as part of a pre-trigger window
+        const bool mayBeSaved = dataFile.isOpen() || isDSFacilityEnabled() || (taskWaitingForTrigger && preTrigScans);
+        if ((saveFilter || saveRef) && mayBeSaved) {
+            // filtered pages go into a small ring of slots of their own, parallel to the sample ring, so that
+            // the pre-trigger window can be served from them without any extra copying
+            const unsigned spp = reader->scansPerPage(), nsamps = spp*reader->scanSizeSamps();
+            const unsigned nslots = (spp ? (preTrigScans + spp - 1) / spp : 0) + 1;
+            if (save_filtered_pnum.size() != nslots) {
+                save_filtered.resize(size_t(nsamps)*nslots);
+                save_filtered_pnum.assign(nslots, 0);
+            }
+            const unsigned pnum = reader->latestPageRead(), slot = pnum % nslots;
+            int16 * const dst = &save_filtered[size_t(slot)*nsamps];
+            memcpy(dst, scans, nsamps*sizeof(int16));
+            // the IIR state is only good for the page right after the last one filtered: start over after pages
+            // lost to an overflow, or after the pages we didn't filter because nothing was being saved
+            if (saveFilter && (skips > 0 || saveFilterStale)) saveFilter->reset();
+            saveFilterStale = false;
+            if (saveFilter) saveFilter->apply(dst, spp, &saveFilterChans[0]);
+            if (saveRef) saveRef->apply(dst, spp);
+            save_filtered_pnum[slot] = pnum;
+            saveScans = dst;
+        } else if (saveFilter)
+            saveFilterStale = true;
         if (skips>0) fakeDataSz = skips*reader->scansPerPage()*reader->scanSizeSamps();
         else fakeDataSz = -1;
         firstSamp += skips ? u64(fakeDataSz) : 0ULL;
@@ -1478,13 +1789,14 @@ bool MainApp::taskReadFunc()
             putRestarts(p, firstSamp, u64(fakeDataSz/p.nVAIChans));
         }
 
-        DAQ::BugTask::BlockMetaData *bugMeta = 0;
+        DAQ::BugTask::BlockMetaData *bugMeta = 0, bugMetaCopy;
         int useAltTrigIdx = -1; int16 altTrigThresh = -1;
 
         tNow = getTime();
 
         if (bugWindow && bugTask() && reader->metaDataSizeBytes() >= (int)sizeof(DAQ::BugTask::BlockMetaData) && metaPtr) {
-            bugMeta = reinterpret_cast<DAQ::BugTask::BlockMetaData *>(metaPtr);
+            memcpy(&bugMetaCopy, metaPtr, sizeof(bugMetaCopy)); // ring memory is the writer's, we don't write to it
+            bugMeta = &bugMetaCopy;
             if (p.bug.backupTrigger > -1 && bugMeta && bugMeta->missingFrameCount >= DAQ::BugTask::FramesPerBlock) {
                 useAltTrigIdx = p.bug.backupTrigger, altTrigThresh = p.bug.backupTriggerThresh;
             }
@@ -1495,9 +1807,9 @@ bool MainApp::taskReadFunc()
         }
 
         lastScanSz = reader->scansPerPage()*reader->scanSizeSamps();
+        if (bugMeta) bugMeta->scansSz = lastScanSz;
         scanCt = firstSamp/u64(p.nVAIChans) + u64(reader->scansPerPage());
         i32 triggerOffset = -1;
-        int prebufCopied = 0;
 
         if (taskWaitingForTrigger) { // task has been triggered , so save data, and graph it..
             if (!taskHasManualTrigOverride) {
@@ -1536,7 +1848,8 @@ bool MainApp::taskReadFunc()
                 QString fn = getNewDataFileName();
                 if (!dataFile.openForWrite(p, fn)) {
                     Error() << "Could not open data file `" << fn << "'!";
-                }
+                } else
+                    spikeSidecarOpen();
                 emit do_updateWindowTitles();
             }
 
@@ -1564,97 +1877,45 @@ bool MainApp::taskReadFunc()
                     // in SpikeGL
                     unsigned ndispscans = graphsWindow->grabAllScansFromDisplayBuffers(prebuf_scans);
                     Debug() << "Bug3 Mode: Manual trigger workaround: Grabbed " << ndispscans << " scans from display buffers and prepended to file...";
-                } else {
-                    // otherwise, do the normal prebuf prepend stuff here
-                    if (triggerOffset >= 0 && preBuf.size()) {
-                        prependPrebufToScans(preBuf, prebuf_scans, prebufCopied, triggerOffset);
-                    }
                 }
                 if (wasFakeData) {
                     // indicate bad data in output file..
                     dataFile.pushBadData(dataFile.scanCount(), fakeDataSz/p.nVAIChans);
                 }
 
-				// Write scans to file
-                if (dataFile.numChans() != p.nVAIChans) {
-                    //double ts = getTime();
-                    // need to subset the chans in-place here.  a bit costly performance-wise.. we can optimize this further if need be by doing it on multiple cores at once using QConcurrent or somesuch mechanism
-                    const int pbs = (int)prebuf_scans.size();
-                    const double ratio = dataFile.numChans() / double(p.nVAIChans ? p.nVAIChans : 1.);
-                    save_subset.resize(0);
-                    save_subset.reserve(qRound((pbs + n) * ratio) + 256);
-                    for (int i = 0; i < int(n+pbs); ++i) {
-                        const int rel = i % p.nVAIChans;
-                        if (p.demuxedBitMap.testBit(rel)) {
-                            if (i < pbs)
-                                save_subset.push_back(prebuf_scans[i]);
-                            else
-                                save_subset.push_back(scans[i-pbs]);
-                        }
-                    }
-                    //Debug() << "subsetting took: " << ((getTime()-ts)*1e3) << " ms";
-                    dataFile.writeScans(save_subset);
-                    if (bugWindow && bugMeta) {
-                        // bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
-                    }
-                } else {
-                    dataFile.writeScans(prebuf_scans);
-                    //if (prebuf_scans.size()) Debug() << "prebuf: wrote " << prebuf_scans.size()/p.nVAIChans << " prebuf scans";
-					dataFile.writeScans(scans, n/p.nVAIChans);
-                    //if (n != i64(scanSz)) Debug() << "writeScans: n=,scanSz=" << n << "," << scanSz << " difference is " << ((scanSz-n)/p.nVAIChans) << " scans.." << (n%p.nVAIChans ? "NOT ALIGNED" : "ALIGNED") ;
-                    if (bugWindow && bugMeta) {
-						// bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
-					}
+                // saving has fallen far enough behind that the ring writer will soon have to block for us, or lap us:
+                // the data file spills to a temp file until we catch up, then the spill drains back a few pages at a time
+                const unsigned lag = reader->lag();
+                if (!dataFile.isSpilling() && lag >= unsigned(reader->nPages()*SAMPLES_SHM_SPILL_LAG)) {
+                    if (dataFile.beginSpill())
+                        Warning() << "Data saving is " << lag << " of " << reader->nPages() << " sample buffer pages behind, spilling to a temp file until it catches up.";
+                } else if (dataFile.isSpilling() && lag <= unsigned(reader->nPages()*SAMPLES_SHM_SPILL_RESUME_LAG)) {
+                    dataFile.endSpill();
+                    Log() << "Data saving caught up, draining " << dataFile.spillPendingScans() << " spilled scans back into " << dataFile.fileName();
                 }
 
-
-				// Write any pre-trigger metadata to file... This is independent of the saved scan subset, hence we do this outside the if-else statements below
-				if (bugWindow) {
-					if (triggerOffset >= 0 && preBufMeta.size() > 0) {
-						// Are there any queued meta frames? If so, write them! Then erase queue, 
-						// so they don't get written twice
-						// This code is derived from MainApp::prependPrebufToScans...
-						//    -- First, compute blocks to skip
-						//       "triggerOffset" is specified in samples (i.e. not "set of <channelCount> samples", not frames, but individual numbers...)
-						//       Note that the "skip" number is rounded *down* to ensure complete metadata
-						int skip = triggerOffset / (p.nVAIChans * DAQ::BugTask::SpikeGLScansPerBlock);
-						
-						void* pMeta = 0;
-						unsigned lenBytes = 0, lenElems = 0, totElems = 0;
-						preBufMeta.dataPtr1(pMeta, lenBytes);
-						lenElems = lenBytes / sizeof(DAQ::BugTask::BlockMetaData);
-						void* pMetaEnd = (void*)(unsigned long(pMeta) + lenElems * sizeof(DAQ::BugTask::BlockMetaData));
-						if (pMeta) {
-							for (DAQ::BugTask::BlockMetaData* pBlock = ((DAQ::BugTask::BlockMetaData*)pMeta) + skip;
-								pBlock < pMetaEnd; pBlock++) {
-								totElems++;
-								bugWindow->writeMetaToBug3File(dataFile, *pBlock);
-							}
-						}
-						skip -= lenElems;
-						preBufMeta.dataPtr2(pMeta, lenBytes);
-						lenElems = lenBytes / sizeof(DAQ::BugTask::BlockMetaData);
-						pMetaEnd = (void*)(unsigned long(pMeta) + lenElems * sizeof(DAQ::BugTask::BlockMetaData));
-						if (pMeta) {
-							for (DAQ::BugTask::BlockMetaData* pBlock = ((DAQ::BugTask::BlockMetaData*)pMeta) + skip;
-								pBlock < pMetaEnd; pBlock++) {
-								totElems++;
-								bugWindow->writeMetaToBug3File(dataFile, *pBlock);
-							}
-						}
-
-						Log() << "Wrote " << totElems << " pre-buffered blocks to file (skipped " << skip << " elements).";
-					}
-
-					if (bugMeta) {
-						bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
-					}
+				// Write scans to file.  On a trigger event, the pre-trigger window goes first, straight out of the sample ring
+                if (prebuf_scans.size())
+                    writeScansToDataFile(p, &prebuf_scans[0], unsigned(prebuf_scans.size()/p.nVAIChans));
+                else if (triggerOffset >= 0 && preTrigScans)
+                    writePreTriggerScans(p, triggerOffset);
+                const u64 pageScan = firstSamp/u64(p.nVAIChans);
+                if (spikeDet) spikeDet->setSidecarStartScan(i64(pageScan) - i64(dataFile.scanCount())); // only the first page of the file counts
+                writeScansToDataFile(p, saveScans, unsigned(n/p.nVAIChans));
+                savedScanEnd = pageScan + u64(n/p.nVAIChans);
+
+				if (bugWindow && bugMeta) {
+					bugWindow->writeMetaToBug3File(dataFile, *bugMeta); // bugMetaFudge explanation: in order to make sure scan numbers in file line up with scan numbers in data file, make sure to writeScans() to the data file *before* calling this!
 				}
 
+                if (!dataFile.isSpilling() && dataFile.spillPendingScans())
+                    dataFile.drainSpill(u64(reader->scansPerPage())*SAMPLES_SHM_SPILL_DRAIN_PAGES);
+
                 if (doStopRecord) {
                     if (!p.stimGlTrigResave && p.acqStartEndMode != DAQ::AITriggered && p.acqStartEndMode != DAQ::Bug3TTLTriggered)
                         needToStop = true;
                     Debug() << "Post-untrigger window detection: Closing datafile because passed samp# stopRecordAtSamp=" << stopRecordAtSamp;
+                    closeSidecars();
                     dataFile.closeAndFinalize();
                     stopRecordAtSamp = -1;
                     emit do_updateWindowTitles();
@@ -1666,7 +1927,7 @@ bool MainApp::taskReadFunc()
             }
 
             if (isDSFacilityEnabled())
-                tmpDataFile.writeScans(scans, lastScanSz); // write all scans
+                tmpDataFile.writeScans(saveScans, lastScanSz); // write all scans
 
 
             if (tNow-lastSBUpd > 0.25) { // every 1/4th of a second
@@ -1677,6 +1938,7 @@ bool MainApp::taskReadFunc()
 
                 QString dfScanStr = "";
                 if (dataFile.isOpen()) dfScanStr = QString(" - ") + QString::number(dataFile.scanCount()) + " scans saved";
+                if (dataFile.isOpen() && dataFile.spillPendingScans()) dfScanStr += QString(" (") + QString::number(dataFile.spillPendingScans()) + " spilled)";
 
                 double bufferFill = (double(reader->latest() - reader->latestPageRead()) / reader->nPages()) * 1e2;
                 QString bufStr = QString(" - ") + QString::number(bufferFill,'f',2) + "% buf. lag ";
@@ -1701,14 +1963,24 @@ bool MainApp::taskReadFunc()
             Warning() << "The buffer: `" << (*it)->name << "' is " << double((buf->dataQueueSize()/double(buf->dataQueueMaxSize))*100.) << "% full! System too slow for the specified acquisition?";
         }
 
-        // normally *always* pre-buffer the scans since we may need them at any time on a re-trigger event
-        preBuf.putData(&scans[0], unsigned(lastScanSz*sizeof(scans[0])));
-
-		// Similarly, pre-buffer bug3 data
-		bugMeta->scansSz = lastScanSz;
-		preBufMeta.putData(bugMeta, sizeof(DAQ::BugTask::BlockMetaData));
+        // NB: no copying here -- the page (and its Bug3 metadata) stays in the sample ring for a while, which is what serves the pre-trigger window on a re-trigger event
 
         firstSamp += reader->scansPerPage()*reader->scanSizeSamps();
+
+        {
+            const u64 tPage1 = Telemetry::now();
+            {
+                Telemetry::Update u(saverTel);
+                u.work(tPage1 - tPage0);
+                if (tCommit && tPage0 > tCommit) u.residency(tPage0 - tCommit);
+                u.add(Telemetry::Pages);
+                u.add(Telemetry::Scans, reader->scansPerPage());
+                if (skips > 0) u.add(Telemetry::Skips, u64(skips));
+                u.backlog(qint64(reader->latest()) - qint64(reader->latestPageRead()));
+            }
+            if (tCommit) saverTel.span("wait", tCommit, tPage0, pageNum, pageScan0);
+            saverTel.span("page", tPage0, tPage1, pageNum, pageScan0);
+        }
     }
 
     if (taskShouldStop || needToStop) {
@@ -1729,7 +2001,7 @@ void MainApp::gotManualTrigOverride(bool b)
     } else {
         Status() << "PD/TTL Manual Trigger Override DISABLED";
         Log() << "PD/TTL Manual Trigger Override DISABLED, will close immediate data file and begin monitoring PD/TTL trigger events again.";
-        if (dataFile.isOpen()) dataFile.closeAndFinalize();
+        if (dataFile.isOpen()) closeSidecars(), dataFile.closeAndFinalize();
         updateWindowTitles();
     }
 }
@@ -1837,7 +2109,7 @@ bool MainApp::detectStopTask(const int16 * scans, unsigned sz, u64 firstSamp, in
         }
         if (firstSamp+u64(sz) - lastSeenPD > pdOffTimeSamps) { // timeout PD after X scans..
 			if (dataFile.isOpen()) {
-                stopRecordAtSamp = lastSeenPD + MAX((preBuf.capacity()/sizeof(int16)),pdOffTimeSamps) /**< NB: preBuf.capacity() is the amount of silence time before/after PD, scan-aligned! */;
+                stopRecordAtSamp = lastSeenPD + MAX(u64(preTrigScans)*u64(p.nVAIChans),pdOffTimeSamps) /**< NB: preTrigScans is the amount of silence time before/after PD */;
                 if (isBugAlt) stopRecordAtSamp = lastSeenPD + pdOffTimeSamps;
 				taskWaitingForStop = false;
 			} else {
@@ -1897,6 +2169,24 @@ void MainApp::triggerTask()
     }
 }
 
+QString MainApp::spikeSidecarFileName() const
+{
+    return dataFile.isOpen() ? baseName(dataFile.fileName()) + ".spikes" : QString();
+}
+
+void MainApp::spikeSidecarOpen()
+{
+    QMutexLocker l(&mut);
+    if (spikeDet) spikeDet->openSidecar(spikeSidecarFileName());
+}
+
+void MainApp::closeSidecars()
+{
+    QMutexLocker l(&mut);
+    if (spikeDet && dataFile.isOpen()) spikeDet->closeSidecar(savedScanEnd);
+    if (bugWindow) bugWindow->closeBug3File(); // the next data file gets a new one from writeMetaToBug3File()
+}
+
 void MainApp::updateWindowTitles()
 {
     const bool isOpen = dataFile.isOpen();
@@ -2212,6 +2502,7 @@ void MainApp::execBufferSizesDialog()
     w.fgShmSlider->setValue(p.fgShmMB > max ? max : p.fgShmMB);
     w.regularSB->setValue(p.regularMB > max ? max : p.regularMB);
     w.regularSlider->setValue(p.regularMB > max ? max : p.regularMB);
+    w.largePagesChk->setChecked(p.largePages);
     int ret = -999;
     bool again = false;
     while (ret == -999 || again) {
@@ -2252,13 +2543,84 @@ void MainApp::execBufferSizesDialog()
             /// else.. all good
             p.fgShmMB = fval;
             p.regularMB = rval;
+            p.largePages = w.largePagesChk->isChecked();
             saveSettings();
-            Log() << "User configued realtime sample buffer sizes as: NI/Bug=" << rval << " MB, FGShm=" << fval << " MB.";
+            Log() << "User configued realtime sample buffer sizes as: NI/Bug=" << rval << " MB" << (p.largePages ? " (large pages)" : "") << ", FGShm=" << fval << " MB.";
             return;
         }
     }
 }
 
+void MainApp::execFilterBankDialog()
+{
+    QString spec = filterBankSpec();
+    for (;;) {
+        bool ok = false;
+        spec = QInputDialog::getText(consoleWindow, "Filter Bank",
+                                     "Filter bank specification.  Semicolon-separated list of:\n\n"
+                                     "  bp=LO-HI  -- 4th order Butterworth band-pass (0 for either edge disables it)\n"
+                                     "  notch=HZxN  -- notch out HZ and its harmonics, N notches total\n"
+                                     "  q=Q  -- quality factor of the notches\n"
+                                     "  car  -- subtract the common average reference\n\n"
+                                     "Eg: bp=300-6000;notch=60x3;q=30;car",
+                                     QLineEdit::Normal, spec, &ok);
+        if (!ok) return;
+        FilterBank::Spec fbs = FilterBank::Spec::fromString(spec, &ok);
+        if (!ok) {
+            QMessageBox::warning(consoleWindow, "Invalid Filter Bank", QString("Could not parse filter bank specification '%1'.\n\nPlease try again.").arg(spec), QMessageBox::Ok);
+            continue;
+        }
+        mut.lock();
+        fbankSpec = fbs.toString();
+        mut.unlock();
+        saveSettings();
+        Log() << "Filter bank set to: '" << fbs.toString() << "'";
+        return;
+    }
+}
+
+void MainApp::execRefStageDialog()
+{
+    QString spec = refStageSpec();
+    for (;;) {
+        bool ok = false;
+        spec = QInputDialog::getText(consoleWindow, "Reference Stage",
+                                     "Per-scan re-referencing.  Semicolon-separated list of:\n\n"
+                                     "  ref=car|median  -- subtract the common average or the common median\n"
+                                     "  group=LO-HI  -- a channel group (inclusive), referenced independently.\n"
+                                     "                 May be repeated, but groups may not overlap.\n"
+                                     "                 No groups means all (non-aux) channels.\n\n"
+                                     "Eg: ref=median;group=0-63;group=64-127",
+                                     QLineEdit::Normal, spec, &ok);
+        if (!ok) return;
+        ReferenceStage::Spec rs = ReferenceStage::Spec::fromString(spec, &ok);
+        if (!ok) {
+            QMessageBox::warning(consoleWindow, "Invalid Reference Stage", QString("Could not parse reference stage specification '%1'.\n\nPlease try again.").arg(spec), QMessageBox::Ok);
+            continue;
+        }
+        mut.lock();
+        refSpec = rs.toString();
+        mut.unlock();
+        saveSettings();
+        Log() << "Reference stage set to: '" << rs.toString() << "'";
+        return;
+    }
+}
+
+void MainApp::execSpikeThresholdDialog()
+{
+    bool ok = false;
+    const double d = QInputDialog::getDouble(consoleWindow, "Spike Detection Threshold",
+                                             "Online spike detection threshold, as a multiple of the\n"
+                                             "noise standard deviation (estimated as median(|x|)/0.6745):",
+                                             spikeThreshMAD, 1.0, 50.0, 2, &ok);
+    if (!ok) return;
+    spikeThreshMAD = d;
+    saveSettings();
+    if (isAcquiring() && spikeDetEnabled)
+        Warning() << "The new spike detection threshold will take effect on the next acquisition.";
+}
+
 bool MainApp::setupStimGLIntegration(bool doQuitOnFail)
 {
     if (notifyServer) delete notifyServer;
@@ -2376,12 +2738,14 @@ void MainApp::trf_stimGL_PluginStarted(const QString &plugin, const QMap<QString
 				stopRecordAtSamp = -1;
 			}
 			Log() << "Data file: " << dataFile.fileName() << " closed by StimulateOpenGL.";
+			closeSidecars();
 			dataFile.closeAndFinalize();			
         }
         QString fn = getNewDataFileName(plugin);
         if (!dataFile.openForWrite(p, fn)) {
             QMessageBox::critical(0, "Error Opening File!", QString("Could not open data file `%1'!").arg(fn));
         } else {
+            spikeSidecarOpen();
             Log() << "Data file: " << dataFile.fileName() << " opened by StimulateOpenGL.";
         }
 
@@ -2441,6 +2805,7 @@ void MainApp::trf_stimGL_PluginEnded(const QString &plugin, const QMap<QString,
         trf_stimGL_SaveParams(plugin,pm);
 		if (p.acqStartEndMode != DAQ::PDStartEnd) {
 	        Log() << "Data file: " << dataFile.fileName() << " closed by StimulateOpenGL.";
+		    closeSidecars();
 		    dataFile.closeAndFinalize();
             emit do_updateWindowTitles();
 		} else if (!taskWaitingForTrigger) {
@@ -2517,11 +2882,13 @@ void MainApp::toggleSave(bool s)
 		if (!dataFileLog.openForWrite(p, fnameBinLog)) {
 			QMessageBox::critical(0, "Error Opening File!", QString("Could not open data file `%1'!").arg(fnameBinLog));
 		}
+        spikeSidecarOpen();
         if (!queuedParams.isEmpty()) stimGL_SaveParams("", queuedParams);
         Log() << "Save file: " << dataFile.fileName() << " opened from GUI.";
         //graphsWindow->clearGraph(-1);
         emit do_updateWindowTitles();
     } else if (!s && dataFile.isOpen()) {
+		closeSidecars();
 		dataFile.closeAndFinalize();
 		dataFileLog.closeAndFinalize();
         Log() << "Save file: " << dataFile.fileName() << " closed from GUI.";
@@ -2581,6 +2948,58 @@ void MainApp::helpWindowClosed()
 	windowMenuRemove(helpWindow);
 }
 
+void MainApp::showStatsWindow()
+{
+    if (!statsWindow) {
+        statsWindow = new QDialog(0);
+        statsWindow->setWindowTitle("SpikeGL Pipeline Stats");
+        QVBoxLayout *l = new QVBoxLayout(statsWindow);
+        statsText = new QTextEdit(statsWindow);
+        statsText->setReadOnly(true);
+        statsText->setLineWrapMode(QTextEdit::NoWrap);
+        QFont f("Courier");
+        f.setStyleHint(QFont::TypeWriter);
+        statsText->setFont(f);
+        l->addWidget(statsText);
+        statsWindow->resize(1000, 300);
+        statsTimer = new QTimer(statsWindow);
+        Connect(statsTimer, SIGNAL(timeout()), this, SLOT(updateStatsWindow()));
+    }
+    lastStats.clear();
+    updateStatsWindow();
+    statsTimer->start(1000);
+    statsWindow->show();
+    statsWindow->raise();
+    statsWindow->activateWindow();
+}
+
+void MainApp::updateStatsWindow()
+{
+    if (!statsWindow->isVisible() && statsTimer->isActive()) { statsTimer->stop(); return; }
+    QList<Telemetry::Snapshot> snaps = Telemetry::Stage::snapshotAll();
+    statsText->setPlainText(Telemetry::formatTable(snaps, lastStats.size() ? &lastStats : 0)
+                            + "\nRates are over the last second; counts and times since each stage started.  Times are per call (ms).\n"
+                            "res50/res99 are how long pages sat in the sample ring before the stage got to them (ms).\n");
+    lastStats = snaps;
+}
+
+void MainApp::toggleTrace()
+{
+    if (Telemetry::Trace::isRecording()) {
+        Telemetry::Trace::stop();
+        Log() << "Pipeline trace saved to " << Telemetry::Trace::fileName() << " -- open it in chrome://tracing or ui.perfetto.dev";
+    } else {
+        const QString fn = outputDirectory() + "/spikegl_trace_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss") + ".json";
+        QString err;
+        if (!Telemetry::Trace::start(fn, &err)) {
+            Error() << "Could not start the pipeline trace: " << err;
+            QMessageBox::critical(consoleWindow, "Pipeline Trace Error", err);
+        } else
+            Log() << "Recording pipeline trace to " << fn;
+    }
+    traceAct->setChecked(Telemetry::Trace::isRecording());
+}
+
 void MainApp::precreateOneGraph(bool nograph)
 {
     const double t0 = getTime();
@@ -2910,6 +3329,7 @@ DataFile_Fn_Shm::~DataFile_Fn_Shm()
 
 bool DataFile_Fn_Shm::openForWrite(const DAQ::Params & params, const QString & filename_override)
 {
+    if (isOpen()) closeAndFinalize(); // before we lock, as in DataFile::openForWrite()
     QMutexLocker ml(&mut);
 	bool ret = DataFile::openForWrite(params, filename_override);
 	if (hMapFile && pBuf) {
@@ -2923,6 +3343,7 @@ bool DataFile_Fn_Shm::openForWrite(const DAQ::Params & params, const QString & f
 
 bool DataFile_Fn_Shm::closeAndFinalize()
 {
+    drainSpillForClose(); // before we lock: it releases the lock in between chunks
     QMutexLocker ml(&mut);
 	bool ret = DataFile::closeAndFinalize();
 	if (hMapFile && pBuf) {
@@ -30,6 +30,8 @@ class Bug_ConfigDialog;
 class Bug_Popout;
 class FG_ConfigDialog;
 class GenericGrapher;
+class FilterBank;
+class ReferenceStage;
 
 #include <QApplication>
 #include <QColor>
@@ -50,6 +52,7 @@ class GenericGrapher;
 #include "WrapBuffer.h"
 #include "StimGL_SpikeGL_Integration.h"
 #include "CommandServer.h"
+#include "SpikeDetector.h"
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -118,6 +121,21 @@ public:
 	/// Returns true if the enable datastream facility checkbox option is enabled
 	bool isDSFacilityEnabled() const;
 
+    /// The user's FilterBank::Spec, in string form, as set from Options->Filter Bank.  Used by the graphs, file viewer and (optionally) the data saving thread
+    QString filterBankSpec() const { QMutexLocker l(&mut); return fbankSpec; }
+    /// Returns true if the filter bank is to be applied to data as it is saved to disk
+    bool isFilterBankOnSave() const { return fbankOnSave; }
+    /// The user's ReferenceStage::Spec, in string form, as set from Options->Reference Stage.  Used by the graphs and (optionally) the data saving thread
+    QString refStageSpec() const { QMutexLocker l(&mut); return refSpec; }
+    /// Returns true if the reference stage is to be applied to data as it is saved to disk
+    bool isRefStageOnSave() const { return refOnSave; }
+
+    /// Returns true if online spike detection is enabled (takes effect on the next acquisition)
+    bool isSpikeDetectionEnabled() const { return spikeDetEnabled; }
+    /// Copies spikes detected during the current acquisition, starting at sequence number 'since', into out.
+    /// Returns the sequence number to pass next time.  Returns false if spike detection is not running.
+    bool getRecentSpikes(u64 since, std::vector<SpikeDetector::Spike> & out, u64 *next_since);
+
     /// Set the save file
     void setOutputFile(const QString &);
     /// Query the save file -- note this is the save file as set in the config control params -- not necessarily an indicator that a save is happening.  for that, see getCurrentSaveFile()
@@ -259,6 +277,9 @@ protected slots:
     void execCommandServerOptionsDialog();
 	void execDSTempFileDialog();
     void execBufferSizesDialog();
+    void execFilterBankDialog();
+    void execRefStageDialog();
+    void execSpikeThresholdDialog();
 
     void stimGL_PluginStarted(const QString &, const QMap<QString, QVariant>  &);
     void stimGL_SaveParams(const QString & unused, const QMap<QString, QVariant> & pm);
@@ -268,6 +289,10 @@ protected slots:
     void precreateGraphs();
     void gotFirstScan();
 
+    void showStatsWindow(); ///< Tools->Pipeline Stats...
+    void updateStatsWindow(); ///< called from statsTimer while the stats window is up
+    void toggleTrace(); ///< Tools->Record Pipeline Trace: starts or stops a Telemetry::Trace in the output directory
+
 protected:
     void customEvent(QEvent *); ///< actually implemented in CommandServer.cpp since it is used to handle events from network connection threads
 
@@ -280,6 +305,9 @@ private slots:
     void fastSettleDoneForCommandConnections();
 	void toggleShowChannelSaveCB();
 	void toggleEnableDSFacility();
+    void toggleFilterBankOnSave();
+    void toggleRefStageOnSave();
+    void toggleSpikeDetection();
 	void windowMenuActivate(QWidget *w = 0);
 	void windowMenuAboutToShow();
 	void helpWindowClosed();
@@ -311,7 +339,11 @@ private:
     bool detectStopTask(const int16 * scans, unsigned sz, u64 firstSamp,
                         int override_trigIndex = -1, int16 override_thresh = -1);
     /// CAREFUL with this function -- it's called from within the DataSavingThread and as such should be fairly thread-safe and not directly touch the GUI
-    static void prependPrebufToScans(const WrapBuffer & wb, std::vector<int16> & scans, int & numAdded, int skip);
+    /// Writes the preTrigScans scans leading up to the trigger (at triggerOffset samples into the current page) to the data file,
+    /// directly out of the sample ring pages (or the filtered page slots), each page followed by its Bug3 metadata.  Returns the scan count written.
+    u64 writePreTriggerScans(const DAQ::Params & p, i32 triggerOffset);
+    /// CAREFUL with this function -- it's called from within the DataSavingThread and as such should be fairly thread-safe and not directly touch the GUI
+    void writeScansToDataFile(const DAQ::Params & p, const int16 *scans, unsigned nScans); ///< subsets the chans if need be
     void precreateOneGraph(bool noGLGraph = false);
     bool startAcq(QString & errTitle, QString & errMsg);
 	void showPrecreateDialog();
@@ -366,6 +398,7 @@ private:
     struct BufSizesParams {
         unsigned int regularMB; ///< how many megabytes to use in sample buffer for regular acquisitions (NI and Bug)
         unsigned int fgShmMB; ///< how many megabytes to use in the Framegrabbet task shared memory structure for sample data
+        bool largePages; ///< back the NI/Bug sample buffer with 2 MB pages if the OS lets us (falls back to regular pages)
     } bufSizesParams;
 
 #ifndef Q_OS_WIN
@@ -382,6 +415,7 @@ private:
     volatile i64 scanCt;
     i64 startScanCt, stopScanCt, lastScanSz, stopRecordAtSamp;
     volatile unsigned long scanSkipCt;
+    Telemetry::Stage saverTel; ///< the DataSavingThread's taskReadFunc(): time per page, skips, pages behind the writer
     DataFile_Fn_Shm dataFile; ///< the OUTPUT save file (this member var never used for input)
 	DataFile_Fn_Shm dataFileLog;
     std::vector<int16> lastNPDSamples;
@@ -393,11 +427,36 @@ private:
     CommandServer *commandServer;
     bool fastSettleRunning;
     QDialog *helpWindow;
-
-	WrapBuffer preBuf;
-	WrapBuffer preBufMeta;
+    QDialog *statsWindow; ///< the Pipeline Stats window, see showStatsWindow()
+    QTextEdit *statsText;
+    QTimer *statsTimer;
+    QList<Telemetry::Snapshot> lastStats; ///< for the rates in the stats window
+
+    /// Sample ring consumer cost, as measured over the last acquisition by measureRingCost(): the worst consumer's
+    /// fixed per-page cost and its cost per sample.  0 if never measured.  Feeds ringPageSize().
+    double ringPageFixedNs, ringPagePerSampNs;
+    double ringPageMs; ///< this acquisition's page length
+    void measureRingCost(unsigned nChans, unsigned scansPerPage);
+    unsigned long ringPageSize(const DAQ::Params & p, unsigned long ringBytes, unsigned metaBytesPerScan = 0, unsigned *metaBytesPerPage = 0);
+
+	unsigned preTrigScans; ///< size of the pre-trigger window, in scans.  0 if not a triggered acquisition.  Served straight out of the sample ring
     bool noHotKeys, pdWaitingForStimGL;	
     bool dsFacilityEnabled;
+    QString fbankSpec;
+    bool fbankOnSave;
+    FilterBank *saveFilter; ///< non-NULL during acquisition iff fbankOnSave.  Only touched by the DataSavingThread once the task is running
+    std::vector<unsigned char> saveFilterChans; ///< which chans saveFilter filters -- all but the aux chans
+    bool saveFilterStale; ///< saveFilter skipped pages while nothing could be saved: its state no longer matches the data, reset it before using it again
+    QString refSpec;
+    bool refOnSave;
+    ReferenceStage *saveRef; ///< non-NULL during acquisition iff refOnSave.  Applied after saveFilter.  Only touched by the DataSavingThread once the task is running
+    bool spikeDetEnabled;
+    double spikeThreshMAD;
+    SpikeDetector *spikeDet; ///< non-NULL during acquisition iff spikeDetEnabled.  Protected by mut as CommandServer threads read from it
+    QString spikeSidecarFileName() const; ///< foo.spikes for data file foo.bin, or empty if no data file is open
+    void spikeSidecarOpen(); ///< call right after dataFile is opened for writing, the spikes sidecar follows it
+    void closeSidecars(); ///< call right before dataFile is closed: the .spikes and .bug3b sidecars end with it
+    volatile u64 savedScanEnd; ///< acquisition scan just past the last one written to dataFile.  Set by the DataSavingThread
     
     QMessageBox *precreateDialog;
     QTimer *pregraphTimer;
@@ -419,6 +478,7 @@ private:
 
     void *samplesBuffer; ///< may point to shm.data() below or may point to a buffer allocated with malloc() if not using framegrabber.  Check the bool 'need2FreeSamplesBuffer' on task stop to determine whether to delete it
     bool need2FreeSamplesBuffer;
+    quint64 samplesBufferBytes; ///< the size samplesBuffer was allocated with, if need2FreeSamplesBuffer
     QSharedMemory shm; /* the giant buffer that scans get dumped to for reading from other app subsystems.
                           note that for now just the framegrabber task uses this */
     PagedScanReader *reader; ///< used to copy-construct other pagers/readers, among other things
@@ -429,6 +489,7 @@ private:
         const DAQ::Params & p;
         volatile bool pleaseStop;
         u64 sampCount;
+        Telemetry::Stage tel; ///< putScans() time per page, skips, pages behind the writer
 
         GraphingThread(GenericGrapher *g, const PagedScanReader & psr, const DAQ::Params &params);
         ~GraphingThread();
@@ -453,7 +514,9 @@ private:
     GraphingThread *gthread1, *gthread2;
     DataSavingThread *dthread;
 
-    std::vector<int16> save_subset, prebuf_scans; ///< working vars used by taskReadFunc().. it may be faster to keep these around across calls to taskReadFunc()
+    std::vector<int16> save_subset, prebuf_scans, save_filtered, pretrig_page; ///< working vars used by taskReadFunc().. it may be faster to keep these around across calls to taskReadFunc()
+    std::vector<unsigned> save_filtered_pnum; ///< save_filtered holds the last few filtered pages, one slot per page, to cover the pre-trigger window.  This is the ring page number in each slot
+    std::vector<char> pretrig_meta; ///< the meta data of the pre-trigger page being written, copied out of the ring
 
 public:
 
@@ -462,7 +525,7 @@ public:
         *quitAct, *toggleDebugAct, *toggleExcessiveDebugAct, *chooseOutputDirAct, *hideUnhideConsoleAct, 
         *hideUnhideGraphsAct, *aboutAct, *aboutQtAct, *newAcqAct, *stopAcq, *verifySha1Act, *par2Act, *stimGLIntOptionsAct, *aoPassthruAct, *helpAct, *commandServerOptionsAct,
 		*showChannelSaveCBAct, *enableDSFacilityAct, *fileOpenAct, *tempFileSizeAct, *bringAllToFrontAct,
-        *sortGraphsByElectrodeAct, *bugAcqAct, *fgAcqAct, *bufferSizesDialogAct;
+        *sortGraphsByElectrodeAct, *bugAcqAct, *fgAcqAct, *bufferSizesDialogAct, *filterBankAct, *filterBankOnSaveAct, *refStageAct, *refStageOnSaveAct, *spikeDetAct, *spikeThreshAct, *statsAct, *traceAct;
 
 /// Appliction icon! Made public.. why the hell not?
     QIcon appIcon, bugIcon;
@@ -269,3 +269,28 @@
 %                calling GetDAQData, as the parameter that GetDAQData
 %                expects is a scan count.  If the Matlab data API facility
 %                is not enabled, then 0 is always returned.
+%
+%    [spikes, next] = GetSpikes(myobj)
+%    [spikes, next] = GetSpikes(myobj, since)
+%
+%                Retrieves the spikes found by the online spike detector
+%                (Options->Online Spike Detection) during the current
+%                acquisition.  spikes is an Nx3 matrix of
+%                [scan_number channel_id amplitude] rows.  Pass the
+%                returned 'next' as 'since' on the next call to only get
+%                the spikes detected since then.  Only the most recent
+%                100000 spikes are kept.
+%
+%    stats = GetStats(myobj)
+%
+%                Retrieves the pipeline telemetry (see Tools->Pipeline
+%                Stats in SpikeGL).  stats is a struct array with one
+%                element per pipeline stage (acq, ring, saver, datafile,
+%                graph, ao and cmd stages), with fields stage, secs,
+%                calls, pages, scans, bytes, skips, errors, backlog and
+%                work_mean_us, work_p50_us, work_p99_us, work_p999_us,
+%                work_max_us, and resid_p50_us, resid_p99_us and
+%                resid_max_us -- how long pages waited in the sample ring
+%                before that stage got to them (consumer stages only,
+%                0 for the rest).  Counts are totals since each stage started,
+%                so call this twice and diff the results to get rates.
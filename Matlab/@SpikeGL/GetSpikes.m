@@ -0,0 +1,21 @@
+%    [spikes, next] = GetSpikes(myobj)
+%    [spikes, next] = GetSpikes(myobj, since)
+%
+%                Retrieves the spikes found by the online spike detector
+%                (Options->Online Spike Detection) during the current
+%                acquisition.  spikes is an Nx3 matrix of
+%                [scan_number channel_id amplitude] rows.  Pass the
+%                returned 'next' as 'since' on the next call to only get
+%                the spikes detected since then.  Only the most recent
+%                100000 spikes are kept.
+function [spikes, next] = GetSpikes(s, since)
+
+    if (nargin < 2),
+        since = 0;
+    end;
+    res = DoGetResultsCmd(s, sprintf('GETSPIKES %d', since));
+    next = str2num(res{1});
+    spikes = zeros(length(res)-1, 3);
+    for i=2:length(res),
+        spikes(i-1,:) = str2num(res{i});
+    end;
@@ -0,0 +1,34 @@
+%    stats = GetStats(myobj)
+%
+%                Retrieves the pipeline telemetry (see Tools->Pipeline
+%                Stats in SpikeGL).  stats is a struct array with one
+%                element per pipeline stage (acq, ring, saver, datafile,
+%                graph, ao and cmd stages), with fields stage, secs,
+%                calls, pages, scans, bytes, skips, errors, backlog and
+%                work_mean_us, work_p50_us, work_p99_us, work_p999_us,
+%                work_max_us, and resid_p50_us, resid_p99_us and
+%                resid_max_us -- how long pages waited in the sample ring
+%                before that stage got to them (consumer stages only,
+%                0 for the rest).  Counts are totals since each stage started,
+%                so call this twice and diff the results to get rates.
+function [stats] = GetStats(s)
+
+    res = DoGetResultsCmd(s, 'GETSTATS');
+    names = regexp(strtrim(res{1}), '\s+', 'split');
+    stats = struct([]);
+    for i=2:length(res),
+        vals = regexp(strtrim(res{i}), '\s+', 'split');
+        if (length(vals) ~= length(names)),
+            continue;
+        end;
+        st = struct();
+        st.(names{1}) = vals{1};
+        for j=2:length(names),
+            st.(names{j}) = str2double(vals{j});
+        end;
+        if (isempty(stats)),
+            stats = st;
+        else
+            stats(end+1) = st;
+        end;
+    end;
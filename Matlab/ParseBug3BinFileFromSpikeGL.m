@@ -0,0 +1,76 @@
+function [ ret ] = ParseBug3BinFileFromSpikeGL( filename )
+%PARSEBUG3BINFILEFROMSPIKEGL
+%
+% Pass a .bug3b file (the binary Bug3 block metadata file SpikeGL saves
+% alongside each data file) to parse.  Returns a struct containing fields
+% which are arrays, exactly like ParseBug3FileFromSpikeGL_SingleStruct does
+% for the older .bug3 text files: per-block fields have one element per
+% block, per-frame fields (boardFrameCounter, boardFrameTimer,
+% chipFrameCounter, chipID, frameMarkerCorrelation) have framesThisBlock
+% elements per block.
+%
+% The whole file is read in one go and decoded with vectorized typecasts,
+% so this is much faster than parsing the text format.
+%
+% Differences from the text format:
+%   systemClock is the local time of day the block was saved, in
+%   milliseconds since midnight.
+%   comm_absTimeNS and creation_absTimeNS (uint64) are only in the binary
+%   file.
+%
+% ParseBug3FileFromSpikeGL and ParseBug3FileFromSpikeGL_SingleStruct call
+% this for you when given a .bug3b file.
+%
+fid = fopen(filename, 'r', 'ieee-le');
+if (fid == -1),
+    error('File not found');
+end;
+raw = fread(fid, inf, 'uint8=>uint8');
+fclose(fid);
+
+if (length(raw) < 64 || ~strcmp(char(raw(1:8)'), 'SGLBUG3M')),
+    error('%s is not a Bug3 block metadata (.bug3b) file', filename);
+end;
+hdrBytes = double(typecast(raw(11:12), 'uint16'));
+recBytes = double(typecast(raw(13:16), 'uint32'));
+nFrames = double(typecast(raw(17:18), 'uint16'));
+scansPerBlock = double(typecast(raw(19:20), 'uint16'));
+nChans = double(typecast(raw(21:24), 'uint32'));
+if (nFrames ~= 40 || recBytes < 724),
+    error('%s: unsupported .bug3b file version', filename);
+end;
+
+% a partial record at the end is ignored
+n = floor((length(raw) - hdrBytes) / recBytes);
+recs = reshape(raw(hdrBytes+1 : hdrBytes+n*recBytes), recBytes, n);
+
+% record layout: see Bug3MetaFile.cpp
+ret = struct();
+ret.blockNum = field(recs, 0, 1, 'uint64', 8);
+ret.scans = field(recs, 8, 1, 'uint64', 8);
+ret.millisecondOffset = field(recs, 16, 1, 'int64', 8);
+ret.systemClock = field(recs, 24, 1, 'uint32', 4);
+ret.framesThisBlock = repmat(nFrames, n, 1);
+ret.spikeGL_DataFile_ScanCount = field(recs, 28, 1, 'uint64', 8);
+ret.spikeGL_DataFile_SampleCount = ret.spikeGL_DataFile_ScanCount * nChans;
+ret.spikeGL_ScansInBlock = repmat(scansPerBlock, n, 1);
+ret.boardFrameCounter = field(recs, 36, nFrames, 'int32', 4);
+ret.boardFrameTimer = field(recs, 196, nFrames, 'int32', 4);
+ret.chipFrameCounter = field(recs, 356, nFrames, 'int32', 4);
+ret.chipID = field(recs, 516, nFrames, 'uint16', 2);
+ret.frameMarkerCorrelation = field(recs, 596, nFrames, 'uint16', 2);
+ret.missingFrameCount = field(recs, 676, 1, 'int32', 4);
+ret.falseFrameCount = field(recs, 680, 1, 'int32', 4);
+ret.BER = field(recs, 684, 1, 'double', 8);
+ret.WER = field(recs, 692, 1, 'double', 8);
+ret.avgVunreg = field(recs, 700, 1, 'double', 8);
+ret.comm_absTimeNS = typecast(reshape(recs(709:716, :), [], 1), 'uint64');
+ret.creation_absTimeNS = typecast(reshape(recs(717:724, :), [], 1), 'uint64');
+
+end
+
+function [ v ] = field( recs, off, count, type, nbytes )
+% count values of the given type at byte offset off of each record, as one
+% column of doubles (count values per record, record after record)
+v = double(typecast(reshape(recs(off+1 : off+count*nbytes, :), [], 1), type));
+end
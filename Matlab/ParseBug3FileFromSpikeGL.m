@@ -1,6 +1,25 @@
 function [ ret ] = ParseBug3FileFromSpikeGL( filename )
 %PARSEBUG3FILEFROMSPIKEGL Pass a .bug3 file to parse, returns an array
 % of structs which is the per-block data
+%
+% Also accepts the binary .bug3b files newer SpikeGL versions save, which
+% load much faster (see ParseBug3BinFileFromSpikeGL).
+[ignored, ignored2, ext] = fileparts(filename);
+if (strcmpi(ext, '.bug3b')),
+    s = ParseBug3BinFileFromSpikeGL(filename);
+    n = length(s.blockNum);
+    names = fieldnames(s);
+    args = cell(1, 2*length(names));
+    for i = 1:length(names),
+        v = s.(names{i});
+        if (length(v) ~= n), v = reshape(v, [], n); end;
+        args{2*i-1} = names{i};
+        args{2*i} = num2cell(v, 1)';
+    end;
+    ret = struct(args{:});
+    return;
+end;
+
 fid = fopen(filename);
 if (fid == -1),
     error('File not found');
@@ -35,6 +35,15 @@ function [ ret ] = ParseBug3FileFromSpikeGL_SingleStruct( filename )
 % out how many frames are in a particular block, look at the corresponding
 % element for that block in the framesThisBlock field).
 %
+% Also accepts the binary .bug3b files newer SpikeGL versions save, which
+% load much faster (see ParseBug3BinFileFromSpikeGL).
+%
+[ignored, ignored2, ext] = fileparts(filename);
+if (strcmpi(ext, '.bug3b')),
+    ret = ParseBug3BinFileFromSpikeGL(filename);
+    return;
+end;
+
 fid = fopen(filename);
 if (fid == -1),
     error('File not found');
@@ -1,16 +1,215 @@
 #include "stdafx.h"
 #include "PagedRingBuffer.h"
 #include <string.h>
+#include <stddef.h>
+#if defined(_WIN32)
+#  include <windows.h>
+#elif defined(__APPLE__)
+#  include <mach/mach_time.h>
+#  include <unistd.h>
+#else
+#  include <time.h>
+#  include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define PAGEDRB_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+void ScanPermutation::setGather(const std::vector<int> & g)
+{
+    clear();
+    scan_size = unsigned(g.size());
+    gather.resize(g.size());
+    tail.resize(g.size());
+    for (unsigned i = 0; i < scan_size; ++i) {
+        gather[i] = (g[i] >= 0 && unsigned(g[i]) < scan_size) ? unsigned(g[i]) : i;
+        tail[i] = i;
+    }
+}
+
+void ScanPermutation::setGather2(const std::vector<int> & g, unsigned ss1)
+{
+    clear();
+    if (ss1 > g.size()) return;
+    scan_size = unsigned(g.size());
+    scan_size1 = ss1;
+    gather.resize(g.size());
+    for (unsigned i = 0; i < scan_size; ++i) {
+        gather[i] = (g[i] >= 0 && unsigned(g[i]) < scan_size) ? unsigned(g[i]) : i;
+        const unsigned which = gather[i] < scan_size1 ? 0 : 1, in = which ? gather[i] - scan_size1 : gather[i];
+        if (runs2.size()) {
+            Run & r (runs2.back());
+            if (r.which == which) {
+                if (r.len == 1 && in > r.in) { r.stride = in - r.in; ++r.len; continue; }
+                if (r.len > 1 && in == r.in + r.len*r.stride) { ++r.len; continue; }
+            }
+        }
+        Run r = { i, in, 1, 1, which };
+        runs2.push_back(r);
+    }
+}
+
+void ScanPermutation::setTranspose(unsigned scanSize, unsigned r, unsigned c)
+{
+    clear();
+    if (r*c > scanSize || r < 2 || c < 2) return; // nothing to do
+    scan_size = scanSize; rows = r; cols = c;
+    gather.resize(scan_size);
+    for (unsigned i = 0; i < scan_size; ++i) gather[i] = i;
+    for (unsigned rr = 0; rr < rows; ++rr)
+        for (unsigned cc = 0; cc < cols; ++cc)
+            gather[cc*rows + rr] = rr*cols + cc;
+    // outputs covered by the 8x8 blocks: rows [0,rows8) of every output row whose column lies in [0,cols8)
+    unsigned rows8 = 0, cols8 = 0;
+#ifdef PAGEDRB_USE_SSE2
+    rows8 = rows & ~7U; cols8 = cols & ~7U;
+#endif
+    for (unsigned i = 0; i < scan_size; ++i) {
+        const bool inBlock = i < rows*cols && (i / rows) < cols8 && (i % rows) < rows8;
+        if (!inBlock) tail.push_back(i);
+    }
+    if (!rows8 || !cols8) rows = cols = 0; // kernel would do nothing, so don't bother
+}
+
+#ifdef PAGEDRB_USE_SSE2
+static inline void transpose8x8(const short *in, unsigned inStride, short *out, unsigned outStride)
+{
+    const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in)),
+                  a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+inStride)),
+                  a2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+2*inStride)),
+                  a3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+3*inStride)),
+                  a4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+4*inStride)),
+                  a5 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+5*inStride)),
+                  a6 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+6*inStride)),
+                  a7 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+7*inStride));
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1),
+                  b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3),
+                  b4 = _mm_unpacklo_epi16(a4, a5), b5 = _mm_unpackhi_epi16(a4, a5),
+                  b6 = _mm_unpacklo_epi16(a6, a7), b7 = _mm_unpackhi_epi16(a6, a7);
+    const __m128i c0 = _mm_unpacklo_epi32(b0, b2), c1 = _mm_unpackhi_epi32(b0, b2),
+                  c2 = _mm_unpacklo_epi32(b1, b3), c3 = _mm_unpackhi_epi32(b1, b3),
+                  c4 = _mm_unpacklo_epi32(b4, b6), c5 = _mm_unpackhi_epi32(b4, b6),
+                  c6 = _mm_unpacklo_epi32(b5, b7), c7 = _mm_unpackhi_epi32(b5, b7);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),             _mm_unpacklo_epi64(c0, c4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+outStride),   _mm_unpackhi_epi64(c0, c4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+2*outStride), _mm_unpacklo_epi64(c1, c5));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*outStride), _mm_unpackhi_epi64(c1, c5));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+4*outStride), _mm_unpacklo_epi64(c2, c6));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+5*outStride), _mm_unpackhi_epi64(c2, c6));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+6*outStride), _mm_unpacklo_epi64(c3, c7));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+7*outStride), _mm_unpackhi_epi64(c3, c7));
+}
+#endif
+
+void ScanPermutation::apply(const short *in, short *out, unsigned nScans) const
+{
+    if (gather.empty()) { memcpy(out, in, size_t(nScans)*scan_size*sizeof(short)); return; }
+    const unsigned * const g = &gather[0];
+    const unsigned * const t = tail.empty() ? 0 : &tail[0];
+    const unsigned nt = unsigned(tail.size());
+    for (unsigned s = 0; s < nScans; ++s, in += scan_size, out += scan_size) {
+#ifdef PAGEDRB_USE_SSE2
+        if (rows) {
+            // input is rows x cols, output is cols x rows.  Each 8x8 input block (8 rows of 8 consecutive cols)
+            // becomes 8 output rows of 8 consecutive samples
+            for (unsigned cb = 0; cb+8 <= cols; cb += 8)
+                for (unsigned rb = 0; rb+8 <= rows; rb += 8)
+                    transpose8x8(in + rb*cols + cb, cols, out + cb*rows + rb, rows);
+        }
+#endif
+        for (unsigned i = 0; i < nt; ++i) out[t[i]] = in[g[t[i]]];
+    }
+}
+
+void ScanPermutation::apply2(const short *in1, const short *in2, short *out, unsigned nScans) const
+{
+    const unsigned ss1 = scan_size1, ss2 = scan_size - scan_size1, nr = unsigned(runs2.size());
+    const Run * const runs = nr ? &runs2[0] : 0;
+    for (unsigned s = 0; s < nScans; ++s, in1 += ss1, in2 += ss2, out += scan_size) {
+        for (unsigned ri = 0; ri < nr; ++ri) {
+            const Run & r (runs[ri]);
+            const short *src = (r.which ? in2 : in1) + r.in;
+            short *dst = out + r.out;
+            if (r.stride == 1) memcpy(dst, src, r.len*sizeof(short));
+            else for (unsigned k = 0; k < r.len; ++k, src += r.stride) dst[k] = *src;
+        }
+    }
+}
 
 PagedRingBuffer::PagedRingBuffer(void *m, unsigned long sz, unsigned long psz)
-    : memBuffer(m), mem(reinterpret_cast<char *>(m)+sizeof(unsigned int)), real_size_bytes(sz), avail_size_bytes(sz-sizeof(unsigned int)), page_size(psz)
+    : memBuffer(m), mem(reinterpret_cast<char *>(m)+sizeof(RingHeader)), real_size_bytes(sz), avail_size_bytes(sz > sizeof(RingHeader) ? sz-sizeof(RingHeader) : 0), page_size(psz)
 {
     resetToBeginning();
 }
 
+bool PagedRingBuffer::writerGeometry(Geometry & g) const
+{
+    if (!ring) return false;
+    // the writer zeroes geomMagic while it's mid-publish and bumps geomGen before restoring it, so an unchanged
+    // (magic, gen) pair on both sides of the copy means the copy is consistent
+    const unsigned gen = ring->geomGen;
+    if (ring->geomMagic != unsigned(PAGED_RINGBUFFER_MAGIC)) return false;
+    g.pageSize = ring->pageSize; g.nPages = ring->nPages;
+    g.scanSizeSamps = ring->scanSizeSamps; g.metaBytes = ring->metaBytes; g.scansPerPage = ring->scansPerPage;
+    g.gen = gen;
+    return ring->geomMagic == unsigned(PAGED_RINGBUFFER_MAGIC) && ring->geomGen == gen && g.pageSize;
+}
+
+// reader slots are claimed from several threads, maybe several processes
+static bool casU32(volatile unsigned int *p, unsigned int expect, unsigned int val)
+{
+#if defined(_WIN32)
+    return (unsigned int)InterlockedCompareExchange((volatile LONG *)p, LONG(val), LONG(expect)) == expect;
+#else
+    return __sync_bool_compare_and_swap(p, expect, val);
+#endif
+}
+
+static void fullBarrier()
+{
+#if defined(_WIN32)
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+static void sleep1ms()
+{
+#if defined(_WIN32)
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+}
+
+/*static*/ unsigned long long PagedRingBuffer::nowNS()
+{
+    // NB: keep in sync with Util::getAbsTimeNS() in osdep.cpp
+#if defined(_WIN32)
+    static __int64 freq = 0;
+    __int64 ct, factor;
+    if (!freq) QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+    QueryPerformanceCounter((LARGE_INTEGER *)&ct);
+    factor = 1000000000LL/freq;
+    if (factor <= 0) factor = 1;
+    return (unsigned long long)(ct * factor);
+#elif defined(__APPLE__)
+    mach_timebase_info_data_t info;
+    mach_timebase_info(&info);
+    return mach_absolute_time() * info.numer / info.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec*1000000000ULL + (unsigned long long)ts.tv_nsec;
+#endif
+}
+
 void PagedRingBuffer::resetToBeginning()
 {
     lastPageRead = 0; pageIdx = -1;
+    lastCommitNS = lastFirstScan = 0;
     npages = avail_size_bytes/(page_size + sizeof(Header));
     if (page_size > avail_size_bytes || !page_size || !avail_size_bytes || !npages || !real_size_bytes || avail_size_bytes > real_size_bytes) {
         memBuffer = 0; mem = 0; page_size = 0; avail_size_bytes = 0; npages = 0; real_size_bytes = 0;
@@ -37,6 +236,8 @@ void *PagedRingBuffer::nextReadPage(int *nSkips)
     if (hdr.magic == unsigned(PAGED_RINGBUFFER_MAGIC) && hdr.pageNum >= lastPageRead+1U) {
         if (nSkips) *nSkips = int(hdr.pageNum-(lastPageRead+1)); // record number of overflows/lost pages here!
         lastPageRead = hdr.pageNum;
+        lastCommitNS = hdr.commitTimeNS;
+        lastFirstScan = hdr.firstScan;
         pageIdx = nxt;
         return reinterpret_cast<char *>(h)+sizeof(Header);
     }
@@ -45,8 +246,20 @@ void *PagedRingBuffer::nextReadPage(int *nSkips)
     return 0;
 }
 
+void *PagedRingBuffer::pastReadPage(unsigned back) const
+{
+    if (!mem || !npages || !avail_size_bytes || pageIdx < 0) return 0;
+    if (back >= npages || lastPageRead <= back) return 0;
+    const int idx = int((unsigned(pageIdx) + npages - back) % npages);
+    const Header *h = reinterpret_cast<const Header *>(&mem[ (page_size+sizeof(Header)) * idx ]);
+    Header hdr; memcpy(&hdr, h, sizeof(hdr));
+    if (hdr.magic != unsigned(PAGED_RINGBUFFER_MAGIC) || hdr.pageNum != lastPageRead-back) return 0;
+    return const_cast<char *>(reinterpret_cast<const char *>(h))+sizeof(Header);
+}
+
 void PagedRingBuffer::bzero() {
-    if (mem && avail_size_bytes) memset(mem, 0, avail_size_bytes);
+    // the ring header too: a stale geometry from whatever used this memory before is worse than none
+    if (memBuffer && real_size_bytes) memset(memBuffer, 0, real_size_bytes);
 }
 
 PagedRingBufferWriter::PagedRingBufferWriter(void *mem, unsigned long sz, unsigned long psz)
@@ -54,21 +267,78 @@ PagedRingBufferWriter::PagedRingBufferWriter(void *mem, unsigned long sz, unsign
 {
     lastPageWritten = 0;
     nWritten = 0;
+    maxBlockMs = 0;
+    blockedNs = 0;
+    nForced = 0;
+    for (int i = 0; i < MaxReaders; ++i) gaveUpAt[i] = ~0U;
+    publishGeometry(0, 0, 0);
 }
 
 PagedRingBufferWriter::~PagedRingBufferWriter() {}
 
 void PagedRingBufferWriter::initializeForWriting()
 {
-    bzero();
+    Geometry g;
+    const bool hadGeom = writerGeometry(g);
+    // like bzero(), but readers already registered stay registered: their slots' policies are never written here, as
+    // readers may be claiming or releasing slots (with casU32) while we clear
+    if (ring && real_size_bytes >= sizeof(RingHeader)) {
+        memset(memBuffer, 0, offsetof(RingHeader, readers));
+        for (int i = 0; i < MaxReaders; ++i) { ring->readers[i].lastPageRead = 0; ring->readers[i].drops = 0; }
+        memset(mem, 0, real_size_bytes - sizeof(RingHeader));
+    }
+    for (int i = 0; i < MaxReaders; ++i) gaveUpAt[i] = ~0U;
     pageIdx = -1;
     nWritten = 0;
     lastPageWritten = 0;
+    if (hadGeom) publishGeometry(g.scanSizeSamps, g.metaBytes, g.scansPerPage);
+}
+
+void PagedRingBufferWriter::waitForReaders(unsigned pg)
+{
+    // a reader is done with page pg once it has moved on from it.  the wait is bounded by the clock, not by counting
+    // sleep1ms()s: on Windows each one can take a whole 15.6 ms scheduler tick
+    unsigned long long t0 = 0;
+    bool forced = false, timedOut = !maxBlockMs;
+    for (;;) {
+        int behind = 0;
+        for (int i = 0; i < MaxReaders; ++i) {
+            RingHeader::ReaderSlot & s = ring->readers[i];
+            if (s.policy != unsigned(MustNotDrop)) continue;
+            const unsigned lpr = s.lastPageRead;
+            if (lpr > pg) continue;
+            if (lpr == gaveUpAt[i] || timedOut) {
+                // given up on it, this time or before: its page goes
+                gaveUpAt[i] = lpr;
+                ++s.drops;
+                forced = true;
+            } else
+                ++behind;
+        }
+        if (!behind) break;
+        const unsigned long long t = nowNS();
+        if (!t0) t0 = t;
+        if (t - t0 >= (unsigned long long)maxBlockMs * 1000000ULL) { timedOut = true; continue; } // one more pass, to give up on them
+        sleep1ms();
+    }
+    if (forced) ++nForced;
+    if (t0) blockedNs += nowNS() - t0;
+}
+
+void PagedRingBufferWriter::publishGeometry(unsigned scanSizeSamps, unsigned metaBytes, unsigned scansPerPage)
+{
+    if (!ring || !mem || !npages) return;
+    ring->geomMagic = 0;
+    ring->pageSize = unsigned(page_size); ring->nPages = npages;
+    ring->scanSizeSamps = scanSizeSamps; ring->metaBytes = metaBytes; ring->scansPerPage = scansPerPage;
+    ring->geomGen = ring->geomGen + 1;
+    ring->geomMagic = unsigned(PAGED_RINGBUFFER_MAGIC);
 }
 
 void *PagedRingBufferWriter::grabNextPageForWrite()
 {
     if (!mem || !npages || !avail_size_bytes) return 0;
+    if (lastPageWritten+1 > npages) waitForReaders(lastPageWritten+1-npages);
     int nxt = (pageIdx+1) % npages;
     if (nxt < 0) nxt = 0;
     Header *h = reinterpret_cast<Header *>(&mem[ (page_size+sizeof(Header)) * nxt ]);
@@ -77,13 +347,16 @@ void *PagedRingBufferWriter::grabNextPageForWrite()
     return reinterpret_cast<char *>(h)+sizeof(Header);
 }
 
-bool PagedRingBufferWriter::commitCurrentWritePage()
+bool PagedRingBufferWriter::commitCurrentWritePage(unsigned long long firstScan)
 {
     if (!mem || !npages || !avail_size_bytes) return false;
     int pg = pageIdx % npages;
     if (pg < 0) pg = 0;
     Header *h = reinterpret_cast<Header *>(&mem[ (page_size+sizeof(Header)) * pg ]);
     pageIdx = pg;
+    // stamps first: pageNum and magic are what make the page visible to readers
+    h->commitTimeNS = nowNS();
+    h->firstScan = firstScan;
     h->pageNum = *latestPNum = ++lastPageWritten;
     h->magic = (unsigned)PAGED_RINGBUFFER_MAGIC;
     ++nWritten;
@@ -93,31 +366,96 @@ bool PagedRingBufferWriter::commitCurrentWritePage()
 PagedScanReader::PagedScanReader(unsigned scan_size_samples, unsigned meta_data_size_bytes, void *mem, unsigned long size_bytes, unsigned long page_size)
     : PagedRingBuffer(mem, size_bytes, page_size), scan_size_samps(scan_size_samples), meta_data_size_bytes(meta_data_size_bytes)
 {
-    if (meta_data_size_bytes > page_size) meta_data_size_bytes = page_size;
-    nScansPerPage = scan_size_samps ? ((page_size-meta_data_size_bytes)/(scan_size_samps*sizeof(short))) : 0;
-    scanCt = scanCtV = 0;
+    seenGen = 0; slot = -1; policy = Unregistered; maxLag = 0; retain = 0;
+    initScanGeometry();
+    syncGeometry(); // a writer that's already there knows better than whoever constructed us
 }
 
 PagedScanReader::PagedScanReader(const PagedScanReader &o)
     : PagedRingBuffer(o.rawData(), o.totalSize(), o.pageSize()), scan_size_samps(o.scanSizeSamps()), meta_data_size_bytes(o.meta_data_size_bytes)
 {
-    if (meta_data_size_bytes > page_size) meta_data_size_bytes = page_size;
-    nScansPerPage = scan_size_samps ? ((page_size-meta_data_size_bytes)/(scan_size_samps*sizeof(short))) : 0;
-    scanCt = scanCtV = 0;
+    seenGen = 0; slot = -1; policy = Unregistered; maxLag = 0; retain = 0;
+    initScanGeometry();
+    syncGeometry(); // a writer that's already there knows better than whoever constructed us
+}
+
+PagedScanReader::~PagedScanReader()
+{
+    unregisterReader();
+}
+
+bool PagedScanReader::registerReader(LagPolicy p, unsigned maxLagPages)
+{
+    unregisterReader();
+    if (!ring || p == Unregistered) return false;
+    for (int i = 0; i < MaxReaders; ++i) {
+        RingHeader::ReaderSlot & s = ring->readers[i];
+        if (s.policy == unsigned(Unregistered) && casU32(&s.policy, unsigned(Unregistered), unsigned(p))) {
+            s.drops = 0;
+            slot = i;
+            policy = p;
+            maxLag = maxLagPages;
+            publishLastRead();
+            return true;
+        }
+    }
+    return false;
+}
+
+void PagedScanReader::unregisterReader()
+{
+    if (slot >= 0 && ring) ring->readers[slot].policy = unsigned(Unregistered);
+    slot = -1;
+    policy = Unregistered;
 }
 
 PagedScanReader::PagedScanReader(const PagedScanWriter &o)
     : PagedRingBuffer(o.rawData(), o.totalSize(), o.pageSize()), scan_size_samps(o.scanSizeSamps()), meta_data_size_bytes(o.metaDataSizeBytes())
+{
+    seenGen = 0; slot = -1; policy = Unregistered; maxLag = 0; retain = 0;
+    initScanGeometry();
+    syncGeometry(); // a writer that's already there knows better than whoever constructed us
+}
+
+void PagedScanReader::initScanGeometry()
 {
     if (meta_data_size_bytes > page_size) meta_data_size_bytes = page_size;
     nScansPerPage = scan_size_samps ? ((page_size-meta_data_size_bytes)/(scan_size_samps*sizeof(short))) : 0;
     scanCt = scanCtV = 0;
 }
 
+bool PagedScanReader::syncGeometry()
+{
+    Geometry g;
+    if (!writerGeometry(g) || g.gen == seenGen) return false;
+    seenGen = g.gen;
+    const bool same = g.pageSize == page_size && g.nPages == npages
+                      && (!g.scanSizeSamps || (g.scanSizeSamps == scan_size_samps && g.metaBytes == meta_data_size_bytes));
+    if (same && latest() >= lastPageRead) return false; // eg our own session's writer, constructed after us
+    if (!g.pageSize || (unsigned long long)g.nPages * (g.pageSize + sizeof(Header)) > avail_size_bytes) return false;
+    page_size = g.pageSize;
+    if (g.scanSizeSamps) { scan_size_samps = g.scanSizeSamps; meta_data_size_bytes = g.metaBytes; }
+    avail_size_bytes = real_size_bytes - sizeof(RingHeader);
+    resetToBeginning();
+    npages = g.nPages;
+    initScanGeometry();
+    seenGen = g.gen;
+    publishLastRead();
+    if (g.scansPerPage && g.scansPerPage != nScansPerPage) nScansPerPage = g.scansPerPage;
+    return true;
+}
+
 const short *PagedScanReader::next(int *nSkips, void **metaPtr, unsigned *scans_returned)
 {
+    if (ring && ring->geomGen != seenGen) syncGeometry();
     int sk = 0;
+    if (policy == BestEffort && npages) {
+        // too far behind to catch up: jump to the newest page, instead of chasing the writer through the oldest
+        const unsigned l = latest(), lim = maxLag ? maxLag : (npages/2 ? npages/2 : 1);
+        if (l > lastPageRead + lim) pageIdx = int((l - 1 + npages - 1) % npages); // so that nextReadPage() looks at page l
+    }
     const short *scans = (short *)nextReadPage(&sk);
+    if (scans) publishLastRead();
     if (nSkips) *nSkips = sk;
     if (scans_returned) *scans_returned = 0;
     if (metaPtr) *metaPtr = 0;
@@ -131,30 +469,75 @@ const short *PagedScanReader::next(int *nSkips, void **metaPtr, unsigned *scans_
     return scans;
 }
 
+const short *PagedScanReader::pastPage(unsigned back, void **metaPtr) const
+{
+    const short *scans = (const short *)pastReadPage(back);
+    if (metaPtr) *metaPtr = (scans && meta_data_size_bytes) ? const_cast<short *>(scans+(nScansPerPage*scan_size_samps)) : 0;
+    return scans;
+}
+
+bool PagedScanReader::copyPastPage(unsigned back, short *scansOut, void *metaOut) const
+{
+    void *meta = 0;
+    const short *scans = pastPage(back, &meta);
+    if (!scans) return false;
+    memcpy(scansOut, scans, size_t(nScansPerPage)*scan_size_samps*sizeof(short));
+    if (metaOut && meta) memcpy(metaOut, meta, meta_data_size_bytes);
+    fullBarrier(); // the header check below must not be done before the copy
+    return pastReadPage(back) == scans; // the writer zeroes the header before it touches the page
+}
+
 static int dummyErrFunc(const char *fmt, ...) { (void)fmt; return 0; }
 
 PagedScanWriter::PagedScanWriter(unsigned scan_size_samples, unsigned meta_data_size_bytes, void *mem, unsigned long size_bytes, unsigned long page_size, const std::vector<int> & cmap)
-    : PagedRingBufferWriter(mem, size_bytes, page_size), ErrFunc(&dummyErrFunc), scan_size_samps(scan_size_samples), scan_size_bytes(scan_size_samples*sizeof(short)), meta_data_size_bytes(meta_data_size_bytes), chan_mapping(cmap),  mapper(0)
+    : PagedRingBufferWriter(mem, size_bytes, page_size), ErrFunc(&dummyErrFunc), scan_size_samps(scan_size_samples), scan_size_bytes(scan_size_samples*sizeof(short)), meta_data_size_bytes(meta_data_size_bytes), nRemapped(0)
 {
     if (meta_data_size_bytes > page_size) meta_data_size_bytes = page_size;
     nScansPerPage = scan_size_bytes ? ((page_size-meta_data_size_bytes)/scan_size_bytes) : 0;
     nBytesPerPage = nScansPerPage * scan_size_bytes;
-    pageOffset = 0; partial_offset = 0; partial_bytes_written = 0; partial_rem = 0;
+    pageOffset = 0; partial_offset = 0; partial_bytes_written = 0;
     scanCt = 0;
     sampleCt = 0;
     currPage = 0;
+    publishGeometry(scan_size_samps, meta_data_size_bytes, nScansPerPage);
+    if (cmap.size() && scan_size_samps) {
+        std::vector<int> g(scan_size_samps);
+        bool identity = true;
+        for (unsigned i = 0; i < scan_size_samps; ++i) {
+            g[i] = (i < cmap.size() && cmap[i] >= 0 && unsigned(cmap[i]) < scan_size_samps) ? cmap[i] : int(i);
+            if (g[i] != int(i)) identity = false;
+        }
+        if (!identity) {
+            remap.setGather(g);
+            // in-place remapping goes through this in blocks of up to ~64KB worth of scans
+            unsigned blk = (65536/scan_size_bytes) ? (65536/scan_size_bytes) : 1;
+            if (nScansPerPage && blk > nScansPerPage) blk = nScansPerPage;
+            remapTmp.resize(size_t(blk)*scan_size_samps);
+        }
+    }
 }
 
 PagedScanWriter::~PagedScanWriter()
 {
-    if (mapper) delete mapper; mapper = 0; // tell mapper to end and kill it
+}
+
+void PagedScanWriter::remapInPlace(unsigned upto)
+{
+    if (remap.isNull() || !currPage) { nRemapped = upto; return; }
+    const unsigned blk = unsigned(remapTmp.size()/scan_size_samps);
+    while (nRemapped < upto) {
+        const unsigned n = upto-nRemapped < blk ? upto-nRemapped : blk;
+        short * const s = currPage + size_t(nRemapped)*scan_size_samps;
+        memcpy(&remapTmp[0], s, size_t(n)*scan_size_bytes);
+        remap.apply(&remapTmp[0], s, n);
+        nRemapped += n;
+    }
 }
 
 void PagedScanWriter::writePartialBegin()
 {
     partial_offset = pageOffset*scan_size_bytes;
     partial_bytes_written = 0;
-    partial_rem = 0;
 }
 
 bool PagedScanWriter::writePartialEnd()
@@ -165,7 +548,6 @@ bool PagedScanWriter::writePartialEnd()
     scanCt += static_cast<unsigned long long>(partial_bytes_written / scan_size_bytes);
     sampleCt += static_cast<unsigned long long>(partial_bytes_written / sizeof(short));
     partial_bytes_written = 0; // guard against shitty use of class
-    partial_rem = 0;
 
     if (pageOffset > nScansPerPage) return false; // should never happen.  indicates bug in this code.
     if (pageOffset == nScansPerPage) commit();  // should never happen!
@@ -176,7 +558,7 @@ bool PagedScanWriter::writePartial(const void *data, unsigned nbytes, const void
 {
     unsigned dataOffset = 0;
     while (nbytes) {
-        if (!currPage) { currPage = (short *)grabNextPageForWrite(); pageOffset = 0; partial_offset = 0; partial_rem = 0; }
+        if (!currPage) { currPage = (short *)grabNextPageForWrite(); pageOffset = 0; partial_offset = 0; }
         unsigned spaceLeft = (nScansPerPage*scan_size_bytes) - partial_offset;
         if (!spaceLeft) {
             ErrFunc("FATAL! Improper use of class or bad code in PagedScanWriter::writePartial() call!  spaceLeft = 0 when it should not be 0!");
@@ -189,10 +571,7 @@ bool PagedScanWriter::writePartial(const void *data, unsigned nbytes, const void
         partial_bytes_written += n2write;
         nbytes -= n2write;
         spaceLeft -= n2write;
-        /*if (mapper) {
-            mapper->release((partial_rem+n2write)/scan_size_bytes);
-            partial_rem = (partial_rem+n2write) % scan_size_bytes;
-        }*/
+        remapInPlace(partial_offset/scan_size_bytes); // any scans completed by this chunk
 
         if (!spaceLeft) {
             if (meta_data_size_bytes) {
@@ -207,22 +586,16 @@ bool PagedScanWriter::writePartial(const void *data, unsigned nbytes, const void
 
 void *PagedScanWriter::grabNextPageForWrite()
 {
-    if (mapper) delete mapper, mapper = 0;
-    void *p = PagedRingBufferWriter::grabNextPageForWrite();
-    /* NOTE THAT CHANNEL MAPPING IS BROKEN FOR NOW.. or so it appears.  It lead to performance issues & hangs -- see 4/12/2016 email from Jim Chen.
-       So we disable it and just do the more kosher thing of having a correct channel mapping setup in SpikeGL GUI.
-       This means the data file will always have raw frame format.. but at least things work well.  
-    if (chan_mapping.size()) {
-        mapper = new ScanRemapper(reinterpret_cast<short *>(p), nScansPerPage, scan_size_samps, chan_mapping);
-        mapper->ErrFunc = ErrFunc; mapper->DbgFunc = DbgFunc;
-        if (!mapper->start()) {
-            ErrFunc("FATAL! Failed to start ScanRemapper thread in PagedScanWriter::grabNextPageForWrite()");
-        }
-    }*/
-    return p;
+    nRemapped = 0;
+    return PagedRingBufferWriter::grabNextPageForWrite();
 }
 
-bool PagedScanWriter::write(const short *scans, unsigned nScans, const void *meta) {
+bool PagedScanWriter::write(const short *scans, unsigned nScans, const void *meta, const ScanPermutation *perm) {
+    if (perm && (perm->isNull() || perm->scanSize() != scan_size_samps)) {
+        if (!perm->isNull()) ErrFunc("PagedScanWriter::write() -- ScanPermutation scan size %u != %u, ignoring it!", perm->scanSize(), scan_size_samps);
+        perm = 0;
+    }
+    if (!perm && !remap.isNull()) perm = &remap;
     unsigned scansOff = 0; //in scans
     while (nScans) {
         if (!currPage) { currPage = (short *)grabNextPageForWrite(); pageOffset = 0; }
@@ -232,15 +605,18 @@ bool PagedScanWriter::write(const short *scans, unsigned nScans, const void *met
             return false; /* this should *NEVER* be reached!! A safeguard, though, in case of improper use of class and/or too small a pagesize */ 
         }
         unsigned n2write = nScans > spaceLeft ? spaceLeft : nScans;
-        memcpy(currPage+(pageOffset*scan_size_samps), scans+(scansOff*scan_size_samps), n2write*scan_size_bytes);
+        if (perm)
+            perm->apply(scans+(scansOff*scan_size_samps), currPage+(pageOffset*scan_size_samps), n2write);
+        else
+            memcpy(currPage+(pageOffset*scan_size_samps), scans+(scansOff*scan_size_samps), n2write*scan_size_bytes);
         pageOffset += n2write;
+        nRemapped = pageOffset;
         partial_offset = pageOffset * scan_size_bytes;
         scansOff += n2write;
         scanCt += static_cast<unsigned long long>(n2write);
         sampleCt += static_cast<unsigned long long>(n2write*scan_size_samps);
         nScans -= n2write;
         spaceLeft -= n2write;
-        /*if (mapper) mapper->release(n2write); /// inform remapper that this many new scans arrived and can be reordered*/
 
         if (!spaceLeft) {  // if clause here is needed as above block may modify spaceLeft
             if (meta_data_size_bytes) {
@@ -254,54 +630,40 @@ bool PagedScanWriter::write(const short *scans, unsigned nScans, const void *met
     return true;
 }
 
-void PagedScanWriter::commit()
+short *PagedScanWriter::directWritePtr(unsigned *nScansFree)
 {
-    if (currPage) {
-        /*if (mapper) { 
-            //DbgFunc("PagedScanWriter::commit() called, but mapper %d is still active. Releasing and waiting...", mapper->id());
-            mapper->release(nScansPerPage); 
-            mapper->wait(); 
-            delete mapper; mapper = 0;
-        } // wait for mapper to complete channel reordering..*/
-        commitCurrentWritePage();
-        currPage = 0; pageOffset = 0; partial_offset = 0;
-    }
+    if (!currPage) { currPage = (short *)grabNextPageForWrite(); pageOffset = 0; partial_offset = 0; }
+    if (!currPage || pageOffset >= nScansPerPage) { if (nScansFree) *nScansFree = 0; return 0; }
+    if (nScansFree) *nScansFree = nScansPerPage - pageOffset;
+    return currPage + (pageOffset*scan_size_samps);
 }
 
-PagedScanWriter::ScanRemapper::ScanRemapper(short *page, unsigned nScansPerPage, unsigned scanLen, const std::vector<int> & mapping)
-    : Semaphore(nScansPerPage), ErrFunc(&dummyErrFunc), pleaseStop(false), scans(page), nScansPerPage(nScansPerPage), scanLen(scanLen), map(mapping) 
-{}
-
-PagedScanWriter::ScanRemapper::~ScanRemapper()
+bool PagedScanWriter::commitDirectWrite(unsigned nScans, const void *meta)
 {
-    pleaseStop = true;
-    if (isRunning()) {
-        //DbgFunc("ScanMapper Thread %d delete called while still running, attempting to end thread gracefully...", id());
-        release(); 
-        Thread::wait(0xffffffff);
+    if (!currPage || pageOffset + nScans > nScansPerPage) {
+        ErrFunc("FATAL! Improper use of class in PagedScanWriter::commitDirectWrite() -- more scans committed than were available!");
+        return false;
     }
+    pageOffset += nScans;
+    remapInPlace(pageOffset);
+    partial_offset = pageOffset * scan_size_bytes;
+    scanCt += static_cast<unsigned long long>(nScans);
+    sampleCt += static_cast<unsigned long long>(nScans*scan_size_samps);
+    if (pageOffset == nScansPerPage) {
+        if (meta_data_size_bytes) {
+            if (!meta) return false; // force caller to give us metadata when we are closing up a page!
+            memcpy(currPage + (pageOffset*scan_size_samps), meta, meta_data_size_bytes);
+        }
+        commit();
+    }
+    return true;
 }
 
-void PagedScanWriter::ScanRemapper::threadFunc()
+void PagedScanWriter::commit()
 {
-    
-    //DbgFunc("ScanRemapper Thread %d started.", id());
-    short *scan = scans;
-    int ct = 0;
-    std::vector<short> tmpScan; tmpScan.resize(scanLen);
-    while (ct < (int)nScansPerPage) {
-        acquire();
-        if (pleaseStop) {
-            DbgFunc("ScanRemapper Thread %d received premature stop. Exiting...", id());
-            return;
-        }
-        for (int i = 0; i < int(scanLen); ++i)
-            tmpScan[i] = scan[map[i]];
-        memcpy(scan, &tmpScan[0], scanLen*sizeof(scan[0]));
-        scan += scanLen;
-        ++ct;
+    if (currPage) {
+        // scans so far, counting any partial write still in progress, less the ones in this page
+        commitCurrentWritePage(scanCt + partial_bytes_written/scan_size_bytes - partial_offset/scan_size_bytes);
+        currPage = 0; pageOffset = 0; partial_offset = 0;
     }
-    //DbgFunc("ScanRemapper Thread %d completed successfully after processing %d scans.", id(), (int)nScansPerPage);
 }
-
-
@@ -7,7 +7,51 @@
 
 #include <string.h>
 
-#define PAGED_RINGBUFFER_MAGIC 0x4a6ef00d
+// bumped from 0x4a6ef00d when the page header grew its commit time and first scan stamps and the ring header grew the
+// page geometry: a ring written with the old layout (an old FG_SpikeGL.exe, say) then just never has any readable
+// pages, instead of garbage ones
+#define PAGED_RINGBUFFER_MAGIC 0x4a6ef00e
+
+/// A fixed reordering of the samples within each scan, applied while copying whole blocks of scans
+/// (eg the Intan MUX demux).  For every scan, out[i] = in[table()[i]].
+/// Transposes -- which is what all the Intan MUX layouts are -- additionally get an SSE2 8x8 block kernel;
+/// anything the kernel doesn't cover goes through the table.
+class ScanPermutation
+{
+public:
+    ScanPermutation() : scan_size(0), rows(0), cols(0), scan_size1(0) {}
+
+    /// Generic permutation.  gather must have one entry per sample in the scan, each a valid index into the scan.
+    void setGather(const std::vector<int> & gather);
+    /// The first rows*cols samples of each scan are a row-major rows x cols matrix to be transposed,
+    /// the remaining samples (up to scanSize) are left where they are.
+    void setTranspose(unsigned scanSize, unsigned rows, unsigned cols);
+    /// Two-source version, for assembling each output scan from one scan of in1 (scanSize1 samples) and one of in2:
+    /// gather entries < scanSize1 refer to in1's scan, the rest to in2's (minus scanSize1).  Use apply2() with it.
+    void setGather2(const std::vector<int> & gather, unsigned scanSize1);
+    void clear() { gather.clear(); tail.clear(); runs2.clear(); scan_size = rows = cols = scan_size1 = 0; }
+
+    bool isNull() const { return gather.empty(); }
+    unsigned scanSize() const { return scan_size; }
+    const std::vector<unsigned> & table() const { return gather; }
+
+    /// Copies nScans scans from in to out, reordering each one.  in and out must not overlap.
+    void apply(const short *in, short *out, unsigned nScans) const;
+    /// For setGather2() permutations: builds nScans output scans from nScans scans of in1 and nScans scans of in2.
+    void apply2(const short *in1, const short *in2, short *out, unsigned nScans) const;
+    unsigned scanSize1() const { return scan_size1; }
+    unsigned scanSize2() const { return scan_size - scan_size1; }
+
+private:
+    std::vector<unsigned> gather;
+    std::vector<unsigned> tail; ///< output indices not handled by the block kernel
+    /// for apply2(): out[out..out+len) = src[in], src[in+stride], ... where src is in1's scan (which == 0) or in2's.
+    /// The Intan transposes collapse to one run per Intan per device, so there's no per-sample table lookup.
+    struct Run { unsigned out, in, stride, len, which; };
+    std::vector<Run> runs2;
+    unsigned scan_size, rows, cols; ///< rows/cols are 0 if not a transpose
+    unsigned scan_size1;
+};
 
 class PagedRingBuffer
 {
@@ -25,6 +69,12 @@ public:
     /// returns NULL when a new read page isn't 'ready' yet.  nSkips is the number of pages dropped due to overflows.  Normally should be 0.
     void *nextReadPage(int *nSkips = 0);
 
+    /// Returns the page 'back' pages before the one most recently returned by nextReadPage() (0 = that page itself),
+    /// straight out of ring memory.  Returns NULL if that page predates the start of the acquisition or the writer
+    /// has already overwritten (or is in the middle of overwriting) it.  Nothing is copied, so callers that hold on to
+    /// the pointer for a while should make sure the writer can't lap them, eg by checking latest() - latestPageRead().
+    void *pastReadPage(unsigned back) const;
+
     /// clear the contents to 0.
     void bzero();
 
@@ -36,19 +86,66 @@ public:
     /// Returns the last page this reader saw.  Compare it to latest() to get an idea of how far behind this reader is.
     unsigned int latestPageRead() const { return lastPageRead; }
 
+    /// When the page most recently returned by nextReadPage() was committed by the writer, on the nowNS() clock, and
+    /// the index of its first scan since the writer started.  Consumers use these to see how long a page sat in the
+    /// ring before they got to it (nowNS() - lastPageCommitTimeNS()) and to line pages up across readers.
+    unsigned long long lastPageCommitTimeNS() const { return lastCommitNS; }
+    unsigned long long lastPageFirstScan() const { return lastFirstScan; }
+
+    /// The monotonic clock pages are stamped with -- the same one as Util::getAbsTimeNS(), which this file can't use
+    /// since it's also compiled into the framegrabber subprocess.  Comparable across processes on the same machine.
+    static unsigned long long nowNS();
+
+    /// Bytes of memory needed for a ring of nPages pages of page_size bytes each, counting the page headers.
+    static unsigned long requiredSize(unsigned long page_size, unsigned nPages) { return sizeof(RingHeader) + nPages*(page_size + sizeof(Header)); }
+
+    /// The page geometry the ring's writer published (see PagedRingBufferWriter), read consistently out of the shared
+    /// ring header.  Returns false if no writer has published one yet.  gen is bumped every time a writer does.
+    struct Geometry { unsigned pageSize, nPages, scanSizeSamps, metaBytes, scansPerPage, gen; };
+    bool writerGeometry(Geometry & g) const;
+
+    /// How a registered reader wants overruns handled, see PagedScanReader::registerReader().
+    enum LagPolicy {
+        Unregistered = 0,
+        BestEffort,  ///< may drop: once it falls too far behind it skips straight to the newest page
+        MustNotDrop  ///< the writer waits (up to its max block time) rather than overwrite a page this reader hasn't read
+    };
+    enum { MaxReaders = 8 };
+
 protected:
+    /// Lives at the very start of the memory, ahead of the pages.  latestPNum must stay first: it's what the old
+    /// single unsigned int header was, and the union below relies on it.
+    struct RingHeader {
+        volatile unsigned int latestPNum;
+        volatile unsigned int geomMagic; ///< PAGED_RINGBUFFER_MAGIC while the geometry below is valid, 0 while it's being written
+        volatile unsigned int geomGen;
+        volatile unsigned int pageSize, nPages, scanSizeSamps, metaBytes, scansPerPage;
+        /// Registered readers, so the writer can see how far behind each one is.  policy 0 = free slot.
+        struct ReaderSlot {
+            volatile unsigned int policy; ///< a LagPolicy
+            volatile unsigned int lastPageRead; ///< the page the reader is on -- it may still be using it
+            volatile unsigned int drops; ///< pages the writer overwrote anyway after blocking for this MustNotDrop reader
+            volatile unsigned int pad;
+        } readers[MaxReaders];
+    };
+
     union {
         void *memBuffer;
         volatile unsigned int *latestPNum;
+        RingHeader *ring;
     };
-    char *mem; // points one unsigned int past memBuffer
+    char *mem; // points sizeof(RingHeader) past memBuffer
     unsigned long real_size_bytes, avail_size_bytes, page_size;
     unsigned int npages, lastPageRead;
     int pageIdx;
+    unsigned long long lastCommitNS, lastFirstScan;
 
     struct Header {
         volatile unsigned int magic;
         volatile unsigned int pageNum;
+        volatile unsigned long long commitTimeNS; ///< nowNS() at commit
+        volatile unsigned long long firstScan; ///< scan index of the first scan in the page, for PagedScanWriter pages
+        unsigned long long reserved; ///< pads the header to 32 bytes -- a 24 byte header measurably slowed the page copies
     };
 };
 
@@ -74,15 +171,38 @@ public:
     /// Updates the magic header info so that the current write page can now
     /// be effectively written by reading processes/tasks.  Call this after
     /// being done with a page returned from grabNextPageForWrite(), and before
-    /// calling grabNextPageForWrite() again after being done with the page.
-    bool commitCurrentWritePage();
+    /// calling grabNextPageForWrite() again after being done with the page.  The page is stamped with the current
+    /// time and firstScan.
+    bool commitCurrentWritePage(unsigned long long firstScan = 0);
 
     void initializeForWriting(); ///< generally, call this before first writing to the buffer to clear it to 0
 
+    /// How long grabNextPageForWrite() may wait for a lagging MustNotDrop reader before overwriting its page anyway.
+    /// 0 (the default) never waits.  The bound is per page: a reader that keeps up just too slowly can hold up every
+    /// page that long (one that stops moving costs it only once).  Only set this where stalling the writer is harmless for that long, eg where the
+    /// hardware buffers upstream of it.
+    void setMaxBlockMs(unsigned ms) { maxBlockMs = ms; }
+    unsigned maxBlock() const { return maxBlockMs; }
+    /// Total time spent waiting for MustNotDrop readers, and the number of pages overwritten anyway once done waiting.
+    unsigned long long blockedNS() const { return blockedNs; }
+    unsigned long forcedOverruns() const { return nForced; }
+
+protected:
+    /// Stamps the ring header with this writer's geometry, for readers that weren't told it.  The constructor
+    /// publishes the page geometry, PagedScanWriter re-publishes it with its scan geometry filled in.
+    void publishGeometry(unsigned scanSizeSamps, unsigned metaBytes, unsigned scansPerPage);
+
 private:
     unsigned long nWritten;
     unsigned int lastPageWritten;
-
+    unsigned maxBlockMs;
+    unsigned long long blockedNs;
+    unsigned long nForced;
+    /// per reader slot: the lastPageRead at which we last gave up waiting for it.  We don't wait on it again until it
+    /// moves, so a reader that died without unregistering costs one max block time, not one per page.
+    unsigned gaveUpAt[MaxReaders];
+
+    void waitForReaders(unsigned overwritingPage);
 };
 
 class PagedScanWriter;
@@ -94,8 +214,30 @@ public:
                     unsigned meta_data_size_bytes,
                     void *mem, unsigned long mem_size_bytes, unsigned long page_size);
 
+    /// Copies are unregistered, whatever the original's registration.
     PagedScanReader(const PagedScanReader &r);
     PagedScanReader(const PagedScanWriter &w);
+    ~PagedScanReader(); ///< unregisters.  If the ring memory may be gone by then, call unregisterReader() first.
+
+    /// Claims a reader slot in the shared ring header, so that the writer (possibly in another process) can see how
+    /// far behind this reader is and treat it according to policy.  BestEffort readers more than maxLagPages behind
+    /// skip to the newest page (default: half the ring), rather than chase the writer through pages it's about to
+    /// overwrite.  Returns false if all MaxReaders slots are taken -- the reader then works unregistered, as before.
+    bool registerReader(LagPolicy policy, unsigned maxLagPages = 0);
+    void unregisterReader();
+    LagPolicy lagPolicy() const { return policy; }
+    /// Pages behind the writer.
+    unsigned lag() const { const unsigned l = latest(); return l > lastPageRead ? l - lastPageRead : 0; }
+    /// For a MustNotDrop reader, the pages the writer overwrote anyway after blocking for it as long as it could.
+    unsigned forcedDrops() const { return slot >= 0 && ring ? ring->readers[slot].drops : 0; }
+    /// Keeps the last n pages read out of the writer's reach, as well as the current one: the reader reports itself
+    /// n pages further behind than it is.  For a MustNotDrop reader that goes back to pastPage()s (eg the saver's
+    /// pre-trigger window) -- for other policies it only makes the reader look more behind.
+    void setRetainPages(unsigned n) { retain = n; publishLastRead(); }
+    unsigned retainPages() const { return retain; }
+    /// True if pastPage(back) is held out of the writer's reach by setRetainPages(), so it can be used in place rather
+    /// than copied out -- short of the writer giving up on us after its max block time (see forcedDrops()).
+    bool isRetained(unsigned back) const { return slot >= 0 && policy == MustNotDrop && back <= retain; }
 
     unsigned metaDataSizeBytes() const { return meta_data_size_bytes; }
     unsigned long long scansRead() const { return scanCt; }
@@ -110,12 +252,32 @@ public:
     /// in samples
     unsigned scanSizeSamps() const { return scan_size_samps; }
 
+    /// Picks up the geometry the writer published in the ring header, if it's not the one this reader was constructed
+    /// with -- so readers work with whatever page size the writer chose.  On a change of geometry (or a restarted
+    /// writer) the reader starts over at the beginning of the ring.  next() calls this whenever the writer publishes,
+    /// so there's normally no need to call it.  Returns true if the geometry changed.
+    bool syncGeometry();
+
     const short *next(int *nSkips, void **metaPtr = 0, unsigned *scans_returned = 0);
+    /// Like next() but for a page already read -- see PagedRingBuffer::pastReadPage().  Always a full page of scans if non-NULL.
+    const short *pastPage(unsigned back, void **metaPtr = 0) const;
+    /// Copies a page already read (scansPerPage()*scanSizeSamps() samples, plus metaDataSizeBytes() to metaOut if
+    /// non-NULL), then checks that the writer didn't get to the page while we were copying it.  Returns false, with
+    /// the outputs in an undefined state, if the page is gone.
+    bool copyPastPage(unsigned back, short *scansOut, void *metaOut = 0) const;
 
 private:
     unsigned scan_size_samps, meta_data_size_bytes;
     unsigned nScansPerPage;
     unsigned long long scanCt, scanCtV;
+    unsigned seenGen; ///< the ring header's geometry generation this reader last synced to
+    int slot; ///< our RingHeader::readers[] slot, or -1
+    LagPolicy policy;
+    unsigned maxLag;
+    unsigned retain; ///< see setRetainPages()
+
+    void initScanGeometry();
+    void publishLastRead() { if (slot >= 0 && ring) ring->readers[slot].lastPageRead = lastPageRead > retain ? lastPageRead - retain : 0; }
 };
 
 class PagedScanWriter : public PagedRingBufferWriter
@@ -125,6 +287,8 @@ public:
 
     ErrFunc_t ErrFunc, DbgFunc;
 
+    /// If chan_mapping is not empty, every scan written is reordered so that page_scan[i] = scan[chan_mapping[i]].
+    /// Missing or out-of-range entries map a channel to itself.
     PagedScanWriter(unsigned scan_size_samples, unsigned meta_data_size_bytes, void *mem, unsigned long size_bytes, unsigned long page_size,
                     const std::vector<int> & chan_mapping = std::vector<int>());
     ~PagedScanWriter();
@@ -138,8 +302,16 @@ public:
     unsigned metaDataSizeBytes() const { return meta_data_size_bytes; }
 
 
-    /// write full scans, optionally writing metadata
-    bool write(const short *scans, unsigned nScans, const void *meta = 0);
+    /// write full scans, optionally writing metadata.  If perm is not NULL, each scan is reordered by it on its
+    /// way into the page (so the data is only touched once).  perm replaces the constructor's chan_mapping, if any,
+    /// for these scans -- callers wanting both should compose them into perm.
+    bool write(const short *scans, unsigned nScans, const void *meta = 0, const ScanPermutation *perm = 0);
+
+    /// Zero-copy writing: returns where the next scan goes in the current page (grabbing a new page if need be), and
+    /// in *nScansFree how many scans fit there.  Fill in up to that many scans, then call commitDirectWrite() with
+    /// the number actually written.  No metadata support beyond passing it to commitDirectWrite() for a page-filling write.
+    short *directWritePtr(unsigned *nScansFree);
+    bool commitDirectWrite(unsigned nScans, const void *meta = 0);
 
     /// write partial scans -- optimization for pitch != w in FG_SpikeGL.exe.. no metadata support
     void writePartialBegin();
@@ -147,36 +319,30 @@ public:
     bool writePartialEnd(); // call this when your partial write is done and you are *sure* you have a multiple of 1 or more full scans written
 
 
-    // same as super class but also initializes the ScanRemapper
+    /// The channel mapping given to the constructor, if any, as applied to every scan on its way into the page:
+    /// page_scan[i] = incoming_scan[chan_mapping[i]].  Null if no mapping is in effect.
+    const ScanPermutation & channelMapping() const { return remap; }
+
+    // same as super class but also resets the channel remapping state for the new page
     /*virtual*/ void *grabNextPageForWrite();
 
 protected:
     void commit(); ///< called by write to commit the current page
 
 private:
+    void remapInPlace(unsigned uptoScan); ///< applies the channel mapping to the scans of currPage in [nRemapped, uptoScan)
+
     short *currPage;
     unsigned scan_size_samps, scan_size_bytes, meta_data_size_bytes;
-    unsigned nScansPerPage, nBytesPerPage, pageOffset /*in scans*/, partial_offset /* in bytes */, partial_bytes_written, partial_rem;
+    unsigned nScansPerPage, nBytesPerPage, pageOffset /*in scans*/, partial_offset /* in bytes */, partial_bytes_written;
     unsigned long long scanCt, sampleCt;
 
-    class ScanRemapper : public Thread, public Semaphore {
-    public:
-        ErrFunc_t ErrFunc, DbgFunc;
-
-        ScanRemapper(short *page, unsigned nScansPerPage, unsigned scanLen, const std::vector<int> & mapping);
-        ~ScanRemapper();
-        void wait() { Thread::wait(0xffffffff); }
-    protected:
-        void threadFunc();
-    private:
-        volatile bool pleaseStop;
-        short *scans;
-        unsigned nScansPerPage, scanLen;
-        const std::vector<int> & map;
-    };
-
-    const std::vector<int> chan_mapping;
-    ScanRemapper *mapper;
+    /* Channel mapping is done inline, by the writing thread: write() gathers straight from the caller's scans into
+       the page, while writePartial() and commitDirectWrite() remap each scan in-place as soon as it is complete.
+       No extra threads, no per-scan synchronization. */
+    ScanPermutation remap;
+    std::vector<short> remapTmp; ///< scratch for remapInPlace(), a few scans' worth
+    unsigned nRemapped; ///< number of scans at the start of currPage that are already in mapped order
 };
 
 
@@ -0,0 +1,151 @@
+#include "ReferenceStage.h"
+#include <algorithm>
+#include <QStringList>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define REFSTAGE_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+QString ReferenceStage::Spec::toString() const
+{
+    QStringList l;
+    l.push_back(QString("ref=%1").arg(mode == Median ? "median" : "car"));
+    for (size_t i = 0; i < groups.size(); ++i)
+        l.push_back(QString("group=%1-%2").arg(groups[i].first).arg(groups[i].second));
+    return l.join(";");
+}
+
+/* static */ ReferenceStage::Spec ReferenceStage::Spec::fromString(const QString & str, bool *ok_out)
+{
+    Spec s;
+    bool allok = true;
+    QStringList toks = str.split(";", QString::SkipEmptyParts);
+    for (QStringList::iterator it = toks.begin(); it != toks.end(); ++it) {
+        const QString t = (*it).trimmed().toLower();
+        const QString key = t.section('=', 0, 0).trimmed(), val = t.section('=', 1).trimmed();
+        bool ok = true, ok2 = true;
+        if (key == "ref") {
+            if (val == "car" || val == "average" || val == "mean") s.mode = Average;
+            else if (val == "median" || val == "cmr") s.mode = Median;
+            else ok = false;
+        } else if (key == "group") {
+            unsigned lo = val.section('-', 0, 0).toUInt(&ok), hi = lo;
+            if (val.contains('-')) hi = val.section('-', 1, 1).toUInt(&ok2);
+            if (ok && ok2 && hi >= lo) {
+                // a channel can only be referenced against one group: overlapping groups are rejected
+                for (size_t i = 0; ok && i < s.groups.size(); ++i)
+                    if (lo <= s.groups[i].second && s.groups[i].first <= hi) ok = false;
+                if (ok) s.groups.push_back(std::pair<unsigned,unsigned>(lo, hi));
+            } else ok = false;
+        } else if (t.length())
+            ok = false;
+        if (!ok || !ok2) allok = false;
+    }
+    if (ok_out) *ok_out = allok;
+    return s;
+}
+
+ReferenceStage::ReferenceStage(unsigned ss, const Spec & s, const unsigned char *chans)
+    : nChans(0)
+{
+    setup(ss, s, chans);
+}
+
+void ReferenceStage::setup(unsigned ss, const Spec & s, const unsigned char *chans)
+{
+    sp = s;
+    nChans = ss;
+    groups.clear();
+    std::vector<std::pair<unsigned,unsigned> > ranges(sp.groups);
+    if (ranges.empty() && nChans) ranges.push_back(std::pair<unsigned,unsigned>(0, nChans-1));
+    unsigned biggest = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        Group g;
+        g.n = 0;
+        const unsigned hi = std::min(ranges[i].second, nChans ? nChans-1 : 0);
+        // break the range up into runs of contiguous, selected channels so apply() can stream through them
+        for (unsigned c = ranges[i].first; c <= hi && c < nChans; ++c) {
+            if (chans && !chans[c]) continue;
+            if (g.runs.size() && g.runs.back().start + g.runs.back().len == c) ++g.runs.back().len;
+            else { Run r; r.start = c; r.len = 1; g.runs.push_back(r); }
+            ++g.n;
+        }
+        if (g.n > 1) { // a group of 1 would just zero that channel out
+            groups.push_back(g);
+            if (g.n > biggest) biggest = g.n;
+        }
+    }
+    medianTmp.resize(biggest);
+}
+
+/* static */ int ReferenceStage::sum(const short *p, unsigned n)
+{
+    int s = 0;
+    unsigned i = 0;
+#ifdef REFSTAGE_USE_SSE2
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    for ( ; i+8 <= n; i += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p+i)), ones));
+    int tmp[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), acc);
+    s = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#endif
+    for ( ; i < n; ++i) s += p[i];
+    return s;
+}
+
+/* static */ void ReferenceStage::subtract(short *p, unsigned n, short ref)
+{
+    unsigned i = 0;
+#ifdef REFSTAGE_USE_SSE2
+    const __m128i r = _mm_set1_epi16(ref);
+    for ( ; i+8 <= n; i += 8) {
+        __m128i * const v = reinterpret_cast<__m128i *>(p+i);
+        _mm_storeu_si128(v, _mm_subs_epi16(_mm_loadu_si128(v), r));
+    }
+#endif
+    for ( ; i < n; ++i) {
+        const int v = int(p[i]) - int(ref);
+        p[i] = short(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+    }
+}
+
+short ReferenceStage::median(const short *scan, const Group & g)
+{
+    short *t = &medianTmp[0];
+    for (size_t r = 0; r < g.runs.size(); ++r) {
+        const Run & run(g.runs[r]);
+        std::copy(scan + run.start, scan + run.start + run.len, t);
+        t += run.len;
+    }
+    t = &medianTmp[0];
+    const unsigned k = g.n/2;
+    std::nth_element(t, t+k, t+g.n);
+    if (g.n & 1) return t[k];
+    // even count: average the two middle values.  nth_element leaves everything below t[k] in [0,k)
+    const int lo = *std::max_element(t, t+k);
+    return short((lo + int(t[k])) >> 1);
+}
+
+void ReferenceStage::apply(short *scans, unsigned nScans)
+{
+    if (groups.empty()) return;
+    for (unsigned s = 0; s < nScans; ++s) {
+        short * const scan = scans + size_t(s)*size_t(nChans);
+        for (size_t gi = 0; gi < groups.size(); ++gi) {
+            const Group & g(groups[gi]);
+            short ref;
+            if (sp.mode == Median)
+                ref = median(scan, g);
+            else {
+                int tot = 0;
+                for (size_t r = 0; r < g.runs.size(); ++r) tot += sum(scan + g.runs[r].start, g.runs[r].len);
+                // round to nearest
+                ref = short(tot >= 0 ? (tot + int(g.n/2)) / int(g.n) : -((-tot + int(g.n/2)) / int(g.n)));
+            }
+            if (!ref) continue;
+            for (size_t r = 0; r < g.runs.size(); ++r) subtract(scan + g.runs[r].start, g.runs[r].len, ref);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef ReferenceStage_H
+#define ReferenceStage_H
+
+#include <vector>
+#include <QString>
+
+/// Per-scan re-referencing: for each scan, computes the common average (CAR)
+/// or common median (CMR) of each channel group and subtracts it from every
+/// channel in that group.  Meant for high-density probes (FG and AI256Demux
+/// modes) where the referencing used to always be done offline.  Like
+/// FilterBank, it works in-place on blocks of interleaved scans.
+class ReferenceStage
+{
+public:
+    enum Mode { Average = 0, Median };
+
+    /// Describes the referencing to do.  Round-trips through a string of the form
+    /// "ref=median;group=0-63;group=64-127" (or "ref=car", for one big group of
+    /// all non-aux channels) so that it can live in the settings and .meta files.
+    struct Spec {
+        Mode mode;
+        std::vector<std::pair<unsigned,unsigned> > groups; ///< inclusive channel index ranges, one per group.  Empty means all the channels form one group.
+
+        Spec() : mode(Average) {}
+
+        QString toString() const;
+        /// Unknown or malformed tokens set *ok to false, but the rest of the string is still parsed.  So do groups that
+        /// overlap an earlier group; they are left out.
+        static Spec fromString(const QString & s, bool *ok = 0);
+    };
+
+    ReferenceStage(unsigned scanSize = 0, const Spec & spec = Spec(), const unsigned char *which_chans = 0);
+
+    /// which_chans, if not NULL, points to scanSize bytes.  Channels with which_chans[i] == 0 (eg aux chans)
+    /// are never part of any group, are not used in computing the reference, and are left untouched.
+    void setup(unsigned scanSize, const Spec & spec, const unsigned char *which_chans = 0);
+    const Spec & spec() const { return sp; }
+    unsigned scanSize() const { return nChans; }
+    unsigned numGroups() const { return unsigned(groups.size()); }
+
+    /// Re-references nScans contiguous scans in-place.
+    void apply(short *scans, unsigned nScans);
+
+private:
+    struct Run { unsigned start, len; }; ///< a contiguous run of channels within a scan
+    struct Group { std::vector<Run> runs; unsigned n; };
+
+    static int sum(const short *p, unsigned n);
+    static void subtract(short *p, unsigned n, short ref);
+    short median(const short *scan, const Group & g);
+
+    Spec sp;
+    unsigned nChans;
+    std::vector<Group> groups;
+    std::vector<short> medianTmp; ///< scratch for the median's nth_element
+};
+
+#endif
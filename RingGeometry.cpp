@@ -0,0 +1,41 @@
+#include "RingGeometry.h"
+#include "SpikeGLConstants.h"
+#include "PagedRingBuffer.h"
+#include <math.h>
+
+void RingGeometry::compute()
+{
+    const double targetMs = lowLatency ? SAMPLES_SHM_DESIRED_PAGETIME_MS/2. : double(SAMPLES_SHM_DESIRED_PAGETIME_MS);
+    double spp = srate * targetMs / 1000.;
+    if (oneScanBytes && spp * oneScanBytes > SAMPLES_SHM_MAX_PAGE_BYTES) spp = double(SAMPLES_SHM_MAX_PAGE_BYTES / oneScanBytes);
+    timeScans = spp;
+    perSampLoad = 0.;
+    if (fixedNs > 0. && srate > 0.) {
+        // load = (fixed + perSamp*nChans*spp) / (spp/srate) <= max, solved for spp
+        perSampLoad = perSampNs * 1e-9 * nChans * srate;
+        const double headroom = SAMPLES_SHM_MAX_CONSUMER_LOAD - perSampLoad;
+        if (headroom > 0.) {
+            const double minSpp = fixedNs * 1e-9 * srate / headroom;
+            if (spp < minSpp) spp = ceil(minSpp);
+        }
+    }
+    scansPerPage = (unsigned long)(spp + .5);
+    if (!scansPerPage) scansPerPage = 1;
+    wantScans = scansPerPage;
+    if (oneScanBytes && ringBytes) {
+        for (;;) {
+            const unsigned preTrigPages = unsigned((preTrigScans + scansPerPage - 1) / scansPerPage);
+            const unsigned minPages = preTrigScans && 2*preTrigPages + 2 > unsigned(SAMPLES_SHM_MIN_PAGES) ? 2*preTrigPages + 2 : unsigned(SAMPLES_SHM_MIN_PAGES);
+            const unsigned long pb = scansPerPage*oneScanBytes;
+            // in 64 bits: pages grown for cost can be big
+            const unsigned long long perPage = PagedRingBuffer::requiredSize(pb, 1) - PagedRingBuffer::requiredSize(pb, 0);
+            if (scansPerPage <= 1 || PagedRingBuffer::requiredSize(pb, 0) + (unsigned long long)minPages*perPage <= (unsigned long long)ringBytes) break;
+            scansPerPage = scansPerPage > 8 ? scansPerPage - scansPerPage/8 : scansPerPage - 1;
+        }
+    }
+}
+
+double RingGeometry::pageMs() const
+{
+    return srate > 0. ? scansPerPage * 1000. / srate : double(SAMPLES_SHM_DESIRED_PAGETIME_MS);
+}
@@ -0,0 +1,34 @@
+#ifndef RingGeometry_H
+#define RingGeometry_H
+
+/// The sample ring's page size policy (see MainApp::ringPageSize(), which logs what it decides): pages of about
+/// SAMPLES_SHM_DESIRED_PAGETIME_MS, no bigger than SAMPLES_SHM_MAX_PAGE_BYTES, grown if the ring consumers' measured
+/// per-page cost calls for it, and shrunk to fit SAMPLES_SHM_MIN_PAGES and the pre-trigger window in the ring.
+/// Qt-free, so that the benchmarks lay out their rings the way the app does.
+struct RingGeometry
+{
+    // inputs
+    double srate;
+    unsigned nChans;
+    unsigned long oneScanBytes; ///< the scan's samples plus any per-scan metadata
+    bool lowLatency; ///< half the usual page time
+    unsigned long ringBytes; ///< 0 = don't fit the pages to a ring
+    unsigned preTrigScans;
+    double fixedNs, perSampNs; ///< the consumers' measured per-page and per-sample cost, 0 if never measured
+
+    // outputs, from compute()
+    unsigned long scansPerPage;
+    double timeScans; ///< scans per page from the page time (and SAMPLES_SHM_MAX_PAGE_BYTES) alone
+    unsigned long wantScans; ///< scans per page before fitting them to the ring: more than timeScans if grown for cost
+    double perSampLoad; ///< the consumers' load from their per-sample cost alone.  No page size helps once it reaches SAMPLES_SHM_MAX_CONSUMER_LOAD
+
+    RingGeometry()
+        : srate(0.), nChans(0), oneScanBytes(0), lowLatency(false), ringBytes(0), preTrigScans(0), fixedNs(0.), perSampNs(0.),
+          scansPerPage(0), timeScans(0.), wantScans(0), perSampLoad(0.) {}
+
+    void compute();
+    unsigned long pageBytes() const { return scansPerPage*oneScanBytes; }
+    double pageMs() const; ///< of scansPerPage
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "SlidingMinMax.h"
+#include <stddef.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SLIDINGMINMAX_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+void SlidingMinMax::push(double t, int16 cmin, int16 cmax)
+{
+    if (!mins.empty() && mins.back().t > t) mins.clear(), maxs.clear(); // time went backwards (new acquisition), start over
+    // anything that is no better than the new value can never be the window's min (max) again
+    while (!mins.empty() && mins.back().v >= cmin) mins.pop_back();
+    while (!maxs.empty() && maxs.back().v <= cmax) maxs.pop_back();
+    Entry e;
+    e.t = t;
+    e.v = cmin; mins.push_back(e);
+    e.v = cmax; maxs.push_back(e);
+}
+
+void SlidingMinMax::expire(double now, double secs)
+{
+    while (!mins.empty() && now - mins.front().t > secs) mins.pop_front();
+    while (!maxs.empty() && now - maxs.front().t > secs) maxs.pop_front();
+}
+
+/*static*/ void SlidingMinMax::chunkMinMax(const int16 *scans, int nscans, int nch, int skip, int16 *mins, int16 *maxs)
+{
+    const int npad = (nch+7)&~7;
+    for (int c = 0; c < npad; ++c) mins[c] = 32767, maxs[c] = -32768;
+    for (int s = 0; s < nscans; s += 1+skip) {
+        const int16 *x = scans + size_t(s)*size_t(nch);
+        int c = 0;
+#ifdef SLIDINGMINMAX_USE_SSE2
+        for ( ; c+8 <= nch; c += 8) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x+c));
+            __m128i * const pmin = reinterpret_cast<__m128i *>(mins+c), * const pmax = reinterpret_cast<__m128i *>(maxs+c);
+            _mm_storeu_si128(pmin, _mm_min_epi16(_mm_loadu_si128(pmin), v));
+            _mm_storeu_si128(pmax, _mm_max_epi16(_mm_loadu_si128(pmax), v));
+        }
+#endif
+        for ( ; c < nch; ++c) {
+            if (x[c] < mins[c]) mins[c] = x[c];
+            if (x[c] > maxs[c]) maxs[c] = x[c];
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef SlidingMinMax_H
+#define SlidingMinMax_H
+
+#include <deque>
+#include "TypeDefs.h"
+
+/// Sliding-window min/max of one channel over a series of per-chunk min/max's, using a pair of monotonic deques.
+/// Amortized O(1) per chunk for both update and query, regardless of how many chunks the window spans.
+/// SpatialVisWindow's auto-scale keeps one per channel, each with its own window length.
+struct SlidingMinMax
+{
+    struct Entry { double t; int16 v; };
+    std::deque<Entry> mins, maxs; ///< mins is increasing front to back, maxs is decreasing.  The fronts are the window's min/max.
+
+    /// add a chunk's min/max at time t.  If t is earlier than the last chunk's (a new acquisition), starts over.
+    void push(double t, int16 cmin, int16 cmax);
+    /// drop entries more than window_secs older than 'now'
+    void expire(double now, double window_secs);
+
+    bool isEmpty() const { return mins.empty(); }
+    int16 min() const { return mins.front().v; } ///< only valid if !isEmpty()
+    int16 max() const { return maxs.front().v; } ///< only valid if !isEmpty()
+
+    /// Per-channel min/max over every (1+skip)th scan of nscans interleaved scans of nch channels, in one pass across
+    /// channels (SSE2 where available).  mins/maxs must be padded to a multiple of 8.
+    static void chunkMinMax(const int16 *scans, int nscans, int nch, int skip, int16 *mins, int16 *maxs);
+};
+
+#endif
@@ -19,11 +19,19 @@
 #include <QSlider>
 #include <QMatrix>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QMutexLocker>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include "StimGL_SpikeGL_Integration.h"
+#include "MainApp.h"
 
 #include "no_data.xpm"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SPATIALVIS_USE_SSE2 1
+#  include <emmintrin.h>
+#endif
 
 #define SETTINGS_GROUP "SpatialVisWindow Settings"
 #define GlyphScaleFactor 0.9725 /**< set this to less than 1 to give each glyph a margin */
@@ -39,6 +47,11 @@ SpatialVisWindow::SpatialVisWindow(DAQ::Params & params, const Vec2i & xy_dims,
 	static bool registeredMetaType = false;
     autoScaleColorRange = false;
     downsampleRatio = 1.0;
+    visMode = InstantaneousMode;
+    heatTauSecs = 1.0;
+    spikesSince = 0;
+    spikesRunning = false;
+    heatMax = 0.f;
 
 	if (fshare.shm) {
 		Log() << "SpatialVisWindow: " << (fshare.createdByThisInstance ? "Created" : "Attatched to pre-existing") <<  " StimGL 'frame share' memory segment, size: " << (double(fshare.size())/1024.0/1024.0) << "MB.";
@@ -79,6 +92,12 @@ SpatialVisWindow::SpatialVisWindow(DAQ::Params & params, const Vec2i & xy_dims,
     toolBar->addWidget(autoScaleChk = new QCheckBox("AutoScale", toolBar));
     autoScaleChk->setToolTip("If checked, scale the displayed colors' dynamic ranges based on the MIN/MAX values seen in the last few seconds worth of data");
 
+    toolBar->addWidget(modeCombo = new QComboBox(toolBar));
+    modeCombo->addItem("Instantaneous", int(InstantaneousMode));
+    modeCombo->addItem("RMS Heatmap", int(RMSMode));
+    modeCombo->addItem("Spike Rate Heatmap", int(SpikeRateMode));
+    modeCombo->setToolTip("What the glyph intensities show: the last sample seen per channel, a running RMS of all samples, or a running spike rate (needs Options->Online Spike Detection).  The heatmaps are normalized to the most active channel.");
+
     toolBar->addSeparator();
 	
 	toolBar->addWidget(label = new QLabel("Layout: ", toolBar));
@@ -114,6 +133,7 @@ SpatialVisWindow::SpatialVisWindow(DAQ::Params & params, const Vec2i & xy_dims,
 	Connect(overlayBut, SIGNAL(clicked(bool)), this, SLOT(overlayButPushed()));
     Connect(colorBut, SIGNAL(clicked(bool)), this, SLOT(colorButPressed()));
     Connect(autoScaleChk, SIGNAL(toggled(bool)), this, SLOT(setAutoScale(bool)));
+    Connect(modeCombo, SIGNAL(activated(int)), this, SLOT(setVisMode(int)));
 	
 	toolBar->addWidget(ovlFFChk = new QCheckBox("Full Frame", toolBar));
 	ovlFFChk->setEnabled(!!fshare.shm);
@@ -144,16 +164,28 @@ SpatialVisWindow::SpatialVisWindow(DAQ::Params & params, const Vec2i & xy_dims,
         Warning() << "SpatialVisWindow: Passed-in dimensions (" << ox << "x" << oy << ") don't match the number of channels!  Auto-corrected to: " << nbx << "x" << nby;
     }
     points.resize(nvai);
-    colors.resize(nvai);
+    intensities.resize(nvai);
+    palettes.resize(nvai);
 	chanVolts.resize(nvai);
     chanRawSamps.resize(nvai);
     graphTimes.resize(nvai);
+    rmsCenter.resize((nvai+3)&~3, 0.f);
+    emaVar.resize(nvai, 0.f);
+    emaRate.resize(nvai, 0.f);
+    pageSum.resize((nvai+3)&~3, 0.f);
+    pageSumSq.resize((nvai+3)&~3, 0.f);
+    pageSpikes.resize(nvai, 0);
+    chanWindows.resize(nvai);
+    chanMinMax.resize(nvai);
+    chunkMin.resize((nvai+7)&~7);
+    chunkMax.resize((nvai+7)&~7);
 	
     // default sorting
     sorting.resize(nvai); naming.resize(nvai); revsorting.resize(nvai);
 
 	for (int chanid = 0; chanid < nvai; ++chanid) {
         revsorting[chanid] = sorting[chanid] = naming[chanid] = chanid;
+        palettes[chanid] = chanid < nvai-nextra ? 0 : 1;
         points[chanid] = chanId2Pos(chanid);
         graphTimes[chanid] = 3.0;
 	}
@@ -219,6 +251,7 @@ SpatialVisWindow::SpatialVisWindow(DAQ::Params & params, const Vec2i & xy_dims,
 	
 	graph->setGlyphType(GLSpatialVis::Square);
 	graph->setPoints(points); // setup graph points
+	graph->setPalettes(palettes);
 	
 	selClear();
 	
@@ -239,6 +272,83 @@ void SpatialVisWindow::setAutoScale(bool b) {
     saveSettings();
 }
 
+void SpatialVisWindow::setVisMode(int m) {
+    if (m < 0 || m >= N_VisModes) m = InstantaneousMode;
+    {
+        QMutexLocker l(&mut);
+        if (visMode != m) {
+            // start the estimators from scratch
+            std::fill(rmsCenter.begin(), rmsCenter.end(), 0.f);
+            std::fill(emaVar.begin(), emaVar.end(), 0.f);
+            std::fill(emaRate.begin(), emaRate.end(), 0.f);
+            heatMax = 0.f;
+        }
+        visMode = m;
+    }
+    updateToolBar();
+    saveSettings();
+}
+
+/// Accumulates per-channel sum and sum of squares of (x - center) over all nscans scans of nch chans.
+/// Centering on the running mean keeps the float sums accurate for channels with a large DC offset.
+/// center, sum and sumsq must be padded to a multiple of 4.
+static void accumSumSq(const int16 *scans, int nscans, int nch, const float *center, float *sum, float *sumsq)
+{
+    const int npad = (nch+3)&~3;
+    memset(sum, 0, npad*sizeof(float));
+    memset(sumsq, 0, npad*sizeof(float));
+    for (int s = 0; s < nscans; ++s) {
+        const int16 *x = scans + size_t(s)*size_t(nch);
+        int c = 0;
+#ifdef SPATIALVIS_USE_SSE2
+        for ( ; c+4 <= nch; c += 4) {
+            const __m128i xi = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(x+c));
+            const __m128 xf = _mm_sub_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(xi, xi), 16)), _mm_loadu_ps(center+c));
+            _mm_storeu_ps(sum+c, _mm_add_ps(_mm_loadu_ps(sum+c), xf));
+            _mm_storeu_ps(sumsq+c, _mm_add_ps(_mm_loadu_ps(sumsq+c), _mm_mul_ps(xf, xf)));
+        }
+#endif
+        for ( ; c < nch; ++c) {
+            const float v = float(x[c]) - center[c];
+            sum[c] += v;
+            sumsq[c] += v*v;
+        }
+    }
+}
+
+void SpatialVisWindow::updateRMS(const int16 *scans, int nscans)
+{
+    if (nscans <= 0) return;
+    accumSumSq(scans, nscans, nvai, &rmsCenter[0], &pageSum[0], &pageSumSq[0]);
+    const float d = float(exp(-double(nscans)/(heatTauSecs*params.srate))), d1 = 1.f-d, inv = 1.f/float(nscans);
+    for (int c = 0; c < nvai; ++c) {
+        const float m = pageSum[c]*inv, var = pageSumSq[c]*inv - m*m;
+        rmsCenter[c] += m; // the page's mean becomes the next page's center
+        emaVar[c] = emaVar[c]*d + d1*(var > 0.f ? var : 0.f);
+    }
+}
+
+void SpatialVisWindow::fetchSpikes()
+{
+    spikeTmp.clear();
+    u64 next = spikesSince;
+    spikesRunning = mainApp()->getRecentSpikes(spikesSince, spikeTmp, &next);
+    spikesSince = next;
+}
+
+void SpatialVisWindow::updateSpikeRate(int nscans)
+{
+    if (nscans <= 0) return;
+    std::fill(pageSpikes.begin(), pageSpikes.end(), 0U);
+    for (size_t i = 0; i < spikeTmp.size(); ++i)
+        if (spikeTmp[i].chan < unsigned(nvai)) ++pageSpikes[spikeTmp[i].chan];
+    spikeTmp.clear();
+    const double dt = double(nscans)/params.srate;
+    const float d = float(exp(-dt/heatTauSecs)), d1 = 1.f-d, invdt = float(1.0/dt);
+    for (int c = 0; c < nvai; ++c)
+        emaRate[c] = emaRate[c]*d + d1*(float(pageSpikes[c])*invdt);
+}
+
 void SpatialVisWindow::resizeEvent (QResizeEvent * event)
 {
 	updateGlyphSize();
@@ -267,46 +377,49 @@ void SpatialVisWindow::setDownsampleRatio(double r)
 
 void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u64 firstSamp)
 {
+    // before taking our mutex: getRecentSpikes() takes MainApp's, and MainApp's is never to be taken while holding ours
+    if (visMode == SpikeRateMode) fetchSpikes();
+
     QMutexLocker l(&mut);
 
     //double t0 = getTime(); (void)t0;
 
     const int downSampleSkips = downsampleRatio > 1.0 ? qRound(downsampleRatio)-1 : 0;//params.srate >= 1000.0 ? qRound(params.srate/1000.0)-1 : 0;
 
-    ChanMinMaxs cmm; cmm.resize(nvai);
-    const bool doAutoScale = autoScaleColorRange;
+    ChanMinMaxs & cmm(chanMinMax);
+    const bool doAutoScale = autoScaleColorRange && visMode == InstantaneousMode;
 
     if (doAutoScale) {
         // bookkeeping -- keep track of min/max values seen, per channel for a window of time to determine scale..
-        double  now = double(u64(firstSamp/nvai))/params.srate,
-                maxAge = 0;
-        for (int i = 0; i < graphTimes.size(); ++i) {
-            if (graphTimes[i] > maxAge) maxAge = graphTimes[i];
-        }
-        // expire old chunk min/max's
-        while (!chunkChanMinMaxs.empty() && (now-chunkChanMinMaxs.begin().key()) > maxAge)
-            chunkChanMinMaxs.erase(chunkChanMinMaxs.begin());
-
-        // now scan entire data chunk to update chanMinMax state...
-        for (int i = 0, ch = 0; i < (int)scans_size_samps; /*nothing. i is incremented last line of loop below..*/) {
-            if (scans[i] <= cmm[ch].smin) cmm[ch].smin = scans[i];
-            if (scans[i] >= cmm[ch].smax) cmm[ch].smax = scans[i];
-            if ((ch=(++i % nvai))==0)
-                i += nvai*downSampleSkips;  // every Nth scan..
+        const double now = double(u64(firstSamp/nvai))/params.srate;
+
+        // reduce this chunk to a min/max per channel..
+        SlidingMinMax::chunkMinMax(scans, int(scans_size_samps)/nvai, nvai, downSampleSkips, &chunkMin[0], &chunkMax[0]);
+
+        // ..then slide each channel's window (each channel has its own window length) and read off its min/max
+        for (int i = 0; i < nvai; ++i) {
+            SlidingMinMax & w(chanWindows[i]);
+            w.expire(now, graphTimes[i]);
+            w.push(now, chunkMin[i], chunkMax[i]);
+            cmm[i].smin = w.min();
+            cmm[i].smax = w.max();
         }
-        chunkChanMinMaxs[now] = cmm;
-
-        // now, get an up-to-date min/max state per channel based on each channel's window size... by looking at all recent chunks
-        for (ChunkChanMinMaxs::iterator it = chunkChanMinMaxs.begin(); it != chunkChanMinMaxs.end() && it.key() < now; ++it) {
-            for (int i = 0; i < nvai; ++i) {
-                if (now-it.key() <= graphTimes[i]) {
-                    const ChanMinMax & v(it.value()[i]);
-                    if (cmm[i].smin > v.smin) cmm[i].smin = v.smin;
-                    if (cmm[i].smax < v.smax) cmm[i].smax = v.smax;
-                }
-            }
+       // Debug() << " auto-scaling code took: " << (getTime()-t0)*1e3 << " ms, chunksize:"  << (scans_size_samps/nvai) << " scans" << " now=" << now;
+    }
+
+    const int mode = visMode;
+    const int nscans = int(scans_size_samps)/nvai;
+    if (mode == RMSMode) updateRMS(scans, nscans);
+    else if (mode == SpikeRateMode) updateSpikeRate(nscans);
+    if (mode != InstantaneousMode) {
+        // normalize the heatmap to the most active (non-aux) channel, letting the normalization decay slowly
+        float m = 0.f;
+        for (int c = 0; c < nvai-nextra; ++c) {
+            const float v = mode == RMSMode ? emaVar[c] : emaRate[c];
+            if (v > m) m = v;
         }
-       // Debug() << " auto-scaling code took: " << (getTime()-t0)*1e3 << " ms, chunksize:"  << (scans_size_samps/nvai) << " scans" <<  " maxage=" << maxAge << " n_chunks_remembered:" << chunkChanMinMaxs.size() << " now=" << now;
+        const float decay = float(exp(-double(nscans)/(heatTauSecs*params.srate)));
+        heatMax = m > heatMax*decay ? m : heatMax*decay;
     }
 
     int firstidx = scans_size_samps - nvai;
@@ -315,7 +428,6 @@ void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u
     for (int i = firstidx; i < int(scans_size_samps); ++i) {
         int ch = i%nvai;
         int chanId = nocm ? ch : revsorting[ch];
-        const QColor color (chanId < nvai-nextra ? fg : fg2);
 #ifdef HEADACHE_PROTECTION
 		double val = .9;
 #else
@@ -323,7 +435,20 @@ void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u
 
         val = ((sampval=double(scans[i]))+32768.) / 65535.;
 
-        if (doAutoScale) {
+        if (mode != InstantaneousMode) {
+            double v;
+            if (mode == RMSMode) {
+                v = emaVar[ch];
+                // chanVolts below shows RMS volts
+                sampval = sqrt(v) * (params.range.max-params.range.min)/65535.;
+            } else
+                sampval = v = emaRate[ch]; // chanVolts below shows Hz
+            val = heatMax > 0.f ? v/double(heatMax) : 0.;
+            if (val > 1.) val = 1.;
+            if (mode == RMSMode) val = sqrt(val); // var -> rms
+            chanRawSamps[chanId] = scans[i];
+            chanVolts[chanId] = sampval;
+        } else if (doAutoScale) {
             //double oldval = val;
             if (cmm[ch].smax>cmm[ch].smin) {
                 val = (sampval-double(cmm[ch].smin)) / (double(cmm[ch].smax) - double(cmm[ch].smin));
@@ -336,12 +461,11 @@ void SpatialVisWindow::putScans(const int16 *scans, unsigned scans_size_samps, u
  */
         }
 #endif
-        chanRawSamps[chanId] = scans[i];
-        chanVolts[chanId] = val * (params.range.max-params.range.min)+params.range.min;
-        colors[chanId].x = color.redF()*float(val);
-        colors[chanId].y = color.greenF()*float(val);
-        colors[chanId].z = color.blueF()*float(val);
-        colors[chanId].w = color.alphaF();
+        if (mode == InstantaneousMode) {
+            chanRawSamps[chanId] = scans[i];
+            chanVolts[chanId] = val * (params.range.max-params.range.min)+params.range.min;
+        }
+        intensities[chanId] = quint8(val*255.0 + 0.5);
 	}
 
     //Debug() << "SpatialVisWindow::putScans took " << (getTime()-t0)*1e3 << " ms for " << double(scans_size_samps/nvai/params.srate)*1e3 << " ms worth of scans, skipped every " << downSampleSkips << " scans." ;
@@ -367,7 +491,8 @@ void SpatialVisWindow::updateGraph()
 	if (!graph) return;
 	updateGlyphSize();
     mut.lock();
-	graph->setColors(colors);
+	graph->setColormaps(fg, fg2);
+	graph->setIntensities(intensities);
     mut.unlock();
 	if (graph->needsUpdateGL())
 		graph->updateGL();
@@ -566,11 +691,15 @@ void SpatialVisWindow::updateMouseOver() // called periodically every 1s
             Debug() << "Error in text formatting code.. raw: " << raw << " original value: " << chanRawSamps[nid];
 
         }
-        statusLabel->setText(QString("Elec: %2 (Graph %1) -- %3 V [0x%4] ")
+        const char *units = visMode == RMSMode ? "V RMS" : (visMode == SpikeRateMode ? "Hz" : "V");
+        statusLabel->setText(QString("Elec: %2 (Graph %1) -- %3 %5 [0x%4] ")
                              .arg(sorting[chanId])
                              .arg(naming[chanId])
                              .arg(chanVolts[chanId])
-                             .arg(raw));
+                             .arg(raw)
+                             .arg(units));
+        if (visMode == SpikeRateMode && !spikesRunning)
+            statusLabel->setText(statusLabel->text() + "(spike detection is off) ");
         //Debug() << "ChanId=" << chanId << " nid=" << nid << " sorting=" << sorting[chanId];
     }
 	
@@ -644,6 +773,8 @@ void SpatialVisWindow::updateToolBar()
         colorBut->setIcon(QIcon(pm));
     }
     autoScaleChk->setChecked(autoScaleColorRange);
+    autoScaleChk->setEnabled(visMode == InstantaneousMode);
+    modeCombo->setCurrentIndex(modeCombo->findData(int(visMode)));
 }
 
 void SpatialVisWindow::colorButPressed()
@@ -679,6 +810,7 @@ void SpatialVisWindow::saveSettings()
 	settings.setValue(QString("UseStimGLOverlay"), overlayChk->isChecked());
 	settings.setValue(QString("OverlayFPS"), ovlFps->value());
     settings.setValue("autoScaleColorRange", autoScaleColorRange);
+    settings.setValue("visMode", int(visMode));
 	
 	settings.endGroup();
 }
@@ -704,6 +836,10 @@ void SpatialVisWindow::loadSettings()
 //	ovlFpsChanged(settings.value(QString("OverlayFPS"), ovlFps->value()).toInt());
 
     autoScaleColorRange = settings.value("autoScaleColorRange", true).toBool();
+    visMode = settings.value("visMode", int(InstantaneousMode)).toInt();
+    if (visMode < 0 || visMode >= N_VisModes) visMode = InstantaneousMode;
+    heatTauSecs = settings.value("heatmapTauSecs", 1.0).toDouble();
+    if (heatTauSecs <= 0.) heatTauSecs = 1.0;
 	settings.endGroup();
 }
 
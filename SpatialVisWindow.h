@@ -12,9 +12,11 @@
 #include <QSet>
 #include <QColor.h>
 #include "StimGL_SpikeGL_Integration.h"
+#include "SlidingMinMax.h"
 #include <QMutex>
 #include <QMutexLocker>
 #include "GenericGrapher.h"
+#include "SpikeDetector.h"
 
 class QToolBar;
 class QLabel;
@@ -24,6 +26,7 @@ class QPushButton;
 class QSpinBox;
 class QSlider;
 class QCheckBox;
+class QComboBox;
 
 class SpatialVisWindow : public QMainWindow, public GenericGrapher
 {
@@ -51,11 +54,20 @@ public:
 
     void setGraphTimesSecs(const QVector<double> & times) { QMutexLocker l(&mut); if (times.size() >= nvai) graphTimes = times; }
 
+    /// What each glyph's intensity represents
+    enum VisMode {
+        InstantaneousMode = 0, ///< the value of the last scan in each chunk (the original behavior)
+        RMSMode, ///< exponentially-decaying RMS of all samples about each page's mean, per channel
+        SpikeRateMode, ///< exponentially-decaying firing rate, from the SpikeDetector's events
+        N_VisModes
+    };
+
 public slots:
     void setSorting(const QVector<int> & sorting, const QVector<int> & naming);
     void setGraphTimeSecs(int graphId, double secs) { QMutexLocker l(&mut); if (graphId > -1 && graphId < graphTimes.size()) graphTimes[graphId] = secs; }
     void setAutoScale(bool);
     void setDownsampleRatio(double ratio);
+    void setVisMode(int mode);
 
 signals:
 	void channelsSelected(const QVector<unsigned> & ids);
@@ -99,6 +111,9 @@ private:
 	void selClear();
 	
 	void setupGridlines();
+    void updateRMS(const int16 *scans, int nscans);
+    void fetchSpikes(); ///< into spikeTmp, called without mut held
+    void updateSpikeRate(int nscans);
 	
 	void saveSettings();
 	void loadSettings();
@@ -114,7 +129,8 @@ private:
     bool didSelDimsDefine, can_redefine_selection_box, click_to_select;
     Vec2 mouseDownAt;
     QVector<Vec2> points;
-    QVector<Vec4f> colors;
+    QVector<quint8> intensities; ///< per-glyph, 0-255, streamed to the graph which applies the fg/fg2 colormaps on the GPU
+    QVector<quint8> palettes; ///< per-glyph: 0 = fg, 1 = fg2 (the aux/extra chans)
 	QVector<double> chanVolts;
     QVector<int16> chanRawSamps;
     GLSpatialVis * graph;
@@ -128,6 +144,7 @@ private:
     QPushButton *colorBut;
 	QSpinBox *sbCols, *sbRows;
     QCheckBox *overlayChk, *ovlFFChk, *autoScaleChk;
+    QComboBox *modeCombo;
 	QLabel *ovlAlphaLbl;
 	QPushButton *overlayBut;
 	QSlider *overlayAlpha;
@@ -148,10 +165,22 @@ private:
         ChanMinMax() : smin(32767), smax(-32768) {}
     };
     typedef QVector<ChanMinMax> ChanMinMaxs;
-    typedef QMap<double, ChanMinMaxs> ChunkChanMinMaxs;
-    ChunkChanMinMaxs chunkChanMinMaxs;
+    ChanMinMaxs chanMinMax; ///< putScans()' auto-scale range per channel, sized once with the rest of the per-channel state
+    std::vector<SlidingMinMax> chanWindows; ///< per-channel auto-scale windows, each graphTimes[chan] long
+    std::vector<int16> chunkMin, chunkMax; ///< SoA per-chunk reduction scratch, padded to a multiple of 8 channels
     volatile double downsampleRatio;
 
+    volatile int visMode; ///< one of VisMode
+    double heatTauSecs; ///< time constant of the RMS and spike rate estimators
+    std::vector<float> emaVar, emaRate; ///< per-channel estimator state, in scan order
+    std::vector<float> rmsCenter; ///< per-channel mean of the previous page, the RMS sums are taken about this.  Padded to a multiple of 4 channels
+    std::vector<float> pageSum, pageSumSq; ///< per-page accumulators for RMSMode, padded to a multiple of 4 channels
+    std::vector<unsigned> pageSpikes;
+    std::vector<SpikeDetector::Spike> spikeTmp; ///< spikes since the last page.  This and spikesSince, spikesRunning are only written by putScans()'s thread
+    u64 spikesSince;
+    bool spikesRunning;
+    float heatMax; ///< decaying max across channels, used to normalize the heatmap
+
     QMutex mut;    
 };
 
@@ -0,0 +1,410 @@
+#include "SpikeDetector.h"
+#include "DAQ.h"
+#include "Util.h"
+#include "FilterBank.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+namespace {
+    const unsigned QueueCapacity = 1U << 16; ///< per worker
+    const unsigned NoiseWindowLen = 1024; ///< number of decimated samples per channel used for the running median
+    const size_t MaxRecent = 100000; ///< how many spikes to keep around for recentSpikes()
+    const double NoiseUpdateSecs = 0.25; ///< how often to re-estimate the thresholds
+
+    struct SpikeByScan {
+        bool operator()(const SpikeDetector::Spike & a, const SpikeDetector::Spike & b) const { return a.scan < b.scan || (a.scan == b.scan && a.chan < b.chan); }
+    };
+}
+
+/* ----------------------------------------------------------------------------
+   Queue
+   ---------------------------------------------------------------------------- */
+SpikeDetector::Queue::Queue(unsigned cap)
+    : buf(cap), mask(cap-1), tailLocal(0), headLocal(0), head(0), tail(0)
+{}
+
+bool SpikeDetector::Queue::push(const Spike & s)
+{
+    const unsigned h = unsigned(head.fetchAndAddOrdered(0));
+    if (tailLocal - h > mask) return false; // full
+    buf[tailLocal & mask] = s;
+    tail.fetchAndStoreOrdered(int(++tailLocal)); // publish
+    return true;
+}
+
+void SpikeDetector::Queue::popAll(std::vector<Spike> & out)
+{
+    const unsigned t = unsigned(tail.fetchAndAddOrdered(0));
+    if (t == headLocal) return;
+    for ( ; headLocal != t; ++headLocal) out.push_back(buf[headLocal & mask]);
+    head.fetchAndStoreOrdered(int(headLocal)); // hand the slots back to the producer
+}
+
+/* ----------------------------------------------------------------------------
+   Worker -- detects spikes on one contiguous slice of channels
+   ---------------------------------------------------------------------------- */
+class SpikeDetector::Worker : public QThread
+{
+public:
+    Worker(const PagedScanReader & psr, const DAQ::Params & p, const SpikeDetector::Config & cfg, const std::vector<unsigned> & chans);
+
+    SpikeDetector::Queue q;
+    QAtomicInt nSpikes, nDropped;
+    QAtomicInt nPages; ///< pages processed or skipped so far, published after their spikes are queued
+    volatile bool pleaseStop; ///< finish the pages left in the ring, then stop
+    unsigned scansPerPage() const { return reader.scansPerPage(); }
+
+protected:
+    void run();
+
+private:
+    struct ChanState {
+        float thresh; ///< 0 until there is enough data to estimate the noise
+        bool inSpike;
+        int peak;
+        u64 peakScan, startScan, deadUntil;
+        unsigned histPos, histFill;
+    };
+
+    void detect(const short *page, u64 firstScan);
+    void updateThresholds();
+    void emitSpike(unsigned k, const ChanState & st);
+
+    PagedScanReader reader;
+    const SpikeDetector::Config cfg;
+    const std::vector<unsigned> chans; ///< the slice of chans we are responsible for, as indices into a scan
+    const double srate;
+    const unsigned nL, decim, refractory, updateEvery;
+    unsigned decimPhase, scansSinceUpdate;
+    FilterBank fb;
+    std::vector<short> loc; ///< the current page, gathered down to just our chans
+    std::vector<short> hist; ///< chan-major running window of |x|, decimated: hist[k*NoiseWindowLen + i]
+    std::vector<short> medianTmp;
+    std::vector<ChanState> st;
+};
+
+SpikeDetector::Worker::Worker(const PagedScanReader & psr, const DAQ::Params & p, const SpikeDetector::Config & c, const std::vector<unsigned> & ch)
+    : q(QueueCapacity), nSpikes(0), nDropped(0), nPages(0), pleaseStop(false), reader(psr), cfg(c), chans(ch), srate(p.srate), nL(unsigned(ch.size())),
+      decim(std::max(1U, unsigned(p.srate*c.windowSecs/NoiseWindowLen))),
+      refractory(std::max(1U, unsigned(p.srate*c.refractoryMS/1e3))),
+      updateEvery(std::max(1U, unsigned(p.srate*NoiseUpdateSecs))),
+      decimPhase(0), scansSinceUpdate(0)
+{
+    FilterBank::Spec spec;
+    spec.bpLoHz = c.bpLoHz;
+    spec.bpHiHz = c.bpHiHz;
+    fb.setScanSize(nL);
+    fb.setSamplingRate(srate);
+    fb.setSpec(spec);
+    loc.resize(size_t(reader.scansPerPage())*nL);
+    hist.resize(size_t(NoiseWindowLen)*nL, 0);
+    medianTmp.resize(NoiseWindowLen);
+    ChanState s0;
+    memset(&s0, 0, sizeof(s0));
+    st.resize(nL, s0);
+}
+
+void SpikeDetector::Worker::run()
+{
+    const unsigned spp = reader.scansPerPage(), ss = reader.scanSizeSamps();
+    int sleepms = int(((spp/srate) * 1e3)/2);
+    if (sleepms < 1) sleepms = 1;
+    if (sleepms > 200) sleepms = 200;
+    u64 scanCt = 0;
+
+    Debug() << "SpikeDetector worker started for chans " << chans.front() << "-" << chans.back() << ", sleeptime_ms=" << sleepms;
+
+    for (;;) {
+        int skips = 0;
+        const short *page = reader.next(&skips);
+        if (!page) {
+            if (pleaseStop) break; // only once we've caught up, so the spikes up to the end of the data file get saved
+            msleep(sleepms);
+            continue;
+        }
+        if (skips) {
+            // discontinuity: forget filter state and any spike in progress
+            scanCt += u64(skips)*u64(spp);
+            fb.reset();
+            for (unsigned k = 0; k < nL; ++k) st[k].inSpike = false;
+        }
+        // gather our slice of channels into loc, then band-pass it
+        for (unsigned s = 0; s < spp; ++s) {
+            const short *scan = page + size_t(s)*ss;
+            short *out = &loc[size_t(s)*nL];
+            for (unsigned k = 0; k < nL; ++k) out[k] = scan[chans[k]];
+        }
+        fb.apply(&loc[0], spp);
+        detect(&loc[0], scanCt);
+        scanCt += spp;
+        nPages.fetchAndAddOrdered(1 + skips);
+        if ((scansSinceUpdate += spp) >= updateEvery) {
+            updateThresholds();
+            scansSinceUpdate = 0;
+        }
+    }
+
+    Debug() << "SpikeDetector worker for chans " << chans.front() << "-" << chans.back() << " ending after " << scanCt << " scans, " << unsigned(nSpikes.fetchAndAddRelaxed(0)) << " spikes.";
+}
+
+void SpikeDetector::Worker::detect(const short *page, u64 firstScan)
+{
+    const unsigned spp = reader.scansPerPage();
+    const unsigned phase0 = decimPhase;
+    for (unsigned k = 0; k < nL; ++k) {
+        ChanState & c(st[k]);
+        const short *x = page + k;
+        // running noise window
+        short *h = &hist[size_t(k)*NoiseWindowLen];
+        for (unsigned s = phase0; s < spp; s += decim) {
+            h[c.histPos] = short(std::min(32767, abs(int(x[size_t(s)*nL]))));
+            if (++c.histPos >= NoiseWindowLen) c.histPos = 0;
+            if (c.histFill < NoiseWindowLen) ++c.histFill;
+        }
+        if (c.thresh <= 0.f) continue; // no estimate yet
+        const int thr = int(c.thresh);
+        for (unsigned s = 0; s < spp; ++s) {
+            const int v = x[size_t(s)*nL], a = abs(v);
+            const u64 scan = firstScan + s;
+            if (c.inSpike) {
+                if (a > abs(c.peak)) c.peak = v, c.peakScan = scan;
+                if (a < thr || scan - c.startScan >= refractory) {
+                    emitSpike(k, c);
+                    c.inSpike = false;
+                    c.deadUntil = c.peakScan + refractory;
+                }
+            } else if (a >= thr && scan >= c.deadUntil) {
+                c.inSpike = true;
+                c.peak = v;
+                c.peakScan = c.startScan = scan;
+            }
+        }
+    }
+    // where in the next page the next decimated sample falls
+    if (phase0 >= spp) decimPhase = phase0 - spp;
+    else decimPhase = (phase0 + ((spp - phase0 + decim - 1) / decim) * decim) - spp;
+}
+
+void SpikeDetector::Worker::updateThresholds()
+{
+    for (unsigned k = 0; k < nL; ++k) {
+        ChanState & c(st[k]);
+        if (c.histFill < NoiseWindowLen/4) continue; // need at least 1/4 of the window for a decent estimate
+        const short *h = &hist[size_t(k)*NoiseWindowLen];
+        std::copy(h, h + c.histFill, medianTmp.begin());
+        std::vector<short>::iterator mid = medianTmp.begin() + c.histFill/2;
+        std::nth_element(medianTmp.begin(), mid, medianTmp.begin() + c.histFill);
+        // median(|x|)/0.6745 estimates the noise sigma, robust to the spikes themselves
+        c.thresh = float(cfg.threshMAD * (double(*mid) / 0.6745));
+        if (c.thresh < 1.f) c.thresh = 1.f;
+    }
+}
+
+void SpikeDetector::Worker::emitSpike(unsigned k, const ChanState & c)
+{
+    SpikeDetector::Spike s;
+    s.scan = c.peakScan;
+    s.chan = chans[k];
+    s.amp = c.peak;
+    if (q.push(s)) nSpikes.fetchAndAddRelaxed(1);
+    else nDropped.fetchAndAddRelaxed(1);
+}
+
+/* ----------------------------------------------------------------------------
+   SpikeDetector
+   ---------------------------------------------------------------------------- */
+SpikeDetector::SpikeDetector(const PagedScanReader & reader, const DAQ::Params & p, const QString & sidecar, const Config & cfg)
+    : cur(0), ending(0), closeSlack(u64(p.srate*cfg.refractoryMS/1e3) + 1), pleaseStop(false), seqNext(0)
+{
+    std::vector<unsigned> all;
+    for (unsigned i = 0; i < p.nVAIChans; ++i)
+        if (!p.isAuxChan(i)) all.push_back(i);
+
+    unsigned nt = cfg.nThreads;
+    if (!nt) nt = unsigned(std::max(1, QThread::idealThreadCount()/2));
+    nt = std::min(nt, std::max(1U, unsigned(all.size())/16U)); // no sense in using a thread for fewer than 16 chans
+    nt = std::min(nt, 8U);
+    if (all.empty()) nt = 0;
+
+    for (unsigned t = 0; t < nt; ++t) {
+        const size_t b = all.size()*t/nt, e = all.size()*(t+1)/nt;
+        workers.push_back(new Worker(reader, p, cfg, std::vector<unsigned>(all.begin()+b, all.begin()+e)));
+    }
+
+    Log() << "Spike detection: " << all.size() << " chans on " << nt << " threads, threshold " << cfg.threshMAD << " x MAD, band-pass " << cfg.bpLoHz << "-" << cfg.bpHiHz << " Hz";
+    openSidecar(sidecar);
+}
+
+void SpikeDetector::openSidecar(const QString & fn)
+{
+    QMutexLocker l(&fileMut);
+    if (ending) {
+        Debug() << "SpikeDetector: " << ending->file.fileName() << " closed before the workers got to its end.";
+        finishSidecar(ending);
+    }
+    if (cur) finishSidecar(cur); // closeSidecar() was never called, so its end is not known
+    backlog.clear();
+    if (fn.isEmpty()) return;
+    cur = new Sidecar;
+    cur->started = false;
+    cur->startScan = 0;
+    cur->endScan = ~u64(0);
+    cur->file.setFileName(fn);
+    if (!cur->file.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+        Error() << "SpikeDetector: could not open sidecar file " << fn << " for writing.";
+        delete cur, cur = 0;
+    } else
+        Log() << "Spike detection: saving spikes to " << fn;
+}
+
+void SpikeDetector::setSidecarStartScan(i64 start)
+{
+    QMutexLocker l(&fileMut);
+    if (!cur || cur->started) return;
+    startSidecar(cur, start);
+    std::sort(backlog.begin(), backlog.end(), SpikeByScan());
+    writeSpikes(cur, backlog);
+    backlog.clear();
+}
+
+void SpikeDetector::closeSidecar(u64 end)
+{
+    QMutexLocker l(&fileMut);
+    if (!cur) return;
+    if (!cur->started) {
+        // nothing was ever saved to the data file, so neither is any spike
+        backlog.clear();
+        startSidecar(cur, i64(end));
+    }
+    if (ending) finishSidecar(ending);
+    ending = cur, cur = 0;
+    ending->endScan = end;
+}
+
+QString SpikeDetector::sidecarFileName() const
+{
+    QMutexLocker l(&fileMut);
+    return cur ? cur->file.fileName() : (ending ? ending->file.fileName() : QString());
+}
+
+void SpikeDetector::startSidecar(Sidecar *sc, i64 start)
+{
+    SidecarHeader h;
+    memcpy(h.magic, "SGLSPIKE", sizeof(h.magic));
+    h.version = SidecarVersion;
+    h.recordBytes = sizeof(Spike);
+    h.startScan = start;
+    sc->file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    sc->started = true;
+    sc->startScan = start;
+}
+
+void SpikeDetector::writeSpikes(Sidecar *sc, const std::vector<Spike> & v)
+{
+    Spike lo, hi;
+    lo.scan = sc->startScan > 0 ? u64(sc->startScan) : 0, lo.chan = 0;
+    hi.scan = sc->endScan, hi.chan = 0;
+    std::vector<Spike>::const_iterator b = std::lower_bound(v.begin(), v.end(), lo, SpikeByScan()),
+                                       e = std::lower_bound(b, v.end(), hi, SpikeByScan());
+    if (b != e) sc->file.write(reinterpret_cast<const char *>(&*b), qint64((e-b)*sizeof(Spike)));
+}
+
+void SpikeDetector::finishSidecar(Sidecar *& sc)
+{
+    sc->file.close();
+    delete sc, sc = 0;
+}
+
+SpikeDetector::~SpikeDetector()
+{
+    for (size_t i = 0; i < workers.size(); ++i) workers[i]->pleaseStop = true;
+    for (size_t i = 0; i < workers.size(); ++i) workers[i]->wait();
+    pleaseStop = true;
+    wait(); // collector does a final drain when it sees pleaseStop
+    for (size_t i = 0; i < workers.size(); ++i) delete workers[i];
+    workers.clear();
+    QMutexLocker l(&fileMut);
+    if (ending) finishSidecar(ending);
+    if (cur) finishSidecar(cur);
+}
+
+void SpikeDetector::startDetecting(QThread::Priority pri)
+{
+    for (size_t i = 0; i < workers.size(); ++i) workers[i]->start(pri);
+    start(pri);
+}
+
+u64 SpikeDetector::spikeCount() const
+{
+    u64 n = 0;
+    for (size_t i = 0; i < workers.size(); ++i) n += u64(unsigned(workers[i]->nSpikes.fetchAndAddRelaxed(0)));
+    return n;
+}
+
+u64 SpikeDetector::droppedCount() const
+{
+    u64 n = 0;
+    for (size_t i = 0; i < workers.size(); ++i) n += u64(unsigned(workers[i]->nDropped.fetchAndAddRelaxed(0)));
+    return n;
+}
+
+u64 SpikeDetector::scansDone() const
+{
+    u64 done = ~u64(0);
+    for (size_t i = 0; i < workers.size(); ++i)
+        done = std::min(done, u64(unsigned(workers[i]->nPages.fetchAndAddOrdered(0))) * u64(workers[i]->scansPerPage()));
+    return done;
+}
+
+void SpikeDetector::drain(std::vector<Spike> & batch)
+{
+    // read before popping: every spike the workers found before getting this far is in the queues by now
+    const u64 done = scansDone();
+    batch.clear();
+    for (size_t i = 0; i < workers.size(); ++i) workers[i]->q.popAll(batch);
+    // workers run independently, so only order within each drain
+    std::sort(batch.begin(), batch.end(), SpikeByScan());
+    {
+        QMutexLocker fl(&fileMut);
+        if (ending) {
+            if (ending->started) writeSpikes(ending, batch);
+            if (done >= ending->endScan + closeSlack) finishSidecar(ending);
+        }
+        if (cur) {
+            if (cur->started) writeSpikes(cur, batch);
+            else if (backlog.size() + batch.size() <= MaxRecent) backlog.insert(backlog.end(), batch.begin(), batch.end());
+        }
+    }
+    if (batch.empty()) return;
+    QMutexLocker l(&mut);
+    recent.insert(recent.end(), batch.begin(), batch.end());
+    if (recent.size() > MaxRecent) recent.erase(recent.begin(), recent.begin() + (recent.size()-MaxRecent));
+    seqNext += batch.size();
+}
+
+void SpikeDetector::run()
+{
+    std::vector<Spike> batch;
+    batch.reserve(QueueCapacity);
+    while (!pleaseStop) {
+        drain(batch);
+        msleep(20);
+    }
+    drain(batch); // workers are stopped by now, get what's left.  The destructor closes the sidecars
+    const u64 nd = droppedCount();
+    if (nd) Warning() << "SpikeDetector: " << nd << " spikes were dropped because the queue was full.";
+    Debug() << "SpikeDetector collector ending, " << seqNext << " spikes collected.";
+}
+
+u64 SpikeDetector::recentSpikes(u64 since, std::vector<Spike> & out, unsigned maxn) const
+{
+    QMutexLocker l(&mut);
+    const u64 oldest = seqNext - u64(recent.size());
+    if (since < oldest) since = oldest;
+    if (since >= seqNext) return seqNext;
+    const u64 n = std::min(u64(maxn), seqNext - since);
+    std::deque<Spike>::const_iterator it = recent.begin() + size_t(since - oldest);
+    out.insert(out.end(), it, it + size_t(n));
+    return since + n;
+}
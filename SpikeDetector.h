@@ -0,0 +1,140 @@
+#ifndef SpikeDetector_H
+#define SpikeDetector_H
+
+#include <vector>
+#include <deque>
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QFile>
+#include <QString>
+#include "TypeDefs.h"
+#include "PagedRingBuffer.h"
+
+namespace DAQ { struct Params; }
+
+/// Online threshold-crossing spike detector.
+///
+/// The (non-aux) channels are split into contiguous slices, one per worker
+/// thread, and each worker reads pages from its own copy of a PagedScanReader,
+/// band-passes its slice (FilterBank) and compares it against a per-channel
+/// adaptive threshold of threshMAD * median(|x|)/0.6745, with the median
+/// estimated on a running, decimated window.  Detected events go into a
+/// per-worker lock-free single-producer/single-consumer queue.
+///
+/// The SpikeDetector thread itself drains those queues, appends the events to
+/// a binary sidecar file and keeps the most recent ones around for
+/// CommandServer's GETSPIKES.  The sidecar follows the data file: a
+/// SidecarHeader, then an array of Spike structs (little-endian, 16 bytes
+/// each) holding only the spikes that fall within the scans saved to that data
+/// file.  Subtract the header's startScan from a spike's scan to get its scan
+/// in the data file (less any gaps the data file's .meta lists as bad data).
+class SpikeDetector : public QThread
+{
+public:
+    /// One detected event.  This is also the on-disk record format of the sidecar file.
+    struct Spike {
+        u64 scan; ///< scan number since the start of the acquisition, as seen by the ring buffer, at the peak of the spike
+        u32 chan; ///< channel index (in demuxed/scan order)
+        i32 amp; ///< (filtered) amplitude at the peak, in ADC counts. Negative for negative-going spikes.
+    };
+
+    /// Start of every sidecar file, followed by the Spike records
+    struct SidecarHeader {
+        char magic[8]; ///< "SGLSPIKE", not NUL-terminated
+        u32 version; ///< SidecarVersion
+        u32 recordBytes; ///< sizeof(Spike)
+        i64 startScan; ///< acquisition scan number of the first scan in the data file.  Negative if the data file starts with zero padding from before the acquisition.
+    };
+    enum { SidecarVersion = 1 };
+
+    struct Config {
+        double threshMAD; ///< threshold as a multiple of the MAD-estimated noise standard deviation
+        double bpLoHz, bpHiHz; ///< band-pass applied before detection
+        double refractoryMS; ///< minimum time between two spikes on the same channel
+        double windowSecs; ///< length of the running window used to estimate the noise
+        unsigned nThreads; ///< 0 = pick a sensible number based on the number of cores and channels
+
+        Config() : threshMAD(5.0), bpLoHz(300.), bpHiHz(6000.), refractoryMS(1.0), windowSecs(2.0), nThreads(0) {}
+    };
+
+    /// If sidecarFile is empty, spikes are not saved to disk but are still available via recentSpikes().  See also
+    /// openSidecar().
+    SpikeDetector(const PagedScanReader & reader, const DAQ::Params & params, const QString & sidecarFile, const Config & cfg = Config());
+    ~SpikeDetector(); ///< lets the workers finish the pages left in the ring, then flushes and closes the sidecar file
+
+    /// Starts the worker threads and the collector thread (this).
+    void startDetecting(QThread::Priority = QThread::LowPriority);
+
+    /// Call when a data file is opened: spikes go to sidecar fileName from now on.  Nothing is written to it until
+    /// setSidecarStartScan() says where the data file starts.  A sidecar that was still open is closed right away,
+    /// without waiting for closeSidecar()'s end scan.  Threadsafe.
+    void openSidecar(const QString & fileName);
+    /// Call with the acquisition scan number of the data file's first scan, before or as its first scans are saved.
+    /// Writes the header and the spikes held back since openSidecar(), dropping those from before startScan.  Only
+    /// the first call after openSidecar() counts.  Threadsafe.
+    void setSidecarStartScan(i64 startScan);
+    /// Call when the data file is closed, with the acquisition scan just past the last one saved to it.  The sidecar
+    /// stays open until every worker has got past endScan, so the spikes still in the pipeline make it to the file;
+    /// those from endScan on are dropped.  Threadsafe.
+    void closeSidecar(u64 endScan);
+    QString sidecarFileName() const; ///< the open sidecar, or the one waiting to be closed, or empty
+    unsigned nThreads() const { return unsigned(workers.size()); }
+
+    /// Total number of spikes detected so far
+    u64 spikeCount() const;
+    /// Number of spikes lost because a worker's queue was full
+    u64 droppedCount() const;
+
+    /// Copies up to maxn recently-detected spikes with sequence number >= since into out (spikes are numbered
+    /// from 0 in the order they were collected).  Returns the sequence number to pass as 'since' on the next call.
+    /// Spikes that have already fallen off the end of the recent list are silently skipped.
+    u64 recentSpikes(u64 since, std::vector<Spike> & out, unsigned maxn = 10000) const;
+
+protected:
+    void run(); ///< from QThread, drains the worker queues
+
+private:
+    /// Lock-free single-producer/single-consumer ring of Spikes
+    class Queue {
+    public:
+        Queue(unsigned capacity_pow2);
+        bool push(const Spike &); ///< producer only. returns false if full
+        void popAll(std::vector<Spike> & out); ///< consumer only. appends to out
+    private:
+        std::vector<Spike> buf;
+        unsigned mask, tailLocal, headLocal; ///< tailLocal is the producer's copy of tail, headLocal the consumer's copy of head
+        QAtomicInt head, tail;
+    };
+
+    class Worker;
+    friend class Worker;
+
+    /// One sidecar file and the acquisition scans [startScan, endScan) that belong in it
+    struct Sidecar {
+        QFile file;
+        bool started; ///< startScan is known and the header has been written
+        i64 startScan;
+        u64 endScan; ///< ~0 while the data file is open
+    };
+
+    void drain(std::vector<Spike> & batch);
+    u64 scansDone() const; ///< how far the slowest worker has got, in acquisition scans
+    void startSidecar(Sidecar *, i64 startScan); ///< writes the header
+    void writeSpikes(Sidecar *, const std::vector<Spike> & sorted); ///< the ones within the sidecar's scans
+    void finishSidecar(Sidecar *&); ///< closes and deletes it
+
+    std::vector<Worker *> workers;
+    Sidecar *cur; ///< the data file's sidecar
+    Sidecar *ending; ///< its data file is closed, waiting for the workers to get past endScan
+    std::vector<Spike> backlog; ///< spikes drained into cur before its startScan was known
+    u64 closeSlack; ///< a spike is emitted up to this many scans after its peak
+    mutable QMutex fileMut; ///< guards cur, ending and backlog: the data file opens and closes while the collector writes
+    volatile bool pleaseStop;
+
+    mutable QMutex mut; ///< guards recent, seqNext
+    std::deque<Spike> recent;
+    u64 seqNext;
+};
+
+#endif
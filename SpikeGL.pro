@@ -23,7 +23,17 @@ HEADERS += SpikeGL.h DataFile.h Params.h sha1.h Util.h TypeDefs.h \
            FrameGrabber/FG_SpikeGL/FG_SpikeGL/XtCmd.h \
            PagedRingBuffer.h stdafx.h \
     Thread_Compat.h \
-    GenericGrapher.h
+    GenericGrapher.h \
+    SlidingMinMax.h \
+    Telemetry.h \
+    SyntheticDAQ.h \
+    Bug3MetaFile.h \
+    Bug3Protocol.h \
+    SpikeDetector.h \
+    ReferenceStage.h \
+    FilterBank.h \
+    SpikeGLConstants.h \
+    RingGeometry.h
 
 SOURCES += DataFile.cpp osdep.cpp Params.cpp sha1.cpp Util.cpp \
            MainApp.cpp ConsoleWindow.cpp main.cpp \
@@ -36,7 +46,16 @@ SOURCES += DataFile.cpp osdep.cpp Params.cpp sha1.cpp Util.cpp \
            SpatialVisWindow.cpp \
            Bug_ConfigDialog.cpp Bug_Popout.cpp \
            FG_ConfigDialog.cpp \
-           PagedRingBuffer.cpp
+           PagedRingBuffer.cpp \
+           SlidingMinMax.cpp \
+           Telemetry.cpp \
+           SyntheticDAQ.cpp \
+           Bug3MetaFile.cpp \
+           Bug3Protocol.cpp \
+           SpikeDetector.cpp \
+           ReferenceStage.cpp \
+           FilterBank.cpp \
+           RingGeometry.cpp
 
 
 FORMS += ConfigureDialog.ui AcqPDParams.ui AcqTimedParams.ui Par2Window.ui \
@@ -54,7 +73,7 @@ QT += opengl network svg
 RESOURCES += qled.qrc bug3.qrc framegrabber.qrc
 
 win32 {
-        LIBS += $${PWD}/NI/NIDAQmx.lib WS2_32.lib DelayImp.lib Psapi.lib
+        LIBS += $${PWD}/NI/NIDAQmx.lib WS2_32.lib DelayImp.lib Psapi.lib Advapi32.lib
         DEFINES += HAVE_NIDAQmx _CRT_SECURE_NO_WARNINGS WIN32 PSAPI_VERSION=1
         RESOURCES += Resources.qrc
         RC_FILE += WinResources.rc
@@ -95,7 +114,6 @@ macx {
 }
 
 !contains(DEFINES,HAVE_NIDAQmx) {
-    RESOURCES += fakedaq.qrc
     DEFINES += FAKEDAQ
 }
 
@@ -0,0 +1,49 @@
+#ifndef SpikeGLConstants_H
+#define SpikeGLConstants_H
+
+/**
+   @file SpikeGLConstants.h - the constants from SpikeGL.h that don't need Qt, so that the headless benchmarks and
+   tools can use the app's values instead of copies.  Include SpikeGL.h in the app.
+*/
+
+#define INTAN_SRATE 29630
+#define DAQ_TIMEOUT 2.5
+#define DEFAULT_FAST_SETTLE_TIME_MS 15
+#define LOCK_TIMEOUT_MS 2000
+#define DEF_TASK_READ_FREQ_HZ_ 20
+#define DEF_AI_BUFFER_SIZE_CENTISECONDS 9
+#define DEF_AO_BUFFER_SIZE_CENTISECONDS 9
+#define TASK_WRITE_FREQ_HZ 10
+#define APPNAME "SpikeGL"
+#define DOWNSAMPLE_TARGET_HZ 1000
+#define DEFAULT_GRAPH_TIME_SECS 3.0
+#define MOUSE_OVER_UPDATE_INTERVAL_MS 1000
+#define NUM_INTANS_MAX 8
+#define NUM_MUX_CHANS_MAX (512)
+#define DEFAULT_PD_SILENCE .010 /* 10 ms silence default */
+#define SETTINGS_DOMAIN "janelia.hhmi.org"
+#define SETTINGS_APP APPNAME
+#define MAX_NUM_GRAPHS_PER_GRAPH_TAB 64
+#define DEFAULT_NUM_GRAPHS_PER_GRAPH_TAB 36
+#define SAMPLE_BUF_Q_SIZE 128
+
+#define SAMPLES_SHM_NAME "SpikeGL_SampleData"
+#ifdef WIN64
+#define DEF_SAMPLES_SHM_SIZE_FG (1024ULL*1024ULL*2000ULL) /* 2GB samples shm/buffer size */
+#define DEF_SAMPLES_SHM_SIZE_REG (1024ULL*1024ULL*384ULL) /* 384 MB samples shm/buffer size */
+#else
+#define DEF_SAMPLES_SHM_SIZE_FG (1024*1024*384) /* 384 MB samples shm/buffer size */
+#define DEF_SAMPLES_SHM_SIZE_REG (1024*1024*384) /* 384 MB samples shm/buffer size */
+#endif
+#define SAMPLES_SHM_DESIRED_PAGETIME_MS (33) /* 33 ms  */
+#define SAMPLES_SHM_MAX_PAGE_BYTES (2*1024*1024) /* bigger pages make trigger and graph granularity coarse */
+#define SAMPLES_SHM_MIN_PAGES (16) /* ring pages are shrunk, whatever the consumers' cost, to keep at least this many */
+#define SAMPLES_SHM_MAX_CONSUMER_LOAD (0.5) /* fraction of real time the slowest ring consumer may spend on its pages */
+#define SAMPLES_SHM_MAX_WRITER_BLOCK_MS (50) /* how long the ring writer may wait for a lagging saver before dropping its pages */
+#define SAMPLES_SHM_SPILL_LAG (0.5) /* saver lag, as a fraction of the ring, at which the data file starts spilling to a temp file */
+#define SAMPLES_SHM_SPILL_RESUME_LAG (0.1) /* ..and the lag at which it stops spilling and starts draining the spill back */
+#define SAMPLES_SHM_SPILL_DRAIN_PAGES (4) /* pages worth of spilled scans drained per page saved, once caught up */
+#define DATAFILE_SPILL_MAX_BYTES (1024LL*1024LL*4096LL) /* 4GB spill file cap */
+#define DATAFILE_SPILL_CHUNK_BYTES (4*1024*1024) /* spill drain read/write size */
+
+#endif
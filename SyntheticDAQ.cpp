@@ -0,0 +1,223 @@
+#include "SyntheticDAQ.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#  include <errno.h>
+#endif
+
+SyntheticDAQParams::SyntheticDAQParams()
+    : nChans(0), srate(0.), noiseRMS(40.), spikeRateHz(10.), spikeAmp(1500.),
+      burstPeriodS(0.), burstLenS(0.5), burstRateX(5.), pdChan(-1), pdPeriodS(1.), pdWidthS(0.1),
+      pdLow(-32000), pdHigh(32000), seed(1), maxSpeed(false)
+{}
+
+bool SyntheticDAQParams::parse(const std::string & spec, std::string *err)
+{
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        const std::string kv(spec.substr(pos, end - pos));
+        pos = end + 1;
+        if (kv.find_first_not_of(" \t") == std::string::npos) continue;
+        const size_t eq = kv.find('=');
+        const std::string key(eq == std::string::npos ? kv : kv.substr(0, eq));
+        const char *val = eq == std::string::npos ? "" : kv.c_str() + eq + 1;
+        char *vend = 0;
+        const double v = strtod(val, &vend);
+        if (!*val || (vend && *vend && *vend != ' ') || v < 0.) {
+            if (err) *err = "bad value in '" + kv + "'";
+            return false;
+        }
+        if (key == "noise") noiseRMS = v;
+        else if (key == "spikerate") spikeRateHz = v;
+        else if (key == "spikeamp") spikeAmp = v > 32767. ? 32767. : v;
+        else if (key == "burstperiod") burstPeriodS = v;
+        else if (key == "burstlen") burstLenS = v;
+        else if (key == "burstx") burstRateX = v;
+        else if (key == "pdperiod") pdPeriodS = v;
+        else if (key == "pdwidth") pdWidthS = v;
+        else if (key == "seed") seed = unsigned(v);
+        else if (key == "maxspeed") maxSpeed = v != 0.;
+        else {
+            if (err) *err = "unknown key '" + key + "' (expected noise, spikerate, spikeamp, burstperiod, burstlen, burstx, pdperiod, pdwidth, seed or maxspeed)";
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline short clampShort(int v) { return short(v < -32768 ? -32768 : (v > 32767 ? 32767 : v)); }
+
+SyntheticDAQ::SyntheticDAQ(const SyntheticDAQParams & params)
+    : p(params), rng(0x9E3779B97F4A7C15ULL ^ (unsigned long long)params.seed), scanCt(0)
+{
+    if (p.srate <= 0.) p.srate = 1.;
+    if (p.pdChan >= int(p.nChans)) p.pdChan = -1;
+
+    // gaussian noise, by Box-Muller
+    noise.resize(1 << 18);
+    for (size_t i = 0; i < noise.size(); i += 2) {
+        const double r = sqrt(-2.0 * log(uniform())) * p.noiseRMS, th = 6.283185307179586 * uniform();
+        noise[i] = clampShort(int(floor(r * cos(th) + .5)));
+        noise[i+1] = clampShort(int(floor(r * sin(th) + .5)));
+    }
+
+    // a 1 ms biphasic spike: a sharp trough, then a smaller, slower bump
+    spikeLen = unsigned(p.srate * 0.001 + .5);
+    if (spikeLen < 4) spikeLen = 4;
+    spikes.resize(size_t(spikeLen) * p.nChans);
+    prevSpike.assign(p.nChans, 0);
+    nextSpike.resize(p.nChans);
+    for (unsigned c = 0; c < p.nChans; ++c) {
+        const double gain = p.spikeAmp * (0.4 + 0.6 * uniform());
+        for (unsigned k = 0; k < spikeLen; ++k) {
+            const double t = double(k) / double(spikeLen), a = (t - 0.3) / 0.08, b = (t - 0.6) / 0.15;
+            spikes[size_t(c)*spikeLen + k] = clampShort(int(gain * (-exp(-a*a) + 0.35 * exp(-b*b))));
+        }
+        prevSpike[c] = ~0ULL;
+        nextSpike[c] = nextISI(0) - spikeLen; // the first one needs no refractory period
+    }
+
+    pdPeriod = (unsigned long long)(p.pdPeriodS * p.srate + .5);
+    pdWidth = (unsigned long long)(p.pdWidthS * p.srate + .5);
+    if (!pdPeriod) pdPeriod = 1;
+}
+
+double SyntheticDAQ::uniform()
+{
+    // xorshift64*
+    rng ^= rng >> 12; rng ^= rng << 25; rng ^= rng >> 27;
+    return (double((rng * 2685821657736338717ULL) >> 11) + 1.0) / 9007199254740992.0;
+}
+
+double SyntheticDAQ::spikeRateAt(unsigned long long scan) const
+{
+    if (p.burstPeriodS > 0.) {
+        const double t = double(scan) / p.srate;
+        if (fmod(t, p.burstPeriodS) < p.burstLenS) return p.spikeRateHz * p.burstRateX;
+    }
+    return p.spikeRateHz;
+}
+
+unsigned long long SyntheticDAQ::nextISI(unsigned long long fromScan)
+{
+    const double rate = spikeRateAt(fromScan);
+    if (rate <= 0.) {
+        // check again once a burst could have started
+        const double wait = p.burstPeriodS > 0. ? p.burstPeriodS * p.srate : 1e15;
+        return (unsigned long long)wait + spikeLen;
+    }
+    return spikeLen + (unsigned long long)(-log(uniform()) * p.srate / rate);
+}
+
+void SyntheticDAQ::addSpike(short *out, unsigned long long s0, unsigned long long s1, unsigned c, unsigned long long start) const
+{
+    const unsigned k0 = start < s0 ? unsigned(s0 - start) : 0;
+    const unsigned k1 = start + spikeLen > s1 ? unsigned(s1 - start) : spikeLen;
+    const short *w = &spikes[size_t(c) * spikeLen];
+    short *o = out + size_t(start + k0 - s0) * p.nChans + c;
+    for (unsigned k = k0; k < k1; ++k, o += p.nChans)
+        *o = clampShort(int(*o) + int(w[k]));
+}
+
+void SyntheticDAQ::generate(short *out, unsigned nScans)
+{
+    const unsigned nChans = p.nChans;
+    if (!nScans || !nChans) return;
+    const unsigned long long s0 = scanCt, s1 = s0 + nScans;
+
+    // noise: straight copies out of the table, starting somewhere random each time
+    const size_t mask = noise.size() - 1;
+    size_t n = size_t(nScans) * nChans, off = size_t(uniform() * double(noise.size())) & mask;
+    for (short *o = out; n; ) {
+        const size_t chunk = n < noise.size() - off ? n : noise.size() - off;
+        memcpy(o, &noise[off], chunk * sizeof(short));
+        o += chunk; n -= chunk; off = 0;
+    }
+
+    // spikes, wherever they fall in [s0, s1)
+    for (unsigned c = 0; c < nChans; ++c) {
+        if (int(c) == p.pdChan) continue;
+        if (prevSpike[c] != ~0ULL && prevSpike[c] + spikeLen > s0) addSpike(out, s0, s1, c, prevSpike[c]);
+        while (nextSpike[c] < s1) {
+            addSpike(out, s0, s1, c, nextSpike[c]);
+            prevSpike[c] = nextSpike[c];
+            nextSpike[c] += nextISI(nextSpike[c]);
+        }
+    }
+
+    // photodiode pulses
+    if (p.pdChan >= 0) {
+        short *o = out + p.pdChan;
+        for (unsigned long long s = s0; s < s1; ++s, o += nChans)
+            *o = (s % pdPeriod) < pdWidth ? p.pdHigh : p.pdLow;
+    }
+
+    scanCt = s1;
+}
+
+// --- DeadlinePacer ---
+
+long long DeadlinePacer::nowNs()
+{
+    // NB: keep in sync with Util::getAbsTimeNS() in osdep.cpp, which this file can't use since gentestdata and the
+    // benchmarks build it without Qt
+#ifdef _WIN32
+    static __int64 freq = 0;
+    __int64 ct, factor;
+    if (!freq) QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+    QueryPerformanceCounter((LARGE_INTEGER *)&ct);
+    factor = 1000000000LL/freq;
+    if (factor <= 0) factor = 1;
+    return (long long)(ct * factor);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+void DeadlinePacer::start(double periodSecs)
+{
+    periodNs = periodSecs > 0. ? periodSecs * 1e9 : 0.;
+    resync();
+}
+
+void DeadlinePacer::resync()
+{
+    t0 = nowNs();
+    n = 0;
+}
+
+double DeadlinePacer::wait()
+{
+    if (periodNs <= 0.) return 0.;
+    ++n;
+    const long long deadline = t0 + (long long)(double(n) * periodNs);
+    const long long late = nowNs() - deadline;
+    if (late >= 0) return double(late) / 1e9;
+#if defined(_WIN32)
+    const long long ms = -late / 1000000LL;
+    if (ms > 0) Sleep(DWORD(ms));
+    while (nowNs() < deadline) Sleep(0);
+#elif defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = time_t(deadline / 1000000000LL);
+    ts.tv_nsec = long(deadline % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR) {}
+#else
+    // no clock_nanosleep (eg. OS X), so sleep relative to the absolute deadline
+    for (long long left = -late; left > 0; left = deadline - nowNs()) {
+        struct timespec ts;
+        ts.tv_sec = time_t(left / 1000000000LL);
+        ts.tv_nsec = long(left % 1000000000LL);
+        nanosleep(&ts, 0);
+    }
+#endif
+    return 0.;
+}
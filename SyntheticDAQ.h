@@ -0,0 +1,79 @@
+#ifndef SyntheticDAQ_H
+#define SyntheticDAQ_H
+
+#include <string>
+#include <vector>
+
+/// Settings for SyntheticDAQ.  nChans, srate and pdChan come from the acquisition; the rest can be set from a spec
+/// string of comma separated key=value pairs, eg. "noise=20,spikerate=40,burstperiod=5,maxspeed=1" (see parse()).
+struct SyntheticDAQParams
+{
+    unsigned nChans;
+    double srate; ///< scans per second
+    double noiseRMS; ///< gaussian noise on every channel, in ADC counts.  key: noise
+    double spikeRateHz; ///< mean firing rate per channel, outside of bursts.  key: spikerate
+    double spikeAmp; ///< peak of the (negative going) spike waveform, in ADC counts.  Each channel gets 40-100% of it.  key: spikeamp
+    double burstPeriodS, burstLenS, burstRateX; ///< every burstPeriodS seconds, for burstLenS seconds, all channels fire burstRateX times faster.  0 period: no bursts.  keys: burstperiod, burstlen, burstx
+    int pdChan; ///< index of the photodiode channel in the scan, or -1 for none
+    double pdPeriodS, pdWidthS; ///< the PD channel is pdHigh for pdWidthS every pdPeriodS seconds, pdLow otherwise.  keys: pdperiod, pdwidth
+    short pdLow, pdHigh;
+    unsigned seed; ///< key: seed
+    bool maxSpeed; ///< for the caller: produce data as fast as possible instead of in real time.  key: maxspeed
+
+    SyntheticDAQParams();
+
+    /// Applies the key=value pairs in spec over the current values.  On error, returns false and says why in *err.
+    bool parse(const std::string & spec, std::string *err = 0);
+};
+
+/// Generates synthetic electrode data -- noise, spike trains with bursts, and photodiode pulses -- a page of scans at a
+/// time, straight into the caller's buffer.  Noise comes from a precomputed table, so filling a page costs little more
+/// than a memcpy plus the spikes that fall into it.  Plain C++, no Qt, so gentestdata.cpp can use it too.
+class SyntheticDAQ
+{
+public:
+    explicit SyntheticDAQ(const SyntheticDAQParams & p);
+
+    const SyntheticDAQParams & params() const { return p; }
+
+    /// Writes the next nScans scans (nScans*nChans samples) to out, continuing where the last call left off.
+    void generate(short *out, unsigned nScans);
+    unsigned long long scansGenerated() const { return scanCt; }
+
+private:
+    double uniform(); ///< in (0,1]
+    double spikeRateAt(unsigned long long scan) const;
+    void addSpike(short *out, unsigned long long s0, unsigned long long s1, unsigned chan, unsigned long long start) const;
+    unsigned long long nextISI(unsigned long long fromScan); ///< in scans, including the refractory period
+
+    SyntheticDAQParams p;
+    unsigned long long rng, scanCt;
+    std::vector<short> noise; ///< power of 2 sized table of gaussian noise
+    unsigned spikeLen; ///< in scans
+    std::vector<short> spikes; ///< per channel spike waveform, spikeLen samples each
+    std::vector<unsigned long long> prevSpike, nextSpike; ///< per channel, scan the last and next spikes start at
+    unsigned long long pdPeriod, pdWidth; ///< in scans
+};
+
+/// Paces a loop to a fixed period against absolute deadlines on a monotonic clock, so that oversleeping on one
+/// iteration doesn't push back the ones after it -- a late iteration is simply followed by the next one right away.
+class DeadlinePacer
+{
+public:
+    DeadlinePacer() : periodNs(0.), t0(0), n(0) {}
+
+    /// periodSecs <= 0 means never wait (run flat out).  The first deadline is one period from now.
+    void start(double periodSecs);
+    /// Sleeps until the next deadline.  Returns how many seconds late we already were for it, 0 if we had to sleep.
+    double wait();
+    /// Forgets any backlog: the next deadline is one period from now.
+    void resync();
+
+    static long long nowNs(); ///< monotonic clock, the same one as Util::getAbsTimeNS()
+
+private:
+    double periodNs;
+    long long t0, n;
+};
+
+#endif
@@ -0,0 +1,346 @@
+#include "Telemetry.h"
+#include "Util.h"
+#include <QThread>
+#include <QFile>
+#include <string.h>
+#include <vector>
+
+namespace Telemetry
+{
+
+/* -- Histogram -- */
+
+void Histogram::clear()
+{
+    memset(counts, 0, sizeof(counts));
+    n = sum = max = 0;
+    min = ~0ULL;
+}
+
+/*static*/ int Histogram::bucketOf(u64 ns)
+{
+    if (ns < u64(NSub)) return int(ns);
+    int e = SubBits;
+    while (e < MaxExp - 1 && (ns >> (e + 1))) ++e;
+    if (ns >> (e + 1)) return NBuckets - 1; // off the top: clamp
+    return NSub + (e - SubBits) * NSub + int((ns >> (e - SubBits)) & (NSub - 1));
+}
+
+/*static*/ u64 Histogram::bucketLow(int b)
+{
+    if (b < NSub) return u64(b);
+    const int e = SubBits + (b - NSub) / NSub, sub = (b - NSub) % NSub;
+    return (u64(NSub + sub)) << (e - SubBits);
+}
+
+void Histogram::record(u64 ns)
+{
+    ++counts[bucketOf(ns)];
+    ++n;
+    sum += ns;
+    if (ns < min) min = ns;
+    if (ns > max) max = ns;
+}
+
+u64 Histogram::percentile(double pct) const
+{
+    if (!n) return 0;
+    const u64 want = u64(double(n) * pct / 100. + .5);
+    u64 seen = 0;
+    for (int b = 0; b < NBuckets; ++b) {
+        seen += counts[b];
+        if (seen >= want && counts[b]) {
+            // middle of the bucket, but never outside what was actually recorded
+            const u64 lo = bucketLow(b), hi = b + 1 < NBuckets ? bucketLow(b + 1) : lo;
+            u64 v = lo + (hi - lo) / 2;
+            if (v < min) v = min;
+            if (v > max) v = max;
+            return v;
+        }
+    }
+    return max;
+}
+
+/* -- Trace state -- */
+
+namespace {
+    struct TraceEvent {
+        const char *what; ///< 0 for a thread_name metadata event
+        QString name; ///< the stage name, for metadata events
+        int tid;
+        u64 t0, t1, page, scan;
+    };
+
+    class TraceWriter : public QThread
+    {
+    public:
+        volatile bool pleaseStop;
+        TraceWriter() : pleaseStop(false) {}
+    protected:
+        void run();
+    };
+
+    enum { MaxPending = 1 << 18 }; ///< events queued between flushes, beyond which spans are dropped (~15 MB)
+
+    QAtomicInt traceOn(0), nextStageId(1);
+    QMutex traceMut; ///< guards the queue and trace state below.  Stages take it for every span, so never held across I/O
+    std::vector<TraceEvent> tracePending;
+    u64 traceDropped = 0; ///< spans dropped because tracePending was full, since the last flush
+    int curTraceGen = 0;
+    u64 traceT0 = 0;
+    TraceWriter *traceWriter = 0;
+    QMutex traceFileMut; ///< guards the file, and keeps flushes in order.  Taken before traceMut, if both
+    QFile traceFile;
+    bool traceFirst = true;
+
+    QString jsonEscape(const QString & s)
+    {
+        QString ret;
+        for (int i = 0; i < s.length(); ++i) {
+            const QChar c = s[i];
+            if (c == '"' || c == '\\') ret += '\\';
+            if (c.unicode() < 0x20) ret += ' ';
+            else ret += c;
+        }
+        return ret;
+    }
+
+    /// takes the pending events off the queue and writes them out, without holding up the stages while it writes.
+    /// call with traceFileMut held.
+    void traceFlushLocked()
+    {
+        std::vector<TraceEvent> batch;
+        u64 dropped, t0;
+        {
+            QMutexLocker l(&traceMut);
+            batch.swap(tracePending);
+            dropped = traceDropped; traceDropped = 0;
+            t0 = traceT0;
+        }
+        if (dropped) Warning() << "Pipeline trace: dropped " << dropped << " spans, the trace file can't keep up";
+        QByteArray out;
+        for (std::vector<TraceEvent>::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+            QString line;
+            if (!it->what)
+                line.sprintf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                             it->tid, jsonEscape(it->name).toUtf8().constData());
+            else
+                // ts and dur in microseconds, relative to the start of the trace
+                line.sprintf("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"page\":%llu,\"scan\":%llu}}",
+                             it->what, it->tid, (double(it->t0) - double(t0)) / 1e3,
+                             it->t1 > it->t0 ? double(it->t1 - it->t0) / 1e3 : 0.,
+                             (unsigned long long)it->page, (unsigned long long)it->scan);
+            out += (traceFirst ? "\n" : ",\n") + line.toUtf8();
+            traceFirst = false;
+        }
+        if (out.size() && traceFile.isOpen()) { traceFile.write(out); traceFile.flush(); }
+    }
+
+    void TraceWriter::run()
+    {
+        while (!pleaseStop) {
+            msleep(250);
+            QMutexLocker l(&traceFileMut);
+            traceFlushLocked();
+        }
+    }
+}
+
+/* -- Stage -- */
+
+/*static*/ QList<Stage *> Stage::allStages;
+/*static*/ QMutex Stage::allStagesMut;
+
+Stage::Stage(const QString & name)
+    : seq(0), nam(name), t0(now()), backlog(0), id(nextStageId.fetchAndAddOrdered(1)), traceGen(0)
+{
+    memset(counters, 0, sizeof(counters));
+    QMutexLocker l(&allStagesMut);
+    allStages.push_back(this);
+}
+
+Stage::~Stage()
+{
+    QMutexLocker l(&allStagesMut);
+    allStages.removeAll(this);
+}
+
+QString Stage::name() const
+{
+    QMutexLocker l(&allStagesMut);
+    return nam;
+}
+
+void Stage::setName(const QString & name)
+{
+    QMutexLocker l(&allStagesMut);
+    nam = name;
+}
+
+void Stage::reset()
+{
+    Update u(*this);
+    t0 = now();
+    memset(counters, 0, sizeof(counters));
+    backlog = 0;
+    work.clear();
+    residency.clear();
+}
+
+void Stage::span(const char *what, u64 t0, u64 t1, u64 page, u64 scan)
+{
+    if (!traceOn.fetchAndAddOrdered(0)) return;
+    QMutexLocker l(&traceMut);
+    if (!traceWriter) return; // raced stop()
+    if (tracePending.size() >= size_t(MaxPending)) { ++traceDropped; return; }
+    if (traceGen != curTraceGen) {
+        // first span from this stage in this trace: name its row.  the only time we need the name
+        traceGen = curTraceGen;
+        TraceEvent m = { 0, name(), id, 0, 0, 0, 0 };
+        tracePending.push_back(m);
+    }
+    TraceEvent e = { what, QString(), id, t0, t1, page, scan };
+    tracePending.push_back(e);
+}
+
+void Stage::copyTo(Snapshot & s) const
+{
+    for (;;) {
+        const int s1 = seq.fetchAndAddOrdered(0);
+        if (s1 & 1) continue; // writer is mid-update, and update sections are only a few stores long
+        s.t0 = t0;
+        memcpy(s.counters, counters, sizeof(counters));
+        s.backlog = backlog;
+        s.work = work;
+        s.residency = residency;
+        if (seq.fetchAndAddOrdered(0) == s1) break;
+    }
+    s.t = now();
+}
+
+Snapshot Stage::snapshot() const
+{
+    Snapshot s;
+    s.name = name();
+    copyTo(s);
+    return s;
+}
+
+/*static*/ QList<Snapshot> Stage::snapshotAll()
+{
+    QList<Snapshot> ret;
+    QMutexLocker l(&allStagesMut);
+    for (QList<Stage *>::const_iterator it = allStages.begin(); it != allStages.end(); ++it) {
+        Snapshot s;
+        s.name = (*it)->nam;
+        (*it)->copyTo(s);
+        ret.push_back(s);
+    }
+    return ret;
+}
+
+/* -- Trace -- */
+
+namespace Trace
+{
+    bool start(const QString & fn, QString *errOut)
+    {
+        QMutexLocker fl(&traceFileMut);
+        QMutexLocker l(&traceMut);
+        if (traceWriter) { if (errOut) *errOut = QString("Already recording a trace to ") + traceFile.fileName(); return false; }
+        traceFile.setFileName(fn);
+        if (!traceFile.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+            if (errOut) *errOut = QString("Could not open ") + fn + " for writing: " + traceFile.errorString();
+            return false;
+        }
+        traceFile.write("[");
+        traceFirst = true;
+        tracePending.clear();
+        traceDropped = 0;
+        ++curTraceGen;
+        traceT0 = now();
+        traceWriter = new TraceWriter;
+        traceWriter->start();
+        traceOn.fetchAndStoreOrdered(1);
+        return true;
+    }
+
+    void stop()
+    {
+        TraceWriter *w = 0;
+        {
+            QMutexLocker l(&traceMut);
+            if (!traceWriter) return;
+            traceOn.fetchAndStoreOrdered(0);
+            w = traceWriter;
+            w->pleaseStop = true;
+        }
+        w->wait();
+        QMutexLocker fl(&traceFileMut);
+        traceFlushLocked();
+        traceFile.write("\n]\n");
+        traceFile.close();
+        QMutexLocker l(&traceMut);
+        delete w;
+        traceWriter = 0;
+    }
+
+    bool isRecording() { return !!traceOn.fetchAndAddOrdered(0); }
+
+    QString fileName() { QMutexLocker l(&traceFileMut); return traceFile.fileName(); }
+}
+
+/* -- misc -- */
+
+u64 now() { return Util::getAbsTimeNS(); }
+
+QString formatTable(const QList<Snapshot> & snaps, const QList<Snapshot> *prev)
+{
+    QString ret;
+    ret.sprintf("%-28s %8s %9s %9s %9s %8s %6s %7s %9s %9s %9s %9s %9s %9s\n",
+                "stage", "secs", "calls/s", "pages/s", "MB/s", "skips", "errs", "backlog",
+                "p50 ms", "p99 ms", "p99.9 ms", "max ms", "res50 ms", "res99 ms");
+    for (QList<Snapshot>::const_iterator it = snaps.begin(); it != snaps.end(); ++it) {
+        const Snapshot & s = *it;
+        // rates are against the previous snapshot of this stage, if we have one from the same run of it
+        const Snapshot *p = 0;
+        if (prev)
+            for (QList<Snapshot>::const_iterator pit = prev->begin(); pit != prev->end(); ++pit)
+                if (pit->name == s.name && pit->t0 == s.t0) { p = &*pit; break; }
+        const double dt = p ? double(s.t - p->t) / 1e9 : s.secs();
+        double rate[NCounters];
+        for (int c = 0; c < NCounters; ++c)
+            rate[c] = dt > 0. ? double(s.counters[c] - (p ? p->counters[c] : 0ULL)) / dt : 0.;
+        ret += QString().sprintf("%-28s %8.1f %9.1f %9.1f %9.2f %8llu %6llu %7lld %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                                 s.name.left(28).toUtf8().constData(), s.secs(),
+                                 rate[Calls], rate[Pages], rate[Bytes] / (1024.*1024.),
+                                 (unsigned long long)s.counters[Skips], (unsigned long long)s.counters[Errors],
+                                 (long long)s.backlog,
+                                 s.work.percentile(50.) / 1e6, s.work.percentile(99.) / 1e6,
+                                 s.work.percentile(99.9) / 1e6, s.work.max / 1e6,
+                                 s.residency.percentile(50.) / 1e6, s.residency.percentile(99.) / 1e6);
+    }
+    return ret;
+}
+
+QString formatColumns(const QList<Snapshot> & snaps)
+{
+    QString ret = "stage secs calls pages scans bytes skips errors backlog work_mean_us work_p50_us work_p99_us work_p999_us work_max_us resid_p50_us resid_p99_us resid_max_us\n";
+    for (QList<Snapshot>::const_iterator it = snaps.begin(); it != snaps.end(); ++it) {
+        const Snapshot & s = *it;
+        QString nam = s.name;
+        nam.replace(' ', '_');
+        ret += QString().sprintf("%s %.3f %llu %llu %llu %llu %llu %llu %lld %.3f %.3f %.3f %.3f %.3f %.3f %.3f %.3f\n",
+                                 nam.toUtf8().constData(), s.secs(),
+                                 (unsigned long long)s.counters[Calls], (unsigned long long)s.counters[Pages],
+                                 (unsigned long long)s.counters[Scans], (unsigned long long)s.counters[Bytes],
+                                 (unsigned long long)s.counters[Skips], (unsigned long long)s.counters[Errors],
+                                 (long long)s.backlog, s.work.mean() / 1e3,
+                                 s.work.percentile(50.) / 1e3, s.work.percentile(99.) / 1e3,
+                                 s.work.percentile(99.9) / 1e3, s.work.max / 1e3,
+                                 s.residency.percentile(50.) / 1e3, s.residency.percentile(99.) / 1e3, s.residency.max / 1e3);
+    }
+    return ret;
+}
+
+} // end namespace Telemetry
@@ -0,0 +1,162 @@
+#ifndef Telemetry_H
+#define Telemetry_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QList>
+#include <QString>
+#include "TypeDefs.h"
+
+/// Per-stage pipeline telemetry.  Each stage of the acquisition pipeline (the DAQ task, the ring writer, the saver,
+/// each GraphingThread, the AO writer, each command connection) owns a Telemetry::Stage and bumps its counters and
+/// its work-time histogram as it goes.  Updates are lock-free and never block the stage: every stage has exactly one
+/// writer thread, and readers (the Pipeline Stats window, the GETSTATS command) copy the stage out under a seqlock,
+/// retrying if they raced an update.  Stages register themselves in a global list on construction, like SampleBufQ.
+///
+/// Consumers of the sample ring also record page residency: how long each page sat in the ring between the writer
+/// committing it and the consumer picking it up (see PagedRingBuffer::lastPageCommitTimeNS()).  And while a trace is
+/// being recorded (Trace::start()) stages also log spans -- page N read, written, waited on, processed -- to a Chrome
+/// Trace Event file, for lining the stages up against each other on a timeline.
+namespace Telemetry
+{
+    enum Counter {
+        Calls = 0, ///< driver reads, write calls, pages processed, commands handled, etc -- one per work() sample
+        Pages,     ///< ring pages written or consumed
+        Scans,     ///< scans acquired, written or consumed
+        Bytes,     ///< bytes read or written
+        Skips,     ///< pages lost to overruns, or buffers dropped
+        Errors,    ///< failed reads, writes or commands
+        NCounters
+    };
+
+    /// HDR-style log-linear histogram of nanosecond durations: 16 linear sub-buckets per power of 2, so any value is
+    /// recorded to within 1/16th (about 6%) of itself, from 1 ns up to ~36 minutes, in a fixed 2.4 KB.
+    struct Histogram
+    {
+        enum { SubBits = 4, NSub = 1 << SubBits, MaxExp = 41, NBuckets = NSub + (MaxExp - SubBits) * NSub };
+
+        quint32 counts[NBuckets];
+        u64 n, sum, min, max;
+
+        Histogram() { clear(); }
+        void clear();
+        void record(u64 ns);
+        /// the value below which pct percent of the samples fall, to bucket resolution.  0 if empty.
+        u64 percentile(double pct) const;
+        double mean() const { return n ? double(sum) / double(n) : 0.; }
+
+        static int bucketOf(u64 ns);
+        static u64 bucketLow(int bucket);
+    };
+
+    /// A consistent copy of a stage, for display.  Counters are totals since the stage was created or reset().
+    struct Snapshot
+    {
+        QString name;
+        u64 t0, t; ///< getAbsTimeNS() when the stage was (re)started and when this snapshot was taken
+        u64 counters[NCounters];
+        qint64 backlog; ///< last value passed to Update::backlog(), in pages (or whatever unit the stage queues in)
+        Histogram work;
+        Histogram residency; ///< ns pages waited in the sample ring before this stage got to them.  Consumers only.
+
+        double secs() const { return t > t0 ? double(t - t0) / 1e9 : 0.; }
+    };
+
+    class Stage;
+
+    /// Groups several updates to a stage into one seqlock write section.  Only the stage's writer thread may use it.
+    class Update
+    {
+    public:
+        explicit Update(Stage & s);
+        ~Update();
+
+        void add(Counter c, u64 n = 1);
+        void backlog(qint64 b);
+        void work(u64 ns);
+        void residency(u64 ns);
+
+    private:
+        Stage & s;
+    };
+
+    class Stage
+    {
+    public:
+        explicit Stage(const QString & name = "<unnamed>");
+        ~Stage();
+
+        QString name() const;
+        void setName(const QString & name);
+
+        /// one-shot update: its own write section
+        void add(Counter c, u64 n = 1) { Update u(*this); u.add(c, n); }
+        /// clears everything and restarts the clock.  Writer thread only, or while the writer is not running.
+        void reset();
+
+        /// Logs an event from t0 to t1 (now() times) to the trace file, if a trace is being recorded, else does nothing.
+        /// what must be a string literal.  page and scan are the ring page number and first scan index involved.
+        void span(const char *what, u64 t0, u64 t1, u64 page = 0, u64 scan = 0);
+
+        /// copies the stage out consistently.  Safe from any thread.
+        Snapshot snapshot() const;
+
+        /// A snapshot of every live stage, in creation order.
+        static QList<Snapshot> snapshotAll();
+
+    private:
+        friend class Update;
+
+        void copyTo(Snapshot & s) const; ///< the seqlock read side
+
+        mutable QAtomicInt seq; ///< seqlock: odd while the writer is mid-update
+        QString nam; ///< guarded by allStagesMut
+        u64 t0;
+        u64 counters[NCounters];
+        qint64 backlog;
+        Histogram work, residency;
+        int id; ///< thread id in the trace file
+        int traceGen; ///< the trace this stage last logged a span to, so its name goes out once per trace
+
+        static QList<Stage *> allStages;
+        static QMutex allStagesMut;
+
+        Stage(const Stage &);
+        Stage & operator=(const Stage &);
+    };
+
+    inline Update::Update(Stage & s) : s(s) { s.seq.fetchAndAddOrdered(1); }
+    inline Update::~Update() { s.seq.fetchAndAddOrdered(1); }
+    inline void Update::add(Counter c, u64 n) { s.counters[c] += n; }
+    inline void Update::backlog(qint64 b) { s.backlog = b; }
+    inline void Update::work(u64 ns) { s.counters[Calls] += 1; s.work.record(ns); }
+    inline void Update::residency(u64 ns) { s.residency.record(ns); }
+
+    /// Pipeline trace recording, to a Chrome Trace Event Format JSON file (open it in chrome://tracing or
+    /// ui.perfetto.dev).  Spans are queued in memory and a background thread appends them to the file a few times a
+    /// second, so stages never wait on the disk.  Only one trace at a time.
+    namespace Trace
+    {
+        /// Starts recording to fileName, truncating it.  Returns false and sets errOut if the file can't be opened or
+        /// a trace is already being recorded.
+        bool start(const QString & fileName, QString *errOut = 0);
+        /// Flushes whatever is queued, closes out the file and stops recording.  Does nothing if not recording.
+        void stop();
+        bool isRecording();
+        /// the file being recorded to, or the last one recorded
+        QString fileName();
+    }
+
+    /// monotonic clock for timing work, in ns
+    u64 now();
+
+    /// Fixed-width table of snapshots, one stage per line, for the Pipeline Stats window.  If prev is given, rates are
+    /// computed against the same stages (same name and start time) in it, otherwise over each stage's lifetime.
+    QString formatTable(const QList<Snapshot> & snaps, const QList<Snapshot> *prev = 0);
+
+    /// Machine readable form for the GETSTATS command: a header line of column names, then one line per stage of
+    /// space separated values.  Spaces in stage names are replaced with '_'.  Times are in microseconds.
+    QString formatColumns(const QList<Snapshot> & snaps);
+}
+
+#endif
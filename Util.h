@@ -95,6 +95,20 @@ extern unsigned getPid();
 
 /// only implemented on windows, for now..
 extern int killAllInstancesOfProcessWithImageName(const QString & imgName);
+
+/// Allocates a big, zeroed, page aligned buffer for the realtime sample ring.  If largePages, tries 2 MB pages first
+/// (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows) to spare the writer and the readers the TLB misses of streaming
+/// through hundreds of MB, and quietly falls back to regular pages if the OS won't give us any.  Either way the buffer
+/// comes back faulted in and, as far as the OS allows, locked into RAM.  Returns 0 on failure.  howOut describes what
+/// was actually allocated, for the log.  Free it with freeSampleBuffer(), passing the same size.
+void *allocSampleBuffer(quint64 bytes, bool largePages, QString *howOut = 0);
+void freeSampleBuffer(void *buf, quint64 bytes);
+/// Faults in every page of buf for write and locks it into RAM (mlock/VirtualLock).  For memory we didn't allocate
+/// ourselves, such as shared memory.  Returns false if it could not be locked; it's still prefaulted.
+bool prefaultAndLock(void *buf, quint64 bytes, QString *howOut = 0);
+/// Undoes prefaultAndLock(): unlocks buf and, on Windows, gives back the working set it grew for it.  Call before
+/// freeing or detaching memory that was locked.  freeSampleBuffer() does it itself.
+void unlockBuffer(void *buf, quint64 bytes);
 }
 /// sets the process affinity mask -- a bitset of which processors to run on
 extern "C" void setProcessAffinityMask(unsigned mask);
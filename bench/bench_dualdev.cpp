@@ -0,0 +1,158 @@
+/*
+ * Compares the dual-device NITask write path as it used to be (three passes:
+ * mergeDualDevData() into a new vector, in-place Intan demux of every scan,
+ * then PagedScanWriter::write() memcpy into the ring page) against the fused
+ * path (one ScanPermutation::apply2() gather straight into the page returned by
+ * PagedScanWriter::directWritePtr()).  Also checks both produce identical pages.
+ *
+ * Usage: bench_dualdev [-s scans_per_block] [-i iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <QElapsedTimer>
+#include "PagedRingBuffer.h"
+
+namespace {
+
+struct Shape { const char *name; int nchansPerIntan, nIntans, nExtra1, nExtra2; };
+
+const Shape shapes[] = {
+    { "AI60Demux x2",  15, 4, 1, 1 },
+    { "AI120Demux x2", 15, 8, 2, 1 },
+    { "AI128Demux x2", 16, 8, 1, 1 },
+    { "AI256Demux x2", 32, 8, 1, 1 },
+    { "AIRegular x2",   1, 0, 32, 32 }, // no mux, no demux -- just the merge
+};
+
+// --- the old three-pass path, as it was in DAQ.cpp ---
+
+void mergeDualDevData(std::vector<short> & out, const std::vector<short> & data, const std::vector<short> & data2,
+                      int NCHANS1, int NCHANS2, int nExtraChans1, int nExtraChans2)
+{
+    const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2, s1 = int(data.size()), s2 = int(data2.size());
+    out.clear();
+    out.reserve(s1+s2);
+    int i,j;
+    for (i = 0, j = 0; i < s1 && j < s2; i+=NCHANS1, j+=NCHANS2) {
+        if (nMx > 0) out.insert(out.end(), data.begin()+i, data.begin()+i+nMx);
+        if (nMx2 > 0) out.insert(out.end(), data2.begin()+j, data2.begin()+j+nMx2);
+        out.insert(out.end(), data.begin()+i+nMx, data.begin()+i+NCHANS1);
+        out.insert(out.end(), data2.begin()+j+nMx2, data2.begin()+j+NCHANS2);
+    }
+}
+
+void applyNewIntanDemuxToScan(short *begin, const unsigned nchans_per_intan, const unsigned num_intans)
+{
+    short tmparr[512];
+    const int narr = nchans_per_intan*num_intans;
+    for (int k = 0; k < int(num_intans); ++k) {
+        const int jlimit = (k+1)*int(nchans_per_intan);
+        for (int i = k, j = k*int(nchans_per_intan); j < jlimit; i+=num_intans,++j)
+            tmparr[j] = begin[i];
+    }
+    memcpy(begin, tmparr, narr*sizeof(short));
+}
+
+// --- the fused path's table, built the same way as NITask::setupFusedDualDev() ---
+
+void setupFused(ScanPermutation & fused, const ScanPermutation & demux, int NCHANS1, int NCHANS2, int nExtraChans1, int nExtraChans2)
+{
+    const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2;
+    std::vector<int> merged;
+    for (int i = 0; i < nMx; ++i) merged.push_back(i);
+    for (int i = 0; i < nMx2; ++i) merged.push_back(NCHANS1+i);
+    for (int i = nMx > 0 ? nMx : 0; i < NCHANS1; ++i) merged.push_back(i);
+    for (int i = nMx2 > 0 ? nMx2 : 0; i < NCHANS2; ++i) merged.push_back(NCHANS1+i);
+    std::vector<int> g(merged.size());
+    for (unsigned i = 0; i < g.size(); ++i) g[i] = merged[demux.isNull() ? i : demux.table()[i]];
+    fused.setGather2(g, unsigned(NCHANS1));
+}
+
+struct Ring {
+    std::vector<char> mem;
+    PagedScanWriter *w;
+    PagedScanReader *r;
+    Ring(unsigned scanSize, unsigned scansPerPage, unsigned nPages)
+        : mem(PagedRingBuffer::requiredSize(scansPerPage*scanSize*sizeof(short), nPages))
+    {
+        w = new PagedScanWriter(scanSize, 0, &mem[0], mem.size(), scansPerPage*scanSize*sizeof(short));
+        w->initializeForWriting();
+        r = new PagedScanReader(*w);
+    }
+    ~Ring() { delete r; delete w; }
+};
+
+void usage() { fprintf(stderr, "Usage: bench_dualdev [-s scans_per_block] [-i iterations]\n"); exit(1); }
+
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned scansPerBlock = 1000, iters = 200;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i+1 < argc) scansPerBlock = unsigned(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-i") && i+1 < argc) iters = unsigned(atoi(argv[++i]));
+        else usage();
+    }
+    if (!scansPerBlock || !iters) usage();
+
+    printf("%-16s %6s %12s %12s %8s %s\n", "shape", "chans", "3-pass ns/scan", "fused ns/scan", "speedup", "check");
+    for (unsigned si = 0; si < sizeof(shapes)/sizeof(*shapes); ++si) {
+        const Shape & sh (shapes[si]);
+        const bool mux = sh.nIntans > 0;
+        const int nMx = mux ? sh.nchansPerIntan*sh.nIntans : 0;
+        const int NCHANS1 = nMx + sh.nExtra1, NCHANS2 = nMx + sh.nExtra2, N = NCHANS1 + NCHANS2;
+
+        std::vector<short> data(size_t(scansPerBlock)*NCHANS1), data2(size_t(scansPerBlock)*NCHANS2), merged;
+        for (size_t i = 0; i < data.size(); ++i) data[i] = short(rand());
+        for (size_t i = 0; i < data2.size(); ++i) data2[i] = short(rand());
+
+        ScanPermutation demux, fused;
+        if (mux) demux.setTranspose(unsigned(N), unsigned(sh.nchansPerIntan), unsigned(sh.nIntans*2));
+        setupFused(fused, demux, NCHANS1, NCHANS2, sh.nExtra1, sh.nExtra2);
+
+        // page size doesn't divide the block evenly on purpose, to exercise page boundaries
+        Ring ring3(unsigned(N), 333, 64), ringF(unsigned(N), 333, 64);
+
+        QElapsedTimer t;
+        t.start();
+        for (unsigned it = 0; it < iters; ++it) {
+            mergeDualDevData(merged, data, data2, NCHANS1, NCHANS2, sh.nExtra1, sh.nExtra2);
+            if (mux)
+                for (size_t i = 0; i < merged.size(); i += N)
+                    applyNewIntanDemuxToScan(&merged[i], unsigned(sh.nchansPerIntan), unsigned(sh.nIntans*2));
+            ring3.w->write(&merged[0], scansPerBlock);
+        }
+        const double ns3 = double(t.nsecsElapsed()) / double(iters) / double(scansPerBlock);
+
+        t.restart();
+        for (unsigned it = 0; it < iters; ++it) {
+            const short *in1 = &data[0], *in2 = &data2[0];
+            unsigned left = scansPerBlock;
+            while (left) {
+                unsigned nFree = 0;
+                short *dst = ringF.w->directWritePtr(&nFree);
+                const unsigned n = left < nFree ? left : nFree;
+                fused.apply2(in1, in2, dst, n);
+                ringF.w->commitDirectWrite(n);
+                in1 += size_t(n)*NCHANS1; in2 += size_t(n)*NCHANS2; left -= n;
+            }
+        }
+        const double nsF = double(t.nsecsElapsed()) / double(iters) / double(scansPerBlock);
+
+        // both rings saw exactly the same sequence of writes, so every committed page should match
+        bool same = true;
+        int skips = 0;
+        const short *p3, *pF;
+        unsigned npages = 0;
+        while ((p3 = ring3.r->next(&skips)) && (pF = ringF.r->next(&skips)) && npages < 64) {
+            if (memcmp(p3, pF, ring3.r->scansPerPage()*N*sizeof(short))) same = false;
+            ++npages;
+        }
+
+        printf("%-16s %6d %12.2f %12.2f %7.2fx %s\n", sh.name, N, ns3, nsF, nsF > 0. ? ns3/nsF : 0., same && npages ? "ok" : "MISMATCH");
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+######################################################################
+# Microbenchmark: dual-device merge + Intan demux + ring page write.
+# Headless, Qt core only.  Build with qmake && make, run ./bench_dualdev
+######################################################################
+
+TEMPLATE = app
+TARGET = bench_dualdev
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../PagedRingBuffer.h ../Thread_Compat.h ../stdafx.h
+SOURCES += bench_dualdev.cpp ../PagedRingBuffer.cpp
@@ -0,0 +1,399 @@
+/*
+ * End-to-end benchmark of the acquisition pipeline, without any windows: a SyntheticDAQ producer writes pages into
+ * a PagedScanWriter ring at the acquisition rate, and one PagedScanReader thread per stage consumes them the way
+ * the app's threads do:
+ *
+ *   saver    MainApp::DataSavingThread -- polls DEF_TASK_READ_FREQ_HZ_ times per page, writes each page to a data
+ *            file (DataFile::doFileWrite's QFile::write; with -sha, also the SHA1 update it has switched off)
+ *   matlab   the Matlab data API tap -- TempDataFile's circular temp file writes
+ *   graphs   MainApp::GraphingThread + GraphsWindow::putScans -- downsample to DOWNSAMPLE_TARGET_HZ into per channel
+ *            DEFAULT_GRAPH_TIME_SECS point wrap buffers, with the running sum / sum of squares stats
+ *   spatial  GraphingThread + SpatialVisWindow::putScans in auto-scale mode -- per channel min/max of the chunk,
+ *            then the last scan's colour intensities
+ *
+ * The GUI and file stages are modelled on their hot loops (the real classes need MainApp), so the numbers track
+ * the pipeline's cost, not the cost of painting.  Each page carries the producer's commit time in its metadata;
+ * a stage's latency for a page is from that commit until the stage is done with the page.
+ *
+ * Usage: bench_pipeline [-c chans,...] [-r rates,...] [-t secs] [-b ring_MB] [-L] [-sha] [-f file_MB] [-d dir] [-o results.csv]
+ *   -c  channel counts to sweep (default 32,64,128,256,512,1024,2304)
+ *   -r  sampling rates to sweep, in Hz; 'max' means produce as fast as possible (default 10000,25000,max)
+ *   -t  seconds per configuration (default 3)
+ *   -b  ring buffer size in MB (default 384, as DEF_SAMPLES_SHM_SIZE_REG)
+ *   -L  low latency page size (half the usual SAMPLES_SHM_DESIRED_PAGETIME_MS pages)
+ *
+ * Pages are sized by RingGeometry, as the app sizes them (before it has measured the consumers' cost).
+ *   -f  the saver and matlab files wrap around at this size, so a long max speed run doesn't fill the disk (default 1024)
+ *   -d  directory for the saver and matlab files, which are removed afterwards (default .)
+ *   -o  results, one CSV row per configuration and stage (default bench_pipeline.csv)
+ *
+ * Exit status is 0 on success, 1 if a file couldn't be written, 2 on bad usage.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <QFile>
+#include <QThread>
+#include "PagedRingBuffer.h"
+#include "RingGeometry.h"
+#include "SpikeGLConstants.h"
+#include "SyntheticDAQ.h"
+#include "sha1.h"
+
+namespace {
+
+const double TaskReadFreqHz = DEF_TASK_READ_FREQ_HZ_;
+const double DownsampleHz = DOWNSAMPLE_TARGET_HZ;
+const double GraphTimeSecs = DEFAULT_GRAPH_TIME_SECS;
+
+struct Options {
+    std::vector<unsigned> chans;
+    std::vector<double> rates; ///< 0 = max speed
+    double secs, ringMB, fileMB;
+    bool lowLatency, sha;
+    std::string dir, out;
+};
+
+struct Stats {
+    std::string stage;
+    unsigned long long pages, dropped;
+    double secs;
+    std::vector<long long> lat; ///< ns, one per page
+    Stats(const char *s) : stage(s), pages(0), dropped(0), secs(0.) {}
+    double pct(double p) const {
+        if (lat.empty()) return 0.;
+        size_t i = size_t(ceil(p / 100. * double(lat.size())));
+        if (i) --i;
+        if (i >= lat.size()) i = lat.size() - 1;
+        return double(lat[i]) / 1e6;
+    }
+};
+
+/// One consumer: its own reader on the ring, polling like the app thread it stands in for.
+class Stage : public QThread
+{
+public:
+    Stage(const char *name, const PagedScanWriter & w, unsigned sleepMs)
+        : stats(name), pleaseStop(false), reader(w), sleepMs(sleepMs), nch(w.scanSizeSamps()), spp(w.scansPerPage()) {}
+    virtual ~Stage() {}
+
+    Stats stats;
+    volatile bool pleaseStop;
+    bool failed() const { return !err.empty(); }
+    std::string err;
+
+protected:
+    virtual void process(const short *page) = 0;
+    virtual void finish() {}
+
+    void run() {
+        const long long t0 = DeadlinePacer::nowNs();
+        // once told to stop, drain whatever is left in the ring
+        for (bool draining = false; ; ) {
+            int skips = 0;
+            void *meta = 0;
+            const short *page = reader.next(&skips, &meta);
+            if (!page) {
+                if (draining) break;
+                if (pleaseStop) { draining = true; continue; }
+                msleep(sleepMs);
+                continue;
+            }
+            long long tCommit; // before process(), in case the producer laps us meanwhile
+            memcpy(&tCommit, meta, sizeof(tCommit));
+            stats.dropped += (unsigned long long)(skips > 0 ? skips : 0);
+            process(page);
+            stats.lat.push_back(DeadlinePacer::nowNs() - tCommit);
+            ++stats.pages;
+        }
+        finish();
+        stats.secs = double(DeadlinePacer::nowNs() - t0) / 1e9;
+    }
+
+    PagedScanReader reader;
+    unsigned sleepMs, nch, spp;
+};
+
+/// DataFile::doFileWrite, or TempDataFile::writeScans: one write per page, wrapping at maxBytes.
+class FileStage : public Stage
+{
+public:
+    FileStage(const char *name, const PagedScanWriter & w, unsigned sleepMs, const std::string & fname, long long maxBytes, bool sha)
+        : Stage(name, w, sleepMs), file(QString(fname.c_str())), maxBytes(maxBytes), sha(sha)
+    {
+        if (!file.open(QIODevice::WriteOnly|QIODevice::Truncate)) err = "could not open " + fname + " for writing";
+    }
+    ~FileStage() { file.close(); QFile::remove(file.fileName()); }
+
+protected:
+    void process(const short *page) {
+        if (failed()) return;
+        const long long bytes = (long long)spp * nch * (long long)sizeof(short);
+        if (file.pos() + bytes > maxBytes) file.seek(0);
+        if (file.write(reinterpret_cast<const char *>(page), bytes) != bytes) err = "write to " + std::string(file.fileName().toUtf8().constData()) + " failed";
+        if (sha) hash.UpdateHash(reinterpret_cast<const uint8_t *>(page), uint32_t(bytes));
+    }
+    void finish() { file.flush(); }
+
+    QFile file;
+    long long maxBytes;
+    bool sha;
+    SHA1 hash;
+};
+
+/// GraphsWindow::putScans' ingest: every DOWNSAMPLE_RATIO'th scan, push (t, v) into each channel's wrap buffer, keeping its stats.
+class GraphStage : public Stage
+{
+public:
+    GraphStage(const PagedScanWriter & w, unsigned sleepMs, double srate)
+        : Stage("graphs", w, sleepMs), srate(srate), sampCount(0)
+    {
+        const int dsr = int(srate / DownsampleHz + .5);
+        ds = dsr < 1 ? 1 : dsr;
+        cap = unsigned(GraphTimeSecs * srate / ds);
+        if (!cap) cap = 1;
+        pts.resize(size_t(nch) * cap);
+        head.assign(nch, 0); num.assign(nch, 0);
+        s1.assign(nch, 0.); s2.assign(nch, 0.);
+    }
+
+protected:
+    struct Vec2f { float x, y; };
+
+    void process(const short *page) {
+        const double deltaT = double(ds) / srate;
+        double t = double(sampCount) / srate;
+        for (unsigned s = 0; s < spp; s += ds, t += deltaT) {
+            const short *scan = page + size_t(s) * nch;
+            for (unsigned c = 0; c < nch; ++c) {
+                Vec2f v;
+                v.x = float(t);
+                v.y = float(scan[c] / 32768.0);
+                Vec2f *buf = &pts[size_t(c) * cap];
+                if (num[c] == cap) {
+                    const double old = buf[head[c]].y;
+                    s1[c] -= old; s2[c] -= old*old;
+                } else ++num[c];
+                buf[head[c]] = v;
+                if (++head[c] == cap) head[c] = 0;
+                s1[c] += v.y; s2[c] += double(v.y)*v.y;
+            }
+        }
+        sampCount += spp;
+    }
+
+    double srate;
+    unsigned ds, cap;
+    unsigned long long sampCount;
+    std::vector<Vec2f> pts;
+    std::vector<unsigned> head, num;
+    std::vector<double> s1, s2;
+};
+
+/// SpatialVisWindow::putScans in auto-scale mode: the chunk's per channel min/max, then the last scan scaled to 0-255.
+class SpatialStage : public Stage
+{
+public:
+    SpatialStage(const PagedScanWriter & w, unsigned sleepMs, double srate)
+        : Stage("spatial", w, sleepMs), mins(nch), maxs(nch), intensities(nch)
+    {
+        skip = srate > DownsampleHz ? int(srate / DownsampleHz + .5) - 1 : 0;
+    }
+
+protected:
+    void process(const short *page) {
+        for (unsigned c = 0; c < nch; ++c) mins[c] = 32767, maxs[c] = -32768;
+        for (unsigned s = 0; s < spp; s += 1 + unsigned(skip)) {
+            const short *x = page + size_t(s) * nch;
+            for (unsigned c = 0; c < nch; ++c) {
+                if (x[c] < mins[c]) mins[c] = x[c];
+                if (x[c] > maxs[c]) maxs[c] = x[c];
+            }
+        }
+        const short *last = page + size_t(spp - 1) * nch;
+        for (unsigned c = 0; c < nch; ++c) {
+            double val = (double(last[c]) + 32768.) / 65535.;
+            if (maxs[c] > mins[c]) {
+                val = (double(last[c]) - mins[c]) / (double(maxs[c]) - mins[c]);
+                if (val < 0.) val = 0.; else if (val > 1.) val = 1.;
+            }
+            intensities[c] = (unsigned char)(val * 255. + .5);
+        }
+    }
+
+    int skip;
+    std::vector<short> mins, maxs;
+    std::vector<unsigned char> intensities;
+};
+
+bool parseList(const char *arg, std::vector<double> & out, bool allowMax)
+{
+    out.clear();
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) end = s.size();
+        const std::string item(s.substr(pos, end - pos));
+        pos = end + 1;
+        if (allowMax && item == "max") { out.push_back(0.); continue; }
+        char *e = 0;
+        const double v = strtod(item.c_str(), &e);
+        if (item.empty() || *e || v <= 0.) return false;
+        out.push_back(v);
+    }
+    return !out.empty();
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage: bench_pipeline [-c chans,...] [-r rates,...] [-t secs] [-b ring_MB] [-L] [-sha] [-f file_MB] [-d dir] [-o results.csv]\n");
+    exit(2);
+}
+
+/// Scans per page for this configuration, as MainApp::ringPageSize() picks them before any consumer cost is measured.
+unsigned long ringScansPerPage(const Options & opt, unsigned nch, double srate)
+{
+    RingGeometry g;
+    g.srate = srate;
+    g.nChans = nch;
+    g.oneScanBytes = nch * sizeof(short);
+    g.lowLatency = opt.lowLatency;
+    g.ringBytes = (unsigned long)(opt.ringMB * 1024. * 1024.);
+    g.compute();
+    return g.scansPerPage;
+}
+
+/// Runs one channel count / rate for opt.secs; appends a Stats per stage (the producer's first) to results.
+bool runOne(const Options & opt, unsigned nch, double rate, std::vector<Stats> & results)
+{
+    const bool maxSpeed = rate <= 0.;
+    const double srate = maxSpeed ? 25000. : rate; // max speed still lays out pages as for 25 kHz
+    const unsigned long spp = ringScansPerPage(opt, nch, srate);
+    const unsigned long pageBytes = spp * nch * sizeof(short) + sizeof(long long);
+    unsigned long ringBytes = (unsigned long)(opt.ringMB * 1024. * 1024.);
+    if (ringBytes < 4 * pageBytes) ringBytes = 4 * pageBytes;
+
+    std::vector<char> mem(ringBytes);
+    PagedScanWriter w(nch, sizeof(long long), &mem[0], ringBytes, pageBytes);
+    w.initializeForWriting();
+
+    const unsigned pageMs = unsigned(double(spp) / srate * 1e3 + .5);
+    unsigned saverSleep = unsigned(double(pageMs) / TaskReadFreqHz + .5), graphSleep = pageMs / 2;
+    if (!saverSleep) saverSleep = 1;
+    if (graphSleep < 1) graphSleep = 1;
+    if (graphSleep > 200) graphSleep = 200;
+
+    const long long fileMax = (long long)(opt.fileMB * 1024. * 1024.);
+    std::vector<Stage *> stages;
+    stages.push_back(new FileStage("saver", w, saverSleep, opt.dir + "/bench_pipeline_saver.bin", fileMax, opt.sha));
+    stages.push_back(new FileStage("matlab", w, saverSleep, opt.dir + "/bench_pipeline_matlab.bin", fileMax, false));
+    stages.push_back(new GraphStage(w, graphSleep, srate));
+    stages.push_back(new SpatialStage(w, graphSleep, srate));
+    bool ok = true;
+    for (size_t i = 0; i < stages.size(); ++i)
+        if (stages[i]->failed()) { fprintf(stderr, "bench_pipeline: %s\n", stages[i]->err.c_str()); ok = false; }
+    if (ok)
+        for (size_t i = 0; i < stages.size(); ++i) stages[i]->start();
+
+    SyntheticDAQParams sp;
+    sp.nChans = nch; sp.srate = srate; sp.maxSpeed = maxSpeed;
+    SyntheticDAQ gen(sp);
+    DeadlinePacer pacer;
+    pacer.start(maxSpeed ? 0. : double(spp) / srate);
+    Stats prod("producer");
+    const long long t0 = DeadlinePacer::nowNs(), tEnd = t0 + (long long)(opt.secs * 1e9);
+    while (ok && DeadlinePacer::nowNs() < tEnd) {
+        unsigned nFree = 0;
+        short *dst = w.directWritePtr(&nFree); // always a whole page, since every commit fills one
+        gen.generate(dst, nFree);
+        const long long late = (long long)(pacer.wait() * 1e9);
+        const long long tCommit = DeadlinePacer::nowNs();
+        w.commitDirectWrite(nFree, &tCommit);
+        prod.lat.push_back(late);
+        ++prod.pages;
+    }
+    prod.secs = double(DeadlinePacer::nowNs() - t0) / 1e9;
+    results.push_back(prod);
+
+    for (size_t i = 0; i < stages.size(); ++i) stages[i]->pleaseStop = true;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (ok) stages[i]->wait();
+        if (stages[i]->failed()) { fprintf(stderr, "bench_pipeline: %s\n", stages[i]->err.c_str()); ok = false; }
+        results.push_back(stages[i]->stats);
+        delete stages[i];
+    }
+    for (size_t i = results.size() - stages.size() - 1; i < results.size(); ++i)
+        std::sort(results[i].lat.begin(), results[i].lat.end());
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    const unsigned defChans[] = { 32, 64, 128, 256, 512, 1024, 2304 };
+    opt.chans.assign(defChans, defChans + sizeof(defChans)/sizeof(*defChans));
+    opt.rates.push_back(10000.); opt.rates.push_back(25000.); opt.rates.push_back(0.);
+    opt.secs = 3.; opt.ringMB = 384.; opt.fileMB = 1024.;
+    opt.lowLatency = opt.sha = false;
+    opt.dir = "."; opt.out = "bench_pipeline.csv";
+
+    std::vector<double> tmp;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a(argv[i]);
+        const bool hasArg = i+1 < argc;
+        if (a == "-L") opt.lowLatency = true;
+        else if (a == "-sha") opt.sha = true;
+        else if (!hasArg) usage();
+        else if (a == "-c") {
+            if (!parseList(argv[++i], tmp, false)) usage();
+            opt.chans.clear();
+            for (size_t k = 0; k < tmp.size(); ++k) opt.chans.push_back(unsigned(tmp[k]));
+        }
+        else if (a == "-r") { if (!parseList(argv[++i], opt.rates, true)) usage(); }
+        else if (a == "-t") { if ((opt.secs = atof(argv[++i])) <= 0.) usage(); }
+        else if (a == "-b") { if ((opt.ringMB = atof(argv[++i])) <= 0.) usage(); }
+        else if (a == "-f") { if ((opt.fileMB = atof(argv[++i])) <= 0.) usage(); }
+        else if (a == "-d") opt.dir = argv[++i];
+        else if (a == "-o") opt.out = argv[++i];
+        else usage();
+    }
+
+    FILE *csv = fopen(opt.out.c_str(), "w");
+    if (!csv) { fprintf(stderr, "bench_pipeline: could not open %s for writing\n", opt.out.c_str()); return 1; }
+    fprintf(csv, "chans,rate_hz,scans_per_page,stage,pages,dropped_pages,secs,MB_per_s,scans_per_s,lat_p50_ms,lat_p99_ms,lat_p999_ms,lat_max_ms\n");
+    printf("%6s %8s %-9s %8s %7s %9s %12s %9s %9s %9s %9s\n", "chans", "rate", "stage", "pages", "dropped", "MB/s", "scans/s", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+
+    bool ok = true;
+    for (size_t ci = 0; ok && ci < opt.chans.size(); ++ci) {
+        for (size_t ri = 0; ok && ri < opt.rates.size(); ++ri) {
+            const unsigned nch = opt.chans[ci];
+            std::vector<Stats> res;
+            ok = runOne(opt, nch, opt.rates[ri], res);
+            const double srate = opt.rates[ri] > 0. ? opt.rates[ri] : 25000.;
+            const unsigned long spp = ringScansPerPage(opt, nch, srate);
+            char rateStr[32];
+            if (opt.rates[ri] > 0.) snprintf(rateStr, sizeof(rateStr), "%g", opt.rates[ri]); else strcpy(rateStr, "max");
+            for (size_t k = 0; k < res.size(); ++k) {
+                const Stats & s(res[k]);
+                const double scansPerS = s.secs > 0. ? double(s.pages) * spp / s.secs : 0.;
+                const double mbPerS = scansPerS * nch * sizeof(short) / (1024. * 1024.);
+                const double maxMs = s.lat.empty() ? 0. : double(s.lat.back()) / 1e6;
+                printf("%6u %8s %-9s %8llu %7llu %9.1f %12.0f %9.3f %9.3f %9.3f %9.3f\n", nch, rateStr, s.stage.c_str(), s.pages, s.dropped,
+                       mbPerS, scansPerS, s.pct(50.), s.pct(99.), s.pct(99.9), maxMs);
+                fprintf(csv, "%u,%s,%lu,%s,%llu,%llu,%.3f,%.2f,%.0f,%.4f,%.4f,%.4f,%.4f\n", nch, rateStr, spp, s.stage.c_str(), s.pages, s.dropped,
+                        s.secs, mbPerS, scansPerS, s.pct(50.), s.pct(99.), s.pct(99.9), maxMs);
+            }
+            fflush(stdout);
+        }
+    }
+    if (fclose(csv)) ok = false;
+    printf("%s (results in %s; the producer's latency columns are how late it was for its page deadlines)\n", ok ? "done" : "FAILED", opt.out.c_str());
+    return ok ? 0 : 1;
+}
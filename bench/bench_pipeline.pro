@@ -0,0 +1,16 @@
+######################################################################
+# End-to-end acquisition pipeline benchmark: synthetic producer, ring
+# buffer, and saver/matlab/graphs/spatial consumer threads.
+# Headless, Qt core only.  Build with qmake && make, run ./bench_pipeline
+######################################################################
+
+TEMPLATE = app
+TARGET = bench_pipeline
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../PagedRingBuffer.h ../RingGeometry.h ../SpikeGLConstants.h ../SyntheticDAQ.h ../sha1.h
+SOURCES += bench_pipeline.cpp ../PagedRingBuffer.cpp ../RingGeometry.cpp ../SyntheticDAQ.cpp ../sha1.cpp
@@ -0,0 +1,294 @@
+/*
+ * Feeds a Bug3 data stream through both block protocols and checks they agree.
+ *
+ * The stream is either a capture of bug3_spikegl.exe's stdout (eg: set BUG3_SPIKEGL_MODE=1 and redirect the exe's
+ * output to a file) or, if no file is given, a synthetic one of random blocks.  Every block the text parser gets
+ * out of it is re-encoded in the binary format, with the exe's message lines interleaved, and that stream is decoded
+ * again in randomly-sized chunks the way BugTask::gotInput() sees it.  Both must yield identical blocks.  The text
+ * stream is also run through the old QString/QRegExp/QMap text parser, as a reference.  Prints the time each parser
+ * takes per block.
+ *
+ * Usage: bug3_replay [-n synthetic_blocks] [captured_stream_file]
+ *
+ * Exit status is 0 if the protocols agree, 1 if not.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QRegExp>
+#include <QStringList>
+#include "Bug3Protocol.h"
+
+namespace {
+
+void randomBlock(Bug3::Block & b, unsigned n)
+{
+    b.clear();
+    for (int c = 0; c < Bug3::TotalNeuralChans; ++c)
+        for (int i = 0; i < Bug3::NeuralSamplesPerBlock; ++i) b.neural[c][i] = quint16(rand() & 0x7ff);
+    for (int f = 0; f < Bug3::FramesPerBlock; ++f) {
+        for (int c = 0; c < Bug3::TotalEMGChans; ++c) b.emg[c][f] = quint16(rand() & 0x7ff);
+        for (int c = 0; c < Bug3::TotalAuxChans; ++c) b.aux[c][f] = quint16(rand() & 0x7ff);
+        for (int c = 0; c < Bug3::TotalTTLChans; ++c) b.ttl[c][f] = quint8(rand() & 1);
+        b.chipID[f] = quint16(rand() & 0x7ff);
+        b.chipFrameCounter[f] = rand() & 0x7ff;
+        b.frameMarkerCorrelation[f] = quint16(rand() % 145);
+        b.boardFrameCounter[f] = int(n*Bug3::FramesPerBlock + unsigned(f));
+        b.boardFrameTimer[f] = rand();
+    }
+    b.creation_absTimeNS = 1000000ULL * n;
+    b.comm_absTimeNS = b.creation_absTimeNS + unsigned(rand() % 1000);
+    b.BER = double(rand()) / double(RAND_MAX) * 1e-3;
+    b.WER = double(rand()) / double(RAND_MAX) * 1e-2;
+    b.missingFrameCount = rand() % 3;
+    b.falseFrameCount = rand() % 2;
+}
+
+/// The text parser SpikeGL used before Bug3::TextParser worked on raw bytes: a QString per line, split on a QRegExp,
+/// every field saved in a QMap and then split and converted once the block was complete.  Kept here for comparison.
+class LegacyTextParser
+{
+public:
+    LegacyTextParser() : state(0) {}
+
+    /// returns true when b is complete
+    bool processLine(const QString & lineUntrimmed, Bug3::Block & b)
+    {
+        QString line = lineUntrimmed.trimmed();
+        if (line.startsWith("---> Console")) {
+            state = 1;
+            fields.clear();
+        } else if (state) {
+            static QRegExp blkSepRE("[}{]");
+            QStringList nv = line.split(blkSepRE, QString::SkipEmptyParts);
+            if (nv.count() != 2) return false;
+            fields[nv.first()] = nv.last();
+            if (++state > Bug3::TextFieldsPerBlock) {
+                fieldsToBlock(b);
+                fields.clear();
+                state = 0;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static void parseNum(const QString & s, quint16 & v) { v = s.toUShort(); }
+    static void parseNum(const QString & s, qint32 & v) { v = s.toInt(); }
+
+    template <typename T> static void parseList(const QString & v, T *out, unsigned n)
+    {
+        QStringList nums = v.split(",");
+        for (unsigned i = 0; i < n; ++i) {
+            if (i >= unsigned(nums.count())) out[i] = 0;
+            else parseNum(nums[int(i)], out[i]);
+        }
+    }
+
+    static int chanIndex(const QString & key, int maxChans)
+    {
+        QStringList knv = key.split("_");
+        const int chan = knv.count() == 2 ? knv.last().toInt() : 0;
+        return chan >= 0 && chan < maxChans ? chan : 0;
+    }
+
+    void fieldsToBlock(Bug3::Block & b)
+    {
+        b.clear();
+        for (QMap<QString,QString>::const_iterator it = fields.begin(); it != fields.end(); ++it) {
+            const QString & k (it.key()), & v (it.value());
+            if (k.startsWith("NEU_")) parseList(v, b.neural[chanIndex(k, Bug3::TotalNeuralChans)], Bug3::NeuralSamplesPerBlock);
+            else if (k.startsWith("EMG_")) parseList(v, b.emg[chanIndex(k, Bug3::TotalEMGChans)], Bug3::FramesPerBlock);
+            else if (k.startsWith("AUX_")) parseList(v, b.aux[chanIndex(k, Bug3::TotalAuxChans)], Bug3::FramesPerBlock);
+            else if (k.startsWith("TTL_")) {
+                quint16 tmp[Bug3::FramesPerBlock];
+                quint8 *ttl = b.ttl[chanIndex(k, Bug3::TotalTTLChans)];
+                parseList(v, tmp, Bug3::FramesPerBlock);
+                for (int i = 0; i < Bug3::FramesPerBlock; ++i) ttl[i] = tmp[i] ? 1 : 0;
+            }
+            else if (k == "CHIPID") parseList(v, b.chipID, Bug3::FramesPerBlock);
+            else if (k == "CHIP_FC") parseList(v, b.chipFrameCounter, Bug3::FramesPerBlock);
+            else if (k == "FRAME_MARKER_COR") parseList(v, b.frameMarkerCorrelation, Bug3::FramesPerBlock);
+            else if (k == "BOARD_FC") parseList(v, b.boardFrameCounter, Bug3::FramesPerBlock);
+            else if (k == "BOARD_FRAME_TIMER") parseList(v, b.boardFrameTimer, Bug3::FramesPerBlock);
+            else if (k == "BER") b.BER = v.toDouble();
+            else if (k == "WER") b.WER = v.toDouble();
+            else if (k == "MISSING_FC") b.missingFrameCount = v.toInt();
+            else if (k == "FALSE_FC") b.falseFrameCount = v.toInt();
+            else if (k == "COMM_ABSTIMENS") b.comm_absTimeNS = v.toULongLong();
+            else if (k == "CREATION_ABSTIMENS") b.creation_absTimeNS = v.toULongLong();
+        }
+    }
+
+    int state;
+    QMap<QString,QString> fields;
+};
+
+void legacyParse(const QByteArray & stream, std::vector<Bug3::Block> & out)
+{
+    LegacyTextParser tp;
+    Bug3::Block b;
+    const char *pos = stream.constData(), * const end = pos + stream.size();
+    while (pos < end) {
+        const char *nl = reinterpret_cast<const char *>(memchr(pos, '\n', size_t(end - pos)));
+        if (!nl) break;
+        if (tp.processLine(QString::fromLatin1(pos, int(nl - pos) + 1), b)) out.push_back(b);
+        pos = nl + 1;
+    }
+}
+
+/// Same idea as BugTask::gotInput(): consume whole lines and binary blocks from the front of buf.  b is the block in
+/// progress, and must persist across calls.
+unsigned consume(const char *buf, unsigned size, Bug3::TextParser & tp, Bug3::Block & b, std::vector<Bug3::Block> & out, unsigned & nMsgs, unsigned & nBad)
+{
+    unsigned consumed = 0;
+    while (consumed < size) {
+        const char *pos = buf + consumed;
+        const unsigned avail = size - consumed;
+        if (Bug3::looksBinary(pos, avail) && !tp.inBlock()) {
+            unsigned frameBytes = 0;
+            const Bug3::DecodeResult r = Bug3::decodeBinary(pos, avail, b, &frameBytes);
+            if (r == Bug3::DecodeNeedMore) break;
+            consumed += frameBytes;
+            if (r == Bug3::DecodeOk) out.push_back(b); else ++nBad;
+        } else {
+            const char *nl = reinterpret_cast<const char *>(memchr(pos, '\n', avail));
+            if (!nl) break;
+            const unsigned lineLen = unsigned(nl - pos) + 1;
+            switch (tp.processLine(pos, lineLen, b)) {
+                case Bug3::TextParser::BlockDone: out.push_back(b); if (tp.problems()) ++nBad; break;
+                case Bug3::TextParser::UserMsg: case Bug3::TextParser::WarnMsg: case Bug3::TextParser::LogMsg: ++nMsgs; break;
+                default: break;
+            }
+            consumed += lineLen;
+        }
+    }
+    return consumed;
+}
+
+/// feeds stream to consume() in random chunks of up to maxChunk bytes, like reads off a pipe
+void feed(const QByteArray & stream, unsigned maxChunk, std::vector<Bug3::Block> & out, unsigned & nMsgs, unsigned & nBad)
+{
+    Bug3::TextParser tp;
+    Bug3::Block b;
+    QByteArray pending;
+    int off = 0;
+    while (off < stream.size()) {
+        int n = maxChunk ? 1 + rand() % int(maxChunk) : stream.size();
+        if (n > stream.size() - off) n = stream.size() - off;
+        pending.append(stream.constData() + off, n);
+        off += n;
+        const unsigned c = consume(pending.constData(), unsigned(pending.size()), tp, b, out, nMsgs, nBad);
+        pending.remove(0, int(c));
+    }
+}
+
+void usage() { fprintf(stderr, "Usage: bug3_replay [-n synthetic_blocks] [captured_stream_file]\n"); exit(2); }
+
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned nSynth = 500;
+    const char *fname = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc) nSynth = unsigned(atoi(argv[++i]));
+        else if (argv[i][0] == '-') usage();
+        else fname = argv[i];
+    }
+
+    QByteArray textStream;
+    std::vector<Bug3::Block> truth;
+    if (fname) {
+        FILE *f = fopen(fname, "rb");
+        if (!f) { fprintf(stderr, "Cannot open %s\n", fname); return 2; }
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) textStream.append(buf, int(n));
+        fclose(f);
+    } else {
+        srand(1);
+        truth.resize(nSynth);
+        for (unsigned i = 0; i < nSynth; ++i) {
+            randomBlock(truth[i], i);
+            if (i % 7 == 0) textStream.append("WARNMSG: block interval hiccup\r\n");
+            Bug3::encodeText(truth[i], textStream);
+        }
+    }
+
+    unsigned textMsgs = 0, textBad = 0, binMsgs = 0, binBad = 0;
+    std::vector<Bug3::Block> fromText, fromBin;
+    fromText.reserve(truth.size());
+
+    QElapsedTimer t;
+    t.start();
+    feed(textStream, 0, fromText, textMsgs, textBad);
+    const double textNs = double(t.nsecsElapsed());
+    if (fromText.empty()) { fprintf(stderr, "No blocks found in the text stream!\n"); return 1; }
+
+    std::vector<Bug3::Block> fromLegacy;
+    fromLegacy.reserve(fromText.size());
+    t.restart();
+    legacyParse(textStream, fromLegacy);
+    const double legacyNs = double(t.nsecsElapsed());
+
+    // the text again, in small chunks, so blocks get split across reads
+    std::vector<Bug3::Block> fromTextChunks;
+    unsigned textChunkMsgs = 0, textChunkBad = 0;
+    srand(3);
+    feed(textStream, 4096, fromTextChunks, textChunkMsgs, textChunkBad);
+
+    // the same blocks and messages, in binary
+    QByteArray binStream;
+    for (size_t i = 0; i < fromText.size(); ++i) {
+        if (i % 7 == 0) binStream.append("WARNMSG: block interval hiccup\r\n");
+        Bug3::encodeBinary(fromText[i], binStream);
+    }
+    fromBin.reserve(fromText.size());
+    t.restart();
+    feed(binStream, 0, fromBin, binMsgs, binBad);
+    const double binNs = double(t.nsecsElapsed());
+
+    // again, in small random chunks, to exercise partial blocks
+    std::vector<Bug3::Block> fromChunks;
+    unsigned chunkMsgs = 0, chunkBad = 0;
+    srand(2);
+    feed(binStream, 4096, fromChunks, chunkMsgs, chunkBad);
+
+    bool ok = true;
+    if (!truth.empty() && truth.size() != fromText.size()) { printf("text parser found %u blocks, expected %u\n", unsigned(fromText.size()), unsigned(truth.size())); ok = false; }
+    if (fromBin.size() != fromText.size() || fromChunks.size() != fromText.size()) {
+        printf("block count mismatch: text %u, binary %u, binary chunked %u\n", unsigned(fromText.size()), unsigned(fromBin.size()), unsigned(fromChunks.size()));
+        ok = false;
+    }
+    if (fromLegacy.size() != fromText.size() || fromTextChunks.size() != fromText.size()) {
+        printf("text block count mismatch: %u, legacy parser %u, chunked %u\n", unsigned(fromText.size()), unsigned(fromLegacy.size()), unsigned(fromTextChunks.size()));
+        ok = false;
+    }
+    unsigned nTextDiff = 0;
+    for (size_t i = 0; i < fromText.size() && i < fromLegacy.size() && i < fromTextChunks.size(); ++i)
+        if (fromText[i] != fromLegacy[i] || fromText[i] != fromTextChunks[i]) {
+            if (!nTextDiff) printf("first text parser mismatch at block %u\n", unsigned(i));
+            ++nTextDiff;
+        }
+    if (nTextDiff) ok = false;
+    unsigned nDiff = 0;
+    for (size_t i = 0; i < fromText.size() && i < fromBin.size() && i < fromChunks.size(); ++i)
+        if (fromText[i] != fromBin[i] || fromText[i] != fromChunks[i] || (i < truth.size() && truth[i] != fromText[i])) {
+            if (!nDiff) printf("first mismatch at block %u\n", unsigned(i));
+            ++nDiff;
+        }
+    if (nDiff) ok = false;
+    if (binBad || chunkBad) { printf("binary decode errors: %u (chunked: %u)\n", binBad, chunkBad); ok = false; }
+    if (binMsgs != chunkMsgs) { printf("message count mismatch: %u vs %u chunked\n", binMsgs, chunkMsgs); ok = false; }
+
+    const double nb = double(fromText.size());
+    printf("%u blocks, %u messages.  text: %d bytes, %.1f us/block (legacy parser: %.1f us/block), %u blocks with parse problems.  binary: %d bytes, %.1f us/block\n",
+           unsigned(fromText.size()), textMsgs, textStream.size(), textNs/nb/1e3, legacyNs/nb/1e3, textBad, binStream.size(), binNs/nb/1e3);
+    printf("%s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
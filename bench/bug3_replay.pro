@@ -0,0 +1,15 @@
+######################################################################
+# Replay test for the Bug3 text and binary block protocols.
+# Headless, Qt core only.  Build with qmake && make, run ./bug3_replay
+######################################################################
+
+TEMPLATE = app
+TARGET = bug3_replay
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../Bug3Protocol.h
+SOURCES += bug3_replay.cpp ../Bug3Protocol.cpp
@@ -0,0 +1,178 @@
+/*
+ * Converts a Bug3 block metadata file (.bug3b) to the older .bug3 text format, or benchmarks the binary writer.
+ *
+ *   bug3meta_tool file.bug3b [out.bug3]
+ *       Writes the text version to out.bug3 (default: file.bug3).
+ *
+ *   bug3meta_tool -bench [-n blocks]
+ *       Saves synthetic blocks both the way SpikeGL used to (reopen the .bug3 file and format every block with a
+ *       QTextStream, on the saving thread) and with Bug3Meta::Writer, and prints the per-block cost each one has
+ *       on the calling thread.  It then converts the .bug3b back to text, which must match the old-style .bug3
+ *       file byte for byte.  The files are made in the current directory and removed afterwards.
+ *
+ * Exit status is 0 on success, 1 on a mismatch or error, 2 on bad usage.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QTime>
+#include "Bug3MetaFile.h"
+
+namespace {
+
+enum { NChans = 23, ScansPerBlock = 640 };
+
+void randomRecord(Bug3Meta::Record & r, unsigned n)
+{
+    r.blockNum = n;
+    r.scans = ScansPerBlock;
+    r.millisecondOffset = 25 * qint64(n);
+    r.systemClockMS = quint32((13*3600000 + 25*n) % 86400000);
+    r.dataFileScanCount = quint64(n + 1) * ScansPerBlock;
+    for (int f = 0; f < Bug3Meta::FramesPerBlock; ++f) {
+        r.boardFrameCounter[f] = int(n*Bug3Meta::FramesPerBlock + unsigned(f));
+        r.boardFrameTimer[f] = rand();
+        r.chipFrameCounter[f] = rand() & 0x7ff;
+        r.chipID[f] = quint16(rand() & 0x7ff);
+        r.frameMarkerCorrelation[f] = quint16(rand() % 145);
+    }
+    r.missingFrameCount = rand() % 3;
+    r.falseFrameCount = rand() % 2;
+    r.BER = double(rand()) / double(RAND_MAX) * 1e-3;
+    r.WER = double(rand()) / double(RAND_MAX) * 1e-2;
+    r.avgVunreg = 1.0 + double(rand()) / double(RAND_MAX);
+    r.comm_absTimeNS = 1000000ULL * n + 500;
+    r.creation_absTimeNS = 1000000ULL * n;
+}
+
+/// What Bug_Popout::writeMetaToBug3File() used to do for every block.
+void writeOldStyle(const QString & fname, const Bug3Meta::Record & m, bool first)
+{
+    QFile f(fname);
+    if (first) {
+        f.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text);
+    } else {
+        f.open(QIODevice::WriteOnly|QIODevice::Append|QIODevice::Text);
+        f.seek(f.size());
+    }
+    QTextStream ts(&f);
+    ts << "[ block " << m.blockNum << " ]\n";
+    ts << "scans = " << m.scans << "\n";
+    ts << "millisecondOffset = " << int(m.millisecondOffset) << "\n";
+    ts << "systemClock = " << QTime(0, 0).addMSecs(int(m.systemClockMS)).toString("hh:mm:ss.zzz") << "\n";
+    ts << "framesThisBlock = " << int(Bug3Meta::FramesPerBlock) << "\n";
+    ts << "spikeGL_DataFile_ScanCount = " << m.dataFileScanCount << "\n";
+    ts << "spikeGL_DataFile_SampleCount = " << (m.dataFileScanCount * NChans) << "\n";
+    ts << "spikeGL_ScansInBlock = " << int(ScansPerBlock) << "\n";
+    ts << "boardFrameCounter = ";
+    for (int i = 0; i < Bug3Meta::FramesPerBlock; ++i) { if (i) ts << ","; ts << m.boardFrameCounter[i]; }
+    ts << "\n";
+    ts << "boardFrameTimer = ";
+    for (int i = 0; i < Bug3Meta::FramesPerBlock; ++i) { if (i) ts << ","; ts << m.boardFrameTimer[i]; }
+    ts << "\n";
+    ts << "chipFrameCounter = ";
+    for (int i = 0; i < Bug3Meta::FramesPerBlock; ++i) { if (i) ts << ","; ts << m.chipFrameCounter[i]; }
+    ts << "\n";
+    ts << "chipID = ";
+    for (int i = 0; i < Bug3Meta::FramesPerBlock; ++i) { if (i) ts << ","; ts << m.chipID[i]; }
+    ts << "\n";
+    ts << "frameMarkerCorrelation = ";
+    for (int i = 0; i < Bug3Meta::FramesPerBlock; ++i) { if (i) ts << ","; ts << m.frameMarkerCorrelation[i]; }
+    ts << "\n";
+    ts << "missingFrameCount = " << m.missingFrameCount << "\n";
+    ts << "falseFrameCount = " << m.falseFrameCount << "\n";
+    ts << "BER = " << m.BER << "\n";
+    ts << "WER = " << m.WER << "\n";
+    ts << "avgVunreg = " << m.avgVunreg << "\n";
+    ts.flush();
+}
+
+QByteArray slurp(const QString & fname)
+{
+    QFile f(fname);
+    if (!f.open(QIODevice::ReadOnly)) return QByteArray();
+    return f.readAll();
+}
+
+int bench(unsigned nBlocks)
+{
+    const QString oldName("bug3meta_bench_old.bug3"), binName("bug3meta_bench.bug3b"), convName("bug3meta_bench_conv.bug3");
+    std::vector<Bug3Meta::Record> recs(nBlocks);
+    srand(1);
+    for (unsigned i = 0; i < nBlocks; ++i) randomRecord(recs[i], i);
+
+    QElapsedTimer t;
+    t.start();
+    for (unsigned i = 0; i < nBlocks; ++i) writeOldStyle(oldName, recs[i], !i);
+    const double oldNs = double(t.nsecsElapsed());
+
+    Bug3Meta::Writer w;
+    QString err;
+    if (!w.open(binName, NChans, ScansPerBlock, &err)) { fprintf(stderr, "%s\n", err.toUtf8().constData()); return 1; }
+    t.restart();
+    for (unsigned i = 0; i < nBlocks; ++i) w.append(recs[i]);
+    const double appendNs = double(t.nsecsElapsed());
+    if (!w.close(&err)) { fprintf(stderr, "%s\n", err.toUtf8().constData()); return 1; }
+    const double totalNs = double(t.nsecsElapsed());
+
+    Bug3Meta::Reader r;
+    bool ok = r.open(binName, &err) && r.convertToText(convName, &err);
+    if (!ok) fprintf(stderr, "%s\n", err.toUtf8().constData());
+    if (ok && r.count() != nBlocks) { printf("read back %u blocks, expected %u\n", r.count(), nBlocks); ok = false; }
+    for (unsigned i = 0; ok && i < r.count(); ++i) {
+        Bug3Meta::Record rec;
+        r.get(i, rec);
+        char a[Bug3Meta::RecordBytes], b[Bug3Meta::RecordBytes];
+        Bug3Meta::encodeRecord(rec, a);
+        Bug3Meta::encodeRecord(recs[i], b);
+        if (memcmp(a, b, sizeof(a))) { printf("record %u differs after reading it back\n", i); ok = false; }
+    }
+    const QByteArray oldText = slurp(oldName), convText = slurp(convName);
+    if (ok && (oldText.isEmpty() || oldText != convText)) { printf("converted text differs from the old-style .bug3 file\n"); ok = false; }
+    const qint64 binBytes = QFile(binName).size();
+
+    printf("%u blocks.  old .bug3 writer: %.1f us/block (%d bytes).  .bug3b: %.2f us/block to queue, %.1f us/block including the final flush (%lld bytes)\n",
+           nBlocks, oldNs/nBlocks/1e3, oldText.size(), appendNs/nBlocks/1e3, totalNs/nBlocks/1e3, (long long)binBytes);
+    QFile::remove(oldName); QFile::remove(binName); QFile::remove(convName);
+    printf("%s\n", ok ? "OK" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage: bug3meta_tool file.bug3b [out.bug3]\n       bug3meta_tool -bench [-n blocks]\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) usage();
+    if (!strcmp(argv[1], "-bench")) {
+        unsigned n = 10000;
+        if (argc == 4 && !strcmp(argv[2], "-n")) n = unsigned(atoi(argv[3]));
+        else if (argc != 2) usage();
+        // all of them get queued at once, so stay under what the writer is willing to buffer
+        const unsigned maxN = Bug3Meta::Writer::MaxPendingBytes / Bug3Meta::RecordBytes;
+        if (n > maxN) { printf("(limiting to %u blocks, the most Bug3Meta::Writer will queue)\n", maxN); n = maxN; }
+        return bench(n ? n : 1);
+    }
+    if (argc > 3 || argv[1][0] == '-') usage();
+    const QString in(argv[1]);
+    QString out(argc > 2 ? QString(argv[2]) : in);
+    if (argc <= 2) {
+        if (out.toLower().endsWith(".bug3b")) out.chop(1); else out += ".bug3";
+    }
+    Bug3Meta::Reader r;
+    QString err;
+    if (!r.open(in, &err) || !r.convertToText(out, &err)) {
+        fprintf(stderr, "%s\n", err.toUtf8().constData());
+        return 1;
+    }
+    printf("%u blocks written to %s\n", r.count(), out.toUtf8().constData());
+    return 0;
+}
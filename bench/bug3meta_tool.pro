@@ -0,0 +1,16 @@
+######################################################################
+# Bug3 block metadata (.bug3b) to .bug3 text converter, and a benchmark
+# of the .bug3b writer against the old per-block text writes.
+# Headless, Qt core only.  Build with qmake && make, run ./bug3meta_tool
+######################################################################
+
+TEMPLATE = app
+TARGET = bug3meta_tool
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../Bug3MetaFile.h
+SOURCES += bug3meta_tool.cpp ../Bug3MetaFile.cpp
@@ -0,0 +1,104 @@
+/*
+ * Checks SlidingMinMax -- the per-channel sliding-window min/max behind SpatialVisWindow's auto-scale -- against a
+ * brute-force reference: random chunks of random scans, per-channel window lengths, uneven chunk times, and the odd
+ * jump back in time (a new acquisition).  Also checks SlidingMinMax::chunkMinMax() against a plain scalar loop.
+ *
+ * Usage: check_minmax [-n chunks] [-s seed]
+ *
+ * Exit status is 0 on success, 1 on a mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "SlidingMinMax.h"
+
+namespace {
+
+struct Chunk { double t; std::vector<int16> mins, maxs; };
+
+int rnd(int n) { return int(rand() % unsigned(n)); }
+
+}
+
+int main(int argc, char *argv[])
+{
+    int nChunks = 200000, opt;
+    unsigned seed = 1;
+    while ((opt = getopt(argc, argv, "n:s:")) > -1) {
+        switch (opt) {
+        case 'n': nChunks = atoi(optarg); break;
+        case 's': seed = unsigned(atoi(optarg)); break;
+        default:
+            fprintf(stderr, "Usage: check_minmax [-n chunks] [-s seed]\n");
+            return 1;
+        }
+    }
+    srand(seed);
+
+    int fails = 0;
+    for (int round = 0; round < 20 && !fails; ++round) {
+        // channel counts around the 8-wide SSE2 blocks, plus a big FG-ish one
+        static const int chanCounts[] = { 1, 7, 8, 9, 17, 64, 130, 2304 };
+        const int nch = chanCounts[round % int(sizeof(chanCounts)/sizeof(*chanCounts))], npad = (nch+7)&~7;
+        std::vector<double> window(nch);
+        for (int c = 0; c < nch; ++c) window[c] = 0.05 * (1 + rnd(40)); // 50 ms .. 2 s
+        std::vector<SlidingMinMax> wins(nch);
+        std::vector<Chunk> hist;
+        std::vector<int16> scans, cmin(npad), cmax(npad);
+        double now = 0.;
+        const int n = nch > 1000 ? nChunks / 100 : nChunks / 20;
+
+        for (int k = 0; k < n && !fails; ++k) {
+            if (!rnd(5000)) { now = 0.; hist.clear(); }  // new acquisition: time starts over
+            else now += 0.001 * rnd(60);                  // 0-60 ms, sometimes the same time twice
+            const int nscans = 1 + rnd(64), skip = rnd(4);
+            scans.resize(size_t(nscans) * size_t(nch));
+            // narrow ranges now and then so there are lots of ties
+            const int range = rnd(3) ? 65536 : 8;
+            for (size_t i = 0; i < scans.size(); ++i) scans[i] = int16(rnd(range) - (range == 65536 ? 32768 : 4));
+
+            SlidingMinMax::chunkMinMax(&scans[0], nscans, nch, skip, &cmin[0], &cmax[0]);
+            Chunk ch;
+            ch.t = now;
+            ch.mins.assign(nch, 32767); ch.maxs.assign(nch, -32768);
+            for (int s = 0; s < nscans; s += 1+skip)
+                for (int c = 0; c < nch; ++c) {
+                    const int16 x = scans[size_t(s)*nch + c];
+                    if (x < ch.mins[c]) ch.mins[c] = x;
+                    if (x > ch.maxs[c]) ch.maxs[c] = x;
+                }
+            for (int c = 0; c < nch && !fails; ++c)
+                if (cmin[c] != ch.mins[c] || cmax[c] != ch.maxs[c]) {
+                    fprintf(stderr, "chunkMinMax mismatch: nch=%d skip=%d chan %d: got %d/%d want %d/%d\n",
+                            nch, skip, c, cmin[c], cmax[c], ch.mins[c], ch.maxs[c]);
+                    ++fails;
+                }
+            hist.push_back(ch);
+
+            for (int c = 0; c < nch && !fails; ++c) {
+                SlidingMinMax & w(wins[c]);
+                w.expire(now, window[c]);
+                w.push(now, cmin[c], cmax[c]);
+                int16 wantMin = 32767, wantMax = -32768;
+                for (size_t i = 0; i < hist.size(); ++i)
+                    if (now - hist[i].t <= window[c]) {
+                        if (hist[i].mins[c] < wantMin) wantMin = hist[i].mins[c];
+                        if (hist[i].maxs[c] > wantMax) wantMax = hist[i].maxs[c];
+                    }
+                if (w.isEmpty() || w.min() != wantMin || w.max() != wantMax) {
+                    fprintf(stderr, "window mismatch: nch=%d chunk %d chan %d window %.2fs: got %d/%d want %d/%d\n",
+                            nch, k, c, window[c], w.isEmpty() ? 0 : w.min(), w.isEmpty() ? 0 : w.max(), wantMin, wantMax);
+                    ++fails;
+                }
+            }
+            // the reference only needs the longest window's worth of history
+            size_t keep = 0;
+            while (keep < hist.size() && now - hist[keep].t > 2.0) ++keep;
+            if (keep) hist.erase(hist.begin(), hist.begin() + keep);
+        }
+        printf("%4d chans: %d chunks %s\n", nch, n, fails ? "FAILED" : "ok");
+    }
+    printf("%s\n", fails ? "FAILED" : "OK");
+    return fails ? 1 : 0;
+}
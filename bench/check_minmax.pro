@@ -0,0 +1,16 @@
+######################################################################
+# Correctness check: SlidingMinMax (SpatialVisWindow auto-scale) against
+# a brute-force reference.
+# Headless, Qt core only.  Build with qmake && make, run ./check_minmax
+######################################################################
+
+TEMPLATE = app
+TARGET = check_minmax
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../SlidingMinMax.h ../TypeDefs.h
+SOURCES += check_minmax.cpp ../SlidingMinMax.cpp
@@ -0,0 +1,786 @@
+/*
+ * Microbenchmarks for the per-sample kernels the acquisition and the viewers spend their time in, each run across
+ * the shapes it sees in practice.  Modelled on Google Benchmark: every case runs its kernel in a timed loop, doubling
+ * the iteration count until the loop takes at least -min_time seconds, and reports the time per iteration and the
+ * samples and bytes processed per second.
+ *
+ * Where the real code is headless it is linked in and called directly (ScanPermutation, HPFilter, FilterBank,
+ * ReferenceStage, SlidingMinMax, WrapBuffer, the samplerate lib behind Util::Resampler, SHA1), and the pages are sized
+ * by RingGeometry, as MainApp sizes the sample ring's.  The rest lives in classes that need MainApp or a window, so
+ * those loops are copies of the ones in the source file named next to each, calling the same kernels -- keep them in
+ * sync when the originals change, or the numbers stop meaning anything.
+ *
+ * Usage: microbench [-filter substring] [-min_time secs] [-o results.csv] [-list]
+ *   -filter   only run the cases whose name contains substring
+ *   -min_time minimum timed seconds per case (default 0.5)
+ *   -o        also write the results as CSV
+ *   -list     print the case names and exit
+ *
+ * Exit status is 0 on success, 1 if a case failed or the results couldn't be written, 2 on bad usage.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+#include "PagedRingBuffer.h"
+#include "HPFilter.h"
+#include "FilterBank.h"
+#include "ReferenceStage.h"
+#include "SlidingMinMax.h"
+#include "RingGeometry.h"
+#include "SpikeGLConstants.h"
+#include "WrapBuffer.h"
+#include "sha1.h"
+#include "samplerate/samplerate.h"
+
+namespace {
+
+typedef short int16;
+
+// --- the harness ---
+
+/// Handed to each case.  The case does its setup, then loops while keepRunning(), and says how much work one
+/// iteration is with setItems()/setBytes().  A case that finds its kernel giving wrong answers calls fail().
+class State
+{
+public:
+    explicit State(unsigned long long iters) : left(iters), iters(iters), items(0), bytes(0), ns(0), started(false) {}
+
+    bool keepRunning() {
+        if (!started) { started = true; timer.start(); }
+        if (left--) return true;
+        ns = timer.nsecsElapsed();
+        return false;
+    }
+    void setItems(double perIter) { items = perIter; }
+    void setBytes(double perIter) { bytes = perIter; }
+    void fail(const std::string & why) { err = why; }
+
+    unsigned long long left, iters;
+    double items, bytes;
+    qint64 ns;
+    bool started;
+    std::string err;
+    QElapsedTimer timer;
+};
+
+typedef void (*CaseFn)(State &, const std::vector<int> & args);
+
+struct Case {
+    std::string name;
+    CaseFn fn;
+    std::vector<int> args;
+};
+
+std::vector<Case> & cases() { static std::vector<Case> c; return c; }
+
+void add(const char *base, CaseFn fn, const char *argNames, int a0, int a1 = -1, int a2 = -1, int a3 = -1)
+{
+    Case c;
+    c.fn = fn;
+    const int a[] = { a0, a1, a2, a3 };
+    c.name = base;
+    std::string names(argNames);
+    for (int i = 0; i < 4 && a[i] >= 0; ++i) {
+        c.args.push_back(a[i]);
+        const size_t comma = names.find(',');
+        char buf[64];
+        snprintf(buf, sizeof(buf), "/%s:%d", names.substr(0, comma).c_str(), a[i]);
+        c.name += buf;
+        names = comma == std::string::npos ? std::string() : names.substr(comma + 1);
+    }
+    cases().push_back(c);
+}
+
+void fillRandom(std::vector<int16> & v, unsigned seed = 1)
+{
+    srand(seed);
+    for (size_t i = 0; i < v.size(); ++i) v[i] = int16((rand() & 0xfff) - 0x800);
+}
+
+const double SRate = 25000.;
+
+/// Scans per ring page of nch channels at SRate, as MainApp::ringPageSize() sizes them before any cost is measured
+int pageScans(int nch)
+{
+    RingGeometry g;
+    g.srate = SRate;
+    g.nChans = unsigned(nch);
+    g.oneScanBytes = (unsigned long)nch * sizeof(int16);
+    g.compute();
+    return int(g.scansPerPage);
+}
+
+// --- Intan demux: DAQ::NITask::setupIntanDemux()'s ScanPermutation, and the per-scan ApplyNewIntanDemuxToScan() it replaced ---
+
+struct Mode { const char *name; int chansPerIntan, nIntans, nExtra; };
+const Mode modes[] = { { "AI60Demux", 15, 4, 1 }, { "AI128Demux", 16, 8, 1 }, { "AI256Demux", 32, 8, 1 } };
+
+int modeChans(int m) { return modes[m].chansPerIntan*modes[m].nIntans + modes[m].nExtra; }
+
+void applyNewIntanDemuxToScan(int16 *begin, const unsigned nchans_per_intan, const unsigned num_intans)
+{
+    int16 tmparr[512];
+    const int narr = nchans_per_intan*num_intans;
+    for (int k = 0; k < int(num_intans); ++k) {
+        const int jlimit = (k+1)*int(nchans_per_intan);
+        for (int i = k, j = k*int(nchans_per_intan); j < jlimit; i+=num_intans,++j)
+            tmparr[j] = begin[i];
+    }
+    memcpy(begin, tmparr, narr*sizeof(int16));
+}
+
+void bmDemuxLegacy(State & st, const std::vector<int> & a)
+{
+    const Mode & m(modes[a[0]]);
+    const int N = m.chansPerIntan*m.nIntans + m.nExtra, nscans = a[1];
+    std::vector<int16> data(size_t(nscans)*N), work;
+    fillRandom(data);
+    while (st.keepRunning()) {
+        work = data;
+        for (size_t i = 0; i < work.size(); i += N) applyNewIntanDemuxToScan(&work[i], m.chansPerIntan, m.nIntans);
+    }
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+void bmDemuxPermutation(State & st, const std::vector<int> & a)
+{
+    const Mode & m(modes[a[0]]);
+    const int N = m.chansPerIntan*m.nIntans + m.nExtra, nscans = a[1];
+    std::vector<int16> data(size_t(nscans)*N), out(data.size()), check(data);
+    fillRandom(data);
+    check = data;
+    for (size_t i = 0; i < check.size(); i += N) applyNewIntanDemuxToScan(&check[i], m.chansPerIntan, m.nIntans);
+    ScanPermutation demux;
+    demux.setTranspose(unsigned(N), unsigned(m.chansPerIntan), unsigned(m.nIntans));
+    while (st.keepRunning()) demux.apply(&data[0], &out[0], unsigned(nscans));
+    if (out != check) st.fail("differs from ApplyNewIntanDemuxToScan");
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+// --- dual device merge: DAQ::NITask::mergeDualDevData() (DAQ.cpp), and the fused ScanPermutation::apply2() path ---
+
+void mergeDualDevData(std::vector<int16> & out, const std::vector<int16> & data, const std::vector<int16> & data2,
+                      int NCHANS1, int NCHANS2, int nExtraChans1, int nExtraChans2)
+{
+    const int nMx = NCHANS1-nExtraChans1, nMx2 = NCHANS2-nExtraChans2, s1 = int(data.size()), s2 = int(data2.size());
+    out.clear();
+    out.reserve(s1+s2);
+    int i,j;
+    for (i = 0, j = 0; i < s1 && j < s2; i+=NCHANS1, j+=NCHANS2) {
+        if (nMx > 0) out.insert(out.end(), data.begin()+i, data.begin()+i+nMx);
+        if (nMx2 > 0) out.insert(out.end(), data2.begin()+j, data2.begin()+j+nMx2);
+        out.insert(out.end(), data.begin()+i+nMx, data.begin()+i+NCHANS1);
+        out.insert(out.end(), data2.begin()+j+nMx2, data2.begin()+j+NCHANS2);
+    }
+}
+
+void bmMergeDualDev(State & st, const std::vector<int> & a)
+{
+    const Mode & m(modes[a[0]]);
+    const int NCHANS = m.chansPerIntan*m.nIntans + m.nExtra, nscans = a[1];
+    std::vector<int16> d1(size_t(nscans)*NCHANS), d2(d1.size()), out;
+    fillRandom(d1, 1); fillRandom(d2, 2);
+    while (st.keepRunning()) mergeDualDevData(out, d1, d2, NCHANS, NCHANS, m.nExtra, m.nExtra);
+    st.setItems(double(2*d1.size())); st.setBytes(double(2*d1.size()*sizeof(int16)));
+}
+
+void bmMergeDualDevFused(State & st, const std::vector<int> & a)
+{
+    // as NITask::setupFusedDualDev(): merge order, then the demux of the merged scan, as one two-source gather
+    const Mode & m(modes[a[0]]);
+    const int NCHANS = m.chansPerIntan*m.nIntans + m.nExtra, nscans = a[1], nMx = NCHANS - m.nExtra, N = 2*NCHANS;
+    std::vector<int16> d1(size_t(nscans)*NCHANS), d2(d1.size()), out(2*d1.size()), check;
+    fillRandom(d1, 1); fillRandom(d2, 2);
+    ScanPermutation demux, fused;
+    demux.setTranspose(unsigned(N), unsigned(m.chansPerIntan), unsigned(m.nIntans*2));
+    std::vector<int> merged;
+    for (int i = 0; i < nMx; ++i) merged.push_back(i);
+    for (int i = 0; i < nMx; ++i) merged.push_back(NCHANS+i);
+    for (int i = nMx; i < NCHANS; ++i) merged.push_back(i);
+    for (int i = nMx; i < NCHANS; ++i) merged.push_back(NCHANS+i);
+    std::vector<int> g(merged.size());
+    for (size_t i = 0; i < g.size(); ++i) g[i] = merged[demux.table()[i]];
+    fused.setGather2(g, unsigned(NCHANS));
+    while (st.keepRunning()) fused.apply2(&d1[0], &d2[0], &out[0], unsigned(nscans));
+    mergeDualDevData(check, d1, d2, NCHANS, NCHANS, m.nExtra, m.nExtra);
+    for (size_t i = 0; i < check.size(); i += N) applyNewIntanDemuxToScan(&check[i], m.chansPerIntan, m.nIntans*2);
+    if (out != check) st.fail("differs from mergeDualDevData + demux");
+    st.setItems(double(out.size())); st.setBytes(double(out.size()*sizeof(int16)));
+}
+
+// --- HPFilter::apply, the block version and the per-scan one ---
+
+void bmHPFilterBlock(State & st, const std::vector<int> & a)
+{
+    const int nch = a[0], nscans = a[1];
+    std::vector<int16> data(size_t(nscans)*nch);
+    fillRandom(data);
+    HPFilter f(unsigned(nch), 300.);
+    while (st.keepRunning()) f.apply(&data[0], unsigned(nscans), 1./SRate);
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+void bmHPFilterPerScan(State & st, const std::vector<int> & a)
+{
+    const int nch = a[0], nscans = a[1];
+    std::vector<int16> data(size_t(nscans)*nch);
+    fillRandom(data);
+    HPFilter f(unsigned(nch), 300.);
+    while (st.keepRunning())
+        for (int s = 0; s < nscans; ++s) f.apply(&data[size_t(s)*nch], 1./SRate);
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+// --- the save channel subset: MainApp::writeScansToDataFile(), called from taskReadFunc() ---
+
+void bmSaveSubset(State & st, const std::vector<int> & a)
+{
+    const unsigned nch = unsigned(a[0]), nScans = unsigned(a[1]);
+    std::vector<int16> data(size_t(nScans)*nch), save_subset;
+    fillRandom(data);
+    QBitArray demuxedBitMap(int(nch), true);
+    for (unsigned c = 0; c < nch; c += 2) demuxedBitMap.clearBit(int(c)); // every other channel saved
+    while (st.keepRunning()) {
+        const int16 *scans = &data[0];
+        save_subset.resize(0);
+        save_subset.reserve(size_t(nScans)*(nch/2));
+        for (unsigned s = 0; s < nScans; ++s, scans += nch)
+            for (unsigned c = 0; c < nch; ++c)
+                if (demuxedBitMap.testBit(int(c))) save_subset.push_back(scans[c]);
+    }
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+// --- FilterBank::apply and ReferenceStage::apply, on their own ---
+
+/// The filter specs the graphs and the save path are typically run with, as FilterBank::Spec strings
+const char * const fbankSpecs[] = { "bp=300-6000", "bp=300-6000;notch=60x3;q=30", "bp=300-6000;notch=60x3;q=30;car" };
+
+void bmFilterBank(State & st, const std::vector<int> & a)
+{
+    const int nch = a[0], nscans = a[1];
+    std::vector<int16> data(size_t(nscans)*nch);
+    fillRandom(data);
+    bool ok = true;
+    FilterBank fb(unsigned(nch), SRate, FilterBank::Spec::fromString(fbankSpecs[a[2]], &ok));
+    if (!ok || !fb.numSections()) { st.fail("bad spec"); return; }
+    while (st.keepRunning()) fb.apply(&data[0], unsigned(nscans));
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+void bmReferenceStage(State & st, const std::vector<int> & a)
+{
+    // groups:0 is one group of all the channels, as "ref=car"; otherwise groups of that many channels, as a probe's shanks
+    const int nch = a[0], nscans = a[1], groupChans = a[3];
+    std::vector<int16> data(size_t(nscans)*nch), work;
+    fillRandom(data);
+    ReferenceStage::Spec spec;
+    spec.mode = a[2] ? ReferenceStage::Median : ReferenceStage::Average;
+    for (int c = 0; groupChans > 0 && c < nch; c += groupChans)
+        spec.groups.push_back(std::make_pair(unsigned(c), unsigned(std::min(c+groupChans, nch)-1)));
+    ReferenceStage ref(unsigned(nch), spec);
+    if (!ref.numGroups()) { st.fail("no groups"); return; }
+    while (st.keepRunning()) {
+        work = data; // it works in place, and referencing already referenced data would make the median's job easy
+        ref.apply(&work[0], unsigned(nscans));
+    }
+    st.setItems(double(data.size())); st.setBytes(double(data.size()*sizeof(int16)));
+}
+
+// --- GraphsWindow::putScans() (GraphsWindow.cpp): the downsampling point ingest, optionally through the highpass,
+//     the filter bank or the filter bank and the re-referencing ---
+
+struct Vec2f { float x, y; };
+/// VecWrapBuffer<Vec2f>, minus Vec.h (which needs Util.h)
+struct PointBuf : public WrapBuffer {
+    unsigned unusedCapacity() const { return WrapBuffer::unusedCapacity()/sizeof(Vec2f); }
+    void putData(const Vec2f *v, unsigned n) { WrapBuffer::putData(v, n*sizeof(Vec2f)); }
+    Vec2f & first() const { void *p; unsigned l; dataPtr1(p, l); return *reinterpret_cast<Vec2f *>(p); }
+};
+struct GraphStats { double s1, s2; unsigned num; };
+
+void bmGraphsPutScans(State & st, const std::vector<int> & a)
+{
+    // filter:0 is none, 1 the highpass, 2 the filter bank (band-pass + notches), 3 that and a median re-reference
+    const int NGRAPHS = a[0], nscans = a[1], DOWNSAMPLE_RATIO = a[2], filt = a[3];
+    const double SRATE = SRate, downsampleRatio = DOWNSAMPLE_RATIO, graphTimeSecs = DEFAULT_GRAPH_TIME_SECS;
+    std::vector<int16> data(size_t(nscans)*NGRAPHS), scanTmp;
+    fillRandom(data);
+    std::vector<PointBuf> points(NGRAPHS);
+    for (int i = 0; i < NGRAPHS; ++i) points[i].reserve(unsigned(graphTimeSecs*SRATE/downsampleRatio)*sizeof(Vec2f));
+    std::vector<GraphStats> graphStats(NGRAPHS);
+    memset(&graphStats[0], 0, graphStats.size()*sizeof(GraphStats));
+    HPFilter hp(unsigned(NGRAPHS), 300.);
+    FilterBank fb(unsigned(NGRAPHS), 0., FilterBank::Spec::fromString(fbankSpecs[1]));
+    const std::vector<unsigned char> fbankChans(NGRAPHS, 1);
+    ReferenceStage::Spec refSpec;
+    refSpec.mode = ReferenceStage::Median;
+    ReferenceStage ref(unsigned(NGRAPHS), refSpec);
+    HPFilter *filter = filt == 1 ? &hp : 0;
+    FilterBank *fbank = filt >= 2 ? &fb : 0;
+    ReferenceStage *refStage = filt >= 3 ? &ref : 0;
+    const unsigned DSIZE = unsigned(data.size());
+    quint64 firstSamp = 0;
+    while (st.keepRunning()) {
+        int16 *const DATA = &data[0];
+        const int16 *DPTR = DATA;
+        PointBuf * const pts = &points[0];
+        int startpt = 0;
+        double t = double(double(firstSamp) / NGRAPHS) / double(SRATE);
+        const double deltaT = 1.0/SRATE * downsampleRatio;
+        Vec2f v;
+        int idx = 0;
+        bool needFilter = (filter || fbank || refStage) && NGRAPHS;
+        int filtRow = 0;
+        if (needFilter) {
+            const int maxRows = (int(DSIZE)-startpt)/(DOWNSAMPLE_RATIO*NGRAPHS) + 2;
+            int nRows = 0;
+            scanTmp.resize(maxRows*NGRAPHS);
+            for (int i = startpt; i < (int)DSIZE && nRows < maxRows; ++nRows) {
+                const int n = std::min(NGRAPHS, int(DSIZE)-i);
+                int16 * const row = &scanTmp[nRows*NGRAPHS];
+                memcpy(row, &DATA[i], n*sizeof(int16));
+                if (n < NGRAPHS) memset(row+n, 0, (NGRAPHS-n)*sizeof(int16));
+                i = int((i-1) + DOWNSAMPLE_RATIO*NGRAPHS);
+                if ((i+1)%NGRAPHS) i -= (i+1)%NGRAPHS;
+                ++i;
+            }
+            if (nRows) {
+                if (filter) filter->apply(&scanTmp[0], unsigned(nRows), deltaT);
+                if (fbank) {
+                    fbank->setSamplingRate(1.0/deltaT);
+                    fbank->apply(&scanTmp[0], unsigned(nRows), &fbankChans[0]);
+                }
+                if (refStage) refStage->apply(&scanTmp[0], unsigned(nRows));
+            } else needFilter = false;
+        }
+        for (int i = startpt; i < (int)DSIZE; ++i) {
+            if (needFilter) {
+                DPTR = (&scanTmp[(filtRow++)*NGRAPHS])-i;
+                needFilter = false;
+            }
+            v.x = float(t);
+            v.y = float(DPTR[i] / 32768.0);
+            PointBuf & pbuf = pts[idx];
+            GraphStats & gs = graphStats[idx];
+            if (!pbuf.unusedCapacity()) {
+                const double val = pbuf.first().y;
+                gs.s1 -= val;
+                gs.s2 -= val*val;
+                --gs.num;
+            }
+            pbuf.putData(&v, 1);
+            gs.s1 += v.y;
+            gs.s2 += v.y*v.y;
+            ++gs.num;
+            if (!(++idx%NGRAPHS)) {
+                idx = 0;
+                t += deltaT;
+                i = int((i-NGRAPHS) + DOWNSAMPLE_RATIO*NGRAPHS);
+                if ((i+1)%NGRAPHS) i -= (i+1)%NGRAPHS;
+                DPTR = DATA;
+                needFilter = (filter || fbank || refStage) && NGRAPHS;
+            }
+        }
+        firstSamp += DSIZE;
+    }
+    st.setItems(double(DSIZE)); st.setBytes(double(DSIZE*sizeof(int16)));
+}
+
+// --- SlidingMinMax: chunkMinMax and the per-channel window update, as SpatialVisWindow's auto-scale does them ---
+
+struct ChanWindows {
+    std::vector<SlidingMinMax> w;
+    std::vector<int16> chunkMin, chunkMax; ///< padded to a multiple of 8 channels
+    std::vector<double> secs;
+    explicit ChanWindows(int nch) : w(nch), chunkMin((nch+7)&~7), chunkMax(chunkMin.size()), secs(nch, DEFAULT_GRAPH_TIME_SECS) {}
+
+    /// SpatialVisWindow::putScans()'s doAutoScale block, returning each channel's window min/max in smin/smax
+    void update(const int16 *scans, int nscans, int nch, int skip, double now, int16 *smin, int16 *smax) {
+        SlidingMinMax::chunkMinMax(scans, nscans, nch, skip, &chunkMin[0], &chunkMax[0]);
+        for (int i = 0; i < nch; ++i) {
+            SlidingMinMax & win(w[i]);
+            win.expire(now, secs[i]);
+            win.push(now, chunkMin[i], chunkMax[i]);
+            smin[i] = win.min();
+            smax[i] = win.max();
+        }
+    }
+};
+
+void bmSlidingMinMax(State & st, const std::vector<int> & a)
+{
+    const int nch = a[0], nscans = a[1], skip = a[2] > 1 ? a[2]-1 : 0;
+    std::vector<int16> scans(size_t(nscans)*nch), smin(nch), smax(nch);
+    fillRandom(scans);
+    ChanWindows cw(nch);
+    double now = 0.;
+    // the first window's worth of pages fill the deques; time the steady state
+    for (; now < DEFAULT_GRAPH_TIME_SECS; now += nscans/SRate) cw.update(&scans[0], nscans, nch, skip, now, &smin[0], &smax[0]);
+    while (st.keepRunning()) {
+        cw.update(&scans[0], nscans, nch, skip, now, &smin[0], &smax[0]);
+        now += nscans/SRate;
+    }
+    st.setItems(double(scans.size())); st.setBytes(double(scans.size()*sizeof(int16)));
+}
+
+// --- SpatialVisWindow::putScans() (SpatialVisWindow.cpp), instantaneous mode with auto-scale ---
+
+void bmSpatialPutScans(State & st, const std::vector<int> & a)
+{
+    const int nvai = a[0], nscans = a[1], downSampleSkips = a[2] > 1 ? a[2]-1 : 0;
+    const unsigned scans_size_samps = unsigned(nscans*nvai);
+    std::vector<int16> scans(scans_size_samps), smin(nvai), smax(nvai), chanRawSamps(nvai);
+    fillRandom(scans);
+    ChanWindows cw(nvai);
+    std::vector<int> revsorting(nvai);
+    for (int i = 0; i < nvai; ++i) revsorting[i] = nvai-1-i;
+    std::vector<double> chanVolts(nvai);
+    std::vector<unsigned char> intensities(nvai);
+    const double rangeMin = -5., rangeMax = 5.;
+    quint64 firstSamp = 0;
+    while (st.keepRunning()) {
+        const double now = double(firstSamp/quint64(nvai))/SRate;
+        cw.update(&scans[0], nscans, nvai, downSampleSkips, now, &smin[0], &smax[0]);
+        int firstidx = int(scans_size_samps) - nvai;
+        if (firstidx < 0) firstidx = 0;
+        for (int i = firstidx; i < int(scans_size_samps); ++i) {
+            const int ch = i%nvai, chanId = revsorting[ch];
+            double val, sampval;
+            val = ((sampval=double(scans[i]))+32768.) / 65535.;
+            if (smax[ch] > smin[ch]) {
+                val = (sampval-double(smin[ch])) / (double(smax[ch]) - double(smin[ch]));
+                if (val < 0.) val = 0.;
+                else if (val > 1.) val = 1.;
+            }
+            chanRawSamps[chanId] = scans[i];
+            chanVolts[chanId] = val * (rangeMax-rangeMin)+rangeMin;
+            intensities[chanId] = (unsigned char)(val*255.0 + 0.5);
+        }
+        firstSamp += scans_size_samps;
+    }
+    st.setItems(double(scans_size_samps)); st.setBytes(double(scans_size_samps*sizeof(int16)));
+}
+
+// --- DataFile::readScans() and TempDataFile::readScans(), reading back a file of random scans ---
+
+const char * const ReadFileName = "microbench_readscans.bin";
+
+bool makeReadFile(int nChans, int nScans)
+{
+    std::vector<int16> data(size_t(nScans)*nChans);
+    fillRandom(data);
+    QFile f(ReadFileName);
+    if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate)) return false;
+    const qint64 n = qint64(data.size()*sizeof(int16));
+    return f.write(reinterpret_cast<const char *>(&data[0]), n) == n;
+}
+
+QBitArray everyOtherChan(int nChans, bool subset)
+{
+    QBitArray b(nChans, true);
+    if (subset) for (int c = 0; c < nChans; c += 2) b.clearBit(c);
+    return b;
+}
+
+/// DataFile::readScans(), reading from dataFile
+qint64 dataFileReadScans(QFile & dataFile, int nChans, double sRate, quint64 scanCt, std::vector<int16> & scans_out, quint64 pos, quint64 num2read, const QBitArray & chset, unsigned downSampleFactor)
+{
+    if (pos > scanCt) return -1;
+    if (num2read + pos > scanCt) num2read = scanCt - pos;
+    if (downSampleFactor <= 0) downSampleFactor = 1;
+    unsigned nChansOn = unsigned(chset.count(true));
+    int sizeofscans;
+    if ( (num2read / downSampleFactor) * downSampleFactor < num2read )
+        sizeofscans = int(((num2read / downSampleFactor)+1) * nChansOn);
+    else
+        sizeofscans = int(((num2read / downSampleFactor)) * nChansOn);
+    scans_out.resize(sizeofscans);
+    quint64 cur = pos;
+    qint64 nout = 0;
+    std::vector<int> onChans;
+    onChans.reserve(chset.size());
+    for (int i = 0, n = chset.size(); i < n; ++i)
+        if (chset.testBit(i)) onChans.push_back(i);
+    qint64 maxBufSize = qint64(nChans*sRate*1);
+    qint64 desiredBufSize = qint64(num2read*nChans);
+    if (desiredBufSize > maxBufSize) desiredBufSize = maxBufSize;
+    std::vector<int16> buf(desiredBufSize);
+    if (int(buf.size()) < nChans) buf.resize(nChans);
+    while (cur < pos + num2read) {
+        if (!dataFile.seek(qint64(cur * sizeof(int16) * nChans))) return -1;
+        qint64 nr = dataFile.read(reinterpret_cast<char *>(&buf[0]), sizeof(int16) * buf.size());
+        if (nr < qint64(sizeof(int16) * nChans)) return -1;
+        int nscans = int(nr/sizeof(int16))/nChans;
+        const int16 *bufptr = &buf[0];
+        const int onChansSize = int(onChans.size());
+        const int skip = nChans*downSampleFactor;
+        for (int sc = 0; sc < nscans && cur < pos + num2read; ) {
+            if (int(nChansOn) == nChans) {
+                qint64 i_out = nout * nChans;
+                for (int i = 0; i < nChans; ++i) scans_out[i_out + i] = int16(bufptr[i]);
+            } else {
+                qint64 i_out = nout*qint64(nChansOn);
+                for (int i = 0; i < onChansSize; ++i) scans_out[i_out++] = int16(bufptr[onChans[i]]);
+            }
+            ++nout;
+            bufptr += skip;
+            sc += downSampleFactor;
+            cur += downSampleFactor;
+        }
+    }
+    return nout;
+}
+
+void bmDataFileReadScans(State & st, const std::vector<int> & a)
+{
+    const int nChans = a[0], nread = a[1], ds = a[2], nScans = 4*nread;
+    if (!makeReadFile(nChans, nScans)) { st.fail("could not write the test file"); return; }
+    QFile f(ReadFileName);
+    if (!f.open(QIODevice::ReadOnly)) { st.fail("could not open the test file"); return; }
+    const QBitArray chset(everyOtherChan(nChans, a[3] != 0));
+    std::vector<int16> out;
+    quint64 pos = 0;
+    while (st.keepRunning()) {
+        if (dataFileReadScans(f, nChans, SRate, quint64(nScans), out, pos, quint64(nread), chset, unsigned(ds)) < 0) { st.fail("read failed"); break; }
+        pos = (pos + quint64(nread)) % quint64(nScans - nread);
+    }
+    f.close();
+    QFile::remove(ReadFileName);
+    st.setItems(double(nread)*nChans); st.setBytes(double(nread)*nChans*sizeof(int16));
+}
+
+/// TempDataFile::readScans(), reading from readFile
+bool tempDataFileReadScans(QFile & readFile, unsigned nChans, qint64 my_scanCount, qint64 my_currSize, QVector<int16> & out, qint64 nfrom, qint64 nread, const QBitArray & channelSubset, unsigned downsample)
+{
+    const qint64 scanSz = nChans * sizeof(int16);
+    const qint64 maxNScans = my_currSize / scanSz;
+    const qint64 maxPos = scanSz * maxNScans;
+    qint64 readCount = nread >= 0 ? nread : 1;
+    if (readCount > maxNScans) readCount = maxNScans;
+    if (readCount > 20000000) readCount = 20000000;
+    if (nfrom + readCount > my_scanCount) readCount = my_scanCount - nfrom;
+    if (nfrom < 0 || nfrom+readCount > my_scanCount) return false;
+    qint64 pos = (nfrom % maxNScans) * scanSz;
+    if (!readFile.seek(pos)) return false;
+    if (downsample <= 0) downsample = 1;
+    const int nChansOn = channelSubset.count(true), subsetSize = channelSubset.size();
+    out.clear();
+    qint64 osize = 0;
+    out.reserve(int((readCount/downsample) * nChansOn));
+    qint64 readSoFar = 0;
+    QVector<int16> scan(int(nChans), 0);
+    QVector<int> chansOn;
+    chansOn.reserve(nChansOn);
+    for (int i = 0; i < subsetSize; ++i)
+        if (channelSubset.testBit(i)) chansOn.append(i);
+    while (readSoFar < readCount) {
+        if (pos + scanSz > maxPos) readFile.seek(pos=0);
+        qint64 read = readFile.read(reinterpret_cast<char *>(&scan[0]), scanSz);
+        if (scanSz == read) {
+            if (int(nChans) == nChansOn) {
+                osize += nChansOn;
+                out.resize(int(osize));
+                memcpy(&out[int(osize-nChansOn)], &scan[0], size_t(scanSz));
+            } else {
+                for (int i = 0; i < nChansOn; ++i) out.append(scan[chansOn[i]]);
+            }
+            pos += read;
+        } else {
+            pos = (pos + scanSz) % maxPos;
+            readFile.seek(pos);
+        }
+        if (downsample > 1) {
+            const int skip = int(downsample)-1;
+            pos = (pos + skip*scanSz) % maxPos;
+            readFile.seek(pos);
+            readSoFar += skip;
+        }
+        ++readSoFar;
+    }
+    return true;
+}
+
+void bmTempDataFileReadScans(State & st, const std::vector<int> & a)
+{
+    const int nChans = a[0], nread = a[1], ds = a[2], nScans = 4*nread;
+    if (!makeReadFile(nChans, nScans)) { st.fail("could not write the test file"); return; }
+    QFile f(ReadFileName);
+    if (!f.open(QIODevice::ReadOnly)) { st.fail("could not open the test file"); return; }
+    const QBitArray chset(everyOtherChan(nChans, a[3] != 0));
+    QVector<int16> out;
+    qint64 from = 0;
+    const qint64 size = qint64(nScans)*nChans*qint64(sizeof(int16));
+    while (st.keepRunning()) {
+        if (!tempDataFileReadScans(f, unsigned(nChans), nScans, size, out, from, nread, chset, unsigned(ds))) { st.fail("read failed"); break; }
+        from = (from + nread) % (nScans - nread);
+    }
+    f.close();
+    QFile::remove(ReadFileName);
+    st.setItems(double(nread)*nChans); st.setBytes(double(nread)*nChans*sizeof(int16));
+}
+
+// --- Util::Resampler::resample() (Util.cpp), the static version: short -> float, src_simple(), float -> short ---
+
+void bmResample(State & st, const std::vector<int> & a)
+{
+    const int nch = a[0], nframes = a[1], alg = a[2];
+    const double ratio = double(a[3]) / 1000.;
+    std::vector<int16> input(size_t(nframes)*nch), output;
+    fillRandom(input);
+    while (st.keepRunning()) {
+        std::vector<float> inf(input.size()), outf(size_t(input.size()*ratio) + size_t(nch) + 32);
+        SRC_DATA d;
+        memset(&d, 0, sizeof(d));
+        src_short_to_float_array(&input[0], (d.data_in=&inf[0]), int(input.size()));
+        d.data_out = &outf[0];
+        d.input_frames = long(input.size())/nch;
+        d.output_frames = long(outf.size())/nch;
+        d.end_of_input = 0;
+        d.src_ratio = ratio;
+        const int errcode = src_simple(&d, alg, nch);
+        if (errcode) { st.fail(src_strerror(errcode)); break; }
+        output.resize(size_t(d.output_frames_gen*nch));
+        src_float_to_short_array(&outf[0], &output[0], long(output.size()));
+    }
+    st.setItems(double(input.size())); st.setBytes(double(input.size()*sizeof(int16)));
+}
+
+// --- SHA1::UpdateHash, a ring page at a time ---
+
+void bmSha1(State & st, const std::vector<int> & a)
+{
+    std::vector<int16> data(size_t(a[0])*a[1]);
+    fillRandom(data);
+    SHA1 sha;
+    const uint32_t n = uint32_t(data.size()*sizeof(int16));
+    while (st.keepRunning()) sha.UpdateHash(reinterpret_cast<const uint8_t *>(&data[0]), n);
+    sha.Final();
+    st.setItems(double(data.size())); st.setBytes(double(n));
+}
+
+void registerCases()
+{
+    const int chanCounts[] = { 32, 64, 128, 256, 1024, 2304 };
+    const int nChanCounts = int(sizeof(chanCounts)/sizeof(*chanCounts));
+    for (int m = 0; m < int(sizeof(modes)/sizeof(*modes)); ++m) {
+        add("intan_demux_legacy", bmDemuxLegacy, "mode,scans", m, pageScans(modeChans(m)));
+        add("intan_demux_permutation", bmDemuxPermutation, "mode,scans", m, pageScans(modeChans(m)));
+    }
+    for (int m = 0; m < int(sizeof(modes)/sizeof(*modes)); ++m) {
+        add("merge_dualdev", bmMergeDualDev, "mode,scans", m, pageScans(modeChans(m)));
+        add("merge_dualdev_fused", bmMergeDualDevFused, "mode,scans", m, pageScans(modeChans(m)));
+    }
+    for (int i = 0; i < nChanCounts; ++i) {
+        add("hpfilter_block", bmHPFilterBlock, "chans,scans", chanCounts[i], pageScans(chanCounts[i]));
+        add("hpfilter_per_scan", bmHPFilterPerScan, "chans,scans", chanCounts[i], pageScans(chanCounts[i]));
+    }
+    // spec is an index into fbankSpecs; ref mode 0 is CAR, 1 CMR
+    for (int i = 0; i < nChanCounts; ++i)
+        for (int spec = 0; spec < 3; ++spec)
+            add("filterbank", bmFilterBank, "chans,scans,spec", chanCounts[i], pageScans(chanCounts[i]), spec);
+    for (int i = 0; i < nChanCounts; ++i) {
+        add("reference_stage", bmReferenceStage, "chans,scans,mode,groups", chanCounts[i], pageScans(chanCounts[i]), 0, 0);
+        add("reference_stage", bmReferenceStage, "chans,scans,mode,groups", chanCounts[i], pageScans(chanCounts[i]), 1, 0);
+        add("reference_stage", bmReferenceStage, "chans,scans,mode,groups", chanCounts[i], pageScans(chanCounts[i]), 1, 32);
+    }
+    for (int i = 0; i < nChanCounts; ++i) add("save_subset", bmSaveSubset, "chans,scans", chanCounts[i], pageScans(chanCounts[i]));
+    for (int i = 0; i < nChanCounts; ++i) {
+        add("graphs_putscans", bmGraphsPutScans, "chans,scans,ds,filter", chanCounts[i], pageScans(chanCounts[i]), 25, 0);
+        add("graphs_putscans", bmGraphsPutScans, "chans,scans,ds,filter", chanCounts[i], pageScans(chanCounts[i]), 25, 1);
+        add("graphs_putscans", bmGraphsPutScans, "chans,scans,ds,filter", chanCounts[i], pageScans(chanCounts[i]), 25, 2);
+        add("graphs_putscans", bmGraphsPutScans, "chans,scans,ds,filter", chanCounts[i], pageScans(chanCounts[i]), 25, 3);
+        add("graphs_putscans", bmGraphsPutScans, "chans,scans,ds,filter", chanCounts[i], pageScans(chanCounts[i]), 1, 0);
+    }
+    for (int i = 0; i < nChanCounts; ++i) {
+        add("sliding_minmax", bmSlidingMinMax, "chans,scans,ds", chanCounts[i], pageScans(chanCounts[i]), 25);
+        add("spatial_putscans", bmSpatialPutScans, "chans,scans,ds", chanCounts[i], pageScans(chanCounts[i]), 25);
+        add("spatial_putscans", bmSpatialPutScans, "chans,scans,ds", chanCounts[i], pageScans(chanCounts[i]), 1);
+    }
+    const int readChans[] = { 64, 256, 2304 };
+    for (int i = 0; i < 3; ++i) {
+        // the file viewer reads a screenful at a time; the Matlab API, whatever the script asks for
+        add("datafile_readscans", bmDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 1, 0);
+        add("datafile_readscans", bmDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 1, 1);
+        add("datafile_readscans", bmDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 10, 1);
+        add("tempdatafile_readscans", bmTempDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 1, 0);
+        add("tempdatafile_readscans", bmTempDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 1, 1);
+        add("tempdatafile_readscans", bmTempDataFileReadScans, "chans,scans,ds,subset", readChans[i], 25000, 10, 1);
+    }
+    // ratio is x1000: 640 is the Bug3's 16 kHz aux from 25 kHz; 1000 is a pass through
+    add("resample", bmResample, "chans,frames,alg,ratio", 1, 16000, SRC_SINC_FASTEST, 640);
+    add("resample", bmResample, "chans,frames,alg,ratio", 1, 16000, SRC_LINEAR, 640);
+    add("resample", bmResample, "chans,frames,alg,ratio", 4, 16000, SRC_SINC_FASTEST, 640);
+    add("resample", bmResample, "chans,frames,alg,ratio", 32, 16000, SRC_SINC_FASTEST, 1000);
+    for (int i = 0; i < nChanCounts; ++i) add("sha1_update", bmSha1, "chans,scans", chanCounts[i], pageScans(chanCounts[i]));
+}
+
+void usage()
+{
+    fprintf(stderr, "Usage: microbench [-filter substring] [-min_time secs] [-o results.csv] [-list]\n");
+    exit(2);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter, out;
+    double minTime = 0.5;
+    bool list = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-list")) list = true;
+        else if (i+1 >= argc) usage();
+        else if (!strcmp(argv[i], "-filter")) filter = argv[++i];
+        else if (!strcmp(argv[i], "-min_time")) { if ((minTime = atof(argv[++i])) <= 0.) usage(); }
+        else if (!strcmp(argv[i], "-o")) out = argv[++i];
+        else usage();
+    }
+
+    registerCases();
+    FILE *csv = 0;
+    if (!list && !out.empty()) {
+        if (!(csv = fopen(out.c_str(), "w"))) { fprintf(stderr, "microbench: could not open %s for writing\n", out.c_str()); return 1; }
+        fprintf(csv, "name,iterations,ns_per_iter,Msamples_per_s,MB_per_s,error\n");
+    }
+    if (!list) printf("%-58s %12s %14s %12s %10s\n", "case", "iterations", "ns/iter", "Msamples/s", "MB/s");
+
+    bool ok = true;
+    for (size_t ci = 0; ci < cases().size(); ++ci) {
+        const Case & c(cases()[ci]);
+        if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+        if (list) { printf("%s\n", c.name.c_str()); continue; }
+        // double the iterations until the timed loop runs long enough, like benchmark::State
+        unsigned long long iters = 1;
+        State *st = 0;
+        for (;;) {
+            delete st;
+            st = new State(iters);
+            c.fn(*st, c.args);
+            if (!st->err.empty() || double(st->ns) >= minTime * 1e9 || iters >= (1ULL << 40)) break;
+            const double want = st->ns > 0 ? minTime * 1e9 / double(st->ns) * double(iters) * 1.4 : double(iters) * 10.;
+            iters = want > double(iters) * 10. ? iters * 10 : (unsigned long long)want + 1;
+        }
+        const double nsPerIter = double(st->ns) / double(st->iters);
+        const double msps = nsPerIter > 0. ? st->items / nsPerIter * 1e3 : 0., mbps = nsPerIter > 0. ? st->bytes / nsPerIter * 1e9 / (1024.*1024.) : 0.;
+        if (st->err.empty())
+            printf("%-58s %12llu %14.1f %12.1f %10.1f\n", c.name.c_str(), st->iters, nsPerIter, msps, mbps);
+        else {
+            printf("%-58s FAILED: %s\n", c.name.c_str(), st->err.c_str());
+            ok = false;
+        }
+        if (csv) fprintf(csv, "%s,%llu,%.1f,%.2f,%.2f,%s\n", c.name.c_str(), st->iters, nsPerIter, msps, mbps, st->err.c_str());
+        fflush(stdout);
+        delete st;
+    }
+    if (csv && fclose(csv)) ok = false;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+######################################################################
+# Microbenchmarks of the per-sample kernels: demux, dual device merge,
+# highpass, filter bank, re-referencing, sliding min/max, save subset,
+# graph and spatial ingest, data file reads, resampling and SHA1.
+# Headless, Qt core only.  Build with qmake && make, run ./microbench
+######################################################################
+
+TEMPLATE = app
+TARGET = microbench
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../PagedRingBuffer.h ../HPFilter.h ../FilterBank.h ../ReferenceStage.h ../SlidingMinMax.h \
+           ../RingGeometry.h ../SpikeGLConstants.h ../WrapBuffer.h ../sha1.h ../samplerate/samplerate.h
+SOURCES += microbench.cpp ../PagedRingBuffer.cpp ../HPFilter.cpp ../FilterBank.cpp ../ReferenceStage.cpp \
+           ../SlidingMinMax.cpp ../RingGeometry.cpp ../WrapBuffer.cpp ../sha1.cpp \
+           ../samplerate/samplerate.c ../samplerate/src_linear.c ../samplerate/src_sinc.c ../samplerate/src_zoh.c
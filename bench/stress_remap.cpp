@@ -0,0 +1,164 @@
+/*
+ * Hammers a PagedScanWriter that has a channel mapping with FG-shaped traffic (2304-channel scans arriving as 32
+ * lines of 144 bytes via writePartial(), like FG_SpikeGL.exe does), plus plain write() and directWritePtr() traffic,
+ * while a reader thread checks that every scan it sees is correctly remapped.  A watchdog fails the run if either
+ * thread stops making progress for 2 seconds.
+ *
+ * Usage: stress_remap [-t seconds] [-r target_scans_per_sec]
+ *
+ * Exit status is 0 on success, 1 on a data mismatch, 2 on a hang.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include "PagedRingBuffer.h"
+
+namespace {
+
+const unsigned NChans = 2304, LineBytes = 144, NLines = 32, ScansPerPage = 64, NPages = 128;
+
+inline short sampleFor(unsigned long long scan, unsigned chan) { return short((scan*7ULL + chan*13ULL) & 0x7fff); }
+
+enum { ModePartial = 0, ModeWrite, ModeDirect, NModes };
+
+class Writer : public QThread
+{
+public:
+    Writer(PagedScanWriter & w, double secs, double rate) : w(w), secs(secs), rate(rate), done(0), scans(0) {}
+    PagedScanWriter & w;
+    double secs, rate;
+    QAtomicInt done, scans; ///< scans is in units of 1024 scans, for the watchdog
+    double elapsed;
+    unsigned long long nWritten;
+protected:
+    void run() {
+        std::vector<short> scan(NChans), block(size_t(NChans)*37);
+        unsigned long long n = 0, meta = 0;
+        QElapsedTimer t; t.start();
+        while (t.nsecsElapsed() < qint64(secs*1e9)) {
+            const int mode = int((n/1000) % NModes); // switch modes every 1000 scans, mid-page
+            if (mode == ModePartial) {
+                for (unsigned c = 0; c < NChans; ++c) scan[c] = sampleFor(n, c);
+                const char *p = reinterpret_cast<const char *>(&scan[0]);
+                w.writePartialBegin();
+                for (unsigned line = 0; line < NLines; ++line) {
+                    meta = n;
+                    if (!w.writePartial(p + line*LineBytes, LineBytes, &meta)) { fprintf(stderr, "writePartial() failed\n"); break; }
+                }
+                if (!w.writePartialEnd()) fprintf(stderr, "writePartialEnd() failed\n");
+                ++n;
+            } else if (mode == ModeWrite) {
+                const unsigned nb = 37;
+                for (unsigned s = 0; s < nb; ++s)
+                    for (unsigned c = 0; c < NChans; ++c) block[s*NChans+c] = sampleFor(n+s, c);
+                meta = n+nb-1;
+                w.write(&block[0], nb, &meta);
+                n += nb;
+            } else {
+                unsigned nFree = 0;
+                short *dst = w.directWritePtr(&nFree);
+                const unsigned nb = std::min(nFree, 5U);
+                for (unsigned s = 0; s < nb; ++s)
+                    for (unsigned c = 0; c < NChans; ++c) dst[s*NChans+c] = sampleFor(n+s, c);
+                meta = n+nb-1;
+                w.commitDirectWrite(nb, &meta);
+                n += nb;
+            }
+            scans.fetchAndStoreOrdered(int(n >> 10));
+            if (rate > 0.) while (double(n) > rate * double(t.nsecsElapsed())/1e9) QThread::yieldCurrentThread();
+        }
+        elapsed = double(t.nsecsElapsed())/1e9;
+        nWritten = n;
+        done.fetchAndStoreOrdered(1);
+    }
+};
+
+class Reader : public QThread
+{
+public:
+    Reader(PagedScanReader & r, const std::vector<int> & map, Writer & wr) : r(r), map(map), wr(wr), pages(0), skips(0), bad(0), lapped(0) {}
+    PagedScanReader & r;
+    const std::vector<int> & map;
+    Writer & wr;
+    QAtomicInt pages;
+    unsigned long long skips, bad, lapped; ///< lapped: pages the writer got to while we were checking them
+protected:
+    void run() {
+        unsigned long long scan0 = 0;
+        unsigned np = 0;
+        for (;;) {
+            int nSkips = 0;
+            const short *p = r.next(&nSkips);
+            if (!p) {
+                if (wr.done.fetchAndAddOrdered(0)) break;
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            scan0 += (unsigned long long)nSkips * ScansPerPage;
+            skips += unsigned(nSkips);
+            unsigned long long nBad = 0;
+            for (unsigned s = 0; s < ScansPerPage; ++s)
+                for (unsigned c = 0; c < NChans; ++c)
+                    if (p[s*NChans+c] != sampleFor(scan0+s, unsigned(map[c]))) { ++nBad; break; }
+            // the reader is unregistered, so the writer may have lapped us mid-check: only count the page if its
+            // header still says it's the page we started with
+            if (r.pastPage(0) != p) ++lapped;
+            else bad += nBad;
+            scan0 += ScansPerPage;
+            pages.fetchAndStoreOrdered(int(++np));
+        }
+    }
+};
+
+void usage() { fprintf(stderr, "Usage: stress_remap [-t seconds] [-r target_scans_per_sec]\n"); exit(3); }
+
+}
+
+int main(int argc, char *argv[])
+{
+    double secs = 10., rate = 0.;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-t") && i+1 < argc) secs = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i+1 < argc) rate = atof(argv[++i]);
+        else usage();
+    }
+
+    std::vector<int> map(NChans);
+    for (unsigned i = 0; i < NChans; ++i) map[i] = int(i);
+    srand(1234);
+    std::random_shuffle(map.begin(), map.end());
+
+    const unsigned long pageSize = ScansPerPage*NChans*sizeof(short) + sizeof(unsigned long long);
+    std::vector<char> mem(PagedRingBuffer::requiredSize(pageSize, NPages));
+    PagedScanWriter w(NChans, sizeof(unsigned long long), &mem[0], mem.size(), pageSize, map);
+    w.initializeForWriting();
+    PagedScanReader r(w);
+    if (w.channelMapping().isNull() || r.scansPerPage() != ScansPerPage) { fprintf(stderr, "setup failed\n"); return 3; }
+
+    Writer wr(w, secs, rate);
+    Reader rd(r, map, wr);
+    rd.start(); wr.start();
+
+    int lastScans = -1, lastPages = -1, stuck = 0;
+    while (!rd.wait(250)) {
+        const int s = wr.scans.fetchAndAddOrdered(0), p = rd.pages.fetchAndAddOrdered(0);
+        if (s == lastScans && p == lastPages && !wr.done.fetchAndAddOrdered(0)) ++stuck; else stuck = 0;
+        lastScans = s; lastPages = p;
+        if (stuck >= 8) {
+            fprintf(stderr, "HANG: no progress in 2 seconds (writer at %d K scans, reader at %d pages)\n", s, p);
+            return 2;
+        }
+    }
+    wr.wait();
+
+    printf("wrote %llu scans (%u chans) in %.2f s = %.0f scans/s, reader saw %d pages, skipped %llu, lapped %llu, bad %llu\n",
+           wr.nWritten, NChans, wr.elapsed, double(wr.nWritten)/wr.elapsed, rd.pages.fetchAndAddOrdered(0), rd.skips, rd.lapped, rd.bad);
+    if (rd.bad) { printf("FAIL\n"); return 1; }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,15 @@
+######################################################################
+# Stress test: PagedScanWriter inline channel remapping at FG rates.
+# Headless, Qt core only.  Build with qmake && make, run ./stress_remap
+######################################################################
+
+TEMPLATE = app
+TARGET = stress_remap
+CONFIG += console release
+CONFIG -= app_bundle
+QT -= gui
+DEPENDPATH += . ..
+INCLUDEPATH += . ..
+
+HEADERS += ../PagedRingBuffer.h ../Thread_Compat.h ../stdafx.h
+SOURCES += stress_remap.cpp ../PagedRingBuffer.cpp
@@ -1,55 +1,86 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include <stdlib.h>
 #include <math.h>
 #include <errno.h>
+#include "SyntheticDAQ.h"
+
+// build with: g++ -O2 -o gentestdata gentestdata.cpp SyntheticDAQ.cpp
 
 static void printUsage() {
-    std::cerr << "Usage: gentestdata [-c nchans] [-n nscans]\n";
+    std::cerr << "Usage: gentestdata [-c nchans] [-n nscans] [-p pdchan] [-r srate] [-S synth_spec]\n"
+              << "  -S writes SyntheticDAQ's spikes, noise and PD pulses instead of the sine/square test pattern.\n"
+              << "     synth_spec is a comma separated key=value list, as for the FAKEDAQ_SYNTH env var, eg. noise=20,spikerate=40\n";
 }
 
-
 int main(int argc, char *argv[]) {
-    const float srate = 29630;
+    float srate = 29630;
     unsigned long nchans = 60, nscans = 1000000, pd = 0;
     int ret;
-    bool errFlag = false;
+    bool errFlag = false, synth = false;
+    std::string spec;
 
-    while ( (ret = getopt(argc, argv, "c:n:p:")) > -1 ) {
+    while ( (ret = getopt(argc, argv, "c:n:p:r:S:")) > -1 ) {
         switch (ret) {
         case 'c': nchans = atoi(optarg); break;
         case 'n': nscans = atoi(optarg); break;
         case 'p': pd = atoi(optarg); break;
+        case 'r': srate = float(atof(optarg)); break;
+        case 'S': synth = true; spec = optarg; break;
         case '?': errFlag = true; break;
         }
-        if (!nchans || !nscans || errFlag) {
+        if (!nchans || !nscans || srate <= 0.f || errFlag) {
             printUsage();
             exit(1);
         }
     }
-    unsigned long s, c;    
-    for (s = 0; s < nscans; ++s) {
-        for (c = 0; c < nchans; ++c) {
-            short datum = 0;
-            if (c % 2) { // odd ch# == square
-                datum = sin((s/srate)*M_PI*(c*3)) > 0.f ? 32767 : -32767;
-            } else { // even ch# == sinusoidal
-                datum = short(sin((s/srate)*M_PI*(c*3)) * 32767.f);
-            }
-            if (pd && c == pd) {
-                // pd chan -- square wave of period ~ 1s?
-                datum = sin((s/srate)*M_PI) > 0.f ? -32768 : 32767;
-            }
-            datum = short(datum*0.75f);
-            if ( fwrite(&datum, sizeof(datum), 1, stdout) != 1 ) {
-                perror("fwrite");
-                exit(1);
+
+    SyntheticDAQ *gen = 0;
+    if (synth) {
+        SyntheticDAQParams sp;
+        std::string err;
+        if (!sp.parse(spec, &err)) {
+            std::cerr << "gentestdata: " << err << "\n";
+            exit(1);
+        }
+        sp.nChans = unsigned(nchans); sp.srate = srate; sp.pdChan = pd ? int(pd) : -1;
+        gen = new SyntheticDAQ(sp);
+    }
+
+    // a block of scans at a time, so it's one fwrite per block instead of one per sample
+    const unsigned long blockScans = 4096;
+    std::vector<short> block(blockScans * nchans);
+    for (unsigned long s0 = 0; s0 < nscans; s0 += blockScans) {
+        const unsigned long n = nscans - s0 < blockScans ? nscans - s0 : blockScans;
+        if (gen) {
+            gen->generate(&block[0], unsigned(n));
+        } else {
+            short *out = &block[0];
+            for (unsigned long s = s0; s < s0 + n; ++s) {
+                for (unsigned long c = 0; c < nchans; ++c) {
+                    short datum = 0;
+                    if (c % 2) { // odd ch# == square
+                        datum = sin((s/srate)*M_PI*(c*3)) > 0.f ? 32767 : -32767;
+                    } else { // even ch# == sinusoidal
+                        datum = short(sin((s/srate)*M_PI*(c*3)) * 32767.f);
+                    }
+                    if (pd && c == pd) {
+                        // pd chan -- square wave of period ~ 1s?
+                        datum = sin((s/srate)*M_PI) > 0.f ? -32768 : 32767;
+                    }
+                    *out++ = short(datum*0.75f);
+                }
             }
         }
+        if ( fwrite(&block[0], sizeof(short) * nchans, n, stdout) != n ) {
+            perror("fwrite");
+            exit(1);
+        }
     }
+    delete gen;
     fclose(stdout);
     return 0;
 }
-
@@ -591,3 +591,161 @@ namespace Util {
     }
 #endif
 }
+
+#ifndef Q_OS_WIN
+#include <sys/mman.h>
+#include <errno.h>
+#endif
+
+namespace Util {
+    static const quint64 largePageBytes = 2ULL*1024ULL*1024ULL;
+
+#ifdef Q_OS_WIN
+    // buffers prefaultAndLock() grew the working set for, and by how much, so unlockBuffer() can give it back.  And the
+    // working set sizes from before the first of them, restored once the last one is unlocked
+    static QMap<void *, quint64> wsGrownFor;
+    static SIZE_T savedWsMin = 0, savedWsMax = 0;
+#endif
+
+    bool prefaultAndLock(void *buf, quint64 bytes, QString *howOut)
+    {
+        if (!buf || !bytes) return false;
+        // touch every 4 KB page for write, so the OS backs it now rather than at the first scan that lands there
+        volatile char *c = reinterpret_cast<volatile char *>(buf);
+        for (quint64 i = 0; i < bytes; i += 4096) c[i] = c[i];
+        c[bytes-1] = c[bytes-1];
+#ifdef Q_OS_WIN
+        // VirtualLock() can only lock as much as the working set minimum allows -- grow it by the size of the buffer,
+        // once per buffer however often it's locked
+        SIZE_T wsMin = 0, wsMax = 0;
+        HANDLE proc = GetCurrentProcess();
+        const bool grow = !wsGrownFor.contains(buf) && GetProcessWorkingSetSize(proc, &wsMin, &wsMax),
+                   grew = grow && SetProcessWorkingSetSize(proc, wsMin + SIZE_T(bytes), wsMax + SIZE_T(bytes));
+        if (!VirtualLock(buf, SIZE_T(bytes))) {
+            const DWORD err = GetLastError();
+            if (grew) SetProcessWorkingSetSize(proc, wsMin, wsMax);
+            if (howOut) *howOut = QString("prefaulted, VirtualLock() failed with error ") + QString::number(err);
+            return false;
+        }
+        if (grew) {
+            if (wsGrownFor.isEmpty()) savedWsMin = wsMin, savedWsMax = wsMax;
+            wsGrownFor[buf] = bytes;
+        }
+#else
+        if (mlock(buf, size_t(bytes))) {
+            if (howOut) *howOut = QString("prefaulted, mlock() failed: ") + strerror(errno) + " (check ulimit -l)";
+            return false;
+        }
+#endif
+        if (howOut) *howOut = "prefaulted and locked";
+        return true;
+    }
+
+    void unlockBuffer(void *buf, quint64 bytes)
+    {
+        if (!buf || !bytes) return;
+#ifdef Q_OS_WIN
+        VirtualUnlock(buf, SIZE_T(bytes)); // fails harmlessly if it wasn't locked
+        if (!wsGrownFor.contains(buf)) return;
+        const quint64 grown = wsGrownFor.take(buf);
+        HANDLE proc = GetCurrentProcess();
+        SIZE_T wsMin = 0, wsMax = 0;
+        if (wsGrownFor.isEmpty())
+            SetProcessWorkingSetSize(proc, savedWsMin, savedWsMax);
+        else if (GetProcessWorkingSetSize(proc, &wsMin, &wsMax) && wsMin > SIZE_T(grown) && wsMax > SIZE_T(grown))
+            SetProcessWorkingSetSize(proc, wsMin - SIZE_T(grown), wsMax - SIZE_T(grown));
+#else
+        munlock(buf, size_t(bytes));
+#endif
+    }
+
+#ifdef Q_OS_WIN
+    static bool enableLockMemoryPrivilege()
+    {
+        HANDLE tok = 0;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES|TOKEN_QUERY, &tok)) return false;
+        TOKEN_PRIVILEGES tp;
+        memset(&tp, 0, sizeof(tp));
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool ok = LookupPrivilegeValue(0, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid)
+                  && AdjustTokenPrivileges(tok, FALSE, &tp, 0, 0, 0)
+                  && GetLastError() == ERROR_SUCCESS; // ERROR_NOT_ALL_ASSIGNED if the user doesn't hold "Lock pages in memory"
+        CloseHandle(tok);
+        return ok;
+    }
+
+    void *allocSampleBuffer(quint64 bytes, bool largePages, QString *howOut)
+    {
+        void *p = 0;
+        QString why;
+        if (largePages) {
+            const SIZE_T lp = GetLargePageMinimum();
+            if (!lp) why = "no large page support";
+            else if (!enableLockMemoryPrivilege()) why = "user lacks the \"Lock pages in memory\" privilege";
+            else {
+                p = VirtualAlloc(0, SIZE_T((bytes + lp - 1) / lp * lp), MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+                if (p) {
+                    // large pages are always resident and never paged out: nothing to prefault or lock
+                    if (howOut) *howOut = QString("%1 KB large pages").arg(lp/1024);
+                    return p;
+                }
+                why = QString("VirtualAlloc(MEM_LARGE_PAGES) failed with error ") + QString::number(GetLastError());
+            }
+        }
+        p = VirtualAlloc(0, SIZE_T(bytes), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        if (!p) return 0;
+        QString how;
+        prefaultAndLock(p, bytes, &how);
+        if (howOut) *howOut = QString("4 KB pages, ") + how + (why.length() ? QString(" (no large pages: ") + why + ")" : QString(""));
+        return p;
+    }
+
+    void freeSampleBuffer(void *buf, quint64 bytes)
+    {
+        if (!buf) return;
+        unlockBuffer(buf, bytes);
+        VirtualFree(buf, 0, MEM_RELEASE);
+    }
+#else
+    // always mapped in whole 2 MB units, so freeSampleBuffer() needn't know whether it got hugepages
+    static quint64 sampleBufferMapSize(quint64 bytes) { return (bytes + largePageBytes - 1) / largePageBytes * largePageBytes; }
+
+    void *allocSampleBuffer(quint64 bytes, bool largePages, QString *howOut)
+    {
+        const size_t sz = size_t(sampleBufferMapSize(bytes));
+        void *p = MAP_FAILED;
+        QString why;
+#ifdef MAP_HUGETLB
+        if (largePages) {
+            // needs hugepages reserved in /proc/sys/vm/nr_hugepages -- MAP_POPULATE faults them all in up front
+            p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+            if (p != MAP_FAILED) {
+                QString how;
+                prefaultAndLock(p, sz, &how);
+                if (howOut) *howOut = QString("2 MB hugepages, ") + how;
+                return p;
+            }
+            why = QString("MAP_HUGETLB: ") + strerror(errno);
+        }
+#else
+        if (largePages) why = "unsupported on this platform";
+#endif
+        p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+        // next best thing: ask for transparent hugepages, if the kernel has them on madvise
+        if (largePages && !madvise(p, sz, MADV_HUGEPAGE)) why += ", transparent hugepages requested";
+#endif
+        QString how;
+        prefaultAndLock(p, sz, &how);
+        if (howOut) *howOut = QString("4 KB pages, ") + how + (why.length() ? QString(" (no hugepages: ") + why + ")" : QString(""));
+        return p;
+    }
+
+    void freeSampleBuffer(void *buf, quint64 bytes)
+    {
+        if (buf) munmap(buf, size_t(sampleBufferMapSize(bytes)));
+    }
+#endif
+}